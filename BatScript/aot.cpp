@@ -0,0 +1,999 @@
+#include "aot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include "errorsys.h"
+#include "instructions.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace Bat
+{
+	// Interface between the generated code and AotModule, has to match the declarations in s_Prelude
+	struct AotEnv
+	{
+		int64_t* globals;
+		void* host;
+		void (*print_int)(void*, int64_t);
+		void (*print_float)(void*, double);
+		void (*print_bool)(void*, int64_t);
+		void (*print_string)(void*, int64_t);
+		int64_t (*native)(void*, int64_t, const int64_t*);
+	};
+	struct AotString
+	{
+		const char* chars;
+		int64_t length;
+	};
+	struct AotNative
+	{
+		const char* name;
+		int32_t num_params;
+		const int32_t* param_types;
+		int32_t return_type;
+	};
+	struct AotModule::ModuleDesc
+	{
+		int32_t version;
+		int64_t num_globals;
+		const AotString* strings;
+		int64_t num_strings;
+		const AotNative* natives;
+		int64_t num_natives;
+		void (*main)(AotEnv*);
+	};
+
+	namespace
+	{
+		constexpr const char* MODULE_SYMBOL = "bat_aot_module";
+
+		const char* const s_Prelude = R"(#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define BAT_EXPORT __declspec(dllexport)
+#else
+#define BAT_EXPORT __attribute__((visibility("default")))
+#endif
+
+typedef struct bat_env
+{
+	int64_t* globals;
+	void* host;
+	void (*print_int)(void*, int64_t);
+	void (*print_float)(void*, double);
+	void (*print_bool)(void*, int64_t);
+	void (*print_string)(void*, int64_t);
+	int64_t (*native)(void*, int64_t, const int64_t*);
+} bat_env;
+
+typedef struct bat_string
+{
+	const char* chars;
+	int64_t length;
+} bat_string;
+
+typedef struct bat_native
+{
+	const char* name;
+	int32_t num_params;
+	const int32_t* param_types;
+	int32_t return_type;
+} bat_native;
+
+typedef struct bat_module
+{
+	int32_t version;
+	int64_t num_globals;
+	const bat_string* strings;
+	int64_t num_strings;
+	const bat_native* natives;
+	int64_t num_natives;
+	void (*main)(bat_env*);
+} bat_module;
+
+/* Every value is 64 bits, floats are stored as their bit pattern */
+static inline double F( int64_t v ) { double d; memcpy( &d, &v, sizeof( d ) ); return d; }
+static inline int64_t I( double d ) { int64_t v; memcpy( &v, &d, sizeof( v ) ); return v; }
+
+/* Integer arithmetic wraps around like it does on the VM, shifts use the count modulo 64 like the hardware does */
+static inline int64_t ADD( int64_t a, int64_t b ) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+static inline int64_t SUB( int64_t a, int64_t b ) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+static inline int64_t MUL( int64_t a, int64_t b ) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+static inline int64_t NEG( int64_t a ) { return (int64_t)(0 - (uint64_t)a); }
+static inline int64_t SHL( int64_t a, int64_t b ) { return (int64_t)((uint64_t)a << (b & 63)); }
+static inline int64_t SHR( int64_t a, int64_t b ) { return a >> (b & 63); }
+)";
+
+		// Pushes and pops of each opcode, for the ones that don't need special handling
+		constexpr int OPCODE_PUSHES[] = {
+#define _(name, operands, pushes, pops, mnemonic) pushes,
+			OPCODES( _ )
+#undef _
+		};
+		constexpr int OPCODE_POPS[] = {
+#define _(name, operands, pushes, pops, mnemonic) pops,
+			OPCODES( _ )
+#undef _
+		};
+
+		bool IsJump( OpCode op )
+		{
+			switch( op )
+			{
+			case OpCode::JMP: case OpCode::JZ: case OpCode::JNZ:
+			case OpCode::JEQ: case OpCode::JNE: case OpCode::JLT: case OpCode::JLE: case OpCode::JGT: case OpCode::JGE:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		std::string Hex( size_t value )
+		{
+			char buffer[32];
+			snprintf( buffer, sizeof( buffer ), "%04zx", value );
+			return buffer;
+		}
+
+		std::string Literal( int64_t value )
+		{
+			// -9223372036854775808 would be the negation of a literal that doesn't fit
+			return (value == INT64_MIN) ? "INT64_MIN" : std::to_string( value ) + "LL";
+		}
+
+		std::string CStringLiteral( const std::string& str )
+		{
+			std::string literal = "\"";
+			for( unsigned char c : str )
+			{
+				if( c == '"' || c == '\\' || c == '?' )
+				{
+					literal += '\\';
+					literal += (char)c;
+				}
+				else if( c >= 0x20 && c < 0x7f )
+				{
+					literal += (char)c;
+				}
+				else
+				{
+					// Always 3 digits so that a digit after it isn't taken as part of the escape
+					char buffer[8];
+					snprintf( buffer, sizeof( buffer ), "\\%03o", c );
+					literal += buffer;
+				}
+			}
+			return literal + "\"";
+		}
+
+		std::string Slot( size_t index )
+		{
+			return "v" + std::to_string( index );
+		}
+	}
+
+	bool AotTranslator::Translate( const BatCode& bc, std::string& source )
+	{
+		if( bc.isa != InstructionSet::STACK )
+		{
+			ErrorSys::Report( 0, 0, "Only stack code can be translated to C" );
+			return false;
+		}
+
+		AotTranslator translator( bc );
+		if( !translator.Decode() || !translator.FindFunctions() )
+		{
+			return false;
+		}
+		for( auto& func : translator.m_Functions )
+		{
+			if( !translator.Analyze( func ) )
+			{
+				return false;
+			}
+		}
+
+		translator.EmitModule();
+		source = std::move( translator.m_Source );
+		return true;
+	}
+
+	AotTranslator::AotTranslator( const BatCode& bc )
+		:
+		m_Code( bc )
+	{
+	}
+
+	bool AotTranslator::Decode()
+	{
+		const char* code = m_Code.CodeBase();
+		const size_t size = m_Code.CodeSize();
+
+		m_InstructionAt.assign( size, -1 );
+		m_Labels.assign( size, false );
+
+		for( size_t pc = 0; pc < size; )
+		{
+			auto decoded = DecodeOp( (unsigned char)code[pc] );
+			Instruction instr{ pc, decoded.op, 0 };
+			pc++;
+			if( OPCODE_OPERANDS[(size_t)decoded.op] )
+			{
+				instr.operand = ReadOperand( code + pc, decoded.width );
+				pc += decoded.width;
+			}
+
+			m_InstructionAt[instr.pc] = (int)m_Instructions.size();
+			m_Instructions.push_back( instr );
+		}
+
+		for( size_t i = 0; i < m_Instructions.size(); i++ )
+		{
+			const Instruction& instr = m_Instructions[i];
+			if( instr.op == OpCode::AWAIT || instr.op == OpCode::SPAWN || instr.op == OpCode::TASK_END )
+			{
+				// Tasks need the VM's scheduler (see scheduler.h)
+				return Fail( i, "Async functions and natives are only supported by the VM" );
+			}
+			if( IsArrayOp( instr.op ) )
+			{
+				return Fail( i, "Arrays are only supported by the VM" );
+			}
+			if( IsJump( instr.op ) )
+			{
+				if( instr.operand < 0 || (size_t)instr.operand >= size || m_InstructionAt[instr.operand] < 0 )
+				{
+					return Fail( i, "Jump to an invalid address" );
+				}
+				m_Labels[instr.operand] = true;
+			}
+		}
+
+		return true;
+	}
+
+	bool AotTranslator::FindFunctions()
+	{
+		// Functions are laid out one after the other, each starting with a proc
+		for( size_t i = 0; i < m_Instructions.size(); i++ )
+		{
+			const Instruction& instr = m_Instructions[i];
+			if( instr.op == OpCode::PROC )
+			{
+				if( !m_Functions.empty() )
+				{
+					m_Functions.back().end = i;
+				}
+
+				Function func;
+				func.first = i;
+				func.end = m_Instructions.size();
+				func.mainline = (instr.pc == m_Code.entry_point);
+				m_Functions.push_back( func );
+			}
+			else if( m_Functions.empty() )
+			{
+				return Fail( i, "Code outside of a function" );
+			}
+		}
+
+		bool has_mainline = false;
+		std::vector<bool> known_args( m_Functions.size(), false );
+		for( size_t f = 0; f < m_Functions.size(); f++ )
+		{
+			Function& func = m_Functions[f];
+			has_mainline |= func.mainline;
+
+			// Every return of a function pops the same arguments
+			for( size_t i = func.first; i < func.end; i++ )
+			{
+				const Instruction& instr = m_Instructions[i];
+				if( instr.op != OpCode::RET )
+				{
+					continue;
+				}
+
+				if( func.mainline || instr.operand < 0 || instr.operand % 8 != 0 || (known_args[f] && instr.operand / 8 != func.num_args) )
+				{
+					return Fail( i, "Unexpected return" );
+				}
+				func.num_args = instr.operand / 8;
+				known_args[f] = true;
+			}
+		}
+
+		// Functions that only ever return through tail calls take as many arguments as the functions they call
+		for( bool changed = true; changed; )
+		{
+			changed = false;
+			for( size_t f = 0; f < m_Functions.size(); f++ )
+			{
+				Function& func = m_Functions[f];
+				for( size_t i = func.first; i < func.end && !known_args[f]; i++ )
+				{
+					const Function* callee = (m_Instructions[i].op == OpCode::TAILCALL) ? FunctionAt( m_Instructions[i].operand ) : nullptr;
+					if( callee && known_args[callee - m_Functions.data()] )
+					{
+						func.num_args = callee->num_args;
+						known_args[f] = changed = true;
+					}
+				}
+			}
+		}
+
+		if( !has_mainline )
+		{
+			ErrorSys::Report( 0, 0, "Entry point isn't the start of a function" );
+			return false;
+		}
+		return true;
+	}
+
+	bool AotTranslator::Analyze( Function& func )
+	{
+		func.states.assign( func.end - func.first, StackState() );
+		func.states[0].reached = true;
+		std::vector<size_t> worklist = { func.first };
+
+		// Merges state into the state before instruction at index, constants only survive if they agree on every path
+		auto flow = [&]( size_t index, const StackState& state )
+		{
+			if( index < func.first || index >= func.end )
+			{
+				return false;
+			}
+
+			StackState& target = func.states[index - func.first];
+			if( !target.reached )
+			{
+				target = state;
+				worklist.push_back( index );
+				return true;
+			}
+
+			if( target.known.size() != state.known.size() )
+			{
+				return false;
+			}
+
+			bool changed = false;
+			for( size_t slot = 0; slot < target.known.size(); slot++ )
+			{
+				if( target.known[slot] && (!state.known[slot] || state.constants[slot] != target.constants[slot]) )
+				{
+					target.known[slot] = false;
+					changed = true;
+				}
+			}
+			if( changed )
+			{
+				worklist.push_back( index );
+			}
+			return true;
+		};
+
+		while( !worklist.empty() )
+		{
+			const size_t index = worklist.back();
+			worklist.pop_back();
+
+			const Instruction& instr = m_Instructions[index];
+			StackState state = func.states[index - func.first];
+
+			auto push = [&]( bool known, int64_t constant )
+			{
+				state.known.push_back( known );
+				state.constants.push_back( constant );
+				func.num_slots = std::max( func.num_slots, state.known.size() );
+			};
+			auto pop = [&]( size_t count )
+			{
+				if( state.known.size() < count )
+				{
+					return false;
+				}
+				state.known.resize( state.known.size() - count );
+				state.constants.resize( state.constants.size() - count );
+				return true;
+			};
+			// Constant on top of the stack, popped
+			int64_t constant = 0;
+			auto pop_constant = [&]()
+			{
+				if( state.known.empty() || !state.known.back() )
+				{
+					return false;
+				}
+				constant = state.constants.back();
+				return pop( 1 );
+			};
+			auto check_local = [&]( int64_t addr )
+			{
+				if( addr % 8 != 0 )
+				{
+					return false;
+				}
+				if( func.mainline )
+				{
+					func.uses_globals = true;
+					m_iGlobalsSize = std::max( m_iGlobalsSize, addr + 8 );
+					return addr >= 0;
+				}
+				if( addr >= 0 )
+				{
+					func.num_slots = std::max( func.num_slots, (size_t)(addr / 8 + 1) );
+					return true;
+				}
+				// Arguments are below the link to the caller (see FRAME_LINK_SIZE)
+				return addr <= -FRAME_LINK_SIZE && func.num_args + (addr + FRAME_LINK_SIZE) / 8 >= 0;
+			};
+			auto check_global = [&]( int64_t addr )
+			{
+				func.uses_globals = true;
+				m_iGlobalsSize = std::max( m_iGlobalsSize, addr + 8 );
+				return addr >= 0 && addr % 8 == 0;
+			};
+
+			bool falls_through = true;
+			switch( instr.op )
+			{
+			case OpCode::PUSH:
+				push( true, instr.operand );
+				break;
+			case OpCode::DUP:
+			{
+				if( state.known.empty() ) return Fail( index, "Stack underflow" );
+				const bool known = state.known.back();
+				push( known, state.constants.back() );
+				break;
+			}
+			case OpCode::DUPX1:
+			{
+				if( state.known.size() < 2 ) return Fail( index, "Stack underflow" );
+				const size_t top = state.known.size() - 1;
+				const bool known1 = state.known[top], known2 = state.known[top - 1];
+				const int64_t constant1 = state.constants[top], constant2 = state.constants[top - 1];
+				state.known[top - 1] = known1; state.constants[top - 1] = constant1;
+				state.known[top] = known2; state.constants[top] = constant2;
+				push( known1, constant1 );
+				break;
+			}
+			case OpCode::PROC:
+				if( index != func.first ) return Fail( index, "Unexpected proc" );
+				[[fallthrough]];
+			case OpCode::STACK:
+				if( instr.operand % 8 != 0 ) return Fail( index, "Unaligned stack reservation" );
+				if( instr.operand < 0 && !pop( (size_t)(-instr.operand / 8) ) ) return Fail( index, "Stack underflow" );
+				for( int64_t i = 0; i < instr.operand / 8; i++ )
+				{
+					push( false, 0 );
+				}
+				break;
+
+			case OpCode::LOAD_LOCAL:
+				if( !pop_constant() || !check_local( constant ) ) return Fail( index, "Local address isn't a constant" );
+				push( false, 0 );
+				break;
+			case OpCode::LOAD_GLOBAL:
+				if( !pop_constant() || !check_global( constant ) ) return Fail( index, "Global address isn't a constant" );
+				push( false, 0 );
+				break;
+			case OpCode::STORE_LOCAL:
+				if( !pop( 1 ) || !pop_constant() || !check_local( constant ) ) return Fail( index, "Local address isn't a constant" );
+				break;
+			case OpCode::STORE_GLOBAL:
+				if( !pop( 1 ) || !pop_constant() || !check_global( constant ) ) return Fail( index, "Global address isn't a constant" );
+				break;
+			case OpCode::LOADL_IMM:
+				if( !check_local( instr.operand ) ) return Fail( index, "Invalid local address" );
+				push( false, 0 );
+				break;
+			case OpCode::LOADG_IMM:
+				if( !check_global( instr.operand ) ) return Fail( index, "Invalid global address" );
+				push( false, 0 );
+				break;
+			case OpCode::STOREL_IMM:
+				if( !check_local( instr.operand ) || !pop( 1 ) ) return Fail( index, "Invalid local store" );
+				break;
+			case OpCode::STOREG_IMM:
+				if( !check_global( instr.operand ) || !pop( 1 ) ) return Fail( index, "Invalid global store" );
+				break;
+
+			case OpCode::CALL:
+			{
+				const Function* callee = FunctionAt( instr.operand );
+				if( !callee ) return Fail( index, "Call of an address that isn't a function" );
+				if( !pop( (size_t)callee->num_args ) ) return Fail( index, "Stack underflow" );
+				push( false, 0 );
+				break;
+			}
+			case OpCode::NATIVE:
+			{
+				if( !pop_constant() || constant < 0 || (size_t)constant >= m_Code.natives.size() ) return Fail( index, "Call of a native that isn't a constant" );
+				if( !pop( m_Code.natives[constant].desc.param_types.size() ) ) return Fail( index, "Stack underflow" );
+				push( false, 0 );
+				break;
+			}
+			case OpCode::TAILCALL:
+			{
+				// The arguments are stored over the function's own, so they become the callee's
+				const Function* callee = FunctionAt( instr.operand );
+				if( !callee ) return Fail( index, "Call of an address that isn't a function" );
+				if( func.mainline || callee->num_args != func.num_args ) return Fail( index, "Tail call with different arguments" );
+				falls_through = false;
+				break;
+			}
+			case OpCode::RET:
+				if( state.known.empty() ) return Fail( index, "Stack underflow" );
+				falls_through = false;
+				break;
+			case OpCode::HALT:
+				if( !func.mainline ) return Fail( index, "Halt outside of the mainline" );
+				falls_through = false;
+				break;
+			case OpCode::JMP:
+				falls_through = false;
+				break;
+
+			default:
+				if( !pop( OPCODE_POPS[(size_t)instr.op] ) ) return Fail( index, "Stack underflow" );
+				for( int i = 0; i < OPCODE_PUSHES[(size_t)instr.op]; i++ )
+				{
+					push( false, 0 );
+				}
+				break;
+			}
+
+			if( IsJump( instr.op ) && !flow( m_InstructionAt[instr.operand], state ) )
+			{
+				return Fail( index, "Jump out of the function or to a different stack depth" );
+			}
+			if( falls_through && !flow( index + 1, state ) )
+			{
+				return Fail( index, "Falls through to a different stack depth or out of the function" );
+			}
+		}
+
+		return true;
+	}
+
+	void AotTranslator::EmitModule()
+	{
+		m_Source = "/* Translated from compiled BatScript code, see aot.h */\n";
+		m_Source += s_Prelude;
+
+		m_Source += "\n";
+		for( const auto& func : m_Functions )
+		{
+			if( !func.mainline )
+			{
+				std::string params = "bat_env* env";
+				for( int64_t i = 0; i < func.num_args; i++ )
+				{
+					params += ", int64_t a" + std::to_string( i );
+				}
+				m_Source += "static int64_t " + FunctionName( func ) + "( " + params + " );\n";
+			}
+		}
+
+		for( const auto& func : m_Functions )
+		{
+			m_Source += "\n";
+			Emit( func );
+		}
+
+		m_Source += "\n";
+		if( !m_Code.string_literals.empty() )
+		{
+			m_Source += "static const bat_string strings[] = {\n";
+			for( const auto& str : m_Code.string_literals )
+			{
+				m_Source += "\t{ " + CStringLiteral( str ) + ", " + std::to_string( str.size() ) + " },\n";
+			}
+			m_Source += "};\n";
+		}
+		if( !m_Code.natives.empty() )
+		{
+			for( size_t i = 0; i < m_Code.natives.size(); i++ )
+			{
+				const auto& param_types = m_Code.natives[i].desc.param_types;
+				m_Source += "static const int32_t native" + std::to_string( i ) + "_params[] = { ";
+				for( auto type : param_types )
+				{
+					m_Source += std::to_string( (int)type ) + ", ";
+				}
+				// Empty initializer lists aren't valid C
+				m_Source += param_types.empty() ? "0 };\n" : "};\n";
+			}
+			m_Source += "static const bat_native natives[] = {\n";
+			for( size_t i = 0; i < m_Code.natives.size(); i++ )
+			{
+				const auto& native = m_Code.natives[i];
+				m_Source += "\t{ " + CStringLiteral( native.name ) + ", " + std::to_string( native.desc.param_types.size() ) +
+					", native" + std::to_string( i ) + "_params, " + std::to_string( (int)native.desc.return_type ) + " },\n";
+			}
+			m_Source += "};\n";
+		}
+
+		const Function& mainline = *std::find_if( m_Functions.begin(), m_Functions.end(), []( const Function& func ) { return func.mainline; } );
+		m_Source += "\nBAT_EXPORT const bat_module " + std::string( MODULE_SYMBOL ) + " = {\n";
+		m_Source += "\t" + std::to_string( AotModule::VERSION ) + ",\n";
+		m_Source += "\t" + std::to_string( m_iGlobalsSize / 8 ) + ",\n";
+		m_Source += m_Code.string_literals.empty() ? "\tNULL, 0,\n" : "\tstrings, " + std::to_string( m_Code.string_literals.size() ) + ",\n";
+		m_Source += m_Code.natives.empty() ? "\tNULL, 0,\n" : "\tnatives, " + std::to_string( m_Code.natives.size() ) + ",\n";
+		m_Source += "\t" + FunctionName( mainline ) + "\n};\n";
+	}
+
+	void AotTranslator::Emit( const Function& func )
+	{
+		std::string params = "bat_env* env";
+		for( int64_t i = 0; i < func.num_args; i++ )
+		{
+			params += ", int64_t a" + std::to_string( i );
+		}
+		m_Source += std::string( func.mainline ? "static void " : "static int64_t " ) + FunctionName( func ) + "( " + params + " )\n{\n";
+		if( func.uses_globals )
+		{
+			m_Source += "\tint64_t* g = env->globals;\n";
+		}
+		for( size_t slot = 0; slot < func.num_slots; slot++ )
+		{
+			m_Source += "\tint64_t " + Slot( slot ) + " = 0;\n";
+		}
+
+		// Locals of the mainline are the globals
+		auto local = [&]( int64_t addr ) -> std::string
+		{
+			if( func.mainline ) return "g[" + std::to_string( addr / 8 ) + "]";
+			if( addr >= 0 ) return Slot( (size_t)(addr / 8) );
+			return "a" + std::to_string( func.num_args + (addr + FRAME_LINK_SIZE) / 8 );
+		};
+		auto global = [&]( int64_t addr ) -> std::string
+		{
+			return "g[" + std::to_string( addr / 8 ) + "]";
+		};
+		auto line = [&]( const std::string& statement )
+		{
+			m_Source += "\t" + statement + "\n";
+		};
+
+		for( size_t index = func.first; index < func.end; index++ )
+		{
+			const Instruction& instr = m_Instructions[index];
+			const StackState& state = func.states[index - func.first];
+			if( !state.reached )
+			{
+				continue;
+			}
+			if( m_Labels[instr.pc] )
+			{
+				m_Source += "L" + Hex( instr.pc ) + ":;\n";
+			}
+
+			// Slots relative to the top of the stack before the instruction
+			const size_t depth = state.known.size();
+			auto top = [&]( size_t n ) { return Slot( depth - 1 - n ); };
+			const std::string next = Slot( depth );
+			const std::string target = IsJump( instr.op ) ? "L" + Hex( (size_t)instr.operand ) : "";
+			auto binary = [&]( const std::string& op ) { line( top( 1 ) + " = " + top( 0 ) + " " + op + " " + top( 1 ) + ";" ); };
+			auto call = [&]( const std::string& fn ) { line( top( 1 ) + " = " + fn + "( " + top( 0 ) + ", " + top( 1 ) + " );" ); };
+			auto binary_float = [&]( const std::string& op ) { line( top( 1 ) + " = I( F( " + top( 0 ) + " ) " + op + " F( " + top( 1 ) + " ) );" ); };
+			auto compare_float = [&]( const std::string& op ) { line( top( 1 ) + " = I( (double)(F( " + top( 0 ) + " ) " + op + " F( " + top( 1 ) + " )) );" ); };
+			auto compare_jump = [&]( const std::string& op ) { line( "if( " + top( 0 ) + " " + op + " " + top( 1 ) + " ) goto " + target + ";" ); };
+
+			switch( instr.op )
+			{
+			case OpCode::NOP:
+			case OpCode::POP:
+			case OpCode::PROC:
+			case OpCode::STACK:
+				break;
+
+			case OpCode::PUSH:
+				line( next + " = " + Literal( instr.operand ) + ";" );
+				break;
+			case OpCode::DUP:
+				line( next + " = " + top( 0 ) + ";" );
+				break;
+			case OpCode::DUPX1:
+				line( next + " = " + top( 0 ) + ";" );
+				line( top( 0 ) + " = " + top( 1 ) + ";" );
+				line( top( 1 ) + " = " + next + ";" );
+				break;
+
+			case OpCode::LOAD_LOCAL:
+				line( top( 0 ) + " = " + local( state.constants[depth - 1] ) + ";" );
+				break;
+			case OpCode::LOAD_GLOBAL:
+				line( top( 0 ) + " = " + global( state.constants[depth - 1] ) + ";" );
+				break;
+			case OpCode::STORE_LOCAL:
+				line( local( state.constants[depth - 2] ) + " = " + top( 0 ) + ";" );
+				break;
+			case OpCode::STORE_GLOBAL:
+				line( global( state.constants[depth - 2] ) + " = " + top( 0 ) + ";" );
+				break;
+			case OpCode::LOADL_IMM:
+				line( next + " = " + local( instr.operand ) + ";" );
+				break;
+			case OpCode::LOADG_IMM:
+				line( next + " = " + global( instr.operand ) + ";" );
+				break;
+			case OpCode::STOREL_IMM:
+				line( local( instr.operand ) + " = " + top( 0 ) + ";" );
+				break;
+			case OpCode::STOREG_IMM:
+				line( global( instr.operand ) + " = " + top( 0 ) + ";" );
+				break;
+
+			case OpCode::BITAND: binary( "&" ); break;
+			case OpCode::BITOR:  binary( "|" ); break;
+			case OpCode::BITXOR: binary( "^" ); break;
+			case OpCode::BITNOT: line( top( 0 ) + " = ~" + top( 0 ) + ";" ); break;
+			case OpCode::SHL:    call( "SHL" ); break;
+			case OpCode::SHR:    call( "SHR" ); break;
+
+			case OpCode::EQ:     binary( "==" ); break;
+			case OpCode::NEQ:    binary( "!=" ); break;
+			case OpCode::LESS:   binary( "<" ); break;
+			case OpCode::LESSE:  binary( "<=" ); break;
+			case OpCode::GRT:    binary( ">" ); break;
+			case OpCode::GRTE:   binary( ">=" ); break;
+			case OpCode::NOT:    line( top( 0 ) + " = !" + top( 0 ) + ";" ); break;
+
+			case OpCode::ADD:    call( "ADD" ); break;
+			case OpCode::SUB:    call( "SUB" ); break;
+			case OpCode::MUL:    call( "MUL" ); break;
+			case OpCode::DIV:    binary( "/" ); break;
+			case OpCode::MOD:    binary( "%" ); break;
+			case OpCode::NEG:    line( top( 0 ) + " = NEG( " + top( 0 ) + " );" ); break;
+			case OpCode::ADDI:   line( top( 0 ) + " = ADD( " + top( 0 ) + ", " + Literal( instr.operand ) + " );" ); break;
+			case OpCode::SUBI:   line( top( 0 ) + " = SUB( " + top( 0 ) + ", " + Literal( instr.operand ) + " );" ); break;
+
+			case OpCode::ITOF:   line( top( 0 ) + " = I( (double)" + top( 0 ) + " );" ); break;
+			case OpCode::FTOI:   line( top( 0 ) + " = (int64_t)F( " + top( 0 ) + " );" ); break;
+			case OpCode::ADDF:   binary_float( "+" ); break;
+			case OpCode::SUBF:   binary_float( "-" ); break;
+			case OpCode::DIVF:   binary_float( "/" ); break;
+			case OpCode::MULF:   binary_float( "*" ); break;
+			case OpCode::NEGF:   line( top( 0 ) + " = I( -F( " + top( 0 ) + " ) );" ); break;
+
+			case OpCode::EQF:    compare_float( "==" ); break;
+			case OpCode::NEQF:   compare_float( "!=" ); break;
+			case OpCode::LESSF:  compare_float( "<" ); break;
+			case OpCode::LESSEF: compare_float( "<=" ); break;
+			case OpCode::GRTF:   compare_float( ">" ); break;
+			case OpCode::GRTEF:  compare_float( ">=" ); break;
+
+			case OpCode::JMP: line( "goto " + target + ";" ); break;
+			case OpCode::JZ:  line( "if( " + top( 0 ) + " == 0 ) goto " + target + ";" ); break;
+			case OpCode::JNZ: line( "if( " + top( 0 ) + " != 0 ) goto " + target + ";" ); break;
+			case OpCode::JEQ: compare_jump( "==" ); break;
+			case OpCode::JNE: compare_jump( "!=" ); break;
+			case OpCode::JLT: compare_jump( "<" ); break;
+			case OpCode::JLE: compare_jump( "<=" ); break;
+			case OpCode::JGT: compare_jump( ">" ); break;
+			case OpCode::JGE: compare_jump( ">=" ); break;
+
+			case OpCode::CALL:
+			{
+				const Function& callee = *FunctionAt( instr.operand );
+				const size_t first_arg = depth - (size_t)callee.num_args;
+				std::string args = "env";
+				for( size_t slot = first_arg; slot < depth; slot++ )
+				{
+					args += ", " + Slot( slot );
+				}
+				line( Slot( first_arg ) + " = " + FunctionName( callee ) + "( " + args + " );" );
+				break;
+			}
+			case OpCode::TAILCALL:
+			{
+				const Function& callee = *FunctionAt( instr.operand );
+				std::string args = "env";
+				for( int64_t i = 0; i < callee.num_args; i++ )
+				{
+					args += ", a" + std::to_string( i );
+				}
+				line( "return " + FunctionName( callee ) + "( " + args + " );" );
+				break;
+			}
+			case OpCode::RET:
+				line( "return " + top( 0 ) + ";" );
+				break;
+			case OpCode::NATIVE:
+			{
+				const int64_t native = state.constants[depth - 1];
+				const size_t first_arg = depth - 1 - m_Code.natives[native].desc.param_types.size();
+				if( first_arg == depth - 1 )
+				{
+					line( Slot( first_arg ) + " = env->native( env->host, " + std::to_string( native ) + ", NULL );" );
+					break;
+				}
+
+				std::string args;
+				for( size_t slot = first_arg; slot < depth - 1; slot++ )
+				{
+					args += ((slot == first_arg) ? "" : ", ") + Slot( slot );
+				}
+				line( "{" );
+				line( "\tconst int64_t args[] = { " + args + " };" );
+				line( "\t" + Slot( first_arg ) + " = env->native( env->host, " + std::to_string( native ) + ", args );" );
+				line( "}" );
+				break;
+			}
+
+			case OpCode::PRINTI: line( "env->print_int( env->host, " + top( 0 ) + " );" ); break;
+			case OpCode::PRINTF: line( "env->print_float( env->host, F( " + top( 0 ) + " ) );" ); break;
+			case OpCode::PRINTB: line( "env->print_bool( env->host, " + top( 0 ) + " );" ); break;
+			case OpCode::PRINTS: line( "env->print_string( env->host, " + top( 0 ) + " );" ); break;
+
+			case OpCode::HALT:
+				line( "return;" );
+				break;
+
+			default:
+				assert( false && "Unhandled opcode" );
+			}
+		}
+
+		m_Source += "}\n";
+	}
+
+	const AotTranslator::Function* AotTranslator::FunctionAt( int64_t addr ) const
+	{
+		for( const auto& func : m_Functions )
+		{
+			if( (int64_t)m_Instructions[func.first].pc == addr )
+			{
+				return &func;
+			}
+		}
+		return nullptr;
+	}
+
+	std::string AotTranslator::FunctionName( const Function& func ) const
+	{
+		return func.mainline ? "bat_main" : "bat_fn_" + Hex( m_Instructions[func.first].pc );
+	}
+
+	bool AotTranslator::Fail( size_t index, const std::string& message ) const
+	{
+		const auto& lines = m_Code.debug_info.line_mapping;
+		const size_t line = (index < lines.size()) ? (size_t)lines[index] : 0;
+		ErrorSys::Report( line, 0, "Can't translate to C: " + message );
+		return false;
+	}
+
+	AotModule::~AotModule()
+	{
+		if( !m_hLibrary )
+		{
+			return;
+		}
+#ifdef _WIN32
+		FreeLibrary( (HMODULE)m_hLibrary );
+#else
+		dlclose( m_hLibrary );
+#endif
+	}
+
+	bool AotModule::IsModuleFile( const std::string& filename )
+	{
+		for( const std::string extension : { ".so", ".dll", ".dylib" } )
+		{
+			if( filename.size() >= extension.size() &&
+				filename.compare( filename.size() - extension.size(), extension.size(), extension ) == 0 )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool AotModule::Load( const std::string& filename )
+	{
+		assert( !m_hLibrary );
+
+		const void* symbol = nullptr;
+#ifdef _WIN32
+		HMODULE library = LoadLibraryA( filename.c_str() );
+		if( library )
+		{
+			m_hLibrary = library;
+			symbol = (const void*)GetProcAddress( library, MODULE_SYMBOL );
+		}
+#else
+		// Without a slash dlopen searches the library path instead of the working directory
+		const std::string path = (filename.find( '/' ) == std::string::npos) ? "./" + filename : filename;
+		m_hLibrary = dlopen( path.c_str(), RTLD_NOW | RTLD_LOCAL );
+		if( m_hLibrary )
+		{
+			symbol = dlsym( m_hLibrary, MODULE_SYMBOL );
+		}
+#endif
+		if( !m_hLibrary )
+		{
+			ErrorSys::Report( 0, 0, "Could not load '" + filename + "'" );
+			return false;
+		}
+
+		m_pDesc = static_cast<const ModuleDesc*>(symbol);
+		if( !m_pDesc || m_pDesc->version != VERSION )
+		{
+			ErrorSys::Report( 0, 0, "'" + filename + "' wasn't translated by this version" );
+			m_pDesc = nullptr;
+			return false;
+		}
+
+		for( int64_t i = 0; i < m_pDesc->num_natives; i++ )
+		{
+			const AotNative& native = m_pDesc->natives[i];
+			BatNativeInfo info;
+			info.name = native.name;
+			for( int32_t param = 0; param < native.num_params; param++ )
+			{
+				info.desc.param_types.push_back( (ObjectType)native.param_types[param] );
+			}
+			info.desc.return_type = (ObjectType)native.return_type;
+			m_NativeInfos.push_back( std::move( info ) );
+		}
+
+		return true;
+	}
+
+	void AotModule::AddNative( const std::string& name, BatNativeCallback callback )
+	{
+		m_Natives.Add( name, std::move( callback ) );
+	}
+
+	void AotModule::Run()
+	{
+		assert( m_pDesc );
+
+		std::vector<std::string> literals;
+		for( int64_t i = 0; i < m_pDesc->num_strings; i++ )
+		{
+			literals.emplace_back( m_pDesc->strings[i].chars, (size_t)m_pDesc->strings[i].length );
+		}
+		m_Strings.Reset( literals );
+		m_Globals.assign( (size_t)m_pDesc->num_globals, 0 );
+		m_ResolvedNatives = m_Natives.Resolve( m_NativeInfos );
+
+		AotEnv env{ m_Globals.data(), this, &PrintInt, &PrintFloat, &PrintBool, &PrintString, &CallNative };
+		m_pDesc->main( &env );
+	}
+
+	void AotModule::PrintInt( void* host, int64_t val )
+	{
+		std::cout << val << std::endl;
+	}
+	void AotModule::PrintFloat( void* host, double val )
+	{
+		std::cout << std::to_string( val ) << std::endl;
+	}
+	void AotModule::PrintBool( void* host, int64_t val )
+	{
+		std::cout << (val ? "true" : "false") << std::endl;
+	}
+	void AotModule::PrintString( void* host, int64_t idx )
+	{
+		std::cout << static_cast<AotModule*>(host)->m_Strings.Get( idx )->chars << std::endl;
+	}
+
+	int64_t AotModule::CallNative( void* host, int64_t idx, const int64_t* args )
+	{
+		auto module = static_cast<AotModule*>(host);
+		const BatNativeInfo& native = module->m_NativeInfos[idx];
+		return NativeTable::Call( module->m_ResolvedNatives[idx], native, args, native.desc.param_types.size(), module->m_Strings );
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bat_callable.h"
+#include "compiler.h"
+#include "stringpool.h"
+
+namespace Bat
+{
+	// Ahead of time translation of compiled stack code to C, for scripts that are built into a shared library with the
+	// system compiler and loaded by AotModule instead of being run on the VM.
+	// Every script function becomes a C function taking its arguments as parameters, and locals and stack temporaries
+	// become C variables, so the C compiler optimizes across them as it would for hand written code.
+	// The library also holds the string literals and native signatures, running it doesn't need the script or an image.
+	// Build with e.g. `cc -O2 -shared -fPIC script.c -o script.so`.
+	class AotTranslator
+	{
+	public:
+		// Returns false for code that can't be translated (e.g. addresses that aren't constants), errors are reported through ErrorSys
+		static bool Translate( const BatCode& bc, std::string& source );
+	private:
+		struct Instruction
+		{
+			size_t pc;
+			OpCode op;
+			int64_t operand;
+		};
+		// Stack before an instruction, one entry per 8 byte slot between the base pointer and the stack pointer,
+		// tracking which slots hold a known constant (addresses, functions and natives are pushed as constants)
+		struct StackState
+		{
+			bool reached = false;
+			std::vector<bool> known;
+			std::vector<int64_t> constants;
+		};
+		struct Function
+		{
+			size_t first;
+			size_t end;
+			bool mainline;
+			int64_t num_args = 0;
+			bool uses_globals = false;
+			std::vector<StackState> states;
+			// Most slots on the stack at any point, each one is a C variable
+			size_t num_slots = 0;
+		};
+
+		AotTranslator( const BatCode& bc );
+
+		bool Decode();
+		bool FindFunctions();
+		bool Analyze( Function& func );
+		void Emit( const Function& func );
+		void EmitModule();
+
+		const Function* FunctionAt( int64_t addr ) const;
+		std::string FunctionName( const Function& func ) const;
+		bool Fail( size_t index, const std::string& message ) const;
+	private:
+		const BatCode& m_Code;
+		std::vector<Instruction> m_Instructions;
+		// Indexed by code offset: index of the instruction starting there, -1 inside of instructions
+		std::vector<int> m_InstructionAt;
+		std::vector<bool> m_Labels;
+		std::vector<Function> m_Functions;
+		int64_t m_iGlobalsSize = 0;
+		std::string m_Source;
+	};
+
+	// Shared library built from the output of AotTranslator
+	class AotModule
+	{
+	public:
+		// Bump whenever the interface between the generated code and AotModule changes
+		static constexpr int32_t VERSION = 2;
+
+		AotModule() = default;
+		~AotModule();
+		AotModule( const AotModule& ) = delete;
+		AotModule& operator=( const AotModule& ) = delete;
+
+		static bool IsModuleFile( const std::string& filename );
+
+		// Returns false if the library can't be loaded or wasn't built from a translation for this build, errors are reported through ErrorSys
+		bool Load( const std::string& filename );
+		void AddNative( const std::string& name, BatNativeCallback callback );
+		// Binds a C++ function as a native, see NativeBinding::Typed
+		template <typename R, typename... Args>
+		void Bind( const std::string& name, R (*function)( Args... ) )
+		{
+			m_Natives.Bind( name, function );
+		}
+		NativeTable& Natives() { return m_Natives; }
+		// Runs the mainline, globals start out fresh every run
+		void Run();
+	private:
+		static void PrintInt( void* host, int64_t val );
+		static void PrintFloat( void* host, double val );
+		static void PrintBool( void* host, int64_t val );
+		static void PrintString( void* host, int64_t idx );
+		static int64_t CallNative( void* host, int64_t idx, const int64_t* args );
+	private:
+		struct ModuleDesc;
+
+		void* m_hLibrary = nullptr;
+		const ModuleDesc* m_pDesc = nullptr;
+		NativeTable m_Natives;
+		// Natives of the module, as they were in the translated BatCode
+		std::vector<BatNativeInfo> m_NativeInfos;
+		std::vector<const NativeBinding*> m_ResolvedNatives;
+		std::vector<int64_t> m_Globals;
+		StringTable m_Strings;
+	};
+}
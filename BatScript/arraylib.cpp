@@ -0,0 +1,754 @@
+#include "arraylib.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+#define BAT_ARRAYLIB_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows intrinsics of any instruction set everywhere
+#define BAT_TARGET( isa )
+#else
+#include <cpuid.h>
+#define BAT_TARGET( isa ) __attribute__(( target( isa ) ))
+#endif
+#endif
+
+namespace Bat
+{
+	namespace ArrayLib
+	{
+		namespace
+		{
+			struct Kernels
+			{
+				InstructionSet set;
+				int64_t (*sum_int)( const int64_t* a, size_t n );
+				double (*sum_float)( const double* a, size_t n );
+				int64_t (*min_int)( const int64_t* a, size_t n );
+				double (*min_float)( const double* a, size_t n );
+				int64_t (*max_int)( const int64_t* a, size_t n );
+				double (*max_float)( const double* a, size_t n );
+				int64_t (*dot_int)( const int64_t* a, const int64_t* b, size_t n );
+				double (*dot_float)( const double* a, const double* b, size_t n );
+				void (*add_int)( int64_t* dst, const int64_t* a, const int64_t* b, size_t n );
+				void (*add_float)( double* dst, const double* a, const double* b, size_t n );
+				void (*mul_int)( int64_t* dst, const int64_t* a, const int64_t* b, size_t n );
+				void (*mul_float)( double* dst, const double* a, const double* b, size_t n );
+				void (*scale_int)( int64_t* dst, const int64_t* a, int64_t k, size_t n );
+				void (*scale_float)( double* dst, const double* a, double k, size_t n );
+				// Floats are filled by their bits
+				void (*fill)( int64_t* dst, int64_t value, size_t n );
+				size_t (*count_int)( const int64_t* a, size_t n, Compare cmp, int64_t value );
+				size_t (*count_float)( const double* a, size_t n, Compare cmp, double value );
+				void (*prefix_sum_int)( int64_t* dst, const int64_t* a, size_t n );
+				void (*prefix_sum_float)( double* dst, const double* a, size_t n );
+			};
+
+			// Ints wrap around, which is undefined for signed ints in C++
+			inline int64_t WrapAdd( int64_t a, int64_t b ) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+			inline int64_t WrapMul( int64_t a, int64_t b ) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+
+			// Plain loops, for CPUs without the other instruction sets and for the elements that don't fill a vector
+			namespace Scalar
+			{
+				int64_t SumInt( const int64_t* a, size_t n )
+				{
+					int64_t sum = 0;
+					for( size_t i = 0; i < n; i++ ) sum = WrapAdd( sum, a[i] );
+					return sum;
+				}
+				double SumFloat( const double* a, size_t n )
+				{
+					double sum = 0.0;
+					for( size_t i = 0; i < n; i++ ) sum += a[i];
+					return sum;
+				}
+				int64_t MinInt( const int64_t* a, size_t n )
+				{
+					if( n == 0 ) return 0;
+					int64_t min = a[0];
+					for( size_t i = 1; i < n; i++ ) min = a[i] < min ? a[i] : min;
+					return min;
+				}
+				double MinFloat( const double* a, size_t n )
+				{
+					if( n == 0 ) return 0.0;
+					double min = a[0];
+					for( size_t i = 1; i < n; i++ ) min = a[i] < min ? a[i] : min;
+					return min;
+				}
+				int64_t MaxInt( const int64_t* a, size_t n )
+				{
+					if( n == 0 ) return 0;
+					int64_t max = a[0];
+					for( size_t i = 1; i < n; i++ ) max = a[i] > max ? a[i] : max;
+					return max;
+				}
+				double MaxFloat( const double* a, size_t n )
+				{
+					if( n == 0 ) return 0.0;
+					double max = a[0];
+					for( size_t i = 1; i < n; i++ ) max = a[i] > max ? a[i] : max;
+					return max;
+				}
+				int64_t DotInt( const int64_t* a, const int64_t* b, size_t n )
+				{
+					int64_t dot = 0;
+					for( size_t i = 0; i < n; i++ ) dot = WrapAdd( dot, WrapMul( a[i], b[i] ) );
+					return dot;
+				}
+				double DotFloat( const double* a, const double* b, size_t n )
+				{
+					double dot = 0.0;
+					for( size_t i = 0; i < n; i++ ) dot += a[i] * b[i];
+					return dot;
+				}
+				void AddInt( int64_t* dst, const int64_t* a, const int64_t* b, size_t n )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = WrapAdd( a[i], b[i] );
+				}
+				void AddFloat( double* dst, const double* a, const double* b, size_t n )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = a[i] + b[i];
+				}
+				void MulInt( int64_t* dst, const int64_t* a, const int64_t* b, size_t n )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = WrapMul( a[i], b[i] );
+				}
+				void MulFloat( double* dst, const double* a, const double* b, size_t n )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = a[i] * b[i];
+				}
+				void ScaleInt( int64_t* dst, const int64_t* a, int64_t k, size_t n )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = WrapMul( a[i], k );
+				}
+				void ScaleFloat( double* dst, const double* a, double k, size_t n )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = a[i] * k;
+				}
+				void Fill( int64_t* dst, int64_t value, size_t n )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = value;
+				}
+				template <typename T>
+				size_t CountMatches( const T* a, size_t n, Compare cmp, T value )
+				{
+					size_t count = 0;
+					switch( cmp )
+					{
+					case Compare::LESS:    for( size_t i = 0; i < n; i++ ) count += a[i] < value; break;
+					case Compare::EQUAL:   for( size_t i = 0; i < n; i++ ) count += a[i] == value; break;
+					case Compare::GREATER: for( size_t i = 0; i < n; i++ ) count += a[i] > value; break;
+					}
+					return count;
+				}
+				size_t CountInt( const int64_t* a, size_t n, Compare cmp, int64_t value ) { return CountMatches( a, n, cmp, value ); }
+				size_t CountFloat( const double* a, size_t n, Compare cmp, double value ) { return CountMatches( a, n, cmp, value ); }
+				// carry is the sum of the elements before a
+				void PrefixSumInt( int64_t* dst, const int64_t* a, size_t n, int64_t carry = 0 )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = carry = WrapAdd( carry, a[i] );
+				}
+				void PrefixSumFloat( double* dst, const double* a, size_t n, double carry = 0.0 )
+				{
+					for( size_t i = 0; i < n; i++ ) dst[i] = carry += a[i];
+				}
+
+				constexpr Kernels KERNELS = {
+					InstructionSet::SCALAR,
+					SumInt, SumFloat, MinInt, MinFloat, MaxInt, MaxFloat, DotInt, DotFloat,
+					AddInt, AddFloat, MulInt, MulFloat, ScaleInt, ScaleFloat, Fill, CountInt, CountFloat,
+					[]( int64_t* dst, const int64_t* a, size_t n ) { PrefixSumInt( dst, a, n ); },
+					[]( double* dst, const double* a, size_t n ) { PrefixSumFloat( dst, a, n ); }
+				};
+			}
+
+#ifdef BAT_ARRAYLIB_X86
+			// 2 elements per vector
+			// SSE4.2 is the first with 64 bit compares (pcmpgtq), SSE4.1 brings the blends and 64 bit equality
+			namespace Sse
+			{
+#define BAT_SSE BAT_TARGET( "sse4.2" )
+				BAT_SSE inline int64_t HorizontalSum( __m128i v )
+				{
+					return _mm_cvtsi128_si64( _mm_add_epi64( v, _mm_unpackhi_epi64( v, v ) ) );
+				}
+				BAT_SSE inline double HorizontalSum( __m128d v )
+				{
+					return _mm_cvtsd_f64( _mm_add_sd( v, _mm_unpackhi_pd( v, v ) ) );
+				}
+				// Low 64 bits of the products, out of 32 bit multiplies, which is the same for signed and unsigned ints
+				BAT_SSE inline __m128i Mul64( __m128i a, __m128i b )
+				{
+					__m128i low = _mm_mul_epu32( a, b );
+					__m128i cross = _mm_add_epi64( _mm_mul_epu32( _mm_srli_epi64( a, 32 ), b ), _mm_mul_epu32( a, _mm_srli_epi64( b, 32 ) ) );
+					return _mm_add_epi64( low, _mm_slli_epi64( cross, 32 ) );
+				}
+				BAT_SSE inline __m128i Load( const int64_t* p ) { return _mm_loadu_si128( reinterpret_cast<const __m128i*>(p) ); }
+				BAT_SSE inline void Store( int64_t* p, __m128i v ) { _mm_storeu_si128( reinterpret_cast<__m128i*>(p), v ); }
+
+				BAT_SSE int64_t SumInt( const int64_t* a, size_t n )
+				{
+					__m128i sum = _mm_setzero_si128();
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) sum = _mm_add_epi64( sum, Load( a + i ) );
+					return WrapAdd( HorizontalSum( sum ), Scalar::SumInt( a + i, n - i ) );
+				}
+				BAT_SSE double SumFloat( const double* a, size_t n )
+				{
+					__m128d sum = _mm_setzero_pd();
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) sum = _mm_add_pd( sum, _mm_loadu_pd( a + i ) );
+					return HorizontalSum( sum ) + Scalar::SumFloat( a + i, n - i );
+				}
+				BAT_SSE int64_t MinInt( const int64_t* a, size_t n )
+				{
+					if( n < 2 ) return Scalar::MinInt( a, n );
+					__m128i min = Load( a );
+					size_t i = 2;
+					for( ; i + 2 <= n; i += 2 )
+					{
+						__m128i v = Load( a + i );
+						min = _mm_blendv_epi8( min, v, _mm_cmpgt_epi64( min, v ) );
+					}
+					int64_t lanes[2];
+					Store( lanes, min );
+					int64_t result = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+					return i < n && a[i] < result ? a[i] : result;
+				}
+				BAT_SSE int64_t MaxInt( const int64_t* a, size_t n )
+				{
+					if( n < 2 ) return Scalar::MaxInt( a, n );
+					__m128i max = Load( a );
+					size_t i = 2;
+					for( ; i + 2 <= n; i += 2 )
+					{
+						__m128i v = Load( a + i );
+						max = _mm_blendv_epi8( max, v, _mm_cmpgt_epi64( v, max ) );
+					}
+					int64_t lanes[2];
+					Store( lanes, max );
+					int64_t result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+					return i < n && a[i] > result ? a[i] : result;
+				}
+				BAT_SSE double MinFloat( const double* a, size_t n )
+				{
+					if( n < 2 ) return Scalar::MinFloat( a, n );
+					__m128d min = _mm_loadu_pd( a );
+					size_t i = 2;
+					for( ; i + 2 <= n; i += 2 ) min = _mm_min_pd( min, _mm_loadu_pd( a + i ) );
+					min = _mm_min_sd( min, _mm_unpackhi_pd( min, min ) );
+					double result = _mm_cvtsd_f64( min );
+					return i < n && a[i] < result ? a[i] : result;
+				}
+				BAT_SSE double MaxFloat( const double* a, size_t n )
+				{
+					if( n < 2 ) return Scalar::MaxFloat( a, n );
+					__m128d max = _mm_loadu_pd( a );
+					size_t i = 2;
+					for( ; i + 2 <= n; i += 2 ) max = _mm_max_pd( max, _mm_loadu_pd( a + i ) );
+					max = _mm_max_sd( max, _mm_unpackhi_pd( max, max ) );
+					double result = _mm_cvtsd_f64( max );
+					return i < n && a[i] > result ? a[i] : result;
+				}
+				BAT_SSE int64_t DotInt( const int64_t* a, const int64_t* b, size_t n )
+				{
+					__m128i dot = _mm_setzero_si128();
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) dot = _mm_add_epi64( dot, Mul64( Load( a + i ), Load( b + i ) ) );
+					return WrapAdd( HorizontalSum( dot ), Scalar::DotInt( a + i, b + i, n - i ) );
+				}
+				BAT_SSE double DotFloat( const double* a, const double* b, size_t n )
+				{
+					__m128d dot = _mm_setzero_pd();
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) dot = _mm_add_pd( dot, _mm_mul_pd( _mm_loadu_pd( a + i ), _mm_loadu_pd( b + i ) ) );
+					return HorizontalSum( dot ) + Scalar::DotFloat( a + i, b + i, n - i );
+				}
+				BAT_SSE void AddInt( int64_t* dst, const int64_t* a, const int64_t* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) Store( dst + i, _mm_add_epi64( Load( a + i ), Load( b + i ) ) );
+					Scalar::AddInt( dst + i, a + i, b + i, n - i );
+				}
+				BAT_SSE void AddFloat( double* dst, const double* a, const double* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) _mm_storeu_pd( dst + i, _mm_add_pd( _mm_loadu_pd( a + i ), _mm_loadu_pd( b + i ) ) );
+					Scalar::AddFloat( dst + i, a + i, b + i, n - i );
+				}
+				BAT_SSE void MulInt( int64_t* dst, const int64_t* a, const int64_t* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) Store( dst + i, Mul64( Load( a + i ), Load( b + i ) ) );
+					Scalar::MulInt( dst + i, a + i, b + i, n - i );
+				}
+				BAT_SSE void MulFloat( double* dst, const double* a, const double* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) _mm_storeu_pd( dst + i, _mm_mul_pd( _mm_loadu_pd( a + i ), _mm_loadu_pd( b + i ) ) );
+					Scalar::MulFloat( dst + i, a + i, b + i, n - i );
+				}
+				BAT_SSE void ScaleInt( int64_t* dst, const int64_t* a, int64_t k, size_t n )
+				{
+					const __m128i factor = _mm_set1_epi64x( k );
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) Store( dst + i, Mul64( Load( a + i ), factor ) );
+					Scalar::ScaleInt( dst + i, a + i, k, n - i );
+				}
+				BAT_SSE void ScaleFloat( double* dst, const double* a, double k, size_t n )
+				{
+					const __m128d factor = _mm_set1_pd( k );
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) _mm_storeu_pd( dst + i, _mm_mul_pd( _mm_loadu_pd( a + i ), factor ) );
+					Scalar::ScaleFloat( dst + i, a + i, k, n - i );
+				}
+				BAT_SSE void Fill( int64_t* dst, int64_t value, size_t n )
+				{
+					const __m128i v = _mm_set1_epi64x( value );
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 ) Store( dst + i, v );
+					Scalar::Fill( dst + i, value, n - i );
+				}
+				// Matches are all ones, i.e. -1, so subtracting the masks counts them
+				BAT_SSE size_t CountInt( const int64_t* a, size_t n, Compare cmp, int64_t value )
+				{
+					const __m128i v = _mm_set1_epi64x( value );
+					__m128i count = _mm_setzero_si128();
+					size_t i = 0;
+					switch( cmp )
+					{
+					case Compare::LESS:    for( ; i + 2 <= n; i += 2 ) count = _mm_sub_epi64( count, _mm_cmpgt_epi64( v, Load( a + i ) ) ); break;
+					case Compare::EQUAL:   for( ; i + 2 <= n; i += 2 ) count = _mm_sub_epi64( count, _mm_cmpeq_epi64( Load( a + i ), v ) ); break;
+					case Compare::GREATER: for( ; i + 2 <= n; i += 2 ) count = _mm_sub_epi64( count, _mm_cmpgt_epi64( Load( a + i ), v ) ); break;
+					}
+					return (size_t)HorizontalSum( count ) + Scalar::CountInt( a + i, n - i, cmp, value );
+				}
+				BAT_SSE size_t CountFloat( const double* a, size_t n, Compare cmp, double value )
+				{
+					const __m128d v = _mm_set1_pd( value );
+					__m128i count = _mm_setzero_si128();
+					size_t i = 0;
+					switch( cmp )
+					{
+					case Compare::LESS:    for( ; i + 2 <= n; i += 2 ) count = _mm_sub_epi64( count, _mm_castpd_si128( _mm_cmplt_pd( _mm_loadu_pd( a + i ), v ) ) ); break;
+					case Compare::EQUAL:   for( ; i + 2 <= n; i += 2 ) count = _mm_sub_epi64( count, _mm_castpd_si128( _mm_cmpeq_pd( _mm_loadu_pd( a + i ), v ) ) ); break;
+					case Compare::GREATER: for( ; i + 2 <= n; i += 2 ) count = _mm_sub_epi64( count, _mm_castpd_si128( _mm_cmpgt_pd( _mm_loadu_pd( a + i ), v ) ) ); break;
+					}
+					return (size_t)HorizontalSum( count ) + Scalar::CountFloat( a + i, n - i, cmp, value );
+				}
+				// Scan within the vector by adding it shifted up one element, then add the sum of everything before it
+				BAT_SSE void PrefixSumInt( int64_t* dst, const int64_t* a, size_t n )
+				{
+					__m128i carry = _mm_setzero_si128();
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 )
+					{
+						__m128i v = Load( a + i );
+						v = _mm_add_epi64( v, _mm_slli_si128( v, 8 ) );
+						v = _mm_add_epi64( v, carry );
+						Store( dst + i, v );
+						carry = _mm_unpackhi_epi64( v, v );
+					}
+					Scalar::PrefixSumInt( dst + i, a + i, n - i, _mm_cvtsi128_si64( carry ) );
+				}
+				BAT_SSE void PrefixSumFloat( double* dst, const double* a, size_t n )
+				{
+					__m128d carry = _mm_setzero_pd();
+					size_t i = 0;
+					for( ; i + 2 <= n; i += 2 )
+					{
+						__m128d v = _mm_loadu_pd( a + i );
+						v = _mm_add_pd( v, _mm_unpacklo_pd( _mm_setzero_pd(), v ) );
+						v = _mm_add_pd( v, carry );
+						_mm_storeu_pd( dst + i, v );
+						carry = _mm_unpackhi_pd( v, v );
+					}
+					Scalar::PrefixSumFloat( dst + i, a + i, n - i, _mm_cvtsd_f64( carry ) );
+				}
+#undef BAT_SSE
+
+				constexpr Kernels KERNELS = {
+					InstructionSet::SSE42,
+					SumInt, SumFloat, MinInt, MinFloat, MaxInt, MaxFloat, DotInt, DotFloat,
+					AddInt, AddFloat, MulInt, MulFloat, ScaleInt, ScaleFloat, Fill, CountInt, CountFloat,
+					PrefixSumInt, PrefixSumFloat
+				};
+			}
+
+			// 4 elements per vector
+			namespace Avx2
+			{
+#define BAT_AVX2 BAT_TARGET( "avx2" )
+				BAT_AVX2 inline int64_t HorizontalSum( __m256i v )
+				{
+					__m128i half = _mm_add_epi64( _mm256_castsi256_si128( v ), _mm256_extracti128_si256( v, 1 ) );
+					return _mm_cvtsi128_si64( _mm_add_epi64( half, _mm_unpackhi_epi64( half, half ) ) );
+				}
+				BAT_AVX2 inline double HorizontalSum( __m256d v )
+				{
+					__m128d half = _mm_add_pd( _mm256_castpd256_pd128( v ), _mm256_extractf128_pd( v, 1 ) );
+					return _mm_cvtsd_f64( _mm_add_sd( half, _mm_unpackhi_pd( half, half ) ) );
+				}
+				BAT_AVX2 inline __m256i Mul64( __m256i a, __m256i b )
+				{
+					__m256i low = _mm256_mul_epu32( a, b );
+					__m256i cross = _mm256_add_epi64( _mm256_mul_epu32( _mm256_srli_epi64( a, 32 ), b ), _mm256_mul_epu32( a, _mm256_srli_epi64( b, 32 ) ) );
+					return _mm256_add_epi64( low, _mm256_slli_epi64( cross, 32 ) );
+				}
+				BAT_AVX2 inline __m256i Load( const int64_t* p ) { return _mm256_loadu_si256( reinterpret_cast<const __m256i*>(p) ); }
+				BAT_AVX2 inline void Store( int64_t* p, __m256i v ) { _mm256_storeu_si256( reinterpret_cast<__m256i*>(p), v ); }
+
+				BAT_AVX2 int64_t SumInt( const int64_t* a, size_t n )
+				{
+					__m256i sum = _mm256_setzero_si256();
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) sum = _mm256_add_epi64( sum, Load( a + i ) );
+					return WrapAdd( HorizontalSum( sum ), Scalar::SumInt( a + i, n - i ) );
+				}
+				BAT_AVX2 double SumFloat( const double* a, size_t n )
+				{
+					__m256d sum = _mm256_setzero_pd();
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) sum = _mm256_add_pd( sum, _mm256_loadu_pd( a + i ) );
+					return HorizontalSum( sum ) + Scalar::SumFloat( a + i, n - i );
+				}
+				BAT_AVX2 int64_t MinInt( const int64_t* a, size_t n )
+				{
+					if( n < 4 ) return Scalar::MinInt( a, n );
+					__m256i min = Load( a );
+					size_t i = 4;
+					for( ; i + 4 <= n; i += 4 )
+					{
+						__m256i v = Load( a + i );
+						min = _mm256_blendv_epi8( min, v, _mm256_cmpgt_epi64( min, v ) );
+					}
+					int64_t lanes[4];
+					Store( lanes, min );
+					int64_t result = Scalar::MinInt( lanes, 4 );
+					int64_t rest = Scalar::MinInt( a + i, n - i );
+					return i < n && rest < result ? rest : result;
+				}
+				BAT_AVX2 int64_t MaxInt( const int64_t* a, size_t n )
+				{
+					if( n < 4 ) return Scalar::MaxInt( a, n );
+					__m256i max = Load( a );
+					size_t i = 4;
+					for( ; i + 4 <= n; i += 4 )
+					{
+						__m256i v = Load( a + i );
+						max = _mm256_blendv_epi8( max, v, _mm256_cmpgt_epi64( v, max ) );
+					}
+					int64_t lanes[4];
+					Store( lanes, max );
+					int64_t result = Scalar::MaxInt( lanes, 4 );
+					int64_t rest = Scalar::MaxInt( a + i, n - i );
+					return i < n && rest > result ? rest : result;
+				}
+				BAT_AVX2 double MinFloat( const double* a, size_t n )
+				{
+					if( n < 4 ) return Scalar::MinFloat( a, n );
+					__m256d min = _mm256_loadu_pd( a );
+					size_t i = 4;
+					for( ; i + 4 <= n; i += 4 ) min = _mm256_min_pd( min, _mm256_loadu_pd( a + i ) );
+					double lanes[4];
+					_mm256_storeu_pd( lanes, min );
+					double result = Scalar::MinFloat( lanes, 4 );
+					double rest = Scalar::MinFloat( a + i, n - i );
+					return i < n && rest < result ? rest : result;
+				}
+				BAT_AVX2 double MaxFloat( const double* a, size_t n )
+				{
+					if( n < 4 ) return Scalar::MaxFloat( a, n );
+					__m256d max = _mm256_loadu_pd( a );
+					size_t i = 4;
+					for( ; i + 4 <= n; i += 4 ) max = _mm256_max_pd( max, _mm256_loadu_pd( a + i ) );
+					double lanes[4];
+					_mm256_storeu_pd( lanes, max );
+					double result = Scalar::MaxFloat( lanes, 4 );
+					double rest = Scalar::MaxFloat( a + i, n - i );
+					return i < n && rest > result ? rest : result;
+				}
+				BAT_AVX2 int64_t DotInt( const int64_t* a, const int64_t* b, size_t n )
+				{
+					__m256i dot = _mm256_setzero_si256();
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) dot = _mm256_add_epi64( dot, Mul64( Load( a + i ), Load( b + i ) ) );
+					return WrapAdd( HorizontalSum( dot ), Scalar::DotInt( a + i, b + i, n - i ) );
+				}
+				BAT_AVX2 double DotFloat( const double* a, const double* b, size_t n )
+				{
+					__m256d dot = _mm256_setzero_pd();
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) dot = _mm256_add_pd( dot, _mm256_mul_pd( _mm256_loadu_pd( a + i ), _mm256_loadu_pd( b + i ) ) );
+					return HorizontalSum( dot ) + Scalar::DotFloat( a + i, b + i, n - i );
+				}
+				BAT_AVX2 void AddInt( int64_t* dst, const int64_t* a, const int64_t* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) Store( dst + i, _mm256_add_epi64( Load( a + i ), Load( b + i ) ) );
+					Scalar::AddInt( dst + i, a + i, b + i, n - i );
+				}
+				BAT_AVX2 void AddFloat( double* dst, const double* a, const double* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) _mm256_storeu_pd( dst + i, _mm256_add_pd( _mm256_loadu_pd( a + i ), _mm256_loadu_pd( b + i ) ) );
+					Scalar::AddFloat( dst + i, a + i, b + i, n - i );
+				}
+				BAT_AVX2 void MulInt( int64_t* dst, const int64_t* a, const int64_t* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) Store( dst + i, Mul64( Load( a + i ), Load( b + i ) ) );
+					Scalar::MulInt( dst + i, a + i, b + i, n - i );
+				}
+				BAT_AVX2 void MulFloat( double* dst, const double* a, const double* b, size_t n )
+				{
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) _mm256_storeu_pd( dst + i, _mm256_mul_pd( _mm256_loadu_pd( a + i ), _mm256_loadu_pd( b + i ) ) );
+					Scalar::MulFloat( dst + i, a + i, b + i, n - i );
+				}
+				BAT_AVX2 void ScaleInt( int64_t* dst, const int64_t* a, int64_t k, size_t n )
+				{
+					const __m256i factor = _mm256_set1_epi64x( k );
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) Store( dst + i, Mul64( Load( a + i ), factor ) );
+					Scalar::ScaleInt( dst + i, a + i, k, n - i );
+				}
+				BAT_AVX2 void ScaleFloat( double* dst, const double* a, double k, size_t n )
+				{
+					const __m256d factor = _mm256_set1_pd( k );
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) _mm256_storeu_pd( dst + i, _mm256_mul_pd( _mm256_loadu_pd( a + i ), factor ) );
+					Scalar::ScaleFloat( dst + i, a + i, k, n - i );
+				}
+				BAT_AVX2 void Fill( int64_t* dst, int64_t value, size_t n )
+				{
+					const __m256i v = _mm256_set1_epi64x( value );
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 ) Store( dst + i, v );
+					Scalar::Fill( dst + i, value, n - i );
+				}
+				BAT_AVX2 size_t CountInt( const int64_t* a, size_t n, Compare cmp, int64_t value )
+				{
+					const __m256i v = _mm256_set1_epi64x( value );
+					__m256i count = _mm256_setzero_si256();
+					size_t i = 0;
+					switch( cmp )
+					{
+					case Compare::LESS:    for( ; i + 4 <= n; i += 4 ) count = _mm256_sub_epi64( count, _mm256_cmpgt_epi64( v, Load( a + i ) ) ); break;
+					case Compare::EQUAL:   for( ; i + 4 <= n; i += 4 ) count = _mm256_sub_epi64( count, _mm256_cmpeq_epi64( Load( a + i ), v ) ); break;
+					case Compare::GREATER: for( ; i + 4 <= n; i += 4 ) count = _mm256_sub_epi64( count, _mm256_cmpgt_epi64( Load( a + i ), v ) ); break;
+					}
+					return (size_t)HorizontalSum( count ) + Scalar::CountInt( a + i, n - i, cmp, value );
+				}
+				BAT_AVX2 size_t CountFloat( const double* a, size_t n, Compare cmp, double value )
+				{
+					const __m256d v = _mm256_set1_pd( value );
+					__m256i count = _mm256_setzero_si256();
+					size_t i = 0;
+					switch( cmp )
+					{
+					case Compare::LESS:    for( ; i + 4 <= n; i += 4 ) count = _mm256_sub_epi64( count, _mm256_castpd_si256( _mm256_cmp_pd( _mm256_loadu_pd( a + i ), v, _CMP_LT_OQ ) ) ); break;
+					case Compare::EQUAL:   for( ; i + 4 <= n; i += 4 ) count = _mm256_sub_epi64( count, _mm256_castpd_si256( _mm256_cmp_pd( _mm256_loadu_pd( a + i ), v, _CMP_EQ_OQ ) ) ); break;
+					case Compare::GREATER: for( ; i + 4 <= n; i += 4 ) count = _mm256_sub_epi64( count, _mm256_castpd_si256( _mm256_cmp_pd( _mm256_loadu_pd( a + i ), v, _CMP_GT_OQ ) ) ); break;
+					}
+					return (size_t)HorizontalSum( count ) + Scalar::CountFloat( a + i, n - i, cmp, value );
+				}
+				// Scan within the vector in two steps, adding it shifted up by one and then by two elements
+				BAT_AVX2 void PrefixSumInt( int64_t* dst, const int64_t* a, size_t n )
+				{
+					const __m256i zero = _mm256_setzero_si256();
+					__m256i carry = zero;
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 )
+					{
+						__m256i v = Load( a + i );
+						v = _mm256_add_epi64( v, _mm256_blend_epi32( _mm256_permute4x64_epi64( v, _MM_SHUFFLE( 2, 1, 0, 0 ) ), zero, 0x03 ) );
+						v = _mm256_add_epi64( v, _mm256_permute2x128_si256( v, v, 0x08 ) );
+						v = _mm256_add_epi64( v, carry );
+						Store( dst + i, v );
+						carry = _mm256_permute4x64_epi64( v, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+					}
+					Scalar::PrefixSumInt( dst + i, a + i, n - i, _mm256_extract_epi64( carry, 0 ) );
+				}
+				BAT_AVX2 void PrefixSumFloat( double* dst, const double* a, size_t n )
+				{
+					const __m256d zero = _mm256_setzero_pd();
+					__m256d carry = zero;
+					size_t i = 0;
+					for( ; i + 4 <= n; i += 4 )
+					{
+						__m256d v = _mm256_loadu_pd( a + i );
+						v = _mm256_add_pd( v, _mm256_blend_pd( _mm256_permute4x64_pd( v, _MM_SHUFFLE( 2, 1, 0, 0 ) ), zero, 0x1 ) );
+						v = _mm256_add_pd( v, _mm256_permute2f128_pd( v, v, 0x08 ) );
+						v = _mm256_add_pd( v, carry );
+						_mm256_storeu_pd( dst + i, v );
+						carry = _mm256_permute4x64_pd( v, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+					}
+					Scalar::PrefixSumFloat( dst + i, a + i, n - i, _mm256_cvtsd_f64( carry ) );
+				}
+#undef BAT_AVX2
+
+				constexpr Kernels KERNELS = {
+					InstructionSet::AVX2,
+					SumInt, SumFloat, MinInt, MinFloat, MaxInt, MaxFloat, DotInt, DotFloat,
+					AddInt, AddFloat, MulInt, MulFloat, ScaleInt, ScaleFloat, Fill, CountInt, CountFloat,
+					PrefixSumInt, PrefixSumFloat
+				};
+			}
+
+			// Registers eax, ebx, ecx and edx of the given CPUID leaf
+			void CpuId( uint32_t leaf, uint32_t subleaf, uint32_t regs[4] )
+			{
+#ifdef _MSC_VER
+				int info[4];
+				__cpuidex( info, (int)leaf, (int)subleaf );
+				memcpy( regs, info, sizeof( info ) );
+#else
+				__cpuid_count( leaf, subleaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+			}
+			// Which register states the OS saves on context switches
+			uint64_t XGetBv()
+			{
+#ifdef _MSC_VER
+				return _xgetbv( 0 );
+#else
+				uint32_t low, high;
+				__asm__( "xgetbv" : "=a"( low ), "=d"( high ) : "c"( 0 ) );
+				return ((uint64_t)high << 32) | low;
+#endif
+			}
+			InstructionSet Detect()
+			{
+				uint32_t regs[4];
+				CpuId( 0, 0, regs );
+				const uint32_t max_leaf = regs[0];
+				if( max_leaf < 1 )
+				{
+					return InstructionSet::SCALAR;
+				}
+
+				CpuId( 1, 0, regs );
+				const bool sse42 = regs[2] & (1u << 20);
+				const bool osxsave = regs[2] & (1u << 27);
+				const bool avx = regs[2] & (1u << 28);
+				bool avx2 = false;
+				if( max_leaf >= 7 )
+				{
+					CpuId( 7, 0, regs );
+					avx2 = regs[1] & (1u << 5);
+				}
+
+				// AVX needs the OS to save the upper halves of the ymm registers as well as the xmm ones
+				if( sse42 && avx && avx2 && osxsave && (XGetBv() & 0x6) == 0x6 )
+				{
+					return InstructionSet::AVX2;
+				}
+				return sse42 ? InstructionSet::SSE42 : InstructionSet::SCALAR;
+			}
+#else
+			InstructionSet Detect()
+			{
+				return InstructionSet::SCALAR;
+			}
+#endif
+
+			const Kernels* KernelsFor( InstructionSet set )
+			{
+				switch( set )
+				{
+#ifdef BAT_ARRAYLIB_X86
+				case InstructionSet::AVX2:  return &Avx2::KERNELS;
+				case InstructionSet::SSE42: return &Sse::KERNELS;
+#endif
+				default:                    return &Scalar::KERNELS;
+				}
+			}
+
+			std::atomic<const Kernels*> s_pKernels{ nullptr };
+
+			const Kernels& Active()
+			{
+				const Kernels* kernels = s_pKernels.load( std::memory_order_acquire );
+				if( !kernels )
+				{
+					// Racing threads all detect the same thing
+					kernels = KernelsFor( Supported() );
+					s_pKernels.store( kernels, std::memory_order_release );
+				}
+				return *kernels;
+			}
+		}
+
+		InstructionSet Supported()
+		{
+			static const InstructionSet s_Supported = Detect();
+			return s_Supported;
+		}
+		InstructionSet Selected()
+		{
+			return Active().set;
+		}
+		bool Select( InstructionSet set )
+		{
+			if( set > Supported() )
+			{
+				return false;
+			}
+			s_pKernels.store( KernelsFor( set ), std::memory_order_release );
+			return true;
+		}
+		const char* ToString( InstructionSet set )
+		{
+			switch( set )
+			{
+			case InstructionSet::AVX2:  return "avx2";
+			case InstructionSet::SSE42: return "sse4.2";
+			default:                    return "scalar";
+			}
+		}
+		bool FromString( const std::string& name, InstructionSet& set )
+		{
+			for( InstructionSet candidate : { InstructionSet::SCALAR, InstructionSet::SSE42, InstructionSet::AVX2 } )
+			{
+				if( name == ToString( candidate ) )
+				{
+					set = candidate;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		int64_t Sum( const int64_t* a, size_t n ) { return Active().sum_int( a, n ); }
+		double Sum( const double* a, size_t n ) { return Active().sum_float( a, n ); }
+		int64_t Min( const int64_t* a, size_t n ) { return Active().min_int( a, n ); }
+		double Min( const double* a, size_t n ) { return Active().min_float( a, n ); }
+		int64_t Max( const int64_t* a, size_t n ) { return Active().max_int( a, n ); }
+		double Max( const double* a, size_t n ) { return Active().max_float( a, n ); }
+		int64_t Dot( const int64_t* a, const int64_t* b, size_t n ) { return Active().dot_int( a, b, n ); }
+		double Dot( const double* a, const double* b, size_t n ) { return Active().dot_float( a, b, n ); }
+		void Add( int64_t* dst, const int64_t* a, const int64_t* b, size_t n ) { Active().add_int( dst, a, b, n ); }
+		void Add( double* dst, const double* a, const double* b, size_t n ) { Active().add_float( dst, a, b, n ); }
+		void Mul( int64_t* dst, const int64_t* a, const int64_t* b, size_t n ) { Active().mul_int( dst, a, b, n ); }
+		void Mul( double* dst, const double* a, const double* b, size_t n ) { Active().mul_float( dst, a, b, n ); }
+		void Scale( int64_t* dst, const int64_t* a, int64_t k, size_t n ) { Active().scale_int( dst, a, k, n ); }
+		void Scale( double* dst, const double* a, double k, size_t n ) { Active().scale_float( dst, a, k, n ); }
+		void Fill( int64_t* dst, int64_t value, size_t n ) { Active().fill( dst, value, n ); }
+		void Fill( double* dst, double value, size_t n )
+		{
+			int64_t bits;
+			memcpy( &bits, &value, sizeof( bits ) );
+			Active().fill( reinterpret_cast<int64_t*>(dst), bits, n );
+		}
+		size_t Count( const int64_t* a, size_t n, Compare cmp, int64_t value ) { return Active().count_int( a, n, cmp, value ); }
+		size_t Count( const double* a, size_t n, Compare cmp, double value ) { return Active().count_float( a, n, cmp, value ); }
+		void PrefixSum( int64_t* dst, const int64_t* a, size_t n ) { Active().prefix_sum_int( dst, a, n ); }
+		void PrefixSum( double* dst, const double* a, size_t n ) { Active().prefix_sum_float( dst, a, n ); }
+	}
+}
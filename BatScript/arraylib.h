@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "native_binding.h"
+
+namespace Bat
+{
+	// Bulk operations on the elements of int and float arrays
+	// Every operation has a scalar, an SSE4.2 and an AVX2 kernel. The widest one that the CPU and the OS support is
+	// picked by CPUID the first time any of them is used, so the same binary runs everywhere.
+	//
+	// Ints wrap around on overflow like they do in scripts. Float sums, dots and prefix sums add in a different order
+	// than a loop over the elements would, so their results can differ from one in the last bits. Mins and maxes of
+	// float arrays with NaNs in them are unspecified, and those of empty arrays are 0.
+	// Operations that write to a destination only touch as many elements as the shortest of their arrays has, the
+	// destination may be one of the other arrays but mustn't partially overlap them.
+	namespace ArrayLib
+	{
+		enum class InstructionSet
+		{
+			SCALAR,
+			SSE42,
+			AVX2
+		};
+
+		enum class Compare
+		{
+			LESS,
+			EQUAL,
+			GREATER
+		};
+
+		// Widest instruction set the CPU and the OS support
+		InstructionSet Supported();
+		// Instruction set whose kernels are used
+		InstructionSet Selected();
+		// Uses the kernels of a narrower instruction set from now on, e.g. to compare them
+		// Returns false, and keeps the current kernels, if set isn't supported
+		bool Select( InstructionSet set );
+		// "scalar", "sse4.2" or "avx2"
+		const char* ToString( InstructionSet set );
+		bool FromString( const std::string& name, InstructionSet& set );
+
+		int64_t Sum( const int64_t* a, size_t n );
+		double Sum( const double* a, size_t n );
+		int64_t Min( const int64_t* a, size_t n );
+		double Min( const double* a, size_t n );
+		int64_t Max( const int64_t* a, size_t n );
+		double Max( const double* a, size_t n );
+		int64_t Dot( const int64_t* a, const int64_t* b, size_t n );
+		double Dot( const double* a, const double* b, size_t n );
+		// dst[i] = a[i] + b[i]
+		void Add( int64_t* dst, const int64_t* a, const int64_t* b, size_t n );
+		void Add( double* dst, const double* a, const double* b, size_t n );
+		// dst[i] = a[i] * b[i]
+		void Mul( int64_t* dst, const int64_t* a, const int64_t* b, size_t n );
+		void Mul( double* dst, const double* a, const double* b, size_t n );
+		// dst[i] = a[i] * k
+		void Scale( int64_t* dst, const int64_t* a, int64_t k, size_t n );
+		void Scale( double* dst, const double* a, double k, size_t n );
+		void Fill( int64_t* dst, int64_t value, size_t n );
+		void Fill( double* dst, double value, size_t n );
+		// Number of elements for which a[i] <cmp> value holds
+		size_t Count( const int64_t* a, size_t n, Compare cmp, int64_t value );
+		size_t Count( const double* a, size_t n, Compare cmp, double value );
+		// dst[i] = a[0] + ... + a[i]
+		void PrefixSum( int64_t* dst, const int64_t* a, size_t n );
+		void PrefixSum( double* dst, const double* a, size_t n );
+	}
+
+	// Binds the array library as typed natives, bind is called with the name and the function of each
+	// Scripts declare the ones they use, e.g. `native isum(xs : int[]) -> int`. Natives of int arrays start with i, those
+	// of float arrays with f:
+	//  isum(xs) -> int           imin(xs) -> int             imax(xs) -> int             idot(xs, ys) -> int
+	//  iadd(dst, xs, ys)         imul(dst, xs, ys)           iscale(dst, xs, k : int)    ifill(dst, x : int)
+	//  icount_less(xs, x) -> int icount_equal(xs, x) -> int  icount_greater(xs, x) -> int
+	//  iprefix_sum(dst, xs)
+	template <typename BindFunc>
+	void BindArrayLib( BindFunc&& bind )
+	{
+		using namespace ArrayLib;
+		using Ints = ArrayRef<int64_t>;
+		using Floats = ArrayRef<double>;
+
+		bind( "isum", +[]( Ints a ) { return Sum( a.data, a.length ); } );
+		bind( "fsum", +[]( Floats a ) { return Sum( a.data, a.length ); } );
+		bind( "imin", +[]( Ints a ) { return Min( a.data, a.length ); } );
+		bind( "fmin", +[]( Floats a ) { return Min( a.data, a.length ); } );
+		bind( "imax", +[]( Ints a ) { return Max( a.data, a.length ); } );
+		bind( "fmax", +[]( Floats a ) { return Max( a.data, a.length ); } );
+		bind( "idot", +[]( Ints a, Ints b ) { return Dot( a.data, b.data, std::min( a.length, b.length ) ); } );
+		bind( "fdot", +[]( Floats a, Floats b ) { return Dot( a.data, b.data, std::min( a.length, b.length ) ); } );
+		bind( "iadd", +[]( Ints dst, Ints a, Ints b ) { Add( dst.data, a.data, b.data, std::min( { dst.length, a.length, b.length } ) ); } );
+		bind( "fadd", +[]( Floats dst, Floats a, Floats b ) { Add( dst.data, a.data, b.data, std::min( { dst.length, a.length, b.length } ) ); } );
+		bind( "imul", +[]( Ints dst, Ints a, Ints b ) { Mul( dst.data, a.data, b.data, std::min( { dst.length, a.length, b.length } ) ); } );
+		bind( "fmul", +[]( Floats dst, Floats a, Floats b ) { Mul( dst.data, a.data, b.data, std::min( { dst.length, a.length, b.length } ) ); } );
+		bind( "iscale", +[]( Ints dst, Ints a, int64_t k ) { Scale( dst.data, a.data, k, std::min( dst.length, a.length ) ); } );
+		bind( "fscale", +[]( Floats dst, Floats a, double k ) { Scale( dst.data, a.data, k, std::min( dst.length, a.length ) ); } );
+		bind( "ifill", +[]( Ints dst, int64_t x ) { Fill( dst.data, x, dst.length ); } );
+		bind( "ffill", +[]( Floats dst, double x ) { Fill( dst.data, x, dst.length ); } );
+		bind( "icount_less", +[]( Ints a, int64_t x ) { return (int64_t)Count( a.data, a.length, Compare::LESS, x ); } );
+		bind( "fcount_less", +[]( Floats a, double x ) { return (int64_t)Count( a.data, a.length, Compare::LESS, x ); } );
+		bind( "icount_equal", +[]( Ints a, int64_t x ) { return (int64_t)Count( a.data, a.length, Compare::EQUAL, x ); } );
+		bind( "fcount_equal", +[]( Floats a, double x ) { return (int64_t)Count( a.data, a.length, Compare::EQUAL, x ); } );
+		bind( "icount_greater", +[]( Ints a, int64_t x ) { return (int64_t)Count( a.data, a.length, Compare::GREATER, x ); } );
+		bind( "fcount_greater", +[]( Floats a, double x ) { return (int64_t)Count( a.data, a.length, Compare::GREATER, x ); } );
+		bind( "iprefix_sum", +[]( Ints dst, Ints a ) { PrefixSum( dst.data, a.data, std::min( dst.length, a.length ) ); } );
+		bind( "fprefix_sum", +[]( Floats dst, Floats a ) { PrefixSum( dst.data, a.data, std::min( dst.length, a.length ) ); } );
+	}
+}
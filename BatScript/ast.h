@@ -152,9 +152,9 @@ namespace Bat
 	public:
 		DECLARE_AST_NODE( StringLiteral );
 
-		StringLiteral( const SourceLoc& loc, const char* value ) : Expression( loc ), value( value ) {}
+		StringLiteral( const SourceLoc& loc, BatString* value ) : Expression( loc ), value( value ) {}
 
-		const char* value;
+		BatString* value; // Interned
 	};
 
 	class TokenLiteral : public Expression
@@ -176,6 +176,8 @@ namespace Bat
 
 		size_t NumValues() const { return m_pValues.size(); }
 		Expression* ValueAt( size_t index ) const { return m_pValues[index].get(); }
+		std::unique_ptr<Expression> TakeValue( size_t index ) { return std::move( m_pValues[index] ); }
+		void SetValue( size_t index, std::unique_ptr<Expression> expr ) { m_pValues[index] = std::move( expr ); }
 	private:
 		std::vector<std::unique_ptr<Expression>> m_pValues;
 	};
@@ -220,6 +222,8 @@ namespace Bat
 
 		TokenType Op() const { return m_Op; }
 		Expression* Right() { return m_pRight.get(); }
+		std::unique_ptr<Expression> TakeRight() { return std::move( m_pRight ); }
+		void SetRight( std::unique_ptr<Expression> expr ) { m_pRight = std::move( expr ); }
 	private:
 		TokenType m_Op;
 		std::unique_ptr<Expression> m_pRight;
@@ -237,10 +241,22 @@ namespace Bat
 		{}
 
 		Expression* Expr() { return m_pExpression.get(); }
+		std::unique_ptr<Expression> TakeExpr() { return std::move( m_pExpression ); }
 	private:
 		std::unique_ptr<Expression> m_pExpression;
 	};
 
+	// Where a variable lives at runtime, filled in by the Resolver (see resolver.h) for the interpreter
+	// depth is the number of environments to walk up from the current one, globals are indexed directly
+	struct VarSlot
+	{
+		static constexpr int GLOBAL = -1;
+		static constexpr int UNRESOLVED = -2;
+
+		int depth = UNRESOLVED;
+		int index = -1;
+	};
+
 	class VarExpr : public LValueExpr
 	{
 	public:
@@ -249,8 +265,11 @@ namespace Bat
 		VarExpr( const SourceLoc& loc, Token name ) : LValueExpr( loc ), m_tokName( name ) {}
 
 		const Token& Identifier() const { return m_tokName; }
+		const VarSlot& Slot() const { return m_Slot; }
+		void SetSlot( VarSlot slot ) { m_Slot = slot; }
 	private:
 		Token m_tokName;
+		VarSlot m_Slot;
 	};
 
 	class CallExpr : public Expression
@@ -266,6 +285,9 @@ namespace Bat
 		{}
 
 		Expression* Function() { return m_pFunc.get(); }
+		// Calls of async functions without await spawn a task instead (see scheduler.h)
+		bool IsAwait() const { return m_bAwait; }
+		void SetAwait( bool await ) { m_bAwait = await; }
 		size_t NumArgs() const { return m_pArguments.size(); }
 		Expression* Arg( size_t index ) const { return m_pArguments[index].get(); }
 		std::unique_ptr<Expression> TakeArg( size_t index ) { return std::move( m_pArguments[index] ); }
@@ -273,6 +295,7 @@ namespace Bat
 	private:
 		std::unique_ptr<Expression> m_pFunc;
 		std::vector<std::unique_ptr<Expression>> m_pArguments;
+		bool m_bAwait = false;
 	};
 
 	class IndexExpr : public LValueExpr
@@ -311,6 +334,8 @@ namespace Bat
 		}
 
 		Expression* Expr() { return m_pExpr.get(); }
+		std::unique_ptr<Expression> TakeExpr() { return std::move( m_pExpr ); }
+		void SetExpr( std::unique_ptr<Expression> expr ) { m_pExpr = std::move( expr ); }
 		Bat::Type* TargetType() { return m_pTargetType; }
 	private:
 		std::unique_ptr<Expression> m_pExpr;
@@ -328,6 +353,8 @@ namespace Bat
 			m_pExpression( std::move( expression ) ) {}
 
 		Expression* Expr() { return m_pExpression.get(); }
+		std::unique_ptr<Expression> TakeExpr() { return std::move( m_pExpression ); }
+		void SetExpr( std::unique_ptr<Expression> expr ) { m_pExpression = std::move( expr ); }
 	private:
 		std::unique_ptr<Expression> m_pExpression;
 	};
@@ -371,8 +398,13 @@ namespace Bat
 		void Add( std::unique_ptr<Statement> stmt ) { m_Statements.push_back( std::move( stmt ) ); }
 		size_t NumStatements() const { return m_Statements.size(); }
 		Statement* Stmt(size_t index) const { return m_Statements[index].get(); }
+		std::vector<std::unique_ptr<Statement>>& Statements() { return m_Statements; }
+		// Number of variables declared directly in this block, filled in by the Resolver
+		size_t NumSlots() const { return m_nSlots; }
+		void SetNumSlots( size_t num_slots ) { m_nSlots = num_slots; }
 	private:
 		std::vector<std::unique_ptr<Statement>> m_Statements;
+		size_t m_nSlots = 0;
 	};
 
 	class PrintStmt : public Statement
@@ -386,6 +418,8 @@ namespace Bat
 			m_pExpression( std::move( expression ) ) {}
 
 		Expression* Expr() { return m_pExpression.get(); }
+		std::unique_ptr<Expression> TakeExpr() { return std::move( m_pExpression ); }
+		void SetExpr( std::unique_ptr<Expression> expr ) { m_pExpression = std::move( expr ); }
 	private:
 		std::unique_ptr<Expression> m_pExpression;
 	};
@@ -404,8 +438,14 @@ namespace Bat
 		{}
 		
 		Expression* Condition() { return m_pCondition.get(); }
+		std::unique_ptr<Expression> TakeCondition() { return std::move( m_pCondition ); }
+		void SetCondition( std::unique_ptr<Expression> expr ) { m_pCondition = std::move( expr ); }
 		Statement* Then() { return m_pThen.get(); }
+		std::unique_ptr<Statement> TakeThen() { return std::move( m_pThen ); }
+		void SetThen( std::unique_ptr<Statement> stmt ) { m_pThen = std::move( stmt ); }
 		Statement* Else() { return m_pElse.get(); }
+		std::unique_ptr<Statement> TakeElse() { return std::move( m_pElse ); }
+		void SetElse( std::unique_ptr<Statement> stmt ) { m_pElse = std::move( stmt ); }
 	private:
 		std::unique_ptr<Expression> m_pCondition;
 		std::unique_ptr<Statement> m_pThen;
@@ -425,7 +465,11 @@ namespace Bat
 		{}
 
 		Expression* Condition() { return m_pCondition.get(); }
+		std::unique_ptr<Expression> TakeCondition() { return std::move( m_pCondition ); }
+		void SetCondition( std::unique_ptr<Expression> expr ) { m_pCondition = std::move( expr ); }
 		Statement* Body() { return m_pBody.get(); }
+		std::unique_ptr<Statement> TakeBody() { return std::move( m_pBody ); }
+		void SetBody( std::unique_ptr<Statement> body ) { m_pBody = std::move( body ); }
 	private:
 		std::unique_ptr<Expression> m_pCondition;
 		std::unique_ptr<Statement> m_pBody;
@@ -469,7 +513,7 @@ namespace Bat
 
 		Expression* RetExpr() { return m_pRetExpr.get(); }
 		std::unique_ptr<Expression> TakeRetExpr() { return std::move( m_pRetExpr ); }
-		void SetRetExpr( std::unique_ptr<Expression> expr ) { m_pRetExpr = std::move( m_pRetExpr ); }
+		void SetRetExpr( std::unique_ptr<Expression> expr ) { m_pRetExpr = std::move( expr ); }
 	private:
 		std::unique_ptr<Expression> m_pRetExpr;
 	};
@@ -486,8 +530,11 @@ namespace Bat
 		{}
 
 		const std::string& ModuleName() const { return m_Module.lexeme; }
+		// Statements of the module, filled in by semantic analysis (see module_loader.h)
+		std::vector<std::unique_ptr<Statement>>& Statements() { return m_Statements; }
 	private:
 		Token m_Module;
+		std::vector<std::unique_ptr<Statement>> m_Statements;
 	};
 
 	class TypeSpecifier
@@ -495,7 +542,7 @@ namespace Bat
 	public:
 		TypeSpecifier()
 			:
-			m_tokTypeName( "<unknown>", "<unknown>", -1, -1 )
+			m_tokTypeName( TOKEN_UNKNOWN, "<unknown>", -1, -1 )
 		{}
 		TypeSpecifier( const Token& type_name )
 			:
@@ -524,14 +571,16 @@ namespace Bat
 			std::vector<TypeSpecifier> types,
 			std::vector<Token> parameters,
 			std::vector<std::unique_ptr<Expression>> defaults,
-			bool varargs )
+			bool varargs,
+			bool async = false )
 			:
 			m_ReturnTypeName( std::move( return_type_name ) ),
 			m_Identifier( identifier ),
 			m_Types( std::move( types ) ),
 			m_Parameters( std::move( parameters ) ),
 			m_pDefaults( std::move( defaults ) ),
-			m_bVarArgs( varargs )
+			m_bVarArgs( varargs ),
+			m_bAsync( async )
 		{}
 
 		const TypeSpecifier& ReturnTypeSpec() const { return m_ReturnTypeName; }
@@ -543,10 +592,19 @@ namespace Bat
 		Expression* ParamDefault( size_t index ) const { return m_pDefaults[index].get(); }
 		std::unique_ptr<Expression> TakeParamDefault( size_t index ) { return std::move( m_pDefaults[index] ); }
 		void SetParamDefault( size_t index, std::unique_ptr<Expression> expr ) { m_pDefaults[index] = std::move( expr ); }
+		// Parameters with defaults come last, calls can leave those out
+		size_t NumRequiredParams() const
+		{
+			size_t num = NumParams();
+			while( num > 0 && m_pDefaults[num - 1] ) num--;
+			return num;
+		}
 		void SetReturnType( Type* rettype ) { m_pReturnType = rettype; }
 		Type* ReturnType() { return m_pReturnType; }
 		const Type* ReturnType() const { return m_pReturnType; }
 		bool VarArgs() const { return m_bVarArgs; }
+		// Async functions run as coroutines, async natives suspend the task that awaits them
+		bool Async() const { return m_bAsync; }
 	private:
 		TypeSpecifier m_ReturnTypeName;
 		Token m_Identifier;
@@ -554,6 +612,7 @@ namespace Bat
 		std::vector<Token> m_Parameters;
 		std::vector<std::unique_ptr<Expression>> m_pDefaults;
 		bool m_bVarArgs;
+		bool m_bAsync;
 
 		Type* m_pReturnType = nullptr;
 	};
@@ -595,12 +654,15 @@ namespace Bat
 		void SetInitializer( std::unique_ptr<Expression> expr ) { m_pInitializer = std::move( expr ); }
 		void SetType( Type* type ) { assert( m_pType == nullptr ); m_pType = type; }
 		Bat::Type* Type() { return m_pType; }
+		const VarSlot& Slot() const { return m_Slot; }
+		void SetSlot( VarSlot slot ) { m_Slot = slot; }
 	private:
 		TypeSpecifier m_TypeName;
 		Bat::Type* m_pType = nullptr;
 		Token m_Identifier;
 		std::unique_ptr<Expression> m_pInitializer;
 		bool m_bIsLValue = false;
+		VarSlot m_Slot;
 	};
 
 	class FuncDecl : public Statement
@@ -619,8 +681,15 @@ namespace Bat
 		Statement* Body() { return m_pBody.get(); }
 		std::unique_ptr<Statement> TakeBody() { return std::move( m_pBody ); }
 		void SetBody( std::unique_ptr<Statement> body ) { m_pBody = std::move( body ); }
+		// Slot of the function itself, and the number of slots its parameters take up (see resolver.h)
+		const VarSlot& Slot() const { return m_Slot; }
+		void SetSlot( VarSlot slot ) { m_Slot = slot; }
+		size_t NumParamSlots() const { return m_nParamSlots; }
+		void SetNumParamSlots( size_t num_slots ) { m_nParamSlots = num_slots; }
 	private:
 		FunctionSignature m_Signature;
 		std::unique_ptr<Statement> m_pBody;
+		VarSlot m_Slot;
+		size_t m_nParamSlots = 0;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,585 @@
+#include "ast_optimizer.h"
+
+#include <cmath>
+#include <limits>
+
+namespace Bat
+{
+	// Value of a literal, bools are 0 or 1 like they are at runtime
+	struct ConstantValue
+	{
+		PrimitiveKind kind;
+		int64_t i = 0;
+		double f = 0.0;
+	};
+
+	static bool IsKind( Expression* e, PrimitiveKind kind )
+	{
+		PrimitiveType* type = e->Type() ? e->Type()->ToPrimitive() : nullptr;
+		return type && type->PrimKind() == kind;
+	}
+
+	static bool GetConstant( Expression* e, ConstantValue& c )
+	{
+		if( IntLiteral* literal = e->ToIntLiteral() )
+		{
+			c = { PrimitiveKind::Int, literal->value };
+			return true;
+		}
+		if( FloatLiteral* literal = e->ToFloatLiteral() )
+		{
+			c = { PrimitiveKind::Float, 0, literal->value };
+			return true;
+		}
+		TokenLiteral* literal = e->ToTokenLiteral();
+		if( literal && (literal->value == TOKEN_TRUE || literal->value == TOKEN_FALSE) )
+		{
+			c = { PrimitiveKind::Bool, (literal->value == TOKEN_TRUE) ? 1 : 0 };
+			return true;
+		}
+		return false;
+	}
+
+	static bool IsIntConstant( Expression* e, int64_t value )
+	{
+		IntLiteral* literal = e->ToIntLiteral();
+		return literal && literal->value == value;
+	}
+
+	static bool IsFloatConstant( Expression* e, double value )
+	{
+		// 0.0 and -0.0 compare equal, but aren't the same constant
+		FloatLiteral* literal = e->ToFloatLiteral();
+		return literal && literal->value == value && std::signbit( literal->value ) == std::signbit( value );
+	}
+
+	// Literal of the type of node, nullptr if it has no literals of the constant's kind
+	static std::unique_ptr<Expression> MakeLiteral( Expression* node, const ConstantValue& c )
+	{
+		PrimitiveType* type = node->Type() ? node->Type()->ToPrimitive() : nullptr;
+		if( !type )
+		{
+			return nullptr;
+		}
+
+		std::unique_ptr<Expression> literal;
+		switch( type->PrimKind() )
+		{
+		case PrimitiveKind::Int:
+			if( c.kind == PrimitiveKind::Float ) return nullptr;
+			literal = std::make_unique<IntLiteral>( node->Location(), c.i );
+			break;
+		case PrimitiveKind::Float:
+			if( c.kind != PrimitiveKind::Float ) return nullptr;
+			literal = std::make_unique<FloatLiteral>( node->Location(), c.f );
+			break;
+		case PrimitiveKind::Bool:
+			if( c.kind == PrimitiveKind::Float ) return nullptr;
+			literal = std::make_unique<TokenLiteral>( node->Location(), (c.i != 0) ? TOKEN_TRUE : TOKEN_FALSE );
+			break;
+		default:
+			return nullptr;
+		}
+		literal->SetType( node->Type() );
+		return literal;
+	}
+
+	// Whether evaluating e has no effects and can't fail, so it can be left out if its value isn't used
+	static bool IsPure( Expression* e )
+	{
+		switch( e->Kind() )
+		{
+		case AstType::IntLiteral:
+		case AstType::FloatLiteral:
+		case AstType::StringLiteral:
+		case AstType::TokenLiteral:
+		case AstType::VarExpr:
+			return true;
+		case AstType::GroupExpr:
+			return IsPure( e->AsGroupExpr()->Expr() );
+		case AstType::UnaryExpr:
+			return IsPure( e->AsUnaryExpr()->Right() );
+		case AstType::CastExpr:
+			return IsPure( e->AsCastExpr()->Expr() );
+		case AstType::BinaryExpr:
+		{
+			BinaryExpr* binary = e->AsBinaryExpr();
+			// Integer division traps on 0 and on the smallest int by -1
+			const bool divides = (binary->Op() == TOKEN_SLASH || binary->Op() == TOKEN_PERCENT);
+			if( divides && !IsKind( binary->Right(), PrimitiveKind::Float ) )
+			{
+				IntLiteral* divisor = binary->Right()->ToIntLiteral();
+				if( !divisor || divisor->value == 0 || divisor->value == -1 )
+				{
+					return false;
+				}
+			}
+			return IsPure( binary->Left() ) && IsPure( binary->Right() );
+		}
+		default:
+			// Calls and indexing, which can fail on bounds
+			return false;
+		}
+	}
+
+	static bool AlwaysReturns( Statement* s )
+	{
+		if( s->IsReturnStmt() )
+		{
+			return true;
+		}
+		if( BlockStmt* block = s->ToBlockStmt() )
+		{
+			for( size_t i = 0; i < block->NumStatements(); i++ )
+			{
+				if( AlwaysReturns( block->Stmt( i ) ) )
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+		if( IfStmt* branch = s->ToIfStmt() )
+		{
+			return branch->Else() && AlwaysReturns( branch->Then() ) && AlwaysReturns( branch->Else() );
+		}
+		return false;
+	}
+
+	static std::unique_ptr<Statement> EmptyBlock( const SourceLoc& loc )
+	{
+		return std::make_unique<BlockStmt>( loc, std::vector<std::unique_ptr<Statement>>() );
+	}
+
+	void AstOptimizer::Optimize( std::vector<std::unique_ptr<Statement>>& statements )
+	{
+		AstOptimizer optimizer;
+		optimizer.OptimizeStatements( statements );
+	}
+	std::unique_ptr<Expression> AstOptimizer::Optimize( std::unique_ptr<Expression> expr )
+	{
+		expr->Accept( this );
+		if( m_pExprReplacement )
+		{
+			return std::move( m_pExprReplacement );
+		}
+		return expr;
+	}
+	std::unique_ptr<Statement> AstOptimizer::Optimize( std::unique_ptr<Statement> stmt )
+	{
+		stmt->Accept( this );
+		if( m_bRemoveStmt )
+		{
+			m_bRemoveStmt = false;
+			return nullptr;
+		}
+		if( m_pStmtReplacement )
+		{
+			return std::move( m_pStmtReplacement );
+		}
+		return stmt;
+	}
+	void AstOptimizer::OptimizeStatements( std::vector<std::unique_ptr<Statement>>& statements )
+	{
+		std::vector<std::unique_ptr<Statement>> kept;
+		for( auto& stmt : statements )
+		{
+			auto optimized = Optimize( std::move( stmt ) );
+			if( !optimized )
+			{
+				continue;
+			}
+
+			const bool returns = AlwaysReturns( optimized.get() );
+			kept.push_back( std::move( optimized ) );
+			if( returns )
+			{
+				break;
+			}
+		}
+		statements = std::move( kept );
+	}
+
+	std::unique_ptr<Expression> AstOptimizer::FoldBinary( BinaryExpr* node )
+	{
+		ConstantValue left, right;
+		if( !GetConstant( node->Left(), left ) || !GetConstant( node->Right(), right ) || left.kind != right.kind || left.kind == PrimitiveKind::Bool )
+		{
+			return nullptr;
+		}
+
+		ConstantValue result = { PrimitiveKind::Bool };
+		if( left.kind == PrimitiveKind::Float )
+		{
+			const double a = left.f, b = right.f;
+			switch( node->Op() )
+			{
+			case TOKEN_EQUAL_EQUAL:    result.i = (a == b); break;
+			case TOKEN_EXCLMARK_EQUAL: result.i = (a != b); break;
+			case TOKEN_LESS:           result.i = (a < b); break;
+			case TOKEN_LESS_EQUAL:     result.i = (a <= b); break;
+			case TOKEN_GREATER:        result.i = (a > b); break;
+			case TOKEN_GREATER_EQUAL:  result.i = (a >= b); break;
+			case TOKEN_PLUS:           result = { PrimitiveKind::Float, 0, a + b }; break;
+			case TOKEN_MINUS:          result = { PrimitiveKind::Float, 0, a - b }; break;
+			case TOKEN_ASTERISK:       result = { PrimitiveKind::Float, 0, a * b }; break;
+			case TOKEN_SLASH:          result = { PrimitiveKind::Float, 0, a / b }; break;
+			default:                   return nullptr;
+			}
+			return MakeLiteral( node, result );
+		}
+
+		// Ints wrap around like they do at runtime
+		const int64_t a = left.i, b = right.i;
+		auto wrap = []( uint64_t value ) { return (int64_t)value; };
+		switch( node->Op() )
+		{
+		case TOKEN_EQUAL_EQUAL:     result.i = (a == b); break;
+		case TOKEN_EXCLMARK_EQUAL:  result.i = (a != b); break;
+		case TOKEN_LESS:            result.i = (a < b); break;
+		case TOKEN_LESS_EQUAL:      result.i = (a <= b); break;
+		case TOKEN_GREATER:         result.i = (a > b); break;
+		case TOKEN_GREATER_EQUAL:   result.i = (a >= b); break;
+		case TOKEN_BAR:             result = { PrimitiveKind::Int, a | b }; break;
+		case TOKEN_HAT:             result = { PrimitiveKind::Int, a ^ b }; break;
+		case TOKEN_AMP:             result = { PrimitiveKind::Int, a & b }; break;
+		case TOKEN_PLUS:            result = { PrimitiveKind::Int, wrap( (uint64_t)a + (uint64_t)b ) }; break;
+		case TOKEN_MINUS:           result = { PrimitiveKind::Int, wrap( (uint64_t)a - (uint64_t)b ) }; break;
+		case TOKEN_ASTERISK:        result = { PrimitiveKind::Int, wrap( (uint64_t)a * (uint64_t)b ) }; break;
+		case TOKEN_LESS_LESS:
+			if( b < 0 || b > 63 ) return nullptr;
+			result = { PrimitiveKind::Int, wrap( (uint64_t)a << b ) };
+			break;
+		case TOKEN_GREATER_GREATER:
+			if( b < 0 || b > 63 ) return nullptr;
+			result = { PrimitiveKind::Int, a >> b };
+			break;
+		case TOKEN_SLASH:
+		case TOKEN_PERCENT:
+			if( b == 0 || (b == -1 && a == std::numeric_limits<int64_t>::min()) ) return nullptr;
+			result = { PrimitiveKind::Int, (node->Op() == TOKEN_SLASH) ? a / b : a % b };
+			break;
+		default:
+			return nullptr;
+		}
+		return MakeLiteral( node, result );
+	}
+	std::unique_ptr<Expression> AstOptimizer::Simplify( BinaryExpr* node )
+	{
+		Expression* left = node->Left();
+		Expression* right = node->Right();
+
+		if( IsKind( node, PrimitiveKind::Float ) && IsKind( left, PrimitiveKind::Float ) && IsKind( right, PrimitiveKind::Float ) )
+		{
+			// Only the identities that hold for every float, x + 0.0 isn't one of them for x = -0.0
+			switch( node->Op() )
+			{
+			case TOKEN_ASTERISK:
+				if( IsFloatConstant( right, 1.0 ) ) return node->TakeLeft();
+				if( IsFloatConstant( left, 1.0 ) ) return node->TakeRight();
+				break;
+			case TOKEN_SLASH:
+				if( IsFloatConstant( right, 1.0 ) ) return node->TakeLeft();
+				break;
+			case TOKEN_MINUS:
+				if( IsFloatConstant( right, 0.0 ) ) return node->TakeLeft();
+				break;
+			default:
+				break;
+			}
+			return nullptr;
+		}
+
+		if( !IsKind( node, PrimitiveKind::Int ) || !IsKind( left, PrimitiveKind::Int ) || !IsKind( right, PrimitiveKind::Int ) )
+		{
+			return nullptr;
+		}
+
+		switch( node->Op() )
+		{
+		case TOKEN_PLUS:
+		case TOKEN_BAR:
+		case TOKEN_HAT:
+			if( IsIntConstant( right, 0 ) ) return node->TakeLeft();
+			if( IsIntConstant( left, 0 ) ) return node->TakeRight();
+			break;
+		case TOKEN_MINUS:
+		case TOKEN_LESS_LESS:
+		case TOKEN_GREATER_GREATER:
+			if( IsIntConstant( right, 0 ) ) return node->TakeLeft();
+			break;
+		case TOKEN_SLASH:
+			if( IsIntConstant( right, 1 ) ) return node->TakeLeft();
+			break;
+		case TOKEN_AMP:
+			if( (IsIntConstant( right, 0 ) && IsPure( left )) || (IsIntConstant( left, 0 ) && IsPure( right )) )
+			{
+				return MakeLiteral( node, { PrimitiveKind::Int, 0 } );
+			}
+			break;
+		case TOKEN_ASTERISK:
+		{
+			if( IsIntConstant( right, 1 ) ) return node->TakeLeft();
+			if( IsIntConstant( left, 1 ) ) return node->TakeRight();
+			if( (IsIntConstant( right, 0 ) && IsPure( left )) || (IsIntConstant( left, 0 ) && IsPure( right )) )
+			{
+				return MakeLiteral( node, { PrimitiveKind::Int, 0 } );
+			}
+
+			// Multiplying by a power of two is a left shift, which wraps around the same way
+			IntLiteral* factor = right->ToIntLiteral();
+			bool factor_right = true;
+			if( !factor || factor->value < 2 || (factor->value & (factor->value - 1)) != 0 )
+			{
+				factor = left->ToIntLiteral();
+				factor_right = false;
+			}
+			if( !factor || factor->value < 2 || (factor->value & (factor->value - 1)) != 0 )
+			{
+				break;
+			}
+
+			int64_t bits = 0;
+			while( (int64_t(1) << bits) != factor->value )
+			{
+				bits++;
+			}
+			auto shift = std::make_unique<IntLiteral>( factor->Location(), bits );
+			shift->SetType( factor->Type() );
+			auto shifted = std::make_unique<BinaryExpr>( node->Location(), TOKEN_LESS_LESS, factor_right ? node->TakeLeft() : node->TakeRight(), std::move( shift ) );
+			shifted->SetType( node->Type() );
+			return shifted;
+		}
+		default:
+			break;
+		}
+		return nullptr;
+	}
+
+	void AstOptimizer::VisitIntLiteral( IntLiteral* node )
+	{
+	}
+	void AstOptimizer::VisitFloatLiteral( FloatLiteral* node )
+	{
+	}
+	void AstOptimizer::VisitStringLiteral( StringLiteral* node )
+	{
+	}
+	void AstOptimizer::VisitTokenLiteral( TokenLiteral* node )
+	{
+	}
+	void AstOptimizer::VisitArrayLiteral( ArrayLiteral* node )
+	{
+		for( size_t i = 0; i < node->NumValues(); i++ )
+		{
+			node->SetValue( i, Optimize( node->TakeValue( i ) ) );
+		}
+	}
+	void AstOptimizer::VisitBinaryExpr( BinaryExpr* node )
+	{
+		node->SetLeft( Optimize( node->TakeLeft() ) );
+		node->SetRight( Optimize( node->TakeRight() ) );
+
+		m_pExprReplacement = FoldBinary( node );
+		if( !m_pExprReplacement )
+		{
+			m_pExprReplacement = Simplify( node );
+		}
+	}
+	void AstOptimizer::VisitUnaryExpr( UnaryExpr* node )
+	{
+		node->SetRight( Optimize( node->TakeRight() ) );
+
+		ConstantValue c;
+		if( !GetConstant( node->Right(), c ) )
+		{
+			return;
+		}
+
+		// Floats aren't negated logically, since that tests their bits at runtime
+		switch( node->Op() )
+		{
+		case TOKEN_MINUS:
+			if( c.kind == PrimitiveKind::Int ) m_pExprReplacement = MakeLiteral( node, { PrimitiveKind::Int, (int64_t)(0 - (uint64_t)c.i) } );
+			if( c.kind == PrimitiveKind::Float ) m_pExprReplacement = MakeLiteral( node, { PrimitiveKind::Float, 0, -c.f } );
+			break;
+		case TOKEN_EXCLMARK:
+			if( c.kind != PrimitiveKind::Float ) m_pExprReplacement = MakeLiteral( node, { PrimitiveKind::Bool, c.i == 0 } );
+			break;
+		case TOKEN_TILDE:
+			if( c.kind == PrimitiveKind::Int ) m_pExprReplacement = MakeLiteral( node, { PrimitiveKind::Int, ~c.i } );
+			break;
+		default:
+			break;
+		}
+	}
+	void AstOptimizer::VisitCallExpr( CallExpr* node )
+	{
+		for( size_t i = 0; i < node->NumArgs(); i++ )
+		{
+			node->SetArg( i, Optimize( node->TakeArg( i ) ) );
+		}
+	}
+	void AstOptimizer::VisitIndexExpr( IndexExpr* node )
+	{
+		node->SetIndex( Optimize( node->TakeIndex() ) );
+
+		// ConstantValue indices into fixed size arrays are addressed directly, without the bounds check the semantic analysis
+		// did for literals. So new ones are wrapped around like it does, or left to the runtime if they're out of bounds.
+		ArrayType* array = node->Array()->Type() ? node->Array()->Type()->ToArray() : nullptr;
+		IntLiteral* constant = node->Index()->ToIntLiteral();
+		if( !array || !array->HasFixedSize() || !constant )
+		{
+			return;
+		}
+
+		const int64_t length = (int64_t)array->FixedSize();
+		if( constant->value < 0 && constant->value >= -length )
+		{
+			constant->value += length;
+		}
+		else if( constant->value < 0 || constant->value >= length )
+		{
+			Bat::Type* type = constant->Type();
+			auto group = std::make_unique<GroupExpr>( constant->Location(), node->TakeIndex() );
+			group->SetType( type );
+			node->SetIndex( std::move( group ) );
+		}
+	}
+	void AstOptimizer::VisitCastExpr( CastExpr* node )
+	{
+		node->SetExpr( Optimize( node->TakeExpr() ) );
+
+		ConstantValue c;
+		if( !GetConstant( node->Expr(), c ) )
+		{
+			return;
+		}
+
+		if( c.kind == PrimitiveKind::Int && IsKind( node, PrimitiveKind::Float ) )
+		{
+			m_pExprReplacement = MakeLiteral( node, { PrimitiveKind::Float, 0, (double)c.i } );
+		}
+		else if( c.kind == PrimitiveKind::Int && IsKind( node, PrimitiveKind::Bool ) )
+		{
+			m_pExprReplacement = MakeLiteral( node, { PrimitiveKind::Bool, c.i != 0 } );
+		}
+		// Floats out of the range of ints (and NaNs) convert differently on different machines
+		else if( c.kind == PrimitiveKind::Float && IsKind( node, PrimitiveKind::Int ) && c.f >= -9223372036854775808.0 && c.f < 9223372036854775808.0 )
+		{
+			m_pExprReplacement = MakeLiteral( node, { PrimitiveKind::Int, (int64_t)c.f } );
+		}
+	}
+	void AstOptimizer::VisitGroupExpr( GroupExpr* node )
+	{
+		// Groups only matter to the parser
+		m_pExprReplacement = Optimize( node->TakeExpr() );
+	}
+	void AstOptimizer::VisitVarExpr( VarExpr* node )
+	{
+	}
+	void AstOptimizer::VisitExpressionStmt( ExpressionStmt* node )
+	{
+		node->SetExpr( Optimize( node->TakeExpr() ) );
+		m_bRemoveStmt = IsPure( node->Expr() );
+	}
+	void AstOptimizer::VisitAssignStmt( AssignStmt* node )
+	{
+		node->SetRight( Optimize( node->TakeRight() ) );
+
+		// The target itself stays, only its index can be simplified
+		if( IndexExpr* index = node->Left()->ToIndexExpr() )
+		{
+			VisitIndexExpr( index );
+		}
+	}
+	void AstOptimizer::VisitBlockStmt( BlockStmt* node )
+	{
+		OptimizeStatements( node->Statements() );
+	}
+	void AstOptimizer::VisitPrintStmt( PrintStmt* node )
+	{
+		node->SetExpr( Optimize( node->TakeExpr() ) );
+	}
+	void AstOptimizer::VisitIfStmt( IfStmt* node )
+	{
+		node->SetCondition( Optimize( node->TakeCondition() ) );
+		auto then_branch = Optimize( node->TakeThen() );
+		node->SetThen( then_branch ? std::move( then_branch ) : EmptyBlock( node->Location() ) );
+		if( node->Else() )
+		{
+			node->SetElse( Optimize( node->TakeElse() ) );
+		}
+
+		// A branch that is just a declaration declares the variable in the enclosing scope, so it has to stay
+		ConstantValue c;
+		if( !GetConstant( node->Condition(), c ) || c.kind == PrimitiveKind::Float ||
+			node->Then()->IsVarDecl() || (node->Else() && node->Else()->IsVarDecl()) )
+		{
+			return;
+		}
+
+		if( c.i != 0 )
+		{
+			m_pStmtReplacement = node->TakeThen();
+		}
+		else if( node->Else() )
+		{
+			m_pStmtReplacement = node->TakeElse();
+		}
+		else
+		{
+			m_bRemoveStmt = true;
+		}
+	}
+	void AstOptimizer::VisitWhileStmt( WhileStmt* node )
+	{
+		node->SetCondition( Optimize( node->TakeCondition() ) );
+		auto body = Optimize( node->TakeBody() );
+		node->SetBody( body ? std::move( body ) : EmptyBlock( node->Location() ) );
+
+		ConstantValue c;
+		if( GetConstant( node->Condition(), c ) && c.kind != PrimitiveKind::Float && c.i == 0 && !node->Body()->IsVarDecl() )
+		{
+			m_bRemoveStmt = true;
+		}
+	}
+	void AstOptimizer::VisitForStmt( ForStmt* node )
+	{
+	}
+	void AstOptimizer::VisitReturnStmt( ReturnStmt* node )
+	{
+		if( node->RetExpr() )
+		{
+			node->SetRetExpr( Optimize( node->TakeRetExpr() ) );
+		}
+	}
+	void AstOptimizer::VisitImportStmt( ImportStmt* node )
+	{
+		OptimizeStatements( node->Statements() );
+	}
+	void AstOptimizer::VisitNativeStmt( NativeStmt* node )
+	{
+	}
+	void AstOptimizer::VisitVarDecl( VarDecl* node )
+	{
+		if( node->Initializer() )
+		{
+			node->SetInitializer( Optimize( node->TakeInitializer() ) );
+		}
+	}
+	void AstOptimizer::VisitFuncDecl( FuncDecl* node )
+	{
+		auto& sig = node->Signature();
+		for( size_t i = 0; i < sig.NumParams(); i++ )
+		{
+			if( sig.ParamDefault( i ) )
+			{
+				sig.SetParamDefault( i, Optimize( sig.TakeParamDefault( i ) ) );
+			}
+		}
+
+		auto body = Optimize( node->TakeBody() );
+		node->SetBody( body ? std::move( body ) : EmptyBlock( node->Location() ) );
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "ast.h"
+
+namespace Bat
+{
+	// Simplifies the analyzed syntax tree before it's compiled or interpreted, e.g.
+	//  2 * 3                  ->  6
+	//  x * 1, x + 0, (x)      ->  x
+	//  x * 8                  ->  x << 3
+	//  if false: ...          ->  the else branch, if any
+	//  return x; print x      ->  return x
+	//  x + 1 (as a statement) ->  nothing
+	// Constants are only folded where every backend computes the same result, e.g. integer division by 0 is left for
+	// the runtime, and nodes that replace others keep their source location and type.
+	class AstOptimizer : public AstVisitor
+	{
+	public:
+		static void Optimize( std::vector<std::unique_ptr<Statement>>& statements );
+	private:
+		// Return what replaces the node, statements that have no effect are replaced by nullptr
+		std::unique_ptr<Expression> Optimize( std::unique_ptr<Expression> expr );
+		std::unique_ptr<Statement> Optimize( std::unique_ptr<Statement> stmt );
+		// Also drops whatever follows a statement that always returns
+		void OptimizeStatements( std::vector<std::unique_ptr<Statement>>& statements );
+
+		std::unique_ptr<Expression> FoldBinary( BinaryExpr* node );
+		std::unique_ptr<Expression> Simplify( BinaryExpr* node );
+	private:
+		virtual void VisitIntLiteral( IntLiteral* node ) override;
+		virtual void VisitFloatLiteral( FloatLiteral* node ) override;
+		virtual void VisitStringLiteral( StringLiteral* node ) override;
+		virtual void VisitTokenLiteral( TokenLiteral* node ) override;
+		virtual void VisitArrayLiteral( ArrayLiteral* node ) override;
+		virtual void VisitBinaryExpr( BinaryExpr* node ) override;
+		virtual void VisitUnaryExpr( UnaryExpr* node ) override;
+		virtual void VisitCallExpr( CallExpr* node ) override;
+		virtual void VisitIndexExpr( IndexExpr* node ) override;
+		virtual void VisitCastExpr( CastExpr* node ) override;
+		virtual void VisitGroupExpr( GroupExpr* node ) override;
+		virtual void VisitVarExpr( VarExpr* node ) override;
+		virtual void VisitExpressionStmt( ExpressionStmt* node ) override;
+		virtual void VisitAssignStmt( AssignStmt* node ) override;
+		virtual void VisitBlockStmt( BlockStmt* node ) override;
+		virtual void VisitPrintStmt( PrintStmt* node ) override;
+		virtual void VisitIfStmt( IfStmt* node ) override;
+		virtual void VisitWhileStmt( WhileStmt* node ) override;
+		virtual void VisitForStmt( ForStmt* node ) override;
+		virtual void VisitReturnStmt( ReturnStmt* node ) override;
+		virtual void VisitImportStmt( ImportStmt* node ) override;
+		virtual void VisitNativeStmt( NativeStmt* node ) override;
+		virtual void VisitVarDecl( VarDecl* node ) override;
+		virtual void VisitFuncDecl( FuncDecl* node ) override;
+	private:
+		// Set by the visit of a node that is to be replaced
+		std::unique_ptr<Expression> m_pExprReplacement;
+		std::unique_ptr<Statement> m_pStmtReplacement;
+		bool m_bRemoveStmt = false;
+	};
+}
@@ -48,7 +48,7 @@ namespace Bat
 
 	void AstPrinter::VisitStringLiteral( StringLiteral* node )
 	{
-		std::cout << node->value;
+		std::cout << node->value->chars;
 	}
 
 	void AstPrinter::VisitTokenLiteral( TokenLiteral* node )
@@ -80,7 +80,7 @@ namespace Bat
 
 	void AstPrinter::VisitCallExpr( CallExpr* node )
 	{
-		std::cout << "call";
+		std::cout << (node->IsAwait() ? "await call" : "call");
 		PrintNode( node->Function() );
 		for( size_t i = 0; i < node->NumArgs(); i++ )
 		{
@@ -181,7 +181,7 @@ namespace Bat
 	void AstPrinter::VisitNativeStmt( NativeStmt* node )
 	{
 		const auto& sig = node->Signature();
-		std::cout << "native ";
+		std::cout << (sig.Async() ? "async native " : "native ");
 		if( node->Signature().ReturnType() )
 		{
 			std::cout << node->Signature().ReturnType()->ToString() << ' ';
@@ -211,6 +211,10 @@ namespace Bat
 	void  AstPrinter::VisitFuncDecl( FuncDecl* node )
 	{
 		const auto& sig = node->Signature();
+		if( sig.Async() )
+		{
+			std::cout << "async ";
+		}
 		std::cout << (node->Signature().ReturnType() ? node->Signature().ReturnType()->ToString() : "def"s) << ' ';
 		std::cout << node->Signature().Identifier().lexeme << '(';
 
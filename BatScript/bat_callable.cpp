@@ -5,8 +5,6 @@
 
 namespace Bat
 {
-	static void AddVar( Environment& env, const Token& tok, const BatObject& value );
-
 	BatFunction::BatFunction( FuncDecl* declaration )
 		:
 		m_pDeclaration( declaration )
@@ -29,44 +27,41 @@ namespace Bat
 	}
 	BatObject BatFunction::Call( Interpreter& interpreter, const std::vector<BatObject>& args )
 	{
-		const auto& sig = m_pDeclaration->Signature();
-
-		Environment environment( interpreter.GetEnvironment() );
-		for( size_t i = 0; i < args.size(); i++ )
-		{
-			AddVar( environment, sig.ParamIdent( i ), args[i] );
-		}
-		for( size_t i = args.size(); i < m_pDeclaration->Signature().NumParams(); i++ )
+		BatFunction* function = this;
+		std::vector<BatObject> tail_args;
+		const std::vector<BatObject>* call_args = &args;
+		while( true )
 		{
-			AddVar( environment, sig.ParamIdent( i ), interpreter.Evaluate( sig.ParamDefault( i ) ) );
-		}
+			FuncDecl* declaration = function->m_pDeclaration;
+			const auto& sig = declaration->Signature();
 
-		try
-		{
-			interpreter.ExecuteBlock( m_pDeclaration->Body(), environment );
-		}
-		catch( const ReturnValue& ret )
-		{
-			return ret.value;
-		}
-
-		return BatObject();
-	}
+			// Functions can only be declared globally, so the globals are all they can see besides their own scope
+			// Parameters take up the first slots, in order
+			Environment environment( interpreter.GetGlobals(), declaration->NumParamSlots() );
+			for( size_t i = 0; i < call_args->size(); i++ )
+			{
+				environment.Slot( i ) = (*call_args)[i];
+			}
+			for( size_t i = call_args->size(); i < sig.NumParams(); i++ )
+			{
+				environment.Slot( i ) = interpreter.Evaluate( sig.ParamDefault( i ), environment );
+			}
 
-	static void AddVar( Environment& env, const Token& tok, const BatObject& value )
-	{
-		if( !env.AddVar( tok.lexeme, value ) )
-		{
-			throw RuntimeError( tok.loc, tok.lexeme + " is already defined in this scope" );
+			interpreter.ExecuteBlock( declaration->Body(), environment );
+			if( !interpreter.TakeTailCall( function, tail_args ) )
+			{
+				return interpreter.TakeReturnValue();
+			}
+			call_args = &tail_args;
 		}
 	}
 
-	BatNative::BatNative( BatNativeCallback callback )
+	BatNative::BatNative( NativeBinding binding )
 		:
-		m_Callback( std::move( callback ) )
+		m_Binding( std::move( binding ) )
 	{}
 	BatObject BatNative::Call( Interpreter& interpreter, const std::vector<BatObject>& args )
 	{
-		return m_Callback( args );
+		return m_Binding.invoke_objects( m_Binding, args );
 	}
 }
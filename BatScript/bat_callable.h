@@ -1,30 +1,20 @@
 #pragma once
 
-#include <functional>
 #include "bat_object.h"
 #include "ast.h"
+#include "native_binding.h"
 
 namespace Bat
 {
 	class Interpreter;
-
-	using BatNativeCallback = std::function<BatObject( const std::vector<BatObject>& )>;
-
-	struct BatNativeDesc
-	{
-		std::vector<ObjectType> param_types;
-	};
-
-	struct ReturnValue
-	{
-		BatObject value;
-	};
+	class BatFunction;
 
 	class BatCallable
 	{
 	public:
 		virtual size_t NumDefaults() const = 0;
 		virtual BatObject Call( Interpreter& interpreter, const std::vector<BatObject>& args ) = 0;
+		virtual BatFunction* ToFunction() { return nullptr; }
 	};
 
 	class BatFunction : public BatCallable
@@ -33,7 +23,9 @@ namespace Bat
 		BatFunction( FuncDecl* declaration );
 
 		virtual size_t NumDefaults() const override;
+		// Tail calls the body makes (see Interpreter::TakeTailCall) are executed here in a loop instead of nesting
 		virtual BatObject Call( Interpreter& interpreter, const std::vector<BatObject>& args ) override;
+		virtual BatFunction* ToFunction() override { return this; }
 	private:
 		FuncDecl* m_pDeclaration;
 		size_t m_nDefaults;
@@ -42,11 +34,11 @@ namespace Bat
 	class BatNative : public BatCallable
 	{
 	public:
-		BatNative( BatNativeCallback callback );
+		BatNative( NativeBinding binding );
 
 		virtual size_t NumDefaults() const override { return 0; } // Default values for params not possible for natives yet
 		virtual BatObject Call( Interpreter& interpreter, const std::vector<BatObject>& args ) override;
 	private:
-		BatNativeCallback m_Callback;
+		NativeBinding m_Binding;
 	};
 }
\ No newline at end of file
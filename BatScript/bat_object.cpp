@@ -1,5 +1,6 @@
 #include "bat_object.h"
 
+#include <cstring>
 #include <string>
 #include "bat_callable.h"
 #include "interpreter.h"
@@ -22,54 +23,22 @@ namespace Bat
 		}
 	}
 
-	BatObject::BatObject()
+	void BatObject::Retain() const
 	{
-		memset( &value, 0, sizeof( value ) );
+		if( type == TYPE_STR ) value.str->Retain();
+		else                   value.arr->ref_count++;
 	}
-
-	BatObject::~BatObject()
+	void BatObject::Release()
 	{
 		if( type == TYPE_STR )
 		{
-			delete[] value.str;
+			value.str->Release();
 		}
-		// TODO: make arrays not so leaky
-	}
-	BatObject::BatObject( const BatObject& other )
-	{
-		type = other.type;
-		arr_size = other.arr_size;
-		fixed_arr = other.fixed_arr;
-		memset( &value, 0, sizeof( value ) );
-		Copy( other );
-	}
-	BatObject& BatObject::operator=( const BatObject& rhs )
-	{
-		type = rhs.type;
-		arr_size = rhs.arr_size;
-		fixed_arr = rhs.fixed_arr;
-		memset( &value, 0, sizeof( value ) );
-		Copy( rhs );
-
-		return *this;
-	}
-	BatObject::BatObject( BatObject&& donor ) noexcept
-	{
-		type = donor.type;
-		arr_size = donor.arr_size;
-		fixed_arr = donor.fixed_arr;
-		Move( donor );
-		memset( &donor.value, 0, sizeof( donor.value ) );
-	}
-	BatObject& BatObject::operator=( BatObject&& rhs ) noexcept
-	{
-		type = rhs.type;
-		arr_size = rhs.arr_size;
-		fixed_arr = rhs.fixed_arr;
-		Move( rhs );
-		memset( &rhs.value, 0, sizeof( rhs.value ) );
-
-		return *this;
+		else if( --value.arr->ref_count == 0 )
+		{
+			delete value.arr;
+		}
+		type = TYPE_UNDEFINED;
 	}
 	BatObject::BatObject( int64_t i )
 		:
@@ -87,9 +56,14 @@ namespace Bat
 		:
 		type( TYPE_STR )
 	{
-		size_t len = strlen( s );
-		value.str = new char[len + 1];
-		memcpy( value.str, s, len + 1 );
+		value.str = BatString::Create( s, strlen( s ) );
+	}
+	BatObject::BatObject( BatString* str )
+		:
+		type( TYPE_STR )
+	{
+		str->Retain();
+		value.str = str;
 	}
 	BatObject::BatObject( bool s )
 		:
@@ -105,14 +79,14 @@ namespace Bat
 	}
 	BatObject::BatObject( const BatObject* arr, size_t size, bool fixed_size )
 		:
-		type( TYPE_ARRAY ),
-		arr_size( size ),
-		fixed_arr( fixed_size )
+		type( TYPE_ARRAY )
 	{
-		value.arr = new BatObject[size];
+		value.arr = new BatArray;
+		value.arr->fixed_size = fixed_size;
+		value.arr->elements.resize( size );
 		for( size_t i = 0; i < size; i++ )
 		{
-			value.arr[i].Assign( arr[i] );
+			value.arr->elements[i].Assign( arr[i] );
 		}
 	}
 	BatObject BatObject::Add( const BatObject& rhs )
@@ -125,17 +99,15 @@ namespace Bat
 		// Adding a list and another object will 
 		if( type == TYPE_ARRAY )
 		{
-			assert( !fixed_arr );
+			assert( !value.arr->fixed_size );
 			// TODO: What about appending array to end of another array?
 			BatObject res;
 			res.type = TYPE_ARRAY;
-			res.arr_size = arr_size + 1;
-			res.value.arr = new BatObject[res.arr_size];
-			for( size_t i = 0; i < arr_size; i++ )
-			{
-				res.value.arr[i] = value.arr[i];
-			}
-			res.value.arr[arr_size] = rhs;
+			res.value.arr = new BatArray;
+			res.value.arr->fixed_size = false;
+			res.value.arr->elements.reserve( value.arr->elements.size() + 1 );
+			res.value.arr->elements.assign( value.arr->elements.begin(), value.arr->elements.end() );
+			res.value.arr->elements.push_back( rhs );
 			return res;
 		}
 
@@ -219,7 +191,7 @@ namespace Bat
 				case TYPE_FLOAT:
 					return value.f64 == rhs.value.f64;
 				case TYPE_STR:
-					return std::string( value.str ) == rhs.value.str;
+					return BatString::Equal( value.str, rhs.value.str );
 			}
 		}
 
@@ -343,32 +315,39 @@ namespace Bat
 			throw BatObjectError( std::string( "Array index must be an integer" ) );
 		}
 
+		// Negative indices count from the end, anything else is out of bounds in every build, same as in the VM
+		const int64_t arr_size = (int64_t)value.arr->elements.size();
 		auto i = index.Int();
 		if( i < 0 )
 		{
 			i += arr_size;
 		}
-#ifdef _DEBUG
-		if( i >= (int64_t)arr_size )
+		if( i < 0 || i >= arr_size )
 		{
-			throw BatObjectError( std::string( "Array index " ) + std::to_string( i ) + " out of bounds" );
+			throw BatObjectError( std::string( "Array index " ) + std::to_string( index.Int() ) + " out of bounds for length " + std::to_string( arr_size ) );
 		}
-#endif
 
-		return value.arr[i];
+		return value.arr->elements[i];
 	}
 	void BatObject::Assign( const BatObject& other )
 	{
 		if( type == TYPE_UNDEFINED )
 		{
-			type = other.type;
+			*this = other;
+			return;
 		}
-		else if( type != other.type )
+		if( type != other.type )
 		{
 			throw BatObjectError( std::string( "Cannot assign object of type " ) + TypeToStr( other.type ) + " to object of type " + TypeToStr( type ) );
 		}
 
-		Copy( other );
+		// Can only assign array if it's a dynamic array (in which case it can be resized) or the sizes of the arrays match
+		if( type == TYPE_ARRAY && value.arr->fixed_size && value.arr->elements.size() != other.value.arr->elements.size() )
+		{
+			throw BatObjectError( "Cannot assign a dynamic array to a fixed-length array" );
+		}
+
+		*this = other;
 	}
 	std::string BatObject::ToString()
 	{
@@ -383,15 +362,15 @@ namespace Bat
 			case TYPE_FLOAT:
 				return std::to_string( value.f64 );
 			case TYPE_STR:
-				return value.str;
+				return std::string( value.str->chars, value.str->length );
 			case TYPE_CALLABLE:
 				return "function";
 			case TYPE_ARRAY:
 			{
 				std::string s = "[";
-				for( size_t i = 0; i < arr_size; i++ )
+				for( auto& element : value.arr->elements )
 				{
-					s += value.arr[i].ToString();
+					s += element.ToString();
 					s += ",";
 				}
 				s += "]";
@@ -400,89 +379,6 @@ namespace Bat
 				return "<error>";
 		}
 	}
-	void BatObject::Copy( const BatObject& other )
-	{
-		switch( type )
-		{
-			case TYPE_NULL:
-			{
-				break;
-			}
-			case TYPE_BOOL:
-			case TYPE_INT:
-			{
-				value.i64 = other.value.i64;
-				break;
-			}
-			case TYPE_FLOAT:
-			{
-				value.f64 = other.value.f64;
-				break;
-			}
-			case TYPE_STR:
-			{
-				delete[] value.str;
-
-				size_t len = strlen( other.value.str );
-				value.str = new char[len + 1];
-				memcpy( value.str, other.value.str, len + 1 );
-				break;
-			}
-			case TYPE_CALLABLE:
-			{
-				value.func = other.value.func;
-				break;
-			}
-			case TYPE_ARRAY:
-			{
-				// Can only assign array if it's a dynamic array (in which case it can be resized) or the sizes of the arrays match
-				if( fixed_arr == false || other.arr_size == arr_size )
-				{
-					value.arr = other.value.arr;
-					ref_count = other.ref_count + 1;
-				}
-				else
-				{
-					throw BatObjectError( "Cannot assign a dynamic array to a fixed-length array" );
-				}
-			}
-		}
-	}
-	void BatObject::Move( const BatObject& other )
-	{
-		switch( type )
-		{
-			case TYPE_NULL:
-			{
-				break;
-			}
-			case TYPE_BOOL:
-			case TYPE_INT:
-			{
-				value.i64 = other.value.i64;
-				break;
-			}
-			case TYPE_FLOAT:
-			{
-				value.f64 = other.value.f64;
-				break;
-			}
-			case TYPE_STR:
-			{
-				value.str = other.value.str;
-				break;
-			}
-			case TYPE_CALLABLE:
-			{
-				value.func = other.value.func;
-				break;
-			}
-			case TYPE_ARRAY:
-			{
-				value.arr = other.value.arr;
-			}
-		}
-	}
 	bool BatObject::IsTruthy() const
 	{
 		switch( type )
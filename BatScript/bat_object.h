@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <cassert>
+#include "bat_string.h"
 #include "type.h"
 
 namespace Bat
@@ -41,22 +42,57 @@ namespace Bat
 		TYPE_ARRAY,
 	};
 
+	struct BatArray;
+
+	// 16 bytes, the payload plus its type
+	// Ints use the full 64 bits, so NaN-boxing everything into 8 bytes isn't an option
+	// Copying anything other than a string or an array is a plain copy, those two only bump a reference count.
 	class BatObject
 	{
 	public:
-		BatObject();
-		~BatObject();
-		BatObject( const BatObject& other );
-		BatObject& operator=( const BatObject& rhs );
-		BatObject( BatObject&& donor ) noexcept;
-		BatObject& operator=( BatObject&& rhs ) noexcept;
+		BatObject() { value.i64 = 0; }
+		~BatObject() { if( IsHeap() ) Release(); }
+		BatObject( const BatObject& other )
+			:
+			type( other.type ),
+			value( other.value )
+		{
+			if( IsHeap() ) Retain();
+		}
+		BatObject& operator=( const BatObject& rhs )
+		{
+			if( rhs.IsHeap() ) rhs.Retain();
+			if( IsHeap() ) Release();
+			type = rhs.type;
+			value = rhs.value;
+			return *this;
+		}
+		BatObject( BatObject&& donor ) noexcept
+			:
+			type( donor.type ),
+			value( donor.value )
+		{
+			donor.type = TYPE_UNDEFINED;
+		}
+		BatObject& operator=( BatObject&& rhs ) noexcept
+		{
+			if( this != &rhs )
+			{
+				if( IsHeap() ) Release();
+				type = rhs.type;
+				value = rhs.value;
+				rhs.type = TYPE_UNDEFINED;
+			}
+			return *this;
+		}
 		BatObject( int64_t i );
 		BatObject( double f );
 		BatObject( const char* s );
+		// Takes a new reference to str
+		BatObject( BatString* str );
 		BatObject( bool s );
 		BatObject( BatCallable* func );
 		BatObject( const BatObject* arr, size_t arr_size, bool fixed_size );
-
 		BatObject Add( const BatObject& rhs );
 		BatObject Sub( const BatObject& rhs );
 		BatObject Div( const BatObject& rhs );
@@ -88,27 +124,36 @@ namespace Bat
 		bool Bool() const { assert( type == TYPE_BOOL ); return value.i64; }
 		int64_t Int() const { assert( type == TYPE_INT ); return value.i64; }
 		double Float() const { assert( type == TYPE_FLOAT ); return value.f64; }
-		const char* String() const { assert( type == TYPE_STR ); return value.str; }
+		const char* String() const { assert( type == TYPE_STR ); return value.str->chars; }
 		BatCallable* Function() const { assert( type == TYPE_CALLABLE ); return value.func; }
-		BatObject* Array() const { assert( type == TYPE_ARRAY ); return value.arr; }
+		BatObject* Array() const;
+		size_t ArraySize() const;
 	private:
-		void Copy( const BatObject& other );
-		void Move( const BatObject& other );
+		bool IsHeap() const { return type == TYPE_STR || type == TYPE_ARRAY; }
+		void Retain() const;
+		void Release();
 	public:
 		ObjectType type = TYPE_UNDEFINED;
 		union ObjectValues
 		{
-			ObjectValues() {}
-			~ObjectValues() {}
-
 			int64_t i64;
 			double f64;
-			char* str;
+			BatString* str;
 			BatCallable* func;
-			BatObject* arr;
+			BatArray* arr;
 		} value;
-		size_t arr_size = 0;
-		bool fixed_arr = false;
-		int ref_count = 0;
 	};
+
+	static_assert( sizeof( BatObject ) == 16, "BatObject should stay two words" );
+
+	// Heap payload of arrays, shared between copies and freed along with the last one
+	struct BatArray
+	{
+		int ref_count = 1;
+		bool fixed_size;
+		std::vector<BatObject> elements;
+	};
+
+	inline BatObject* BatObject::Array() const { assert( type == TYPE_ARRAY ); return value.arr->elements.data(); }
+	inline size_t BatObject::ArraySize() const { assert( type == TYPE_ARRAY ); return value.arr->elements.size(); }
 }
\ No newline at end of file
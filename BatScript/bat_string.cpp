@@ -0,0 +1,31 @@
+#include "bat_string.h"
+
+#include <cstring>
+#include <new>
+
+namespace Bat
+{
+	BatString* BatString::Create( const char* s, size_t length )
+	{
+		void* mem = ::operator new( offsetof( BatString, chars ) + length + 1 );
+		BatString* str = static_cast<BatString*>(mem);
+		str->ref_count = 1;
+		str->interned = false;
+		str->length = length;
+		memcpy( str->chars, s, length );
+		str->chars[length] = '\0';
+		return str;
+	}
+
+	void BatString::Destroy( BatString* str )
+	{
+		::operator delete( str );
+	}
+
+	bool BatString::Equal( const BatString* a, const BatString* b )
+	{
+		if( a == b ) return true;
+		if( a->interned && b->interned ) return false;
+		return a->length == b->length && memcmp( a->chars, b->chars, a->length ) == 0;
+	}
+}
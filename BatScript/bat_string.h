@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Bat
+{
+	// Immutable, reference counted string shared by every BatObject that holds it
+	// Interned strings (see stringpool.h) exist once per distinct value, so two of them are equal exactly when they're the same string.
+	// They also live as long as the process and skip reference counting, which lets threads share them without synchronizing.
+	struct BatString
+	{
+		int ref_count;
+		bool interned;
+		size_t length;
+		char chars[1]; // Allocated to fit length + 1
+
+		// Returns a new string with a reference count of 1
+		static BatString* Create( const char* s, size_t length );
+		static void Destroy( BatString* str );
+
+		void Retain() { if( !interned ) ref_count++; }
+		void Release() { if( !interned && --ref_count == 0 ) Destroy( this ); }
+
+		static bool Equal( const BatString* a, const BatString* b );
+	};
+}
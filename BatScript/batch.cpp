@@ -0,0 +1,132 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <sstream>
+#include <thread>
+
+namespace Bat
+{
+	// Input of the run on this thread, for the input() native
+	static thread_local const std::string* t_pInput = nullptr;
+
+	BatchRunner::BatchRunner( std::shared_ptr<const Program> program, const NativeTable& natives, const AwaitableTable& awaitables, size_t num_workers )
+	{
+		for( size_t i = 0; i < std::max<size_t>( num_workers, 1 ); i++ )
+		{
+			auto worker = std::make_unique<Worker>();
+			worker->instance = std::make_unique<Instance>( program );
+			worker->instance->Natives() = natives;
+			for( const auto& [name, callback] : awaitables )
+			{
+				worker->instance->BindAwaitable( name, callback );
+			}
+			worker->instance->Bind( "input", +[]() -> const char* { return t_pInput ? t_pInput->c_str() : ""; } );
+			m_Workers.push_back( std::move( worker ) );
+		}
+	}
+
+	BatchRunner::~BatchRunner() = default;
+
+	void BatchRunner::Run( const std::vector<std::string>& inputs, std::ostream& out )
+	{
+		const size_t num_inputs = inputs.size();
+		const size_t num_workers = m_Workers.size();
+		for( size_t i = 0; i < num_workers; i++ )
+		{
+			m_Workers[i]->begin = num_inputs * i / num_workers;
+			m_Workers[i]->end = num_inputs * (i + 1) / num_workers;
+		}
+
+		// Outputs of runs that are done but not written yet
+		std::vector<std::string> outputs( num_inputs );
+		std::vector<bool> done( num_inputs, false );
+		std::mutex done_mutex;
+		std::condition_variable done_cv;
+
+		std::vector<std::thread> threads;
+		for( size_t w = 0; w < num_workers; w++ )
+		{
+			threads.emplace_back( [&, w]() {
+				Instance& instance = *m_Workers[w]->instance;
+				size_t index;
+				while( Take( w, index ) )
+				{
+					std::ostringstream output;
+					instance.SetOutput( output );
+					t_pInput = &inputs[index];
+					instance.Run();
+					t_pInput = nullptr;
+
+					{
+						std::lock_guard<std::mutex> lock( done_mutex );
+						outputs[index] = output.str();
+						done[index] = true;
+					}
+					done_cv.notify_one();
+				}
+			} );
+		}
+
+		for( size_t next = 0; next < num_inputs; next++ )
+		{
+			std::string output;
+			{
+				std::unique_lock<std::mutex> lock( done_mutex );
+				done_cv.wait( lock, [&]() { return done[next]; } );
+				output = std::move( outputs[next] );
+			}
+			out << output;
+		}
+		out.flush();
+
+		for( auto& thread : threads )
+		{
+			thread.join();
+		}
+	}
+
+	bool BatchRunner::Take( size_t w, size_t& index )
+	{
+		Worker& worker = *m_Workers[w];
+		{
+			std::lock_guard<std::mutex> lock( worker.mutex );
+			if( worker.begin < worker.end )
+			{
+				index = worker.begin++;
+				return true;
+			}
+		}
+		return Steal( w, index );
+	}
+
+	bool BatchRunner::Steal( size_t w, size_t& index )
+	{
+		for( size_t i = 1; i < m_Workers.size(); i++ )
+		{
+			Worker& victim = *m_Workers[(w + i) % m_Workers.size()];
+			size_t begin, end;
+			{
+				std::lock_guard<std::mutex> lock( victim.mutex );
+				const size_t left = victim.end - victim.begin;
+				if( left == 0 )
+				{
+					continue;
+				}
+				end = victim.end;
+				begin = end - (left + 1) / 2;
+				victim.end = begin;
+			}
+
+			// Run the first stolen input right away, keep the rest
+			Worker& worker = *m_Workers[w];
+			std::lock_guard<std::mutex> lock( worker.mutex );
+			index = begin;
+			worker.begin = begin + 1;
+			worker.end = end;
+			return true;
+		}
+		// Ranges only move to workers that are busy with them, so the remaining inputs all have a worker
+		return false;
+	}
+}
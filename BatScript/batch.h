@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "embed.h"
+
+namespace Bat
+{
+	// Runs one Program once per input (--batch), on a pool of worker threads that each own an Instance
+	// The script gets the input of its run from the native `input() -> string`.
+	// Inputs are dealt out to the workers in contiguous ranges. A worker runs the inputs at the front of its own range,
+	// and once that is empty steals the back half of another worker's range, so a few slow inputs don't leave the
+	// other workers idle while neighbouring inputs still mostly run on the same worker.
+	// The output of every run is buffered and written in the order of the inputs, as soon as all runs before it are done.
+	class BatchRunner
+	{
+	public:
+		// natives and awaitables are copied into the instance of every worker, num_workers is at least 1
+		BatchRunner( std::shared_ptr<const Program> program, const NativeTable& natives, const AwaitableTable& awaitables, size_t num_workers );
+		~BatchRunner();
+
+		size_t NumWorkers() const { return m_Workers.size(); }
+		// Returns once every input has run and its output is written to out
+		void Run( const std::vector<std::string>& inputs, std::ostream& out );
+	private:
+		struct Worker
+		{
+			std::unique_ptr<Instance> instance;
+			// Inputs [begin, end) that are left for this worker, taken from the front by the worker and from the back by thieves
+			std::mutex mutex;
+			size_t begin = 0;
+			size_t end = 0;
+		};
+		// Next input for worker w, from its own range or stolen from another one, returns false if none are left
+		bool Take( size_t w, size_t& index );
+		bool Steal( size_t w, size_t& index );
+	private:
+		std::vector<std::unique_ptr<Worker>> m_Workers;
+	};
+}
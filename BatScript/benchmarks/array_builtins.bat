@@ -0,0 +1,24 @@
+// Sums, dots, scales and counts over an int array with the array builtins, same work as array_loop.bat
+// methods: vm jit interpreter
+native isum(xs : int[]) -> int
+native idot(xs : int[], ys : int[]) -> int
+native iscale(dst : int[], xs : int[], k : int)
+native icount_greater(xs : int[], x : int) -> int
+
+init : int[128]
+i := 0
+while i < 128:
+	init[i] = i % 17 - 8
+	i += 1
+values : int[] = init
+scaled : int[] = init
+
+total := 0
+round := 0
+while round < 20000:
+	total += isum(values)
+	total += idot(values, values)
+	iscale(scaled, values, 3)
+	total += icount_greater(scaled, 0)
+	round += 1
+print total
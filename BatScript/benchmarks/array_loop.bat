@@ -0,0 +1,23 @@
+// Sums, dots, scales and counts over an int array in script loops, same work as array_builtins.bat
+// methods: vm jit interpreter
+init : int[128]
+i := 0
+while i < 128:
+	init[i] = i % 17 - 8
+	i += 1
+values : int[] = init
+scaled : int[] = init
+
+total := 0
+round := 0
+while round < 20000:
+	j := 0
+	while j < 128:
+		x := values[j]
+		total += x + x * x
+		scaled[j] = x * 3
+		if scaled[j] > 0:
+			total += 1
+		j += 1
+	round += 1
+print total
@@ -0,0 +1,18 @@
+// Sums and updates of a fixed size array, time is dominated by indexed loads and stores
+// methods: vm jit interpreter
+values : int[128]
+i := 0
+while i < 128:
+	values[i] = i
+	i += 1
+
+sum := 0
+round := 0
+while round < 5000:
+	j := 0
+	while j < 128:
+		sum += values[j]
+		values[j] = values[j] + 1
+		j += 1
+	round += 1
+print sum
@@ -0,0 +1,11 @@
+// Many calls to a tiny function, time is dominated by call and return overhead
+// calls: 1000000
+def add(a : int, b : int) -> int:
+	return a + b
+
+i := 0
+sum := 0
+while i < 1000000:
+	sum = add(sum, i)
+	i += 1
+print sum
@@ -0,0 +1,10 @@
+// Loop whose body is mostly constant arithmetic, identities and a branch that never runs
+i := 0
+total := 0
+while i < 3000000:
+	total += i * (60 * 60 * 24) + i * 1 - 0 + (1 << 10) / 4
+	total = total * 8
+	if 2 > 3:
+		total += i
+	i += 1
+print total
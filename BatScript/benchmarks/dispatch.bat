@@ -0,0 +1,8 @@
+// Tight loop of cheap instructions, time is dominated by instruction dispatch
+// instructions: 110000013
+i := 0
+sum := 0
+while i < 10000000:
+	sum += i
+	i += 1
+print sum
@@ -0,0 +1,8 @@
+// Call heavy recursive benchmark
+// calls: 2692537
+def fib(n : int) -> int:
+	if n < 2:
+		return n
+	return fib(n - 2) + fib(n - 1)
+
+print fib(30)
@@ -0,0 +1,14 @@
+// Calls of a function with several arguments and locals, time is dominated by setting up and tearing down frames
+// calls: 1000000
+def mix(a : int, b : int, c : int) -> int:
+	t := a * b
+	u := t + c
+	return u - b
+
+i := 0
+sum := 0
+while i < 500000:
+	sum += mix(i, 3, 5)
+	sum += mix(i, 2, 1)
+	i += 1
+print sum
@@ -0,0 +1,11 @@
+// Loop that repeats a subexpression, recomputes a product of values it doesn't change and scales its counter,
+// which -O2 computes once, in front of the loop and by stepping a second counter
+def checksum(n : int, w : int, h : int) -> int:
+	total := 0
+	i := 0
+	while i < n:
+		total += (i * 24 + w * h) % 1000 + (i * 24 + w * h) / 7
+		i += 1
+	return total
+
+print checksum(3000000, 640, 480)
@@ -0,0 +1,10 @@
+// Many calls to a native, time is dominated by the native call path
+// calls: 1000000
+native time() -> int
+
+i := 0
+last := 0
+while i < 1000000:
+	last = time()
+	i += 1
+print last > 0
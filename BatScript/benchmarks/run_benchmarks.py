@@ -0,0 +1,93 @@
+import os
+import re
+import sys
+import time
+import subprocess
+import argparse
+
+def get_benchmarks():
+    root = os.path.dirname(os.path.abspath(__file__))
+    benchmarks = []
+    for filename in sorted(os.listdir(root)):
+        base, ext = os.path.splitext(filename)
+        if ext == '.bat':
+            benchmarks += [(base, os.path.join(root, filename))]
+    return benchmarks
+
+def get_count(path, what):
+    # Benchmarks can state how many VM instructions or script calls they execute with a comment like
+    # "// instructions: 1234", "// calls: 1234" or "// switches: 1234" (task switches), which lets us report the cost of each one
+    with open(path, 'r') as f:
+        for line in f:
+            m = re.match(r'\s*//\s*' + what + r':\s*(\d+)', line)
+            if m:
+                return int(m.group(1))
+    return None
+
+def get_methods(path):
+    # Benchmarks of features that only some methods support list them with a comment like "// methods: vm jit"
+    with open(path, 'r') as f:
+        for line in f:
+            m = re.match(r'\s*//\s*methods:(.*)', line)
+            if m:
+                return m.group(1).split()
+    return None
+
+def time_run(compiler_path, path, method, repeat):
+    best = None
+    for i in range(repeat):
+        argv = [compiler_path, path, '--method', method]
+        start = time.perf_counter()
+        p = subprocess.Popen(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+        stdout, stderr = p.communicate()
+        elapsed = time.perf_counter() - start
+        if p.returncode != 0:
+            print('Benchmark %s failed!' % path)
+            print(stderr)
+            return None
+        if best == None or elapsed < best:
+            best = elapsed
+    return best
+
+def describe(name, elapsed, instructions, calls, switches):
+    s = '%-20s %10.3f ms' % (name, elapsed * 1000.0)
+    if instructions != None:
+        s += '  %6.3f ns/instruction' % (elapsed * 1e9 / instructions)
+    if calls != None:
+        s += '  %8.1f ns/call  %6.2f M calls/s' % (elapsed * 1e9 / calls, calls / elapsed / 1e6)
+    if switches != None:
+        s += '  %8.1f ns/switch' % (elapsed * 1e9 / switches)
+    return s
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--method', type=str, default='vm')
+    parser.add_argument('--compiler', type=str, default='BatScript.exe')
+    parser.add_argument('--baseline', type=str, default=None, help='Executable to compare against')
+    parser.add_argument('--repeat', type=int, default=5, help='Number of runs, the best time is reported')
+    args = parser.parse_args()
+
+    for name, path in get_benchmarks():
+        methods = get_methods(path)
+        if methods != None and args.method not in methods:
+            continue
+
+        instructions = get_count(path, 'instructions') if args.method == 'vm' else None
+        calls = get_count(path, 'calls')
+        switches = get_count(path, 'switches')
+        elapsed = time_run(args.compiler, path, args.method, args.repeat)
+        if elapsed == None:
+            continue
+
+        if args.baseline == None:
+            print(describe(name, elapsed, instructions, calls, switches))
+            continue
+
+        baseline = time_run(args.baseline, path, args.method, args.repeat)
+        if baseline == None:
+            continue
+        print(describe(name + ' (baseline)', baseline, instructions, calls, switches))
+        print(describe(name, elapsed, instructions, calls, switches) + '  %.2fx' % (baseline / elapsed))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,56 @@
+import os
+import re
+import sys
+import subprocess
+import argparse
+
+# Runs one script on 1..N instances in parallel (--instances), each instance on its own thread executing the same
+# compiled code, and reports how throughput scales. Ideally runs/s grows linearly up to the number of cores.
+
+def run_instances(compiler_path, script, method, instances, repeat):
+    best = None
+    for i in range(repeat):
+        argv = [compiler_path, script, '--method', method, '--instances', str(instances)]
+        p = subprocess.Popen(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+        stdout, stderr = p.communicate()
+        m = re.search(r'instances: ([\d.]+) ms', stderr)
+        if p.returncode != 0 or not m:
+            print('Running %d instances failed!' % instances)
+            print(stderr)
+            return None
+        elapsed = float(m.group(1)) / 1000.0
+        if best == None or elapsed < best:
+            best = elapsed
+    return best
+
+def main():
+    root = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--method', type=str, default='vm')
+    parser.add_argument('--compiler', type=str, default='BatScript.exe')
+    parser.add_argument('--script', type=str, default=os.path.join(root, 'dispatch.bat'))
+    parser.add_argument('--max-instances', type=int, default=os.cpu_count(), help='Defaults to the number of cores')
+    parser.add_argument('--repeat', type=int, default=3, help='Number of runs, the best time is reported')
+    args = parser.parse_args()
+
+    counts = []
+    n = 1
+    while n < args.max_instances:
+        counts.append(n)
+        n *= 2
+    counts.append(args.max_instances)
+
+    base_throughput = None
+    print('%-10s %12s %12s %9s %11s' % ('instances', 'time', 'runs/s', 'speedup', 'efficiency'))
+    for instances in counts:
+        elapsed = run_instances(args.compiler, args.script, args.method, instances, args.repeat)
+        if elapsed == None:
+            sys.exit(1)
+        throughput = instances / elapsed
+        if base_throughput == None:
+            base_throughput = throughput
+        speedup = throughput / base_throughput
+        print('%-10d %9.3f ms %12.3f %8.2fx %10.0f%%' % (instances, elapsed * 1000.0, throughput, speedup, 100.0 * speedup / instances))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,13 @@
+// Tail recursive accumulation, shallow enough that it also runs without tail calls on the JIT's stack
+// calls: 2000000
+def sum(n : int, acc : int) -> int:
+	if n == 0:
+		return acc
+	return sum(n - 1, acc + n)
+
+i := 0
+total := 0
+while i < 20000:
+	total += sum(99, i)
+	i += 1
+print total
@@ -0,0 +1,21 @@
+// Many tasks that keep yielding to each other, time is dominated by task switches
+// methods: vm jit
+// switches: 1000000
+async native yield() -> int
+
+done := 0
+
+async def worker(n : int):
+	i := 0
+	while i < n:
+		await yield()
+		i += 1
+	done += 1
+
+i := 0
+while i < 1000:
+	worker(1000)
+	i += 1
+while done < 1000:
+	await yield()
+print done
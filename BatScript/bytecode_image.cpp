@@ -0,0 +1,297 @@
+#include "bytecode_image.h"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include "errorsys.h"
+#include "reg_instructions.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Bat
+{
+	static constexpr char IMAGE_MAGIC[4] = { 'B', 'A', 'T', 'C' };
+	static constexpr size_t CODE_ALIGNMENT = 16;
+
+	struct ImageSection
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint64_t count;
+	};
+
+	struct ImageHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t isa;
+		// Number of opcodes of the instruction set, catches images from builds that forgot to bump the version
+		uint32_t num_opcodes;
+		int64_t entry_point;
+		ImageSection code;
+		ImageSection strings;
+		ImageSection natives;
+		ImageSection lines;
+	};
+
+	static uint32_t NumOpcodes( InstructionSet isa )
+	{
+		return (isa == InstructionSet::REGISTER) ? (uint32_t)NUM_REG_OPCODES : (uint32_t)NUM_ENCODED_OPCODES;
+	}
+
+	// Bounds checked reads from a section of a mapped image
+	class ImageReader
+	{
+	public:
+		ImageReader( const char* data, size_t size )
+			:
+			m_pCurrent( data ),
+			m_pEnd( data + size )
+		{}
+
+		template <typename T>
+		T Read()
+		{
+			T val{};
+			if( !Check( sizeof( T ) ) ) return val;
+			memcpy( &val, m_pCurrent, sizeof( T ) );
+			m_pCurrent += sizeof( T );
+			return val;
+		}
+		std::string ReadString()
+		{
+			auto length = Read<uint32_t>();
+			if( !Check( length ) ) return "";
+			std::string str( m_pCurrent, length );
+			m_pCurrent += length;
+			return str;
+		}
+
+		bool Ok() const { return m_bOk; }
+	private:
+		bool Check( size_t size )
+		{
+			if( (size_t)(m_pEnd - m_pCurrent) < size ) m_bOk = false;
+			return m_bOk;
+		}
+	private:
+		const char* m_pCurrent;
+		const char* m_pEnd;
+		bool m_bOk = true;
+	};
+
+	BytecodeImage::~BytecodeImage()
+	{
+		Unmap();
+	}
+
+	bool BytecodeImage::Save( const BatCode& bc, const std::string& filename )
+	{
+		ImageHeader header = {};
+		memcpy( header.magic, IMAGE_MAGIC, sizeof( IMAGE_MAGIC ) );
+		header.version = VERSION;
+		header.isa = (uint32_t)bc.isa;
+		header.num_opcodes = NumOpcodes( bc.isa );
+		header.entry_point = bc.entry_point;
+
+		MemoryStream ms;
+		ms.Write( header );
+
+		auto align = [&ms]( size_t alignment ) {
+			while( ms.Size() % alignment != 0 ) ms.WriteByte( 0 );
+		};
+
+		align( CODE_ALIGNMENT );
+		header.code = { ms.Size(), bc.CodeSize(), 1 };
+		ms.WriteBytes( bc.CodeBase(), bc.CodeSize() );
+
+		header.strings = { ms.Size(), 0, bc.string_literals.size() };
+		for( const auto& str : bc.string_literals )
+		{
+			ms.WriteUInt32( (uint32_t)str.size() );
+			ms.WriteBytes( str.data(), str.size() );
+		}
+		header.strings.size = ms.Size() - header.strings.offset;
+
+		header.natives = { ms.Size(), 0, bc.natives.size() };
+		for( const auto& native : bc.natives )
+		{
+			ms.WriteUInt32( (uint32_t)native.name.size() );
+			ms.WriteBytes( native.name.data(), native.name.size() );
+			ms.WriteUInt32( (uint32_t)native.desc.param_types.size() );
+			for( ObjectType type : native.desc.param_types )
+			{
+				ms.WriteByte( (char)type );
+			}
+			ms.WriteByte( (char)native.desc.return_type );
+		}
+		header.natives.size = ms.Size() - header.natives.offset;
+
+		align( alignof( int32_t ) );
+		const auto& lines = bc.debug_info.line_mapping;
+		header.lines = { ms.Size(), lines.size() * sizeof( int32_t ), lines.size() };
+		for( int line : lines )
+		{
+			ms.WriteInt32( line );
+		}
+
+		// Now that the section offsets are known
+		ms.Seek( SeekPosition::START );
+		ms.Write( header );
+
+		std::ofstream file( filename, std::ios::binary );
+		if( !file )
+		{
+			ErrorSys::Report( 0, 0, "Could not open '" + filename + "' for writing" );
+			return false;
+		}
+		MemoryStream::ToStream( ms, file );
+
+		return true;
+	}
+
+	bool BytecodeImage::Load( const std::string& filename, BatCode& bc, bool report_errors )
+	{
+		// Private constructor, can't use make_shared
+		std::shared_ptr<BytecodeImage> image( new BytecodeImage() );
+		if( !image->Map( filename ) )
+		{
+			if( report_errors ) ErrorSys::Report( 0, 0, "Could not open image '" + filename + "'" );
+			return false;
+		}
+
+		auto invalid = [&filename, report_errors]( const std::string& reason ) {
+			if( report_errors ) ErrorSys::Report( 0, 0, "Invalid image '" + filename + "': " + reason );
+			return false;
+		};
+
+		ImageHeader header;
+		if( image->m_iSize < sizeof( header ) ) return invalid( "truncated header" );
+		memcpy( &header, image->m_pData, sizeof( header ) );
+
+		if( memcmp( header.magic, IMAGE_MAGIC, sizeof( IMAGE_MAGIC ) ) != 0 ) return invalid( "not a bytecode image" );
+		if( header.version != VERSION ) return invalid( "image version " + std::to_string( header.version ) + ", expected " + std::to_string( VERSION ) + ", recompile the script" );
+		if( header.isa != (uint32_t)InstructionSet::STACK && header.isa != (uint32_t)InstructionSet::REGISTER ) return invalid( "unknown instruction set" );
+		InstructionSet isa = (InstructionSet)header.isa;
+		if( header.num_opcodes != NumOpcodes( isa ) ) return invalid( "instruction set doesn't match this build, recompile the script" );
+
+		for( const ImageSection* section : { &header.code, &header.strings, &header.natives, &header.lines } )
+		{
+			if( section->offset > image->m_iSize || section->size > image->m_iSize - section->offset ) return invalid( "section out of bounds" );
+		}
+		if( header.entry_point < 0 || (uint64_t)header.entry_point >= header.code.size ) return invalid( "entry point out of bounds" );
+
+		image->m_pCode = image->m_pData + header.code.offset;
+		image->m_iCodeSize = header.code.size;
+
+		BatCode loaded;
+		loaded.isa = isa;
+		loaded.entry_point = header.entry_point;
+
+		ImageReader strings( image->m_pData + header.strings.offset, header.strings.size );
+		for( uint64_t i = 0; i < header.strings.count && strings.Ok(); i++ )
+		{
+			loaded.string_literals.push_back( strings.ReadString() );
+		}
+		if( !strings.Ok() ) return invalid( "corrupt string section" );
+
+		ImageReader natives( image->m_pData + header.natives.offset, header.natives.size );
+		for( uint64_t i = 0; i < header.natives.count && natives.Ok(); i++ )
+		{
+			BatNativeInfo info;
+			info.name = natives.ReadString();
+			auto num_params = natives.Read<uint32_t>();
+			for( uint32_t param = 0; param < num_params && natives.Ok(); param++ )
+			{
+				info.desc.param_types.push_back( (ObjectType)natives.Read<uint8_t>() );
+			}
+			info.desc.return_type = (ObjectType)natives.Read<uint8_t>();
+			loaded.natives.push_back( std::move( info ) );
+		}
+		if( !natives.Ok() ) return invalid( "corrupt native section" );
+
+		ImageReader lines( image->m_pData + header.lines.offset, header.lines.size );
+		loaded.debug_info.line_mapping.reserve( header.lines.count );
+		for( uint64_t i = 0; i < header.lines.count && lines.Ok(); i++ )
+		{
+			loaded.debug_info.line_mapping.push_back( lines.Read<int32_t>() );
+		}
+		if( !lines.Ok() ) return invalid( "corrupt line mapping" );
+
+		loaded.image = std::move( image );
+		bc = std::move( loaded );
+
+		return true;
+	}
+
+	bool BytecodeImage::IsImageFile( const std::string& filename )
+	{
+		static const std::string extension = ".batc";
+		return filename.size() >= extension.size() &&
+			filename.compare( filename.size() - extension.size(), extension.size(), extension ) == 0;
+	}
+
+#ifdef _WIN32
+	bool BytecodeImage::Map( const std::string& filename )
+	{
+		HANDLE file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if( file == INVALID_HANDLE_VALUE ) return false;
+		m_hFile = file;
+
+		LARGE_INTEGER size;
+		if( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 ) return false;
+		m_iSize = (size_t)size.QuadPart;
+
+		m_hMapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		if( !m_hMapping ) return false;
+
+		m_pData = static_cast<const char*>(MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 ));
+		return m_pData != nullptr;
+	}
+	void BytecodeImage::Unmap()
+	{
+		if( m_pData ) UnmapViewOfFile( m_pData );
+		if( m_hMapping ) CloseHandle( m_hMapping );
+		if( m_hFile ) CloseHandle( m_hFile );
+		m_pData = nullptr;
+		m_hMapping = nullptr;
+		m_hFile = nullptr;
+	}
+#else
+	bool BytecodeImage::Map( const std::string& filename )
+	{
+		int fd = open( filename.c_str(), O_RDONLY );
+		if( fd < 0 ) return false;
+
+		struct stat st;
+		if( fstat( fd, &st ) != 0 || st.st_size == 0 )
+		{
+			close( fd );
+			return false;
+		}
+		m_iSize = (size_t)st.st_size;
+
+		// The mapping stays valid after the descriptor is closed
+		void* data = mmap( nullptr, m_iSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+		close( fd );
+		if( data == MAP_FAILED ) return false;
+
+		m_pData = static_cast<const char*>(data);
+		return true;
+	}
+	void BytecodeImage::Unmap()
+	{
+		if( m_pData ) munmap( const_cast<char*>(m_pData), m_iSize );
+		m_pData = nullptr;
+	}
+#endif
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "compiler.h"
+
+namespace Bat
+{
+	// Compiled BatCode as stored on disk (.batc files)
+	// The image starts with a header holding the version and the offset/size of each section:
+	//  code            raw instructions, aligned so they can be executed straight from the mapped file
+	//  string literals u32 length + bytes each
+	//  natives         u32 name length + name, u32 param count + one byte ObjectType per param, one byte return ObjectType each
+	//  line mapping    i32 per entry
+	// Values are stored in native byte order, images aren't meant to be moved between architectures.
+	class BytecodeImage
+	{
+	public:
+		// Bump whenever the layout of the image or the encoding of any instruction changes
+		static constexpr uint32_t VERSION = 7;
+
+		BytecodeImage( const BytecodeImage& ) = delete;
+		BytecodeImage& operator=( const BytecodeImage& ) = delete;
+		~BytecodeImage();
+
+		static bool Save( const BatCode& bc, const std::string& filename );
+		// Maps the image and fills in bc, its code keeps pointing into the mapping (see BatCode::image)
+		// Returns false if the file isn't a valid image for this build, and reports why unless told not to
+		static bool Load( const std::string& filename, BatCode& bc, bool report_errors = true );
+		static bool IsImageFile( const std::string& filename );
+
+		const char* Code() const { return m_pCode; }
+		size_t CodeSize() const { return m_iCodeSize; }
+	private:
+		BytecodeImage() = default;
+
+		bool Map( const std::string& filename );
+		void Unmap();
+	private:
+		const char* m_pData = nullptr;
+		size_t m_iSize = 0;
+		const char* m_pCode = nullptr;
+		size_t m_iCodeSize = 0;
+#ifdef _WIN32
+		void* m_hFile = nullptr;
+		void* m_hMapping = nullptr;
+#endif
+	};
+}
@@ -0,0 +1,76 @@
+#include "compile_cache.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "bytecode_image.h"
+#include "memory_stream.h"
+
+namespace Bat
+{
+	CompileCache::CompileCache( std::string directory )
+		:
+		m_Directory( std::move( directory ) )
+	{}
+
+	bool CompileCache::Load( const std::string& source, const std::string& options, BatCode& bc ) const
+	{
+		const std::string path = EntryPath( source, options );
+
+		std::ifstream deps( path + ".deps" );
+		if( !deps ) return false;
+
+		std::string line;
+		while( std::getline( deps, line ) )
+		{
+			std::istringstream entry( line );
+			uint64_t hash;
+			std::string filename;
+			entry >> std::hex >> hash;
+			entry.ignore( 1 );
+			std::getline( entry, filename );
+
+			if( !std::ifstream( filename ) ) return false;
+			auto module = MemoryStream::FromFile( filename, FileMode::TEXT );
+			std::string text = (module.Size() > 0) ? module.Base() : "";
+			if( ModuleLoader::Hash( text.data(), text.size() ) != hash ) return false;
+		}
+
+		return BytecodeImage::Load( path + ".batc", bc, false );
+	}
+
+	void CompileCache::Store( const std::string& source, const std::string& options, const BatCode& bc, const std::vector<ModuleDependency>& dependencies ) const
+	{
+		std::error_code ec;
+		std::filesystem::create_directories( m_Directory, ec );
+		if( ec ) return;
+
+		const std::string path = EntryPath( source, options );
+
+		// Written under a temporary name first so that an interrupted run can't leave a half written entry behind
+		{
+			std::ofstream deps( path + ".deps.tmp" );
+			for( const auto& dep : dependencies )
+			{
+				deps << std::hex << dep.hash << ' ' << dep.filename << '\n';
+			}
+		}
+		if( !BytecodeImage::Save( bc, path + ".batc.tmp" ) ) return;
+
+		std::filesystem::rename( path + ".batc.tmp", path + ".batc", ec );
+		if( !ec ) std::filesystem::rename( path + ".deps.tmp", path + ".deps", ec );
+	}
+
+	std::string CompileCache::EntryPath( const std::string& source, const std::string& options ) const
+	{
+		const uint32_t version = BytecodeImage::VERSION;
+		uint64_t key = ModuleLoader::Hash( source.data(), source.size() );
+		key = ModuleLoader::Hash( options.data(), options.size(), key );
+		key = ModuleLoader::Hash( reinterpret_cast<const char*>(&version), sizeof( version ), key );
+
+		char name[17];
+		snprintf( name, sizeof( name ), "%016llx", (unsigned long long)key );
+		return (std::filesystem::path( m_Directory ) / name).string();
+	}
+}
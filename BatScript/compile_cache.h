@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "compiler.h"
+#include "module_loader.h"
+
+namespace Bat
+{
+	// Keeps compiled programs on disk, so running an unchanged script again only has to map its image
+	// Entries are named after a hash of the script's source, the compile options and the image version.
+	// Each entry is a .batc image plus a .deps file listing the imported modules with a hash of their contents,
+	// an entry is only used while every one of those modules still matches.
+	class CompileCache
+	{
+	public:
+		CompileCache( std::string directory );
+
+		bool Load( const std::string& source, const std::string& options, BatCode& bc ) const;
+		void Store( const std::string& source, const std::string& options, const BatCode& bc, const std::vector<ModuleDependency>& dependencies ) const;
+	private:
+		// Path of the entry without extension
+		std::string EntryPath( const std::string& source, const std::string& options ) const;
+	private:
+		std::string m_Directory;
+	};
+}
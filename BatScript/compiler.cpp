@@ -1,20 +1,36 @@
 #include "compiler.h"
 
 #include <algorithm>
+#include <cstring>
 #include <fstream>
+#include "bytecode_image.h"
 #include "errorsys.h"
+#include "ir_builder.h"
+#include "ir_optimizer.h"
+#include "ir_schedule.h"
 #include "lexer.h"
 #include "parser.h"
 #include "type_manager.h"
 
 namespace Bat
 {
-	static ObjectType TypeToObjectType( Type* t )
+	const char* BatCode::CodeBase() const
+	{
+		return image ? image->Code() : code.Base();
+	}
+	size_t BatCode::CodeSize() const
+	{
+		return image ? image->CodeSize() : code.Size();
+	}
+
+	ObjectType TypeToObjectType( Type* t )
 	{
 		if( PrimitiveType* p = t->ToPrimitive() )
 		{
 			switch( p->PrimKind() )
 			{
+			case PrimitiveKind::Void:
+				return TYPE_NULL;
 			case PrimitiveKind::Bool:
 				return TYPE_BOOL;
 			case PrimitiveKind::Int:
@@ -71,6 +87,15 @@ namespace Bat
 			}
 		}
 
+		// Natives before functions, so function bodies can call them
+		for( const auto& stmt : statements )
+		{
+			if( NativeStmt* native = stmt->ToNativeStmt() )
+			{
+				Compile( native );
+			}
+		}
+
 		int globals_stack = m_iStackSize;
 
 		// Functions third
@@ -84,23 +109,46 @@ namespace Bat
 
 		m_iEntryPoint = IP();
 
-		Emit( OpCode::PROC );
-		if( globals_stack > 0 )
-		{
-			Emit( OpCode::STACK, globals_stack );
-		}
+		// Locals of blocks in the mainline go above the globals
+		m_iStackSize = globals_stack;
+		CodeLoc_t stack_size = EmitToPatch( OpCode::PROC );
+		m_FunctionNames.push_back( "main" );
 
 		// Everything else gets put into a pseudo-function as the mainline
+		std::vector<Statement*> mainline;
 		for( const auto& stmt : statements )
 		{
-			if( !stmt->IsImportStmt() && !stmt->IsFuncDecl() )
+			if( !stmt->IsImportStmt() && !stmt->IsFuncDecl() && !stmt->IsNativeStmt() )
+			{
+				mainline.push_back( stmt.get() );
+			}
+		}
+
+		// The IR ends the mainline itself
+		IrBuilder builder( m_pSymTab, m_InlinedFunctions, m_GlobalAccess );
+		std::unique_ptr<IrFunction> ir = m_bOptimizeIr ? builder.BuildMainline( mainline ) : nullptr;
+		if( ir )
+		{
+			CompileIr( *ir, 0 );
+			Patch( stack_size, m_iStackSize );
+		}
+		else
+		{
+			for( Statement* stmt : mainline )
 			{
-				Compile( stmt.get() );
+				Compile( stmt );
 			}
+
+			Patch( stack_size, m_iStackSize );
+			Emit( OpCode::STACK, -m_iStackSize );
+			Emit( OpCode::HALT );
 		}
 
-		Emit( OpCode::STACK, -globals_stack );
-		Emit( OpCode::HALT );
+		// Symbols keep pointing into the AST (e.g. native signatures used by Code()), so it has to outlive compilation
+		for( auto& stmt : statements )
+		{
+			m_pStatements.push_back( std::move( stmt ) );
+		}
 	}
 	void Compiler::Compile( std::unique_ptr<Statement> s )
 	{
@@ -138,23 +186,47 @@ namespace Bat
 	}
 	CodeLoc_t Compiler::Emit( OpCode op )
 	{
+		assert( OPCODE_OPERANDS[(size_t)op] == 0 );
+
 		m_LineMapping.push_back( m_iCurrentLine );
 
 		auto loc = IP();
-		code.Write( op );
+		code.Write( EncodeOp( op ) );
 		return loc;
 	}
 	CodeLoc_t Compiler::Emit( OpCode op, int64_t param1 )
 	{
-		auto loc = Emit( op );
-		EmitI64( param1 );
+		return Emit( op, param1, OperandWidthFor( param1 ) );
+	}
+	CodeLoc_t Compiler::Emit( OpCode op, int64_t param1, size_t width )
+	{
+		assert( OPCODE_OPERANDS[(size_t)op] == 1 );
+		assert( width >= OperandWidthFor( param1 ) );
+
+		m_LineMapping.push_back( m_iCurrentLine );
+
+		auto loc = IP();
+		code.Write( EncodeOp( op, width ) );
+		EmitOperand( param1, width );
 		return loc;
 	}
 	CodeLoc_t Compiler::EmitF( OpCode op, double param1 )
 	{
-		auto loc = Emit( op );
-		EmitDouble( param1 );
-		return loc;
+		int64_t bits;
+		static_assert( sizeof( bits ) == sizeof( param1 ) );
+		std::memcpy( &bits, &param1, sizeof( bits ) );
+
+		return Emit( op, bits );
+	}
+	CodeLoc_t Compiler::EmitOperand( int64_t operand, size_t width )
+	{
+		switch( width )
+		{
+		case 1:  return EmitByte( (char)operand );
+		case 2:  return EmitI16( (int16_t)operand );
+		case 4:  return EmitI32( (int32_t)operand );
+		default: return EmitI64( operand );
+		}
 	}
 	CodeLoc_t Compiler::EmitByte( char byte )
 	{
@@ -212,13 +284,18 @@ namespace Bat
 	}
 	CodeLoc_t Compiler::EmitToPatch( OpCode op )
 	{
-		return Emit( op, 0 );
+		// Value isn't known yet, so leave room for any code address or stack size
+		return Emit( op, 0, sizeof( int32_t ) );
 	}
 	void Compiler::Patch( CodeLoc_t addr, int64_t value )
 	{
+		DecodedOp decoded = DecodeOp( (unsigned char)code.Base()[addr] );
+		assert( OPCODE_OPERANDS[(size_t)decoded.op] == 1 );
+		assert( decoded.width >= OperandWidthFor( value ) );
+
 		auto old = code.Tell();
 		code.Seek( (size_t)addr + sizeof( OpCode ), SeekPosition::START );
-		code.Write( value );
+		EmitOperand( value, decoded.width );
 		code.Seek( old, SeekPosition::START );
 	}
 	void Compiler::PatchJump( CodeLoc_t addr )
@@ -229,42 +306,46 @@ namespace Bat
 	{
 		Emit( OpCode::RET, m_iArgsSize );
 	}
-	void Compiler::EmitLoad( Symbol* sym )
+	Compiler::AddressSpace Compiler::SpaceOf( Symbol* sym ) const
 	{
-		if( VariableSymbol* var = sym->AsVariable() )
-		{
-			bool global = (var->Storage() == StorageClass::GLOBAL);
-			if( global )
-			{
-				Emit( OpCode::LOAD_GLOBAL );
-			}
-			else
-			{
-				Emit( OpCode::LOAD_LOCAL );
-			}
-		}
-		else
+		VariableSymbol* var = sym->AsVariable();
+		assert( var );
+		return (var->Storage() == StorageClass::GLOBAL) ? AddressSpace::GLOBAL : AddressSpace::FRAME;
+	}
+	Compiler::AddressSpace Compiler::SpaceOf( Expression* lvalue ) const
+	{
+		// Elements of fixed size arrays are wherever their array is
+		if( IndexExpr* index = lvalue->ToIndexExpr() )
 		{
-			assert( false );
+			return index->Array()->Type()->AsArray()->HasFixedSize() ? SpaceOf( index->Array() ) : AddressSpace::HEAP;
 		}
+
+		return SpaceOf( GetSymbol( lvalue ) );
+	}
+	void Compiler::EmitLoad( Symbol* sym )
+	{
+		EmitLoad( SpaceOf( sym ) );
 	}
 	void Compiler::EmitStore( Symbol* sym )
 	{
-		if( VariableSymbol * var = sym->AsVariable() )
+		EmitStore( SpaceOf( sym ) );
+	}
+	void Compiler::EmitLoad( AddressSpace space )
+	{
+		switch( space )
 		{
-			bool global = (var->Storage() == StorageClass::GLOBAL);
-			if( global )
-			{
-				Emit( OpCode::STORE_GLOBAL );
-			}
-			else
-			{
-				Emit( OpCode::STORE_LOCAL );
-			}
+		case AddressSpace::GLOBAL: Emit( OpCode::LOAD_GLOBAL ); break;
+		case AddressSpace::FRAME:  Emit( OpCode::LOAD_LOCAL ); break;
+		case AddressSpace::HEAP:   Emit( OpCode::HEAP_LOAD ); break;
 		}
-		else
+	}
+	void Compiler::EmitStore( AddressSpace space )
+	{
+		switch( space )
 		{
-			assert( false );
+		case AddressSpace::GLOBAL: Emit( OpCode::STORE_GLOBAL ); break;
+		case AddressSpace::FRAME:  Emit( OpCode::STORE_LOCAL ); break;
+		case AddressSpace::HEAP:   Emit( OpCode::HEAP_STORE ); break;
 		}
 	}
 	BatCode Compiler::Code() const
@@ -275,6 +356,7 @@ namespace Bat
 		bc.entry_point = m_iEntryPoint;
 		bc.string_literals = m_StringLiterals;
 		bc.debug_info.line_mapping = m_LineMapping;
+		bc.debug_info.function_names = m_FunctionNames;
 
 		for( size_t i = 0; i < m_Natives.size(); i++ )
 		{
@@ -283,13 +365,15 @@ namespace Bat
 
 			FunctionSymbol* ntv = GetSymbol( info.name )->AsFunction();
 			FunctionSignature& sig = ntv->Signature();
-			for( size_t param_idx = 0; param_idx < sig.NumParams(); i++ )
+			for( size_t param_idx = 0; param_idx < sig.NumParams(); param_idx++ )
 			{
 				Type* t = TypeSpecifierToType( sig.ParamType( param_idx ) );
 				ObjectType obj_type = TypeToObjectType( t );
 
 				info.desc.param_types.push_back( obj_type );
 			}
+			// Natives declared without a return type don't have one
+			info.desc.return_type = sig.ReturnType() ? TypeToObjectType( sig.ReturnType() ) : TYPE_NULL;
 
 			bc.natives.push_back( info );
 		}
@@ -326,14 +410,21 @@ namespace Bat
 	}
 	void Compiler::CompileAssign( AssignStmt* node )
 	{
-		Symbol* sym = GetSymbol( node->Left() );
+		Type* left_type = node->Left()->Type();
+		if( left_type->IsArray() && left_type->AsArray()->HasFixedSize() )
+		{
+			CompileArrayAssign( GetSymbol( node->Left() )->AsVariable(), node->Right() );
+			return;
+		}
+
+		const AddressSpace space = SpaceOf( node->Left() );
 
 		/* Straight assignment is a simple store operation */
 		if( node->Op() == TOKEN_EQUAL )
 		{
 			CompileLValue( node->Left() );
-			CompileRValue( node->Right() );
-			EmitStore( sym );
+			CompileRValue( node->Right(), left_type );
+			EmitStore( space );
 			return;
 		}
 
@@ -351,7 +442,7 @@ namespace Bat
 		PrimitiveKind kind = node->Left()->Type()->ToPrimitive()->PrimKind();
 
 		Emit( OpCode::DUPX1 );
-		EmitLoad( sym );
+		EmitLoad( space );
 
 		switch( node->Op() )
 		{
@@ -366,7 +457,84 @@ namespace Bat
 		default:                   assert( false && "Unhandled assign op" );
 		}
 
-		EmitStore( sym );
+		EmitStore( space );
+	}
+	void Compiler::CompileRValue( Expression* e, Type* to )
+	{
+		CompileRValue( e );
+
+		// The rvalue of a fixed size array is its address
+		ArrayType* from = e->Type()->ToArray();
+		if( from && from->HasFixedSize() && to && to->IsArray() && !to->AsArray()->HasFixedSize() )
+		{
+			Emit( OpCode::ARRAY_FROM, (int64_t)from->FixedSize() );
+		}
+	}
+	void Compiler::CompileArrayAssign( VariableSymbol* var, Expression* value )
+	{
+		const int64_t length = (int64_t)var->VarType()->AsArray()->FixedSize();
+		const AddressSpace space = SpaceOf( var );
+
+		if( ArrayLiteral* literal = value ? value->ToArrayLiteral() : nullptr )
+		{
+			// The semantic analysis made sure that the literal has as many values as the array
+			for( size_t i = 0; i < literal->NumValues(); i++ )
+			{
+				Emit( OpCode::PUSH, var->Address() + (int64_t)(i * sizeof( int64_t )) );
+				CompileRValue( literal->ValueAt( i ) );
+				EmitStore( space );
+			}
+			return;
+		}
+
+		//  push <array address>
+		//  local.addr           ; locals only
+		//  ; other array address
+		//  copy <length>        ; zero <length> without a value
+		Emit( OpCode::PUSH, var->Address() );
+		if( space == AddressSpace::FRAME )
+		{
+			Emit( OpCode::LOCAL_ADDR );
+		}
+		if( value )
+		{
+			CompileRValue( value );
+			Emit( OpCode::COPY, length );
+		}
+		else
+		{
+			Emit( OpCode::ZERO, length );
+		}
+	}
+	bool Compiler::CheckArrayType( AstNode* node, Type* type, bool in_signature )
+	{
+		ArrayType* array = type ? type->ToArray() : nullptr;
+		if( !array )
+		{
+			return true;
+		}
+
+		// Elements and parameters are single slots, arrays of those can be held by handle
+		if( in_signature && array->HasFixedSize() )
+		{
+			ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Fixed size arrays can't be passed to or returned from functions, use '" + array->Inner()->ToString() + "[]' instead" );
+			return false;
+		}
+		// Frames and globals share the VM stack, which is small
+		if( array->HasFixedSize() && array->FixedSize() > MAX_FIXED_ARRAY_SIZE )
+		{
+			ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Fixed size arrays can have at most " + std::to_string( MAX_FIXED_ARRAY_SIZE ) + " elements" );
+			return false;
+		}
+		for( Type* inner = array->Inner(); inner->IsArray(); inner = inner->AsArray()->Inner() )
+		{
+			if( inner->AsArray()->HasFixedSize() )
+			{
+				ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Arrays of fixed size arrays are only supported by the interpreter" );
+				return false;
+			}
+		}
+		return true;
 	}
 	VariableSymbol* Compiler::AddVariable( AstNode* node, const std::string& name, StorageClass storage, Type* type )
 	{
@@ -461,7 +629,7 @@ namespace Bat
 	{
 		UpdateCurrLine( node );
 
-		int64_t index = AddStringLiteral( node->value );
+		int64_t index = AddStringLiteral( node->value->chars );
 		Emit( OpCode::PUSH, index );
 	}
 	void Compiler::VisitTokenLiteral( TokenLiteral* node )
@@ -489,7 +657,18 @@ namespace Bat
 	{
 		UpdateCurrLine( node );
 
-		assert( false );
+		if( !CheckArrayType( node, node->Type(), false ) )
+		{
+			return;
+		}
+
+		//  ; values
+		//  array.new <number of values>
+		for( size_t i = 0; i < node->NumValues(); i++ )
+		{
+			CompileRValue( node->ValueAt( i ) );
+		}
+		Emit( OpCode::ARRAY_NEW, (int64_t)node->NumValues() );
 	}
 	void Compiler::VisitBinaryExpr( BinaryExpr* node )
 	{
@@ -564,33 +743,120 @@ namespace Bat
 		Symbol* symbol = m_pSymTab->GetSymbol( callee->Identifier().lexeme );
 
 		FunctionSymbol* func_symbol = symbol->ToFunction();
+		if( func_symbol == m_pFunction )
+		{
+			m_bRecursive = true;
+		}
+		if( CompileInline( node, func_symbol ) )
+		{
+			return;
+		}
 
 		auto& sig = func_symbol->Signature();
 		
+		CompileArgs( node, func_symbol );
+
+		if( func_symbol->FuncKind() == FunctionKind::Native )
+		{
+			CompileLValue( node->Function() );
+			Emit( sig.Async() ? OpCode::AWAIT : OpCode::NATIVE );
+			return;
+		}
+
+		if( sig.Async() && !node->IsAwait() )
+		{
+			// The arguments move to a new task that calls the function, this one skips that:
+			//  push <number of arguments>
+			//  spawn skip
+			//  call <function>
+			//  task.end
+			// skip:
+			//  push 0
+			Emit( OpCode::PUSH, (int64_t)sig.NumParams() );
+			CodeLoc_t skip_patch = EmitToPatch( OpCode::SPAWN );
+			Emit( OpCode::CALL, func_symbol->Address() );
+			Emit( OpCode::TASK_END );
+			PatchJump( skip_patch );
+			// Like a void call, the spawn still pushes a value
+			Emit( OpCode::PUSH, 0 );
+			return;
+		}
+
+		// Awaiting an async function just calls it, the task is suspended if the function awaits something
+		Emit( OpCode::CALL, func_symbol->Address() );
+	}
+	void Compiler::CompileArgs( CallExpr* node, FunctionSymbol* func )
+	{
+		auto& sig = func->Signature();
 		for( size_t i = 0; i < node->NumArgs(); i++ )
 		{
-			CompileRValue( node->Arg( i ) );
+			// Arguments for the variadic part of natives have no declared type
+			CompileRValue( node->Arg( i ), (i < sig.NumParams()) ? TypeSpecifierToType( sig.ParamType( i ) ) : nullptr );
 		}
 
-		CompileLValue( node->Function() );
-		if( func_symbol->FuncKind() == FunctionKind::Script )
+		// Script functions always get all of their arguments, the caller fills in the ones the call leaves out
+		if( func->FuncKind() == FunctionKind::Script && node->NumArgs() < sig.NumParams() )
+		{
+			CompileDefaults( sig, node->NumArgs() );
+			UpdateCurrLine( node );
+		}
+	}
+	void Compiler::CompileDefaults( FunctionSignature& sig, size_t first )
+	{
+		// Defaults only see the globals (see SemanticAnalysis::VisitFuncDecl), not the locals of the caller
+		SymbolTable* scope = m_pSymTab;
+		while( m_pSymTab->Enclosing() )
 		{
-			Emit( OpCode::CALL );
+			m_pSymTab = m_pSymTab->Enclosing();
 		}
-		else if( func_symbol->FuncKind() == FunctionKind::Native )
+
+		for( size_t i = first; i < sig.NumParams(); i++ )
 		{
-			Emit( OpCode::NATIVE );
+			assert( sig.ParamDefault( i ) );
+			CompileRValue( sig.ParamDefault( i ), TypeSpecifierToType( sig.ParamType( i ) ) );
 		}
+
+		m_pSymTab = scope;
 	}
 	void Compiler::VisitIndexExpr( IndexExpr* node )
 	{
 		UpdateCurrLine( node );
 
-		CompileLValue( node->Array() );
-		CompileRValue( node->Index() );
-		Emit( OpCode::ADD );
+		const bool rvalue = (m_CompileType == ExprType::RVALUE);
+		ArrayType* type = node->Array()->Type()->AsArray();
 
-		assert( false );
+		if( type->HasFixedSize() )
+		{
+			//  push <array address>
+			//  ; index
+			//  elem <length>
+			//  ; load for rvalues
+			// The semantic analysis checked constant indices already, those address their element directly
+			IntLiteral* constant = node->Index()->ToIntLiteral();
+			if( constant && node->Array()->IsVarExpr() )
+			{
+				Emit( OpCode::PUSH, GetSymbol( node->Array() )->Address() + constant->value * (int64_t)sizeof( int64_t ) );
+			}
+			else
+			{
+				CompileLValue( node->Array() );
+				CompileRValue( node->Index() );
+				Emit( OpCode::ELEM, (int64_t)type->FixedSize() );
+			}
+
+			if( rvalue )
+			{
+				EmitLoad( SpaceOf( node->Array() ) );
+			}
+			return;
+		}
+
+		//  ; array handle
+		//  ; index
+		//  array.load  ; array.elem for lvalues, which leaves the heap address of the element
+		CompileRValue( node->Array() );
+		CompileRValue( node->Index() );
+		Emit( rvalue ? OpCode::ARRAY_LOAD : OpCode::ARRAY_ELEM );
 	}
 	void Compiler::VisitCastExpr( CastExpr* node )
 	{
@@ -651,6 +917,16 @@ namespace Bat
 		Emit( OpCode::PUSH, sym->Address() );
 		if( m_CompileType == ExprType::RVALUE )
 		{
+			// Fixed size arrays don't fit in a slot, their rvalue is their absolute address for copying them around
+			ArrayType* array = node->Type()->ToArray();
+			if( array && array->HasFixedSize() )
+			{
+				if( SpaceOf( sym ) == AddressSpace::FRAME )
+				{
+					Emit( OpCode::LOCAL_ADDR );
+				}
+				return;
+			}
 			EmitLoad( sym );
 		}
 	}
@@ -768,50 +1044,148 @@ namespace Bat
 
 		assert( false );
 	}
-	void Compiler::VisitReturnStmt( ReturnStmt* node )
+	bool Compiler::CompileTailCall( ReturnStmt* node )
 	{
-		UpdateCurrLine( node );
+		// `return f(...)` reuses the frame if f takes as many arguments as this function does, which recursion always
+		// does. The arguments are all evaluated before they replace this function's, since they may depend on them:
+		//  ; arguments
+		//  local.store.imm <last argument>
+		//  ...
+		//  local.store.imm <first argument>
+		//  tailcall <function>
+		// Recursion jumps to the body instead, past the proc, since the frame's locals are reserved already.
+		// Calls that return something that still has to be converted, or that spawn a task, aren't in tail position.
+		// Calls of inlined functions are left to VisitCallExpr, which is cheaper still.
+		CallExpr* call = node->RetExpr() ? node->RetExpr()->ToCallExpr() : nullptr;
+		if( !call )
+		{
+			return false;
+		}
 
-		if( node->RetExpr() )
+		FunctionSymbol* func = GetSymbol( call->Function() )->ToFunction();
+		auto& sig = func->Signature();
+		const int64_t arg_size = (int64_t)sizeof( int64_t );
+		ArrayType* array = call->Type()->ToArray();
+		if( func->FuncKind() != FunctionKind::Script || (sig.Async() && !call->IsAwait()) || (array && array->HasFixedSize()) ||
+			(int64_t)sig.NumParams() * arg_size != m_iArgsSize || m_InlinedFunctions.count( func ) )
+		{
+			return false;
+		}
+
+		UpdateCurrLine( call );
+		CompileArgs( call, func );
+		const int64_t first_arg_addr = -FRAME_LINK_SIZE - m_iArgsSize;
+		for( size_t i = sig.NumParams(); i-- > 0; )
+		{
+			Emit( OpCode::STOREL_IMM, first_arg_addr + (int64_t)i * arg_size );
+		}
+		if( func == m_pFunction )
 		{
-			CompileRValue( node->RetExpr() );
+			m_bRecursive = true;
+			Emit( OpCode::JMP, m_iBodyAddr );
 		}
 		else
 		{
-			// Even void functions have to return a value for overall consistent pushes/pops
-			Emit( OpCode::PUSH, 0 );
+			Emit( OpCode::TAILCALL, func->Address() );
 		}
-		EmitReturn();
+		return true;
 	}
-	void Compiler::VisitImportStmt( ImportStmt* node )
+	bool Compiler::CompileInline( CallExpr* node, FunctionSymbol* func )
 	{
-		UpdateCurrLine( node );
+		// The arguments are stored to fresh locals of this frame that stand in for the parameters, then the body is
+		// compiled like it was written here, except that the return leaves its value on the stack:
+		//  ; arguments
+		//  local.store.imm <last parameter>
+		//  ...
+		//  local.store.imm <first parameter>
+		//  ; body up to the return
+		//  ; returned value, 0 for void functions
+		// The instructions of the body keep the lines of the function for runtime errors and the disassembler.
+		if( m_InlinedFunctions.count( func ) == 0 )
+		{
+			return false;
+		}
+
+		FuncDecl* decl = func->Node()->AsFuncDecl();
+		auto& sig = decl->Signature();
+		CompileArgs( node, func );
 
-		std::string filename = node->ModuleName() + ".bat";
-		if( !std::ifstream( filename ) )
+		// Like defaults, the body only sees the globals and not the locals of the caller
+		SymbolTable* scope = m_pSymTab;
+		while( m_pSymTab->Enclosing() )
 		{
-			filename = node->ModuleName() + ".bs";
-			if( !std::ifstream( filename ) )
-			{
-				ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Module '" + node->ModuleName() + "' not found" );
-			}
+			m_pSymTab = m_pSymTab->Enclosing();
 		}
+		PushScope();
 
-		auto source = MemoryStream::FromFile( filename, FileMode::TEXT );
+		std::vector<int64_t> param_addrs;
+		for( size_t i = 0; i < sig.NumParams(); i++ )
+		{
+			Type* param_type = TypeSpecifierToType( sig.ParamType( i ) );
+			VariableSymbol* param = AddVariable( decl, sig.ParamIdent( i ).lexeme, StorageClass::LOCAL, param_type );
+			param->SetAddress( m_iStackSize );
+			param_addrs.push_back( m_iStackSize );
+			m_iStackSize += (int)param_type->Size();
+		}
+		for( size_t i = param_addrs.size(); i-- > 0; )
+		{
+			Emit( OpCode::STOREL_IMM, param_addrs[i] );
+		}
 
-		Lexer l( source.Base() );
-		auto tokens = l.Scan();
+		BlockStmt* body = decl->Body()->AsBlockStmt();
+		const size_t ret_idx = body->NumStatements() - 1;
+		PushScope();
+		for( size_t i = 0; i < ret_idx; i++ )
+		{
+			Compile( body->Stmt( i ) );
+		}
 
-		if( ErrorSys::HadError() ) return;
+		ReturnStmt* ret = body->Stmt( ret_idx )->AsReturnStmt();
+		UpdateCurrLine( ret );
+		if( ret->RetExpr() )
+		{
+			CompileRValue( ret->RetExpr(), sig.ReturnType() );
+		}
+		else
+		{
+			Emit( OpCode::PUSH, 0 );
+		}
+		PopScope();
+		PopScope();
+
+		m_pSymTab = scope;
+		UpdateCurrLine( node );
+		return true;
+	}
+	void Compiler::VisitReturnStmt( ReturnStmt* node )
+	{
+		UpdateCurrLine( node );
 
-		Parser p( std::move( tokens ) );
-		std::vector<std::unique_ptr<Statement>> res = p.Parse();
+		m_iNumReturns++;
 
-		if( ErrorSys::HadError() ) return;
+		if( CompileTailCall( node ) )
+		{
+			return;
+		}
+
+		if( node->RetExpr() )
+		{
+			CompileRValue( node->RetExpr(), m_pReturnType );
+		}
+		else
+		{
+			// Even void functions have to return a value for overall consistent pushes/pops
+			Emit( OpCode::PUSH, 0 );
+		}
+		EmitReturn();
+	}
+	void Compiler::VisitImportStmt( ImportStmt* node )
+	{
+		UpdateCurrLine( node );
 
-		for( size_t i = 0; i < res.size(); i++ )
+		for( const auto& stmt : node->Statements() )
 		{
-			Compile( std::move( res[i] ) );
+			Compile( stmt.get() );
 		}
 	}
 	void Compiler::VisitNativeStmt( NativeStmt* node )
@@ -836,6 +1210,32 @@ namespace Bat
 
 		VariableSymbol* var = GetSymbol( node->Identifier().lexeme )->AsVariable();
 
+		if( ArrayType* array = node->Type()->ToArray() )
+		{
+			if( !CheckArrayType( node, array, false ) )
+			{
+				return;
+			}
+
+			// Arrays always start out initialized, handle 0 is an empty array
+			if( array->HasFixedSize() )
+			{
+				CompileArrayAssign( var, node->Initializer() );
+				return;
+			}
+			Emit( OpCode::PUSH, var->Address() );
+			if( node->Initializer() )
+			{
+				CompileRValue( node->Initializer(), array );
+			}
+			else
+			{
+				Emit( OpCode::PUSH, 0 );
+			}
+			EmitStore( var );
+			return;
+		}
+
 		if( node->Initializer() )
 		{
 			Emit( OpCode::PUSH, var->Address() );
@@ -848,45 +1248,298 @@ namespace Bat
 		UpdateCurrLine( node );
 
 		auto& sig = node->Signature();
-		AddFunction( node, sig.Identifier().lexeme );
+		m_pFunction = AddFunction( node, sig.Identifier().lexeme );
 
 		m_iStackSize = 0;
 		
-		//  proc
-		//  stack XX
+		//  proc <size of locals>
 		//  ; function body
-		//  endproc
+		//  ret <size of arguments>
 
-		Emit( OpCode::PROC );
-		CodeLoc_t stack_size = EmitToPatch( OpCode::STACK );
+		CodeLoc_t stack_size = EmitToPatch( OpCode::PROC );
+		m_iBodyAddr = IP();
+		m_FunctionNames.push_back( sig.Identifier().lexeme );
+		const size_t first_instruction = m_LineMapping.size();
+		m_iNumReturns = 0;
+		m_bRecursive = false;
 
+		// Arguments are below the caller's return address and base pointer (see FRAME_LINK_SIZE)
 		constexpr int64_t arg_size = (int64_t)sizeof( int64_t );
-		constexpr int64_t first_arg_addr = -1 * arg_size;
-		const int64_t last_arg_addr = (first_arg_addr - (sig.NumParams() - 1) * arg_size);
+		const int64_t first_arg_addr = -FRAME_LINK_SIZE - (int64_t)sig.NumParams() * arg_size;
 
 		PushScope();
 
+		m_pReturnType = sig.ReturnType();
+		CheckArrayType( node, m_pReturnType, true );
+
 		m_iArgsSize = 0;
 		for( size_t i = 0; i < sig.NumParams(); i++ )
 		{
 			Type* arg_type = TypeSpecifierToType( sig.ParamType( i ) );
+			CheckArrayType( node, arg_type, true );
 			VariableSymbol* arg = AddVariable( node, sig.ParamIdent( i ).lexeme, StorageClass::ARGUMENT, arg_type );
-			arg->SetAddress( last_arg_addr + i * sizeof( int64_t ) );
+			arg->SetAddress( first_arg_addr + (int64_t)i * arg_size );
 			m_iArgsSize += (int)arg_type->Size();
+		}
+
+		// The global symbol table is the one the function was added to
+		IrBuilder builder( m_pSymTab->Enclosing(), m_InlinedFunctions, m_GlobalAccess );
+		std::unique_ptr<IrFunction> ir = m_bOptimizeIr ? builder.BuildFunction( node, m_pFunction ) : nullptr;
+		if( ir )
+		{
+			m_iNumReturns = builder.NumReturns();
+			m_bRecursive = builder.IsRecursive();
+			m_GlobalAccess[m_pFunction] = builder.GlobalAccess();
+			CompileIr( *ir, first_arg_addr );
+		}
+		else
+		{
+			Compile( node->Body() );
+		}
 
-			// TODO: defaults are handled wrong, should be handled at caller side
-			if( sig.ParamDefault( i ) )
+		Patch( stack_size, m_iStackSize );
+
+		// Calls from later functions and the mainline inline this one if its only return is the one that ends it
+		BlockStmt* body = node->Body()->ToBlockStmt();
+		const bool returns_at_end = body && body->NumStatements() > 0 && body->Stmt( body->NumStatements() - 1 )->IsReturnStmt();
+		if( returns_at_end && m_iNumReturns == 1 && !m_bRecursive && !sig.Async() &&
+			m_LineMapping.size() - first_instruction <= m_nInlineLimit )
+		{
+			m_InlinedFunctions.insert( m_pFunction );
+		}
+
+		PopScope();
+		m_pReturnType = nullptr;
+		m_pFunction = nullptr;
+	}
+	void Compiler::CompileIr( IrFunction& func, int64_t first_arg_addr )
+	{
+		// Values that IrStackSchedule keeps in slots are locals of the frame, the others are computed on the stack
+		// right before they're used, like the operands of expressions are:
+		//  local.load.imm <slot of b>
+		//  local.load.imm <slot of a>
+		//  add
+		//  local.store.imm <slot of a + b>
+		// Phis are copied into their slots at the end of their predecessors, unless the value is there already.
+		IrOptimizer::Optimize( func );
+		if( m_pIrDump )
+		{
+			func.Dump( *m_pIrDump );
+		}
+
+		constexpr int64_t slot_size = (int64_t)sizeof( int64_t );
+		IrStackSchedule schedule( func );
+		const int64_t first_slot_addr = m_iStackSize;
+		m_iStackSize += schedule.NumSlots() * (int)slot_size;
+		auto slot_addr = [&]( const IrInstr* value ) { return first_slot_addr + schedule.Slot( value ) * slot_size; };
+		auto push = [&]( const IrInstr* value )
+		{
+			if( value->op == IrOp::PARAM )
+			{
+				Emit( OpCode::LOADL_IMM, first_arg_addr + value->imm * slot_size );
+			}
+			else if( !value->IsConst() )
+			{
+				Emit( OpCode::LOADL_IMM, slot_addr( value ) );
+			}
+			else if( value->type == IrType::FLOAT )
+			{
+				EmitF( OpCode::PUSH, value->Float() );
+			}
+			else if( value->type == IrType::STRING )
 			{
-				Emit( OpCode::PUSH, arg->Address() );
-				CompileRValue( sig.ParamDefault( i ) );
-				EmitStore( arg );
+				Emit( OpCode::PUSH, AddStringLiteral( value->name ) );
 			}
+			else
+			{
+				Emit( OpCode::PUSH, value->imm );
+			}
+		};
+
+		const std::vector<IrBlock*>& layout = schedule.Layout();
+		int num_blocks = 0;
+		for( IrBlock* block : layout )
+		{
+			num_blocks = std::max( num_blocks, block->id + 1 );
 		}
+		std::vector<CodeLoc_t> block_addrs( num_blocks );
+		std::vector<std::pair<CodeLoc_t, IrBlock*>> jumps;
+		auto jump = [&]( OpCode op, IrBlock* to ) { jumps.push_back( { EmitToPatch( op ), to } ); };
 
-		Compile( node->Body() );
+		for( size_t i = 0; i < layout.size(); i++ )
+		{
+			IrBlock* block = layout[i];
+			IrBlock* next = (i + 1 < layout.size()) ? layout[i + 1] : nullptr;
+			block_addrs[block->id] = IP();
+
+			// Operands are pushed on the line of the instruction that takes them
+			const auto& entries = schedule.Entries( block );
+			std::vector<int> lines( entries.size() );
+			int line = 0;
+			for( size_t index = entries.size(); index-- > 0; )
+			{
+				if( entries[index].kind == IrStackSchedule::EntryKind::INSTR )
+				{
+					line = entries[index].instr->line;
+				}
+				lines[index] = line;
+			}
 
-		Patch( stack_size, m_iStackSize );
+			for( size_t index = 0; index < entries.size(); index++ )
+			{
+				const IrStackSchedule::Entry& entry = entries[index];
+				if( entry.kind == IrStackSchedule::EntryKind::PHI_COPIES )
+				{
+					// Every argument is pushed before the first phi is stored, since phis can be arguments of others
+					IrBlock* succ = block->succs[0];
+					const size_t pred = std::find( succ->preds.begin(), succ->preds.end(), block ) - succ->preds.begin();
+					std::vector<const IrInstr*> copied;
+					for( const IrInstr* phi : succ->phis )
+					{
+						const IrInstr* value = phi->args[pred];
+						if( value->IsConst() || value->op == IrOp::PARAM || schedule.Slot( value ) != schedule.Slot( phi ) )
+						{
+							push( value );
+							copied.push_back( phi );
+						}
+					}
+					for( auto it = copied.rbegin(); it != copied.rend(); ++it )
+					{
+						Emit( OpCode::STOREL_IMM, slot_addr( *it ) );
+					}
+					continue;
+				}
+
+				const IrInstr* instr = entry.instr;
+				if( lines[index] > 0 )
+				{
+					m_iCurrentLine = lines[index];
+				}
+				if( entry.kind == IrStackSchedule::EntryKind::GET )
+				{
+					push( instr );
+					continue;
+				}
+
+				const bool is_int = !instr->args.empty() && instr->args[0]->type == IrType::INT;
+				switch( instr->op )
+				{
+				case IrOp::ADD:    Emit( is_int ? OpCode::ADD : OpCode::ADDF ); break;
+				case IrOp::SUB:    Emit( is_int ? OpCode::SUB : OpCode::SUBF ); break;
+				case IrOp::MUL:    Emit( is_int ? OpCode::MUL : OpCode::MULF ); break;
+				case IrOp::DIV:    Emit( is_int ? OpCode::DIV : OpCode::DIVF ); break;
+				case IrOp::MOD:    Emit( OpCode::MOD ); break;
+				case IrOp::SHL:    Emit( OpCode::SHL ); break;
+				case IrOp::SHR:    Emit( OpCode::SHR ); break;
+				case IrOp::BITAND: Emit( OpCode::BITAND ); break;
+				case IrOp::BITOR:  Emit( OpCode::BITOR ); break;
+				case IrOp::BITXOR: Emit( OpCode::BITXOR ); break;
+				case IrOp::EQ:     Emit( is_int ? OpCode::EQ : OpCode::EQF ); break;
+				case IrOp::NEQ:    Emit( is_int ? OpCode::NEQ : OpCode::NEQF ); break;
+				case IrOp::LESS:   Emit( is_int ? OpCode::LESS : OpCode::LESSF ); break;
+				case IrOp::LESSE:  Emit( is_int ? OpCode::LESSE : OpCode::LESSEF ); break;
+				case IrOp::GRT:    Emit( is_int ? OpCode::GRT : OpCode::GRTF ); break;
+				case IrOp::GRTE:   Emit( is_int ? OpCode::GRTE : OpCode::GRTEF ); break;
+				case IrOp::NEG:    Emit( is_int ? OpCode::NEG : OpCode::NEGF ); break;
+				case IrOp::NOT:    Emit( OpCode::NOT ); break;
+				case IrOp::BITNOT: Emit( OpCode::BITNOT ); break;
+				case IrOp::ITOF:   Emit( OpCode::ITOF ); break;
+				case IrOp::FTOI:   Emit( OpCode::FTOI ); break;
+				case IrOp::TO_BOOL:
+					Emit( OpCode::NOT );
+					Emit( OpCode::NOT );
+					break;
+				case IrOp::LOAD_GLOBAL:
+					Emit( OpCode::LOADG_IMM, instr->imm );
+					break;
+				case IrOp::STORE_GLOBAL:
+					Emit( OpCode::STOREG_IMM, instr->imm );
+					break;
+				case IrOp::CALL:
+					Emit( OpCode::CALL, instr->imm );
+					break;
+				case IrOp::NATIVE:
+					Emit( OpCode::PUSH, instr->imm );
+					Emit( OpCode::NATIVE );
+					break;
+				case IrOp::PRINT:
+					switch( instr->args[0]->type )
+					{
+					case IrType::BOOL:   Emit( OpCode::PRINTB ); break;
+					case IrType::FLOAT:  Emit( OpCode::PRINTF ); break;
+					case IrType::STRING: Emit( OpCode::PRINTS ); break;
+					default:             Emit( OpCode::PRINTI ); break;
+					}
+					break;
+				case IrOp::JUMP:
+					if( block->succs[0] != next )
+					{
+						jump( OpCode::JMP, block->succs[0] );
+					}
+					break;
+				case IrOp::BRANCH:
+					if( block->succs[0] == next )
+					{
+						jump( OpCode::JZ, block->succs[1] );
+					}
+					else
+					{
+						jump( OpCode::JNZ, block->succs[0] );
+						if( block->succs[1] != next )
+						{
+							jump( OpCode::JMP, block->succs[1] );
+						}
+					}
+					break;
+				case IrOp::RETURN:
+					if( func.IsMainline() )
+					{
+						Emit( OpCode::STACK, -m_iStackSize );
+						Emit( OpCode::HALT );
+						break;
+					}
+					if( instr->args.empty() )
+					{
+						Emit( OpCode::PUSH, 0 );
+					}
+					EmitReturn();
+					break;
+				case IrOp::TAILCALL:
+					// Like CompileTailCall, the arguments are on the stack already
+					for( size_t arg = instr->args.size(); arg-- > 0; )
+					{
+						Emit( OpCode::STOREL_IMM, first_arg_addr + (int64_t)arg * slot_size );
+					}
+					if( instr->imm == m_pFunction->Address() )
+					{
+						Emit( OpCode::JMP, m_iBodyAddr );
+					}
+					else
+					{
+						Emit( OpCode::TAILCALL, instr->imm );
+					}
+					break;
+				default:
+					assert( false && "Unhandled IR op" );
+				}
+
+				if( instr->HasResult() && !schedule.OnStack( instr ) )
+				{
+					if( schedule.Slot( instr ) >= 0 )
+					{
+						Emit( OpCode::STOREL_IMM, slot_addr( instr ) );
+					}
+					else
+					{
+						Emit( OpCode::POP );
+					}
+				}
+			}
+		}
 
-		PopScope();
+		for( const auto& [addr, to] : jumps )
+		{
+			Patch( addr, block_addrs[to->id] );
+		}
 	}
 }
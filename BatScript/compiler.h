@@ -1,7 +1,12 @@
 #pragma once
 
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
 #include "ast.h"
 #include "instructions.h"
+#include "ir.h"
 #include "memory_stream.h"
 #include "symbol_table.h"
 #include "bat_callable.h"
@@ -15,6 +20,9 @@ namespace Bat
 		// Maps from instruction to corresponding line
 		// e.g. first entry would be the line that the first instruction corresponds to
 		std::vector<int> line_mapping;
+		// Name of every function in the order of their PROC instructions, the mainline is "main"
+		// Empty for code loaded from images.
+		std::vector<std::string> function_names;
 	};
 
 	struct BatNativeInfo
@@ -23,15 +31,32 @@ namespace Bat
 		BatNativeDesc desc;
 	};
 
+	// Instruction set that the code of a BatCode is encoded in
+	enum class InstructionSet
+	{
+		STACK,
+		REGISTER
+	};
+
+	class BytecodeImage;
+
 	struct BatCode
 	{
+		InstructionSet isa = InstructionSet::STACK;
 		MemoryStream code;
 		CodeLoc_t entry_point;
 		std::vector<std::string> string_literals;
 		std::vector<BatNativeInfo> natives;
 		BatDebugInfo debug_info;
+		// Set when loaded from an image (see bytecode_image.h), the code is then executed from the mapped file and `code` is empty
+		std::shared_ptr<const BytecodeImage> image;
+
+		const char* CodeBase() const;
+		size_t CodeSize() const;
 	};
 
+	ObjectType TypeToObjectType( Type* t );
+
 	class Compiler : public AstVisitor
 	{
 	public:
@@ -40,10 +65,21 @@ namespace Bat
 
 		void Compile( std::vector<std::unique_ptr<Statement>> statements );
 
+		// Calls to script functions of at most this many instructions are replaced by their bodies, 0 turns that off
+		static constexpr size_t DEFAULT_INLINE_LIMIT = 32;
+		void SetInlineLimit( size_t num_instructions ) { m_nInlineLimit = num_instructions; }
+		// Functions and the mainline are compiled through the optimized IR (see ir.h) where it supports their code,
+		// the others are compiled from the syntax tree like without it
+		void SetOptimizeIr( bool optimize ) { m_bOptimizeIr = optimize; }
+		// Writes the optimized IR of everything compiled through it to out, nullptr turns that off
+		void SetIrDump( std::ostream* out ) { m_pIrDump = out; }
+
 		BatCode Code() const;
 	private:
 		CodeLoc_t Emit( OpCode op );
+		// Operand is encoded in the smallest width that fits it, unless a width is given
 		CodeLoc_t Emit( OpCode op, int64_t param1 );
+		CodeLoc_t Emit( OpCode op, int64_t param1, size_t width );
 		CodeLoc_t EmitF( OpCode op, double param1 );
 		CodeLoc_t EmitByte( char byte );
 		CodeLoc_t EmitI16( int16_t i16 );
@@ -54,6 +90,7 @@ namespace Bat
 		CodeLoc_t EmitU64( uint64_t u64 );
 		CodeLoc_t EmitFloat( float f );
 		CodeLoc_t EmitDouble( double d );
+		CodeLoc_t EmitOperand( int64_t operand, size_t width );
 
 		CodeLoc_t EmitToPatch( OpCode op );
 		// Patches the first operand of the opcode at a given address to contain the given value
@@ -63,13 +100,45 @@ namespace Bat
 
 		void EmitReturn();
 
+		// Where the address that an lvalue compiles to points to
+		enum class AddressSpace
+		{
+			GLOBAL,
+			FRAME,
+			// Elements of arrays that aren't fixed size (see vm.h)
+			HEAP
+		};
+		AddressSpace SpaceOf( Symbol* sym ) const;
+		AddressSpace SpaceOf( Expression* lvalue ) const;
 		void EmitLoad( Symbol* sym );
 		void EmitStore( Symbol* sym );
+		void EmitLoad( AddressSpace space );
+		void EmitStore( AddressSpace space );
 
 		void Compile( std::unique_ptr<Statement> s );
 		void Compile( Statement* s );
 		void CompileLValue( Expression* e );
 		void CompileRValue( Expression* e );
+		// Rvalue for a variable or parameter of type to, fixed size arrays are copied to the heap for other arrays
+		void CompileRValue( Expression* e, Type* to );
+		// Fixed size arrays are stored element by element from array literals, copied from other fixed size arrays
+		// or cleared if there is no value
+		void CompileArrayAssign( VariableSymbol* var, Expression* value );
+		// Pushes the arguments of a call, including the defaults of script functions
+		void CompileArgs( CallExpr* node, FunctionSymbol* func );
+		// Pushes the defaults of the parameters from first on, for a call that leaves them out
+		void CompileDefaults( FunctionSignature& sig, size_t first );
+		// Compiles a return of a call in tail position, returns false if the return isn't one
+		bool CompileTailCall( ReturnStmt* node );
+		// Compiles the body of an inlined function in place of a call to it, returns false if func isn't inlined
+		bool CompileInline( CallExpr* node, FunctionSymbol* func );
+		// Optimizes func and compiles it in place of the body of the function or mainline being compiled, the
+		// parameters are at first_arg_addr
+		void CompileIr( IrFunction& func, int64_t first_arg_addr );
+		// Reports array types that the code can't hold (see vm.h), returns false if type is one of them
+		// Fixed size arrays live on the VM stack, so they can't take up more than a quarter of it
+		static constexpr size_t MAX_FIXED_ARRAY_SIZE = 128;
+		bool CheckArrayType( AstNode* node, Type* type, bool in_signature );
 
 		void CompileBinaryExpr( BinaryExpr* node );
 		void CompileAssign( AssignStmt* node );
@@ -128,11 +197,26 @@ namespace Bat
 		std::vector<std::string> m_Natives;
 		int m_iCurrentLine = 1;
 		std::vector<int> m_LineMapping;
+		std::vector<std::string> m_FunctionNames;
 		std::vector<std::unique_ptr<Statement>> m_pStatements;
 		SymbolTable* m_pSymTab;
 		int m_iStackSize = 0;
 		ExprType m_CompileType = ExprType::UNKNOWN;
 		CodeLoc_t m_iEntryPoint = 0;
 		int m_iArgsSize;
+		// Return type of the function being compiled
+		Type* m_pReturnType = nullptr;
+		// Function being compiled and the start of its body, after the proc
+		FunctionSymbol* m_pFunction = nullptr;
+		CodeLoc_t m_iBodyAddr = 0;
+		// Functions whose calls are inlined, those that only return at the end, don't call themselves and are small
+		std::unordered_set<FunctionSymbol*> m_InlinedFunctions;
+		size_t m_nInlineLimit = DEFAULT_INLINE_LIMIT;
+		int m_iNumReturns = 0;
+		bool m_bRecursive = false;
+		bool m_bOptimizeIr = false;
+		// Of the functions compiled through the IR, calls of the others may access any global
+		std::unordered_map<FunctionSymbol*, IrGlobalAccess> m_GlobalAccess;
+		std::ostream* m_pIrDump = nullptr;
 	};
 }
\ No newline at end of file
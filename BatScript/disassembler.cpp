@@ -3,7 +3,9 @@
 #include <cassert>
 #include <iomanip>
 #include <sstream>
+#include "bytecode_image.h"
 #include "instructions.h"
+#include "reg_instructions.h"
 #include "stringlib.h"
 
 namespace Bat
@@ -12,13 +14,22 @@ namespace Bat
 		:
 		m_Code( std::move( code ) )
 	{
-		m_Code.code.Seek( SeekPosition::START );
+		LoadImageCode();
 	}
 	Disassembler::Disassembler( BatCode code, const std::string& source_code )
 		:
 		m_Code( std::move( code ) ),
 		m_SourceLines( SplitString( source_code, '\n' ) )
 	{
+		LoadImageCode();
+	}
+	void Disassembler::LoadImageCode()
+	{
+		// Code of a loaded image isn't in a stream, copy it out so it can be read like compiled code
+		if( m_Code.image )
+		{
+			m_Code.code = MemoryStream( m_Code.CodeBase(), m_Code.CodeSize() );
+		}
 		m_Code.code.Seek( SeekPosition::START );
 	}
 	void Disassembler::Disassemble()
@@ -42,31 +53,13 @@ namespace Bat
 				}
 			}
 
-			size_t address = m_Code.code.Tell();
-			OpCode op = m_Code.code.Read<OpCode>();
-
-			out << std::setfill( '0' ) << std::setw( 4 ) << std::hex << address << std::dec;
-			out << '\t';
-
-			switch( op )
+			if( m_Code.isa == InstructionSet::REGISTER )
 			{
-#define _(name, operands, pushes, pops, mnemonic) \
-			case OpCode::name: \
-			{ \
-				std::stringstream ss; \
-				ss << std::hex << std::setfill( '0' ) << std::setw( 2 ) << (int)op << std::dec; \
-				auto old = m_Code.code.Tell(); \
-				for( int i = 0; i < operands; i++ ) ss << ' ' << std::hex << std::setfill( '0' ) << std::setw( 2 ) << m_Code.code.ReadInt64() << std::dec; \
-				out << std::setfill( ' ' ) << std::setw( 20 ) << ss.str() << '\t'; \
-				m_Code.code.Seek( old, SeekPosition::START ); \
-				out << #mnemonic; \
-				for( int i = 0; i < operands; i++ ) Operand( out ); \
-				break; \
+				RegisterInstruction( out );
 			}
-OPCODES( _ )
-#undef _
-			default:
-				assert( false && "Unhandled opcode" );
+			else
+			{
+				StackInstruction( out );
 			}
 
 			out << '\n';
@@ -74,10 +67,116 @@ OPCODES( _ )
 			current_op++;
 		}
 	}
-	void Disassembler::Operand( std::ostream& out )
+	void Disassembler::StackInstruction( std::ostream& out )
+	{
+		size_t address = m_Code.code.Tell();
+		auto encoded = m_Code.code.Read<unsigned char>();
+		DecodedOp decoded = DecodeOp( encoded );
+
+		out << std::setfill( '0' ) << std::setw( 4 ) << std::hex << address << std::dec;
+		out << '\t';
+
+		const char* mnemonic = nullptr;
+		switch( decoded.op )
+		{
+#define _(name, operands, pushes, pops, mnem) case OpCode::name: mnemonic = #mnem; break;
+		OPCODES( _ )
+#undef _
+		default:
+			assert( false && "Unhandled opcode" );
+			return;
+		}
+		const int operands = OPCODE_OPERANDS[(size_t)decoded.op];
+
+		std::stringstream ss;
+		ss << std::hex << std::setfill( '0' ) << std::setw( 2 ) << (int)encoded << std::dec;
+		auto old = m_Code.code.Tell();
+		for( int i = 0; i < operands; i++ )
+		{
+			// Show the operand as it's encoded, i.e. only its low width bytes
+			uint64_t raw = (uint64_t)ReadStackOperand( decoded.width );
+			if( decoded.width < sizeof( raw ) ) raw &= (uint64_t( 1 ) << (decoded.width * 8)) - 1;
+			ss << ' ' << std::hex << std::setfill( '0' ) << std::setw( decoded.width * 2 ) << raw << std::dec;
+		}
+		out << std::setfill( ' ' ) << std::setw( 20 ) << ss.str() << '\t';
+		m_Code.code.Seek( old, SeekPosition::START );
+
+		out << mnemonic;
+		for( int i = 0; i < operands; i++ ) Operand( out, decoded.width );
+	}
+	void Disassembler::RegisterInstruction( std::ostream& out )
+	{
+		size_t address = m_Code.code.Tell();
+		RegOpCode op = m_Code.code.Read<RegOpCode>();
+
+		out << std::setfill( '0' ) << std::setw( 4 ) << std::hex << address << std::dec;
+		out << '\t';
+
+		const char* operands = nullptr;
+		const char* mnemonic = nullptr;
+		switch( op )
+		{
+#define _(name, kinds, mnem) case RegOpCode::name: operands = kinds; mnemonic = #mnem; break;
+		REG_OPCODES( _ )
+#undef _
+		default:
+			assert( false && "Unhandled opcode" );
+			return;
+		}
+
+		std::stringstream ss;
+		ss << std::hex << std::setfill( '0' ) << std::setw( 2 ) << (int)op << std::dec;
+		auto old = m_Code.code.Tell();
+		for( const char* kind = operands; *kind; kind++ )
+		{
+			int64_t value = (*kind == 'i') ? m_Code.code.ReadInt64() : m_Code.code.Read<RegOperand_t>();
+			ss << ' ' << std::hex << std::setfill( '0' ) << std::setw( 2 ) << value << std::dec;
+		}
+		out << std::setfill( ' ' ) << std::setw( 20 ) << ss.str() << '\t';
+		m_Code.code.Seek( old, SeekPosition::START );
+
+		out << mnemonic;
+		for( const char* kind = operands; *kind; kind++ )
+		{
+			out << ((kind == operands) ? " " : ", ");
+			RegisterOperand( out, *kind );
+		}
+	}
+	void Disassembler::RegisterOperand( std::ostream& out, char kind )
+	{
+		if( kind == 'i' )
+		{
+			out << m_Code.code.ReadInt64();
+			return;
+		}
+
+		RegOperand_t value = m_Code.code.Read<RegOperand_t>();
+		switch( kind )
+		{
+		case 'r': out << 'r' << value; break;
+		case 'g': out << 'g' << value; break;
+		case 'a': out << "0x" << std::hex << value << std::dec; break;
+		case 'n': out << m_Code.natives[value].name; break;
+		case 'c': out << value; break;
+		case 's': out << value; break;
+		default:
+			assert( false && "Unhandled operand kind" );
+		}
+	}
+	void Disassembler::Operand( std::ostream& out, size_t width )
 	{
 		out << ' ';
 
-		out << "0x" << std::hex << m_Code.code.ReadInt64() << std::dec;
+		out << "0x" << std::hex << ReadStackOperand( width ) << std::dec;
+	}
+	int64_t Disassembler::ReadStackOperand( size_t width )
+	{
+		switch( width )
+		{
+		case 1:  return (int8_t)m_Code.code.ReadByte();
+		case 2:  return m_Code.code.ReadInt16();
+		case 4:  return m_Code.code.ReadInt32();
+		default: return m_Code.code.ReadInt64();
+		}
 	}
 }
@@ -15,7 +15,12 @@ namespace Bat
 		void Disassemble();
 		void Disassemble( std::ostream& out );
 	private:
-		void Operand( std::ostream& out );
+		void LoadImageCode();
+		void StackInstruction( std::ostream& out );
+		void RegisterInstruction( std::ostream& out );
+		void Operand( std::ostream& out, size_t width );
+		int64_t ReadStackOperand( size_t width );
+		void RegisterOperand( std::ostream& out, char kind );
 	private:
 		BatCode m_Code;
 		std::vector<std::string> m_SourceLines;
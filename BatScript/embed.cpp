@@ -0,0 +1,125 @@
+#include "embed.h"
+
+#include <mutex>
+#include "ast_optimizer.h"
+#include "bytecode_image.h"
+#include "errorsys.h"
+#include "lexer.h"
+#include "parser.h"
+#include "peephole.h"
+#include "reg_compiler.h"
+#include "reg_vm.h"
+#include "semantic_analysis.h"
+#include "vm.h"
+
+namespace Bat
+{
+	static std::mutex s_CompileMutex;
+
+	std::shared_ptr<const Program> Program::Compile( const std::string& source, InstructionSet isa, bool optimize )
+	{
+		std::lock_guard<std::mutex> lock( s_CompileMutex );
+		ErrorSys::Reset();
+
+		Lexer l( source );
+		auto tokens = l.Scan();
+		if( ErrorSys::HadError() ) return nullptr;
+
+		Parser p( std::move( tokens ) );
+		auto statements = p.Parse();
+		if( ErrorSys::HadError() ) return nullptr;
+
+		SemanticAnalysis sa;
+		for( auto& s : statements )
+		{
+			sa.Analyze( s.get() );
+		}
+		if( ErrorSys::HadError() ) return nullptr;
+
+		if( optimize )
+		{
+			AstOptimizer::Optimize( statements );
+		}
+
+		BatCode code;
+		if( isa == InstructionSet::REGISTER )
+		{
+			RegCompiler compiler;
+			compiler.Compile( std::move( statements ) );
+			if( ErrorSys::HadError() ) return nullptr;
+			code = compiler.Code();
+		}
+		else
+		{
+			Compiler compiler;
+			compiler.SetInlineLimit( optimize ? Compiler::DEFAULT_INLINE_LIMIT : 0 );
+			compiler.Compile( std::move( statements ) );
+			if( ErrorSys::HadError() ) return nullptr;
+			code = compiler.Code();
+			if( optimize )
+			{
+				PeepholeOptimizer::Optimize( code );
+			}
+		}
+
+		return FromCode( std::move( code ) );
+	}
+
+	std::shared_ptr<const Program> Program::Load( const std::string& image_filename )
+	{
+		BatCode code;
+		if( !BytecodeImage::Load( image_filename, code ) ) return nullptr;
+
+		return FromCode( std::move( code ) );
+	}
+
+	std::shared_ptr<const Program> Program::FromCode( BatCode code )
+	{
+		auto program = std::make_shared<Program>();
+		program->m_Code = std::move( code );
+		return program;
+	}
+
+	Instance::Instance( std::shared_ptr<const Program> program )
+		:
+		m_pProgram( std::move( program ) )
+	{
+		if( m_pProgram->Code().isa == InstructionSet::REGISTER )
+		{
+			m_pRegVM = std::make_unique<RegisterVM>();
+		}
+		else
+		{
+			m_pVM = std::make_unique<VirtualMachine>();
+		}
+	}
+
+	Instance::~Instance() = default;
+
+	void Instance::AddNative( const std::string& name, BatNativeCallback callback )
+	{
+		Natives().Add( name, std::move( callback ) );
+	}
+
+	void Instance::BindAwaitable( const std::string& name, AwaitableCallback callback )
+	{
+		if( m_pVM ) m_pVM->BindAwaitable( name, std::move( callback ) );
+	}
+
+	NativeTable& Instance::Natives()
+	{
+		return m_pRegVM ? m_pRegVM->Natives() : m_pVM->Natives();
+	}
+
+	void Instance::SetOutput( std::ostream& out )
+	{
+		if( m_pRegVM ) m_pRegVM->SetOutput( out );
+		else           m_pVM->SetOutput( out );
+	}
+
+	void Instance::Run()
+	{
+		if( m_pRegVM ) m_pRegVM->Run( m_pProgram->Code() );
+		else           m_pVM->Run( m_pProgram->Code() );
+	}
+}
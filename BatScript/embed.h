@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include "bat_callable.h"
+#include "compiler.h"
+#include "scheduler.h"
+
+namespace Bat
+{
+	class VirtualMachine;
+	class RegisterVM;
+
+	// Compiled script for embedding
+	// A Program never changes once it's compiled, so any number of Instances can run it at the same time, each on its own thread.
+	// Compiling goes through process wide state (types, modules, errors), so compiles are serialized.
+	class Program
+	{
+	public:
+		// Returns nullptr if the source doesn't compile, errors are reported through ErrorSys
+		// Unless optimize is false, the syntax tree (see ast_optimizer.h) is optimized, small functions are inlined and the
+		// compiled stack code (see peephole.h) is optimized.
+		static std::shared_ptr<const Program> Compile( const std::string& source, InstructionSet isa = InstructionSet::STACK, bool optimize = true );
+		static std::shared_ptr<const Program> Load( const std::string& image_filename );
+		static std::shared_ptr<const Program> FromCode( BatCode code );
+
+		const BatCode& Code() const { return m_Code; }
+	private:
+		BatCode m_Code;
+	};
+
+	// One execution context for a Program, with its own stacks, globals and natives
+	// An Instance is used by one thread at a time, run as many of them side by side as there are threads.
+	// Running code doesn't take locks: instances only share the string pool, for a lookup per literal when a run starts,
+	// and ErrorSys, when they report an error. Natives are called without a lock (see AddNative).
+	class Instance
+	{
+	public:
+		Instance( std::shared_ptr<const Program> program );
+		~Instance();
+
+		// Natives are bound per instance, callbacks shared between instances have to be thread-safe themselves
+		void AddNative( const std::string& name, BatNativeCallback callback );
+		// Binds a C++ function as a native, see NativeBinding::Typed
+		template <typename R, typename... Args>
+		void Bind( const std::string& name, R (*function)( Args... ) )
+		{
+			Natives().Bind( name, function );
+		}
+		NativeTable& Natives();
+		// Binds a native declared as `async native`, see scheduler.h
+		// Only the stack VM runs tasks, register code can't declare async natives, so it doesn't need them.
+		void BindAwaitable( const std::string& name, AwaitableCallback callback );
+		// Where print statements write to, std::cout by default
+		void SetOutput( std::ostream& out );
+		// Runs the program from the start, globals start out fresh every run
+		void Run();
+	private:
+		std::shared_ptr<const Program> m_pProgram;
+		std::unique_ptr<VirtualMachine> m_pVM;
+		std::unique_ptr<RegisterVM> m_pRegVM;
+	};
+}
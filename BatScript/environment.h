@@ -1,26 +1,35 @@
 #pragma once
 
-#include <string>
-#include <unordered_map>
+#include <cassert>
+#include <vector>
 #include "bat_object.h"
-#include "type.h"
 
 namespace Bat
 {
+	// Variables of one scope, kept in the slots the Resolver handed out (see resolver.h)
 	class Environment
 	{
 	public:
 		Environment() = default;
-		Environment( Environment* enclosing );
+		Environment( Environment* enclosing, size_t num_slots );
 
-		bool Exists( const std::string& name ) const;
-		bool ExistsLocally( const std::string& name ) const;
-		bool AddVar( const std::string& name, const BatObject& value );
-		const BatObject* GetVar( const std::string& name ) const;
-		bool SetVar( const std::string& name, const BatObject& value );
+		BatObject& Slot( size_t index ) { assert( index < m_Slots.size() ); return m_Slots[index]; }
+		size_t NumSlots() const { return m_Slots.size(); }
+		// Only the global environment grows, as later statements declare more globals
+		void Resize( size_t num_slots );
+		// Environment depth levels up the chain
+		Environment* Ancestor( int depth )
+		{
+			Environment* env = this;
+			for( int i = 0; i < depth; i++ )
+			{
+				env = env->m_pEnclosing;
+			}
+			return env;
+		}
 		Environment* Enclosing() { return m_pEnclosing; }
 	private:
 		Environment* m_pEnclosing = nullptr;
-		std::unordered_map<std::string, BatObject> m_mapVariables;
+		std::vector<BatObject> m_Slots;
 	};
-}
\ No newline at end of file
+}
@@ -1,14 +1,19 @@
 #include "errorsys.h"
 
+#include <atomic>
 #include <iostream>
+#include <mutex>
 
 namespace Bat
 {
-	static bool g_bHadError = false;
+	// Runtime errors can be reported by VMs on several threads at once (see embed.h)
+	static std::atomic<bool> g_bHadError{ false };
 	static std::string g_szSource;
+	static std::mutex g_Mutex;
 
 	void ErrorSys::Report( size_t line, size_t column, const std::string& message )
 	{
+		std::lock_guard<std::mutex> lock( g_Mutex );
 		g_bHadError = true;
 		if( g_szSource.empty() )
 		{
@@ -26,6 +31,7 @@ namespace Bat
 	}
 	void ErrorSys::SetSource( const std::string& source )
 	{
+		std::lock_guard<std::mutex> lock( g_Mutex );
 		g_szSource = source;
 	}
 	void ErrorSys::Reset()
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include "util.h"
 
 // Opcode name, no. of operands, no. of pushes, no. of pops, mnemonic
@@ -10,9 +11,9 @@
 	/* Stack manipulation */                    \
 	_(PUSH,         1, 1, 0, push)              \
 	_(POP,          0, 0, 1, pop)               \
-	_(DUP,          0, 1, 0, dup)               \
-	_(DUPX1,        0, 1, 0, dupx1)             \
-	_(PROC,         0, 0, 0, proc)              \
+	_(DUP,          0, 2, 1, dup)               \
+	_(DUPX1,        0, 3, 2, dupx1)             \
+	_(PROC,         1, 0, 0, proc)              \
 	_(STACK,        1, 0, 0, stack)             \
 	/* Memory operations */                     \
 	_(LOAD_LOCAL,   0, 1, 1, local.load)        \
@@ -24,22 +25,23 @@
 	_(BITAND,       0, 1, 2, bitand)            \
 	_(BITXOR,       0, 1, 2, bitxor)            \
 	_(BITNOT,       0, 1, 1, bitnot)            \
-	_(SHL,          0, 1, 1, shl)               \
-	_(SHR,          0, 1, 1, shr)               \
+	_(SHL,          0, 1, 2, shl)               \
+	_(SHR,          0, 1, 2, shr)               \
 	/* Logical operations */                    \
-	_(EQ,           0, 1, 1, eq)                \
-	_(NEQ,          0, 1, 1, neq)               \
-	_(LESS,         0, 1, 1, less)              \
-	_(LESSE,        0, 1, 1, lesse)             \
-	_(GRT,          0, 1, 1, grt)               \
-	_(GRTE,         0, 1, 1, grte)              \
+	_(EQ,           0, 1, 2, eq)                \
+	_(NEQ,          0, 1, 2, neq)               \
+	_(LESS,         0, 1, 2, less)              \
+	_(LESSE,        0, 1, 2, lesse)             \
+	_(GRT,          0, 1, 2, grt)               \
+	_(GRTE,         0, 1, 2, grte)              \
 	_(NOT,          0, 1, 1, not)               \
 	/* Jump instructions */                     \
-	_(JMP,          1, 0, 1, jmp)               \
-	_(JZ,           1, 0, 2, jz)                \
-	_(JNZ,          1, 0, 2, jnz)               \
-	_(CALL,         0, 1, 1, call)              \
+	_(JMP,          1, 0, 0, jmp)               \
+	_(JZ,           1, 0, 1, jz)                \
+	_(JNZ,          1, 0, 1, jnz)               \
+	_(CALL,         1, 1, 0, call)              \
 	_(RET,          1, 1, 1, ret)               \
+	_(TAILCALL,     1, 0, 0, tailcall)          \
 	/* Integer arithmetic */                    \
 	_(ADD,          0, 1, 2, add)               \
 	_(SUB,          0, 1, 2, sub)               \
@@ -68,7 +70,35 @@
 	_(PRINTF,       0, 0, 1, float.print)       \
 	_(PRINTS,       0, 0, 1, str.print)         \
 	_(PRINTB,       0, 0, 1, bool.print)        \
-	_(NATIVE,       0, 1, 1, native)
+	_(NATIVE,       0, 1, 1, native)            \
+	/* Coroutines (see scheduler.h) */          \
+	_(AWAIT,        0, 1, 1, await)             \
+	_(SPAWN,        1, 0, 1, spawn)             \
+	_(TASK_END,     0, 0, 1, task.end)          \
+	/* Arrays (see vm.h) */                     \
+	_(ELEM,         1, 1, 2, elem)              \
+	_(LOCAL_ADDR,   0, 1, 1, local.addr)        \
+	_(ZERO,         1, 0, 1, zero)              \
+	_(COPY,         1, 0, 2, copy)              \
+	_(ARRAY_NEW,    1, 1, 0, array.new)         \
+	_(ARRAY_FROM,   1, 1, 1, array.from)        \
+	_(ARRAY_ELEM,   0, 1, 2, array.elem)        \
+	_(ARRAY_LOAD,   0, 1, 2, array.load)        \
+	_(HEAP_LOAD,    0, 1, 1, heap.load)         \
+	_(HEAP_STORE,   0, 0, 2, heap.store)        \
+	/* Superinstructions (see peephole.h) */    \
+	_(LOADL_IMM,    1, 1, 0, local.load.imm)    \
+	_(LOADG_IMM,    1, 1, 0, global.load.imm)   \
+	_(STOREL_IMM,   1, 0, 1, local.store.imm)   \
+	_(STOREG_IMM,   1, 0, 1, global.store.imm)  \
+	_(ADDI,         1, 1, 1, addi)              \
+	_(SUBI,         1, 1, 1, subi)              \
+	_(JEQ,          1, 0, 2, jeq)               \
+	_(JNE,          1, 0, 2, jne)               \
+	_(JLT,          1, 0, 2, jlt)               \
+	_(JLE,          1, 0, 2, jle)               \
+	_(JGT,          1, 0, 2, jgt)               \
+	_(JGE,          1, 0, 2, jge)
 
 namespace Bat
 {
@@ -78,4 +108,132 @@ namespace Bat
 		OPCODES( _ )
 #undef _
 	};
+
+	// Total number of opcodes, used to size tables that are indexed by opcode
+	constexpr size_t NUM_OPCODES = 0
+#define _(name, operands, pushes, pops, mnemonic) + 1
+		OPCODES( _ );
+#undef _
+
+	// Number of operands of each opcode
+	inline constexpr int OPCODE_OPERANDS[] = {
+#define _(name, operands, pushes, pops, mnemonic) operands,
+		OPCODES( _ )
+#undef _
+	};
+
+	// Calls: the caller pushes the arguments, then `call <function>` pushes the return address and the caller's base pointer
+	// and points the base pointer after them. The function starts with `proc <size of locals>` and `ret <size of arguments>`
+	// pops all of it again, leaving the returned value in place of the arguments. The mainline's proc reserves the globals.
+	// So a frame is the arguments, the link to the caller and then the locals, all on the one stack.
+	// Arguments are at negative offsets from the base pointer, below the link.
+	// `tailcall <function>` enters a function in the frame of the one that calls it, which takes as many arguments and
+	// already stored the new ones over its own. The function then returns straight to the frame's caller.
+	constexpr int64_t FRAME_LINK_SIZE = 2 * sizeof( int64_t );
+	// Size of the stack in bytes, of the VM and of the JIT's code alike
+	// A frame of a function with one argument and no locals takes 3 slots, so that's a recursion depth of about 40000.
+	constexpr int64_t STACK_SIZE = 1024 * 1024;
+	// Frames and blocks check that their locals fit on the stack when they reserve them, the values that code pushes
+	// on top while it evaluates expressions and arguments have to fit in this much
+	constexpr int64_t STACK_RESERVE = 64 * sizeof( int64_t );
+
+	// Opcodes that work on arrays, the JIT and AOT backends don't support them
+	constexpr bool IsArrayOp( OpCode op )
+	{
+		return op >= OpCode::ELEM && op <= OpCode::HEAP_STORE;
+	}
+
+	// Operands are encoded in the smallest of 1, 2, 4 or 8 bytes that holds them, and are sign extended when read.
+	// The 1 byte form is encoded with the plain opcode. The wider forms of every opcode that takes an operand get their
+	// own opcodes, which come after all of the plain ones, so that the VM can dispatch on the width directly.
+	constexpr size_t NUM_OPERAND_WIDTHS = 4;
+
+	// Number of opcodes that have wide forms
+	constexpr size_t NUM_WIDE_OPCODES = 0
+#define _(name, operands, pushes, pops, mnemonic) + operands
+		OPCODES( _ );
+#undef _
+
+	// Total number of encoded opcodes, including the wide forms
+	constexpr size_t NUM_ENCODED_OPCODES = NUM_OPCODES + NUM_WIDE_OPCODES * (NUM_OPERAND_WIDTHS - 1);
+	static_assert( NUM_ENCODED_OPCODES <= 256, "Encoded opcodes have to fit in a byte" );
+
+	// Size in bytes of operand width of given index, 0 being the plain 1 byte form
+	constexpr size_t OperandWidth( size_t index ) { return (size_t)1 << index; }
+	constexpr size_t OperandWidthIndex( size_t width ) { return (width == 1) ? 0 : (width == 2) ? 1 : (width == 4) ? 2 : 3; }
+
+	// Smallest operand width that can hold value
+	constexpr size_t OperandWidthFor( int64_t value )
+	{
+		if( value >= INT8_MIN && value <= INT8_MAX ) return 1;
+		if( value >= INT16_MIN && value <= INT16_MAX ) return 2;
+		if( value >= INT32_MIN && value <= INT32_MAX ) return 4;
+		return 8;
+	}
+
+	// Encodes opcode with an operand of given width, opcodes without operands should use a width of 1
+	constexpr unsigned char EncodeOp( OpCode op, size_t width = 1 )
+	{
+		if( width == 1 )
+		{
+			return (unsigned char)op;
+		}
+
+		size_t wide_index = 0;
+		for( size_t i = 0; i < (size_t)op; i++ )
+		{
+			wide_index += OPCODE_OPERANDS[i];
+		}
+		return (unsigned char)(NUM_OPCODES + wide_index * (NUM_OPERAND_WIDTHS - 1) + OperandWidthIndex( width ) - 1);
+	}
+
+	struct DecodedOp
+	{
+		OpCode op;
+		// Width in bytes of the operand, if there is one
+		size_t width;
+	};
+
+	// Reverse of EncodeOp
+	constexpr DecodedOp DecodeOp( unsigned char encoded )
+	{
+		if( encoded < NUM_OPCODES )
+		{
+			return { (OpCode)encoded, 1 };
+		}
+
+		size_t wide = encoded - NUM_OPCODES;
+		size_t wide_index = wide / (NUM_OPERAND_WIDTHS - 1);
+		for( size_t i = 0; i < NUM_OPCODES; i++ )
+		{
+			if( OPCODE_OPERANDS[i] && wide_index-- == 0 )
+			{
+				return { (OpCode)i, OperandWidth( wide % (NUM_OPERAND_WIDTHS - 1) + 1 ) };
+			}
+		}
+
+		return { OpCode::NOP, 1 };
+	}
+
+	// Reads a value from code, where operands follow their opcode byte and so aren't aligned
+	// Dereferencing a misaligned pointer is undefined, memcpy isn't and compiles to the same single load.
+	template <typename T>
+	inline T ReadUnaligned( const char* code )
+	{
+		T val;
+		std::memcpy( &val, code, sizeof( T ) );
+		return val;
+	}
+
+	// Reads an operand of given width from code, sign-extended
+	inline int64_t ReadOperand( const char* code, size_t width )
+	{
+		switch( width )
+		{
+		case 1: return ReadUnaligned<int8_t>( code );
+		case 2: return ReadUnaligned<int16_t>( code );
+		case 4: return ReadUnaligned<int32_t>( code );
+		default: return ReadUnaligned<int64_t>( code );
+		}
+	}
 }
\ No newline at end of file
@@ -31,30 +31,158 @@ namespace Bat
 		Environment* value;
 	};
 
+	// Frame of a call while profiling, popped however the call ends
+	class ProfileFrameScope
+	{
+	public:
+		ProfileFrameScope( std::vector<Profiler::Frame>& frames, CallExpr* call )
+			:
+			frames( frames )
+		{
+			static const std::string s_Unknown = "?";
+
+			VarExpr* callee = call->Function()->ToVarExpr();
+			frames.push_back( { callee ? &callee->Identifier().lexeme : &s_Unknown, call->Location().Line() } );
+		}
+		~ProfileFrameScope()
+		{
+			frames.pop_back();
+		}
+	private:
+		std::vector<Profiler::Frame>& frames;
+	};
+
+	// Counts a call for as long as it's being executed, however it ends
+	class CallDepth
+	{
+	public:
+		CallDepth( size_t& depth )
+			:
+			depth( depth )
+		{
+			depth++;
+		}
+		~CallDepth()
+		{
+			depth--;
+		}
+	private:
+		size_t& depth;
+	};
+
+	// Fixed size arrays are values, so copies don't share their elements with the original
+	static BatObject CopyValue( const BatObject& value, Type* type )
+	{
+		ArrayType* arr_type = type ? type->ToArray() : nullptr;
+		if( !arr_type || !arr_type->HasFixedSize() || value.type != TYPE_ARRAY )
+		{
+			return value;
+		}
+
+		BatObject copy( value.Array(), value.ArraySize(), true );
+		for( size_t i = 0; i < copy.ArraySize(); i++ )
+		{
+			copy.Array()[i] = CopyValue( copy.Array()[i], arr_type->Inner() );
+		}
+		return copy;
+	}
+	// Value of variables declared without an initializer, fixed size arrays are filled with zeros and dynamic ones are empty
+	static BatObject DefaultValue( Type* type )
+	{
+		if( PrimitiveType* prim = type->ToPrimitive() )
+		{
+			switch( prim->PrimKind() )
+			{
+				case PrimitiveKind::Int:   return BatObject( (int64_t)0 );
+				case PrimitiveKind::Float: return BatObject( 0.0 );
+				case PrimitiveKind::Bool:  return BatObject( false );
+			}
+			return BatObject();
+		}
+		if( ArrayType* arr_type = type->ToArray() )
+		{
+			std::vector<BatObject> elements( arr_type->FixedSize() );
+			for( auto& element : elements )
+			{
+				element = DefaultValue( arr_type->Inner() );
+			}
+			return BatObject( elements.data(), elements.size(), arr_type->HasFixedSize() );
+		}
+		return BatObject();
+	}
+
 	Interpreter::Interpreter()
 	{
-		m_pEnvironment = new Environment;
+		m_pGlobals = new Environment;
+		m_pEnvironment = m_pGlobals;
 	}
 	Interpreter::~Interpreter()
 	{
-		delete m_pEnvironment;
+		delete m_pGlobals;
 	}
 	BatObject Interpreter::Evaluate( Expression* e )
 	{
 		e->Accept( this );
 		return m_Result;
+	}
 
-		return BatObject();
+	BatObject Interpreter::Evaluate( Expression* e, Environment& environment )
+	{
+		EnvironmentRestore save( &m_pEnvironment );
+		m_pEnvironment = &environment;
+
+		return Evaluate( e );
+	}
+
+	void Interpreter::Resolve( Statement* s )
+	{
+		m_Resolver.Resolve( s );
+		m_pGlobals->Resize( m_Resolver.NumGlobals() );
+	}
+
+	BatObject Interpreter::TakeReturnValue()
+	{
+		if( !m_bReturning )
+		{
+			return BatObject();
+		}
+
+		m_bReturning = false;
+		return std::move( m_ReturnValue );
+	}
+
+	bool Interpreter::TakeTailCall( BatFunction*& function, std::vector<BatObject>& args )
+	{
+		if( !m_pTailCall )
+		{
+			return false;
+		}
+
+		function = m_pTailCall;
+		args = std::move( m_TailCallArgs );
+		m_pTailCall = nullptr;
+		m_bReturning = false;
+		return true;
 	}
 
 	void Interpreter::Execute( std::unique_ptr<Statement> s )
 	{
+		Resolve( s.get() );
 		Execute( s.get() );
 		m_pStatements.push_back( std::move( s ) );
 	}
 
 	void Interpreter::Execute( Statement* s )
 	{
+		if( m_pProfiler )
+		{
+			m_ProfileFrames.back().line = s->Location().Line();
+			if( Profiler::SamplePending() )
+			{
+				m_pProfiler->AddSample( m_ProfileFrames );
+			}
+		}
+
 		s->Accept( this );
 	}
 
@@ -68,36 +196,27 @@ namespace Bat
 
 	void Interpreter::AddNative( const std::string& name, BatNativeCallback callback )
 	{
-		auto native = BatObject( new BatNative( std::move( callback ) ) );
-		auto loc = SourceLoc( 0, 0 );
-		AddVar( name, native, loc );
+		AddBinding( name, NativeBinding::Generic( std::move( callback ) ) );
 	}
-
-	void Interpreter::AddVar( const std::string& name, const BatObject& value, const SourceLoc& loc )
+	void Interpreter::AddBinding( const std::string& name, NativeBinding binding )
 	{
-		if( !m_pEnvironment->AddVar( name, value ) )
-		{
-			throw RuntimeError( loc, name + " is already defined in this scope" );
-		}
+		int slot = m_Resolver.GlobalSlot( name );
+		m_pGlobals->Resize( m_Resolver.NumGlobals() );
+		m_pGlobals->Slot( slot ) = BatObject( new BatNative( std::move( binding ) ) );
 	}
 
-	void Interpreter::SetVar( const std::string& name, const BatObject& value, const SourceLoc& loc )
+	void Interpreter::SetProfiler( Profiler* profiler )
 	{
-		if( !m_pEnvironment->SetVar( name, value ) )
-		{
-			throw RuntimeError( loc, name + " is not defined" );
-		}
+		static const std::string s_Main = "main";
+
+		m_pProfiler = profiler;
+		m_ProfileFrames.clear();
+		m_ProfileFrames.push_back( { &s_Main, 0 } );
 	}
 
-	const BatObject& Interpreter::GetVar( const std::string& name, const SourceLoc& loc )
+	void Interpreter::Unresolved( const Token& name )
 	{
-		const BatObject* obj = m_pEnvironment->GetVar( name );
-		if( !obj )
-		{
-			throw RuntimeError( loc, name + " is not defined" );
-		}
-
-		return *obj;
+		throw RuntimeError( name.loc, name.lexeme + " is not defined" );
 	}
 
 	bool Interpreter::IsTruthy( const BatObject& obj, const SourceLoc& loc )
@@ -122,7 +241,7 @@ namespace Bat
 	}
 	void Interpreter::VisitStringLiteral( StringLiteral* node )
 	{
-		BAT_RETURN( node->value );
+		BAT_RETURN( BatObject( node->value ) );
 	}
 	void Interpreter::VisitTokenLiteral( TokenLiteral* node )
 	{
@@ -209,6 +328,18 @@ namespace Bat
 	}
 	void Interpreter::VisitCallExpr( CallExpr* node )
 	{
+		CallDepth depth( m_iCallDepth );
+		char marker;
+		uintptr_t stack = reinterpret_cast<uintptr_t>(&marker);
+		if( m_iCallDepth == 1 )
+		{
+			m_iStackBase = stack;
+		}
+		else if( m_iStackBase - stack > MAX_NATIVE_STACK )
+		{
+			throw RuntimeError( node->Location(), "Stack overflow" );
+		}
+
 		try
 		{
 			BatObject func = Evaluate( node->Function() );
@@ -216,7 +347,18 @@ namespace Bat
 			std::vector<BatObject> arguments;
 			for( size_t i = 0; i < num_args; i++ )
 			{
-				arguments.push_back( Evaluate( node->Arg( i ) ) );
+				arguments.push_back( CopyValue( Evaluate( node->Arg( i ) ), node->Arg( i )->Type() ) );
+			}
+
+			if( m_pProfiler )
+			{
+				// Also a sampling point, otherwise samples due while evaluating a call land on the callee's first statement
+				if( Profiler::SamplePending() )
+				{
+					m_pProfiler->AddSample( m_ProfileFrames );
+				}
+				ProfileFrameScope frame( m_ProfileFrames, node );
+				BAT_RETURN( func.Call( *this, arguments ) );
 			}
 
 			BAT_RETURN( func.Call( *this, arguments ) );
@@ -315,7 +457,7 @@ namespace Bat
 	}
 	void Interpreter::VisitVarExpr( VarExpr* node )
 	{
-		BAT_RETURN( GetVar( node->Identifier().lexeme, node->Location() ) );
+		BAT_RETURN( Variable( node->Slot(), node->Identifier() ) );
 	}
 	void Interpreter::VisitExpressionStmt( ExpressionStmt* node )
 	{
@@ -344,7 +486,7 @@ namespace Bat
 				BatObject index = Evaluate( i->Index() );
 				current = arr.Index( index );
 			}
-			BatObject assign = Evaluate( r );
+			BatObject assign = CopyValue( Evaluate( r ), r->Type() );
 
 			BatObject newval;
 			switch( node->Op() )
@@ -361,7 +503,7 @@ namespace Bat
 			}
 			if( VarExpr* v = l->ToVarExpr() )
 			{
-				SetVar( v->Identifier().lexeme, newval, node->Location() );
+				Variable( v->Slot(), v->Identifier() ) = newval;
 			}
 			else if( IndexExpr* i = l->ToIndexExpr() )
 			{
@@ -380,9 +522,9 @@ namespace Bat
 	}
 	void Interpreter::VisitBlockStmt( BlockStmt* node )
 	{
-		Environment environment( m_pEnvironment );
+		Environment environment( m_pEnvironment, node->NumSlots() );
 		size_t count = node->NumStatements();
-		for( size_t i = 0; i < count; i++ )
+		for( size_t i = 0; i < count && !m_bReturning; i++ )
 		{
 			ExecuteBlock( node->Stmt( i ), environment );
 		}
@@ -408,6 +550,7 @@ namespace Bat
 		while( IsTruthy( Evaluate( node->Condition() ), node->Condition()->Location() ) )
 		{
 			Execute( node->Body() );
+			if( m_bReturning ) break;
 		}
 	}
 	void Interpreter::VisitForStmt( ForStmt* node )
@@ -417,63 +560,69 @@ namespace Bat
 			Evaluate( node->Increment() ) )
 		{
 			Execute( node->Body() );
+			if( m_bReturning ) break;
 		}
 	}
 	void Interpreter::VisitReturnStmt( ReturnStmt* node )
 	{
-		ReturnValue ret;
-		if( node->RetExpr() )
+		// `return f(...)` of a script function hands f and its arguments to the call being returned from, so that
+		// tail recursion doesn't nest. Not while profiling, samples keep the full chain of calls.
+		CallExpr* call = node->RetExpr() ? node->RetExpr()->ToCallExpr() : nullptr;
+		if( call && m_iCallDepth > 0 && !m_pProfiler )
 		{
-			ret.value = Evaluate( node->RetExpr() );
+			BatObject func = Evaluate( call->Function() );
+			if( func.type == TYPE_CALLABLE && func.Function()->ToFunction() )
+			{
+				std::vector<BatObject> arguments;
+				for( size_t i = 0; i < call->NumArgs(); i++ )
+				{
+					arguments.push_back( CopyValue( Evaluate( call->Arg( i ) ), call->Arg( i )->Type() ) );
+				}
+				m_pTailCall = func.Function()->ToFunction();
+				m_TailCallArgs = std::move( arguments );
+				m_bReturning = true;
+				return;
+			}
 		}
 
-		throw ret;
+		m_ReturnValue = node->RetExpr() ? CopyValue( Evaluate( node->RetExpr() ), node->RetExpr()->Type() ) : BatObject();
+		m_bReturning = true;
 	}
 	void Interpreter::VisitImportStmt( ImportStmt* node )
 	{
-		std::string filename = node->ModuleName() + ".bat";
-		if( !std::ifstream( filename ) )
+		for( const auto& stmt : node->Statements() )
 		{
-			filename = node->ModuleName() + ".bs";
-			if( !std::ifstream( filename ) )
-			{
-				ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Module '" + node->ModuleName() + "' not found" );
-			}
-		}
-
-		auto source = MemoryStream::FromFile( filename, FileMode::TEXT );
-
-		Lexer l( source.Base() );
-		auto tokens = l.Scan();
-
-		if( ErrorSys::HadError() ) return;
-
-		Parser p( std::move( tokens ) );
-		std::vector<std::unique_ptr<Statement>> res = p.Parse();
-
-		if( ErrorSys::HadError() ) return;
-
-		for( size_t i = 0; i < res.size(); i++ )
-		{
-			Execute( std::move( res[i] ) );
+			Execute( stmt.get() );
 		}
 	}
 	void Interpreter::VisitNativeStmt( NativeStmt* node )
 	{
 		// Natives are more like forward declarations as a hint to the compiler for static checks
 		// When executing they aren't needed
+		if( node->Signature().Async() )
+		{
+			throw RuntimeError( node->Location(), "Async natives are only supported by the stack VM" );
+		}
 	}
 	void Interpreter::VisitVarDecl( VarDecl* node )
 	{
 		BatObject initial;
 		if( node->Initializer() )
 		{
-			initial = Evaluate( node->Initializer() );
+			initial = CopyValue( Evaluate( node->Initializer() ), node->Initializer()->Type() );
+		}
+		else if( node->Type()->IsArray() )
+		{
+			initial = DefaultValue( node->Type() );
 		}
-		AddVar( node->Identifier().lexeme, initial, node->Identifier().loc );
+		Variable( node->Slot(), node->Identifier() ) = std::move( initial );
 	}
 	void Interpreter::VisitFuncDecl( FuncDecl* node )
 	{
-		AddVar( node->Signature().Identifier().lexeme, new BatFunction( node ), node->Signature().Identifier().loc );
+		if( node->Signature().Async() )
+		{
+			throw RuntimeError( node->Location(), "Async functions are only supported by the stack VM" );
+		}
+		Variable( node->Slot(), node->Signature().Identifier() ) = BatObject( new BatFunction( node ) );
 	}
 }
@@ -4,6 +4,8 @@
 #include "bat_object.h"
 #include "bat_callable.h"
 #include "environment.h"
+#include "profiler.h"
+#include "resolver.h"
 
 namespace Bat
 {
@@ -16,16 +18,40 @@ namespace Bat
 		void Execute( std::unique_ptr<Statement> s );
 		void Execute( Statement* s );
 		BatObject Evaluate( Expression* e );
+		// Evaluates in the given environment, used for default values of parameters
+		BatObject Evaluate( Expression* e, Environment& environment );
 		void ExecuteBlock( Statement* s, Environment& environment );
+		// Assigns variable slots, has to run on every top level statement before it's executed
+		void Resolve( Statement* s );
+		// Picks up the value of the return statement that ended the current call, and resumes executing statements
+		BatObject TakeReturnValue();
+		// Picks up the function and arguments of a `return f(...)` that ended the current call, which the caller
+		// executes in place of a nested call. Returns false if the call ended with a regular return.
+		bool TakeTailCall( BatFunction*& function, std::vector<BatObject>& args );
 
 		void AddNative( const std::string& name, BatNativeCallback callback );
+		// Binds a C++ function as a native, see NativeBinding::Typed
+		template <typename R, typename... Args>
+		void Bind( const std::string& name, R (*function)( Args... ) )
+		{
+			AddBinding( name, NativeBinding::Typed( function ) );
+		}
 		Environment* GetEnvironment() { return m_pEnvironment; }
 		const Environment* GetEnvironment() const { return m_pEnvironment; }
+		Environment* GetGlobals() { return m_pGlobals; }
+
+		// Takes samples for profiler while executing (see profiler.h), nullptr to stop
+		void SetProfiler( Profiler* profiler );
 	private:
 		// Helper functions that do error checking, and throw runtime exceptions when stuff goes wrong
-		void AddVar( const std::string& name, const BatObject& value, const SourceLoc& loc );
-		void SetVar( const std::string& name, const BatObject& value, const SourceLoc& loc );
-		const BatObject& GetVar( const std::string& name, const SourceLoc& loc );
+		BatObject& Variable( const VarSlot& slot, const Token& name )
+		{
+			if( slot.depth == VarSlot::GLOBAL ) return m_pGlobals->Slot( slot.index );
+			if( slot.depth == VarSlot::UNRESOLVED ) Unresolved( name );
+			return m_pEnvironment->Ancestor( slot.depth )->Slot( slot.index );
+		}
+		[[noreturn]] void Unresolved( const Token& name );
+		void AddBinding( const std::string& name, NativeBinding binding );
 		bool IsTruthy( const BatObject& obj, const SourceLoc& loc );
 
 		virtual void VisitIntLiteral( IntLiteral* node ) override;
@@ -54,7 +80,24 @@ namespace Bat
 		virtual void VisitFuncDecl( FuncDecl* node ) override;
 	private:
 		BatObject m_Result;
+		// Set by a return statement, blocks and loops stop executing until the returning call takes the value
+		bool m_bReturning = false;
+		BatObject m_ReturnValue;
+		// Set instead of m_ReturnValue by a return statement that tail calls a script function
+		BatFunction* m_pTailCall = nullptr;
+		std::vector<BatObject> m_TailCallArgs;
+		// Calls being executed, and where the native stack was when the outermost one started
+		// The interpreter recurses on the native stack, calls report a stack overflow before they use more than
+		// MAX_NATIVE_STACK of it. Builds reserve 8 MB of stack for every thread (see BatScript.vcxproj).
+		static constexpr uintptr_t MAX_NATIVE_STACK = 6 * 1024 * 1024;
+		size_t m_iCallDepth = 0;
+		uintptr_t m_iStackBase = 0;
 		Environment* m_pEnvironment;
+		Environment* m_pGlobals;
+		Resolver m_Resolver;
+		Profiler* m_pProfiler = nullptr;
+		// Calls being executed while profiling, each with the line of the statement it's at
+		std::vector<Profiler::Frame> m_ProfileFrames;
 		std::vector<std::unique_ptr<Statement>> m_pStatements; // Not actually used, but interpreter relies on having AST references always alive, so it manages the lifetime
 	};
 }
\ No newline at end of file
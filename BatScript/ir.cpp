@@ -0,0 +1,352 @@
+#include "ir.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <sstream>
+
+namespace Bat
+{
+	bool IrInstr::IsTerminator() const
+	{
+		switch( op )
+		{
+		case IrOp::JUMP:
+		case IrOp::BRANCH:
+		case IrOp::RETURN:
+		case IrOp::TAILCALL:
+			return true;
+		default:
+			return false;
+		}
+	}
+	bool IrInstr::HasResult() const
+	{
+		return op != IrOp::STORE_GLOBAL && op != IrOp::PRINT && !IsTerminator();
+	}
+	double IrInstr::Float() const
+	{
+		assert( op == IrOp::CONST && type == IrType::FLOAT );
+		double value;
+		std::memcpy( &value, &imm, sizeof( value ) );
+		return value;
+	}
+
+	IrInstr* IrBlock::Terminator() const
+	{
+		return (!instrs.empty() && instrs.back()->IsTerminator()) ? instrs.back() : nullptr;
+	}
+	void IrBlock::InsertBeforeTerminator( IrInstr* instr )
+	{
+		assert( Terminator() );
+		instrs.insert( instrs.end() - 1, instr );
+		instr->block = this;
+	}
+	void IrBlock::Remove( IrInstr* instr )
+	{
+		auto& list = (instr->op == IrOp::PHI) ? phis : instrs;
+		list.erase( std::find( list.begin(), list.end(), instr ) );
+		instr->block = nullptr;
+	}
+
+	IrEffect EffectOf( const IrInstr* instr )
+	{
+		switch( instr->op )
+		{
+		case IrOp::DIV:
+		case IrOp::MOD:
+		{
+			// Float division doesn't trap, mod always works on the bits like for ints
+			if( instr->op == IrOp::DIV && instr->type == IrType::FLOAT )
+			{
+				return IrEffect::NONE;
+			}
+			const IrInstr* divisor = instr->args[1];
+			const bool safe = divisor->IsConst() && divisor->type != IrType::FLOAT && divisor->imm != 0 && divisor->imm != -1;
+			return safe ? IrEffect::NONE : IrEffect::TRAP;
+		}
+		case IrOp::LOAD_GLOBAL:
+			return IrEffect::READ_GLOBAL;
+		case IrOp::STORE_GLOBAL:
+			return IrEffect::WRITE_GLOBAL;
+		case IrOp::CALL:
+		case IrOp::NATIVE:
+		case IrOp::PRINT:
+			return IrEffect::OTHER;
+		default:
+			return instr->IsTerminator() ? IrEffect::OTHER : IrEffect::NONE;
+		}
+	}
+	bool Conflicts( const IrInstr* a, const IrInstr* b )
+	{
+		IrEffect ea = EffectOf( a );
+		IrEffect eb = EffectOf( b );
+		if( ea == IrEffect::NONE || eb == IrEffect::NONE )
+		{
+			return false;
+		}
+		if( ea > eb )
+		{
+			std::swap( a, b );
+			std::swap( ea, eb );
+		}
+		switch( ea )
+		{
+		case IrEffect::TRAP:
+			// A runtime error must stop the script before the effects that follow it, and after those that precede it
+			return eb != IrEffect::READ_GLOBAL;
+		case IrEffect::READ_GLOBAL:
+			return eb == IrEffect::OTHER || (eb == IrEffect::WRITE_GLOBAL && a->imm == b->imm);
+		case IrEffect::WRITE_GLOBAL:
+			return eb == IrEffect::OTHER || a->imm == b->imm;
+		default:
+			return true;
+		}
+	}
+
+	const char* ToString( IrOp op )
+	{
+		switch( op )
+		{
+#define _(name, mnemonic) case IrOp::name: return #mnemonic;
+			IR_OPS( _ )
+#undef _
+		}
+		return "?";
+	}
+	const char* ToString( IrType type )
+	{
+		switch( type )
+		{
+		case IrType::VOID:   return "void";
+		case IrType::BOOL:   return "bool";
+		case IrType::INT:    return "int";
+		case IrType::FLOAT:  return "float";
+		case IrType::STRING: return "string";
+		}
+		return "?";
+	}
+
+	IrFunction::IrFunction( const std::string& name, size_t num_params, bool mainline )
+		:
+		m_Name( name ),
+		m_nParams( num_params ),
+		m_bMainline( mainline )
+	{}
+	IrInstr* IrFunction::NewInstr( IrOp op, IrType type, std::vector<IrInstr*> args, int64_t imm )
+	{
+		auto instr = std::make_unique<IrInstr>();
+		instr->op = op;
+		instr->type = type;
+		instr->args = std::move( args );
+		instr->imm = imm;
+		instr->id = (int)m_Instrs.size();
+		m_Instrs.push_back( std::move( instr ) );
+		return m_Instrs.back().get();
+	}
+	IrInstr* IrFunction::NewConst( IrType type, int64_t value )
+	{
+		return NewInstr( IrOp::CONST, type, {}, value );
+	}
+	IrInstr* IrFunction::NewFloatConst( double value )
+	{
+		int64_t bits;
+		std::memcpy( &bits, &value, sizeof( bits ) );
+		return NewInstr( IrOp::CONST, IrType::FLOAT, {}, bits );
+	}
+	IrBlock* IrFunction::NewBlock()
+	{
+		auto block = std::make_unique<IrBlock>();
+		block->id = m_iNextBlockId++;
+		m_Blocks.push_back( std::move( block ) );
+		return m_Blocks.back().get();
+	}
+	void IrFunction::AddEdge( IrBlock* from, IrBlock* to )
+	{
+		from->succs.push_back( to );
+		to->preds.push_back( from );
+	}
+	void IrFunction::RemoveEdge( IrBlock* from, IrBlock* to )
+	{
+		from->succs.erase( std::find( from->succs.begin(), from->succs.end(), to ) );
+
+		const size_t index = std::find( to->preds.begin(), to->preds.end(), from ) - to->preds.begin();
+		to->preds.erase( to->preds.begin() + index );
+		for( IrInstr* phi : to->phis )
+		{
+			phi->args.erase( phi->args.begin() + index );
+		}
+	}
+	std::vector<IrBlock*> IrFunction::ReversePostorder() const
+	{
+		std::vector<IrBlock*> order;
+		std::vector<bool> visited( m_iNextBlockId, false );
+		std::function<void( IrBlock* )> visit = [&]( IrBlock* block )
+		{
+			visited[block->id] = true;
+			// Successors are visited last to first, so that the first one, e.g. the body of a loop, comes first
+			for( auto it = block->succs.rbegin(); it != block->succs.rend(); ++it )
+			{
+				if( !visited[(*it)->id] )
+				{
+					visit( *it );
+				}
+			}
+			order.push_back( block );
+		};
+		visit( Entry() );
+
+		std::reverse( order.begin(), order.end() );
+		return order;
+	}
+	void IrFunction::ReplaceUses( IrInstr* from, IrInstr* to )
+	{
+		for( const auto& block : m_Blocks )
+		{
+			for( auto* list : { &block->phis, &block->instrs } )
+			{
+				for( IrInstr* instr : *list )
+				{
+					std::replace( instr->args.begin(), instr->args.end(), from, to );
+				}
+			}
+		}
+	}
+	void IrFunction::RemoveUnreachableBlocks()
+	{
+		std::vector<bool> reachable( m_iNextBlockId, false );
+		for( IrBlock* block : ReversePostorder() )
+		{
+			reachable[block->id] = true;
+		}
+
+		for( const auto& block : m_Blocks )
+		{
+			if( !reachable[block->id] )
+			{
+				while( !block->succs.empty() )
+				{
+					RemoveEdge( block.get(), block->succs.front() );
+				}
+			}
+		}
+		m_Blocks.erase( std::remove_if( m_Blocks.begin(), m_Blocks.end(), [&]( const auto& block ) { return !reachable[block->id]; } ), m_Blocks.end() );
+	}
+	void IrFunction::SplitCriticalEdges()
+	{
+		const size_t num_blocks = m_Blocks.size();
+		for( size_t i = 0; i < num_blocks; i++ )
+		{
+			IrBlock* from = m_Blocks[i].get();
+			if( from->succs.size() < 2 )
+			{
+				continue;
+			}
+			for( IrBlock*& to : from->succs )
+			{
+				if( to->preds.size() < 2 )
+				{
+					continue;
+				}
+				IrBlock* split = NewBlock();
+				*std::find( to->preds.begin(), to->preds.end(), from ) = split;
+				split->preds.push_back( from );
+				split->succs.push_back( to );
+				IrInstr* jump = NewInstr( IrOp::JUMP, IrType::VOID );
+				jump->line = from->Terminator()->line;
+				jump->block = split;
+				split->instrs.push_back( jump );
+				to = split;
+			}
+		}
+	}
+
+	static void DumpArg( std::ostream& out, const IrInstr* arg )
+	{
+		if( !arg->IsConst() )
+		{
+			out << 'v' << arg->id;
+			return;
+		}
+		switch( arg->type )
+		{
+		case IrType::BOOL:   out << (arg->imm ? "true" : "false"); break;
+		case IrType::FLOAT:  out << arg->Float(); break;
+		case IrType::STRING: out << '"' << arg->name << '"'; break;
+		default:             out << arg->imm; break;
+		}
+	}
+	void IrFunction::Dump( std::ostream& out ) const
+	{
+		//  function add(2)
+		//  b0:
+		//    v0 int = param 0
+		//    v2 int = add v0 v1          ; line 3
+		//    return v2
+		out << "function " << m_Name << '(' << m_nParams << ")\n";
+		for( IrBlock* block : ReversePostorder() )
+		{
+			out << 'b' << block->id << ':';
+			if( !block->preds.empty() )
+			{
+				out << " preds";
+				for( IrBlock* pred : block->preds )
+				{
+					out << " b" << pred->id;
+				}
+			}
+			out << '\n';
+
+			int line = 0;
+			for( auto* list : { &block->phis, &block->instrs } )
+			{
+				for( const IrInstr* instr : *list )
+				{
+					std::ostringstream text;
+					text << "  ";
+					if( instr->HasResult() )
+					{
+						text << 'v' << instr->id << ' ' << ToString( instr->type ) << " = ";
+					}
+					text << ToString( instr->op );
+					if( instr->op == IrOp::CONST )
+					{
+						text << ' ';
+						DumpArg( text, instr );
+					}
+					if( instr->op == IrOp::PARAM )
+					{
+						text << ' ' << instr->imm;
+					}
+					if( !instr->name.empty() && instr->op != IrOp::CONST )
+					{
+						text << ' ' << instr->name;
+					}
+					for( const IrInstr* arg : instr->args )
+					{
+						text << ' ';
+						DumpArg( text, arg );
+					}
+					if( instr->IsTerminator() )
+					{
+						for( IrBlock* succ : block->succs )
+						{
+							text << " b" << succ->id;
+						}
+					}
+
+					std::string s = text.str();
+					if( instr->line != line && instr->line > 0 )
+					{
+						s.resize( std::max<size_t>( s.size() + 1, 40 ), ' ' );
+						s += "; line " + std::to_string( instr->line );
+						line = instr->line;
+					}
+					out << s << '\n';
+				}
+			}
+		}
+		out << '\n';
+	}
+}
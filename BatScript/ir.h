@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// name, mnemonic
+#define IR_OPS(_) \
+	_(CONST,        const)        \
+	/* Value of a parameter, in the entry block */ \
+	_(PARAM,        param)        \
+	_(PHI,          phi)          \
+	_(LOAD_GLOBAL,  load)         \
+	_(STORE_GLOBAL, store)        \
+	\
+	_(ADD,          add)          \
+	_(SUB,          sub)          \
+	_(MUL,          mul)          \
+	_(DIV,          div)          \
+	_(MOD,          mod)          \
+	_(SHL,          shl)          \
+	_(SHR,          shr)          \
+	_(BITAND,       bitand)       \
+	_(BITOR,        bitor)        \
+	_(BITXOR,       bitxor)       \
+	_(EQ,           eq)           \
+	_(NEQ,          neq)          \
+	_(LESS,         less)         \
+	_(LESSE,        lesse)        \
+	_(GRT,          grt)          \
+	_(GRTE,         grte)         \
+	_(NEG,          neg)          \
+	_(NOT,          not)          \
+	_(BITNOT,       bitnot)       \
+	_(ITOF,         itof)         \
+	_(FTOI,         ftoi)         \
+	_(TO_BOOL,      bool)         \
+	\
+	_(CALL,         call)         \
+	_(NATIVE,       native)       \
+	_(PRINT,        print)        \
+	\
+	/* Terminators, every block ends with exactly one */ \
+	_(JUMP,         jump)         \
+	_(BRANCH,       branch)       \
+	_(RETURN,       return)       \
+	_(TAILCALL,     tailcall)
+
+namespace Bat
+{
+	// Mid-level representation of the code of a function or the mainline, which the optimizations of -O2 work on
+	// (see ir_builder.h, ir_optimizer.h and ir_schedule.h)
+	// The code is a control flow graph of basic blocks in static single assignment form: every instruction with a
+	// result defines a value exactly once, and the phis at the start of a block pick the value from whichever
+	// predecessor the block was entered from. Parameters and locals are values, globals are loaded and stored.
+	enum class IrOp
+	{
+#define _(name, mnemonic) name,
+		IR_OPS( _ )
+#undef _
+	};
+
+	// Bools are 0 or 1 and strings are indices of string literals like they are in the VM, void calls still push 0
+	enum class IrType
+	{
+		VOID,
+		BOOL,
+		INT,
+		FLOAT,
+		STRING
+	};
+
+	struct IrBlock;
+
+	struct IrInstr
+	{
+		IrOp op;
+		IrType type;
+		// Values the instruction uses, binary ops are (left, right) and phis have one for every predecessor
+		std::vector<IrInstr*> args;
+		// CONST: the value, the bits of floats
+		// PARAM: index of the parameter
+		// LOAD_GLOBAL, STORE_GLOBAL: address of the global
+		// CALL, TAILCALL: address of the function
+		// NATIVE: index of the native
+		int64_t imm = 0;
+		// Name of the global or function, or the contents of a string constant
+		std::string name;
+		IrBlock* block = nullptr;
+		int id = 0;
+		int line = 0;
+
+		bool IsTerminator() const;
+		// Whether the instruction leaves a value on the stack of the VM
+		bool HasResult() const;
+		bool IsConst() const { return op == IrOp::CONST; }
+		double Float() const;
+	};
+
+	struct IrBlock
+	{
+		int id = 0;
+		std::vector<IrInstr*> phis;
+		// The last one is the terminator
+		std::vector<IrInstr*> instrs;
+		// Phis have their arguments in the order of preds
+		// Branches go to the first successor if their condition holds, to the second otherwise
+		std::vector<IrBlock*> preds;
+		std::vector<IrBlock*> succs;
+
+		IrInstr* Terminator() const;
+		// Inserts instr before the terminator
+		void InsertBeforeTerminator( IrInstr* instr );
+		void Remove( IrInstr* instr );
+	};
+
+	// How an instruction interacts with the ones around it, for moving it
+	enum class IrEffect
+	{
+		NONE,
+		// Integer division by something that may be 0 or -1
+		TRAP,
+		READ_GLOBAL,
+		WRITE_GLOBAL,
+		// Calls, prints and terminators
+		OTHER
+	};
+	IrEffect EffectOf( const IrInstr* instr );
+	// Whether a and b have to run in the order they're in
+	bool Conflicts( const IrInstr* a, const IrInstr* b );
+
+	const char* ToString( IrOp op );
+	const char* ToString( IrType type );
+
+	// Globals that a function reads or writes, including through the functions it calls, by address
+	struct IrGlobalAccess
+	{
+		std::set<int64_t> accessed;
+		std::set<int64_t> written;
+		// Set if it calls a function that isn't known, which may access any of them
+		bool any = false;
+	};
+
+	class IrFunction
+	{
+	public:
+		IrFunction( const std::string& name, size_t num_params, bool mainline );
+
+		const std::string& Name() const { return m_Name; }
+		size_t NumParams() const { return m_nParams; }
+		bool IsMainline() const { return m_bMainline; }
+
+		// Instructions belong to the function, they're only added to a block by the caller
+		IrInstr* NewInstr( IrOp op, IrType type, std::vector<IrInstr*> args = {}, int64_t imm = 0 );
+		IrInstr* NewConst( IrType type, int64_t value );
+		IrInstr* NewFloatConst( double value );
+		IrBlock* NewBlock();
+		void AddEdge( IrBlock* from, IrBlock* to );
+		// Also drops the arguments of phis in to for the edge
+		void RemoveEdge( IrBlock* from, IrBlock* to );
+
+		IrBlock* Entry() const { return m_Blocks.front().get(); }
+		const std::vector<std::unique_ptr<IrBlock>>& Blocks() const { return m_Blocks; }
+		// Blocks reachable from the entry, each one before its successors except along back edges
+		std::vector<IrBlock*> ReversePostorder() const;
+
+		void ReplaceUses( IrInstr* from, IrInstr* to );
+		void RemoveUnreachableBlocks();
+		// Puts an empty block on every edge from a block with several successors to one with several predecessors,
+		// so that whatever happens on the edge has a block of its own
+		void SplitCriticalEdges();
+
+		void Dump( std::ostream& out ) const;
+	private:
+		std::string m_Name;
+		size_t m_nParams;
+		bool m_bMainline;
+		std::vector<std::unique_ptr<IrInstr>> m_Instrs;
+		std::vector<std::unique_ptr<IrBlock>> m_Blocks;
+		int m_iNextBlockId = 0;
+	};
+}
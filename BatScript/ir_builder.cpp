@@ -0,0 +1,839 @@
+#include "ir_builder.h"
+
+#include "type_manager.h"
+
+namespace Bat
+{
+	IrBuilder::IrBuilder( SymbolTable* globals, const std::unordered_set<FunctionSymbol*>& inlined,
+		const std::unordered_map<FunctionSymbol*, IrGlobalAccess>& access )
+		:
+		m_pGlobals( globals ),
+		m_InlinedFunctions( inlined ),
+		m_CalleeAccess( access )
+	{}
+	std::unique_ptr<IrFunction> IrBuilder::BuildFunction( FuncDecl* node, FunctionSymbol* func )
+	{
+		m_pFuncSymbol = func;
+		m_nArgs = node->Signature().NumParams();
+		BlockStmt* body = node->Body()->ToBlockStmt();
+		if( !body || node->Signature().Async() )
+		{
+			return nullptr;
+		}
+
+		std::vector<Statement*> statements;
+		for( size_t i = 0; i < body->NumStatements(); i++ )
+		{
+			statements.push_back( body->Stmt( i ) );
+		}
+		return Build( node, statements );
+	}
+	std::unique_ptr<IrFunction> IrBuilder::BuildMainline( const std::vector<Statement*>& statements )
+	{
+		m_pFuncSymbol = nullptr;
+		m_nArgs = 0;
+		return Build( nullptr, statements );
+	}
+	std::unique_ptr<IrFunction> IrBuilder::Build( FuncDecl* node, const std::vector<Statement*>& statements )
+	{
+		m_KnownGlobals.clear();
+		m_AssignedGlobals.clear();
+		do
+		{
+			m_bRestart = false;
+			m_bFailed = false;
+			m_bClobbered = false;
+			m_bSynced = false;
+			m_iNumReturns = 0;
+			m_bRecursive = false;
+			m_Vars.clear();
+			m_Scopes.clear();
+			m_GlobalVars.clear();
+			m_Defs.clear();
+			m_Sealed.clear();
+			m_IncompletePhis.clear();
+			m_Access = {};
+
+			const std::string name = node ? node->Signature().Identifier().lexeme : "main";
+			m_pFunction = std::make_unique<IrFunction>( name, m_nArgs, node == nullptr );
+			SetBlock( NewBlock() );
+			SealBlock( m_pBlock );
+
+			for( const auto& [address, global] : m_KnownGlobals )
+			{
+				m_GlobalVars[address] = AddVariable( global.type, address, global.name );
+			}
+
+			if( node )
+			{
+				// Parameters are in scope of the body, which has a scope of its own like in the stack compiler
+				auto& sig = node->Signature();
+				m_iLine = node->Location().Line();
+				m_Scopes.emplace_back();
+				for( size_t i = 0; i < sig.NumParams(); i++ )
+				{
+					IrType type;
+					if( !ToIrType( TypeSpecifierToType( sig.ParamType( i ) ), type ) )
+					{
+						return nullptr;
+					}
+					const int var = AddVariable( type, -1, sig.ParamIdent( i ).lexeme );
+					m_Scopes.back()[sig.ParamIdent( i ).lexeme] = var;
+					WriteVariable( var, m_pBlock, Append( IrOp::PARAM, type, {}, (int64_t)i ) );
+				}
+				m_Scopes.emplace_back();
+			}
+
+			for( Statement* stmt : statements )
+			{
+				stmt->Accept( this );
+				if( m_bFailed )
+				{
+					return nullptr;
+				}
+			}
+
+			// Function bodies end with a return, so this is only reached by the mainline
+			SyncGlobals();
+			Append( IrOp::RETURN, IrType::VOID );
+		} while( m_bRestart );
+
+		if( m_bFailed )
+		{
+			return nullptr;
+		}
+		for( const auto& [address, global] : m_KnownGlobals )
+		{
+			m_Access.accessed.insert( address );
+		}
+		m_Access.written.insert( m_AssignedGlobals.begin(), m_AssignedGlobals.end() );
+		m_pFunction->RemoveUnreachableBlocks();
+		return std::move( m_pFunction );
+	}
+	IrInstr* IrBuilder::BuildValue( Expression* e )
+	{
+		m_pValue = nullptr;
+		e->Accept( this );
+		if( !m_pValue )
+		{
+			// Whatever failed leaves the build to fail, this keeps the rest of it going until then
+			Fail();
+			m_pValue = m_pFunction->NewConst( IrType::INT, 0 );
+		}
+		return m_pValue;
+	}
+	IrInstr* IrBuilder::Append( IrOp op, IrType type, std::vector<IrInstr*> args, int64_t imm )
+	{
+		IrInstr* instr = m_pFunction->NewInstr( op, type, std::move( args ), imm );
+		instr->line = m_iLine;
+		instr->block = m_pBlock;
+		m_pBlock->instrs.push_back( instr );
+		return instr;
+	}
+	IrInstr* IrBuilder::Terminate( IrOp op, std::vector<IrInstr*> args, int64_t imm )
+	{
+		IrInstr* instr = Append( op, IrType::VOID, std::move( args ), imm );
+
+		// Whatever follows can't be reached, it's built anyway and removed afterwards
+		SetBlock( NewBlock() );
+		SealBlock( m_pBlock );
+		return instr;
+	}
+	void IrBuilder::Jump( IrBlock* to )
+	{
+		Append( IrOp::JUMP, IrType::VOID );
+		m_pFunction->AddEdge( m_pBlock, to );
+	}
+	IrBlock* IrBuilder::NewBlock()
+	{
+		IrBlock* block = m_pFunction->NewBlock();
+		m_Defs.resize( block->id + 1 );
+		m_Sealed.resize( block->id + 1, false );
+		m_IncompletePhis.resize( block->id + 1 );
+		return block;
+	}
+	bool IrBuilder::ToIrType( const Type* type, IrType& out )
+	{
+		const PrimitiveType* primitive = type ? type->ToPrimitive() : nullptr;
+		if( !primitive )
+		{
+			Fail();
+			return false;
+		}
+
+		switch( primitive->PrimKind() )
+		{
+		case PrimitiveKind::Void:   out = IrType::VOID; break;
+		case PrimitiveKind::Bool:   out = IrType::BOOL; break;
+		case PrimitiveKind::Int:    out = IrType::INT; break;
+		case PrimitiveKind::Float:  out = IrType::FLOAT; break;
+		case PrimitiveKind::String: out = IrType::STRING; break;
+		}
+		return true;
+	}
+	int IrBuilder::AddVariable( IrType type, int64_t address, const std::string& name )
+	{
+		m_Vars.push_back( { type, address, name } );
+		return (int)m_Vars.size() - 1;
+	}
+	int IrBuilder::LookupVariable( const std::string& name )
+	{
+		for( auto scope = m_Scopes.rbegin(); scope != m_Scopes.rend(); ++scope )
+		{
+			auto it = scope->find( name );
+			if( it != scope->end() )
+			{
+				return it->second;
+			}
+		}
+
+		Symbol* symbol = m_pGlobals->GetSymbol( name );
+		VariableSymbol* global = symbol ? symbol->AsVariable() : nullptr;
+		IrType type;
+		if( !global || global->Storage() != StorageClass::GLOBAL || !ToIrType( global->VarType(), type ) )
+		{
+			Fail();
+			return -1;
+		}
+
+		auto it = m_GlobalVars.find( global->Address() );
+		if( it != m_GlobalVars.end() )
+		{
+			return it->second;
+		}
+
+		// Calls so far didn't reload it, so start over with the global known from the start
+		m_KnownGlobals[global->Address()] = { type, global->Address(), name };
+		if( m_bClobbered )
+		{
+			m_bRestart = true;
+		}
+		const int var = AddVariable( type, global->Address(), name );
+		m_GlobalVars[global->Address()] = var;
+		return var;
+	}
+	bool IrBuilder::IsLocal( const std::string& name ) const
+	{
+		for( const auto& scope : m_Scopes )
+		{
+			if( scope.count( name ) )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	void IrBuilder::AssignVariable( int var, IrInstr* value )
+	{
+		const int64_t address = m_Vars[var].address;
+		if( address >= 0 && m_AssignedGlobals.insert( address ).second && m_bSynced )
+		{
+			// Stores before this missed it, e.g. those before calls in a loop that it's assigned in
+			m_bRestart = true;
+		}
+		WriteVariable( var, m_pBlock, value );
+	}
+	void IrBuilder::WriteVariable( int var, IrBlock* block, IrInstr* value )
+	{
+		m_Defs[block->id][var] = value;
+	}
+	IrInstr* IrBuilder::ReadValue( int var, IrBlock* block )
+	{
+		IrInstr* value = ReadVariable( var, block );
+		if( value != &m_Clobbered )
+		{
+			return value;
+		}
+
+		const Variable& global = m_Vars[var];
+		value = m_pFunction->NewInstr( IrOp::LOAD_GLOBAL, global.type, {}, global.address );
+		value->name = global.name;
+		if( block->Terminator() )
+		{
+			value->line = block->Terminator()->line;
+			block->InsertBeforeTerminator( value );
+		}
+		else
+		{
+			value->line = m_iLine;
+			value->block = block;
+			block->instrs.push_back( value );
+		}
+		WriteVariable( var, block, value );
+		return value;
+	}
+	IrInstr* IrBuilder::ReadVariable( int var, IrBlock* block )
+	{
+		auto it = m_Defs[block->id].find( var );
+		if( it != m_Defs[block->id].end() )
+		{
+			return it->second;
+		}
+		return ReadVariableRecursive( var, block );
+	}
+	IrInstr* IrBuilder::ReadVariableRecursive( int var, IrBlock* block )
+	{
+		IrInstr* value;
+		if( !m_Sealed[block->id] )
+		{
+			// Not all predecessors are known yet, e.g. the back edge of a loop, the phi is completed once they are
+			value = m_pFunction->NewInstr( IrOp::PHI, m_Vars[var].type );
+			value->block = block;
+			block->phis.push_back( value );
+			m_IncompletePhis[block->id].push_back( { var, value } );
+		}
+		else if( block->preds.empty() )
+		{
+			// Globals start out in memory, locals that are read before they're assigned are 0
+			value = (m_Vars[var].address >= 0) ? &m_Clobbered : m_pFunction->NewConst( m_Vars[var].type, 0 );
+		}
+		else if( block->preds.size() == 1 )
+		{
+			value = ReadVariable( var, block->preds[0] );
+		}
+		else
+		{
+			// Written first to break cycles through loops
+			value = m_pFunction->NewInstr( IrOp::PHI, m_Vars[var].type );
+			value->block = block;
+			block->phis.push_back( value );
+			WriteVariable( var, block, value );
+			AddPhiOperands( var, value );
+		}
+		WriteVariable( var, block, value );
+		return value;
+	}
+	void IrBuilder::AddPhiOperands( int var, IrInstr* phi )
+	{
+		// Trivial phis, like those of variables that a loop doesn't change, are left to IrOptimizer
+		for( IrBlock* pred : phi->block->preds )
+		{
+			phi->args.push_back( ReadValue( var, pred ) );
+		}
+	}
+	void IrBuilder::SealBlock( IrBlock* block )
+	{
+		auto incomplete = std::move( m_IncompletePhis[block->id] );
+		m_IncompletePhis[block->id].clear();
+		for( auto& [var, phi] : incomplete )
+		{
+			AddPhiOperands( var, phi );
+		}
+		m_Sealed[block->id] = true;
+	}
+	void IrBuilder::SyncGlobals( const IrGlobalAccess* callee )
+	{
+		m_bSynced = true;
+		for( int64_t address : m_AssignedGlobals )
+		{
+			if( callee && !callee->any && callee->accessed.count( address ) == 0 )
+			{
+				continue;
+			}
+			const int var = m_GlobalVars.at( address );
+			IrInstr* value = ReadVariable( var, m_pBlock );
+			if( value != &m_Clobbered )
+			{
+				Append( IrOp::STORE_GLOBAL, IrType::VOID, { value }, address )->name = m_Vars[var].name;
+			}
+		}
+	}
+	void IrBuilder::ClobberGlobals( const IrGlobalAccess* callee )
+	{
+		// Globals that are only found after this restart the build (see LookupVariable)
+		m_bClobbered = true;
+		for( const auto& [address, var] : m_GlobalVars )
+		{
+			if( !callee || callee->any || callee->written.count( address ) )
+			{
+				WriteVariable( var, m_pBlock, &m_Clobbered );
+			}
+		}
+	}
+	const IrGlobalAccess* IrBuilder::AccessOf( FunctionSymbol* func )
+	{
+		auto it = m_CalleeAccess.find( func );
+		if( it == m_CalleeAccess.end() )
+		{
+			m_Access.any = true;
+			return nullptr;
+		}
+
+		const IrGlobalAccess& access = it->second;
+		m_Access.accessed.insert( access.accessed.begin(), access.accessed.end() );
+		m_Access.written.insert( access.written.begin(), access.written.end() );
+		m_Access.any = m_Access.any || access.any;
+		return &access;
+	}
+	bool IrBuilder::BuildArgs( CallExpr* node, FunctionSymbol* func, std::vector<IrInstr*>& args )
+	{
+		auto& sig = func->Signature();
+		for( size_t i = 0; i < node->NumArgs(); i++ )
+		{
+			args.push_back( BuildValue( node->Arg( i ) ) );
+		}
+
+		if( func->FuncKind() == FunctionKind::Script && node->NumArgs() < sig.NumParams() )
+		{
+			// Defaults only see the globals, like in Compiler::CompileDefaults
+			auto scopes = std::move( m_Scopes );
+			m_Scopes.clear();
+			for( size_t i = node->NumArgs(); i < sig.NumParams(); i++ )
+			{
+				args.push_back( BuildValue( sig.ParamDefault( i ) ) );
+			}
+			m_Scopes = std::move( scopes );
+			m_iLine = node->Location().Line();
+		}
+		return !m_bFailed;
+	}
+	IrInstr* IrBuilder::BuildInline( CallExpr* node, FunctionSymbol* func, std::vector<IrInstr*> args )
+	{
+		// The parameters are bound to the arguments in a scope that only sees the globals, the value of the call is
+		// that of the return that ends the body (see Compiler::CompileInline)
+		FuncDecl* decl = func->Node()->AsFuncDecl();
+		auto& sig = decl->Signature();
+		auto scopes = std::move( m_Scopes );
+		m_Scopes.assign( 1, {} );
+		for( size_t i = 0; i < sig.NumParams(); i++ )
+		{
+			IrType type;
+			if( !ToIrType( TypeSpecifierToType( sig.ParamType( i ) ), type ) )
+			{
+				return args[i];
+			}
+			const int var = AddVariable( type, -1, sig.ParamIdent( i ).lexeme );
+			m_Scopes.back()[sig.ParamIdent( i ).lexeme] = var;
+			WriteVariable( var, m_pBlock, args[i] );
+		}
+
+		BlockStmt* body = decl->Body()->AsBlockStmt();
+		const size_t ret_idx = body->NumStatements() - 1;
+		m_Scopes.emplace_back();
+		for( size_t i = 0; i < ret_idx && !m_bFailed; i++ )
+		{
+			body->Stmt( i )->Accept( this );
+		}
+
+		ReturnStmt* ret = body->Stmt( ret_idx )->AsReturnStmt();
+		m_iLine = ret->Location().Line();
+		IrInstr* value = ret->RetExpr() ? BuildValue( ret->RetExpr() ) : m_pFunction->NewConst( IrType::VOID, 0 );
+
+		m_Scopes = std::move( scopes );
+		m_iLine = node->Location().Line();
+		return value;
+	}
+	bool IrBuilder::BuildTailCall( ReturnStmt* node )
+	{
+		// Same calls as Compiler::CompileTailCall, arrays and async functions aren't built at all
+		CallExpr* call = node->RetExpr() ? node->RetExpr()->ToCallExpr() : nullptr;
+		VarExpr* callee = call ? call->Function()->ToVarExpr() : nullptr;
+		Symbol* symbol = callee ? m_pGlobals->GetSymbol( callee->Identifier().lexeme ) : nullptr;
+		FunctionSymbol* func = symbol ? symbol->AsFunction() : nullptr;
+		if( !func || func->FuncKind() != FunctionKind::Script || func->Signature().Async() ||
+			func->Signature().NumParams() != m_nArgs || m_InlinedFunctions.count( func ) || IsLocal( callee->Identifier().lexeme ) )
+		{
+			return false;
+		}
+
+		m_iLine = call->Location().Line();
+		std::vector<IrInstr*> args;
+		if( !BuildArgs( call, func, args ) )
+		{
+			return true;
+		}
+		SyncGlobals();
+		if( func == m_pFuncSymbol )
+		{
+			m_bRecursive = true;
+		}
+		Terminate( IrOp::TAILCALL, std::move( args ), func->Address() )->name = callee->Identifier().lexeme;
+		return true;
+	}
+	IrInstr* IrBuilder::BuildBinary( TokenType op, IrType type, IrInstr* left, IrInstr* right )
+	{
+		// type is that of the operands
+		const bool is_int = (type == IrType::INT);
+		const bool is_number = is_int || type == IrType::FLOAT;
+		IrOp ir_op;
+		bool valid;
+		switch( op )
+		{
+		case TOKEN_BAR:             ir_op = IrOp::BITOR;  valid = is_int; break;
+		case TOKEN_HAT:             ir_op = IrOp::BITXOR; valid = is_int; break;
+		case TOKEN_AMP:             ir_op = IrOp::BITAND; valid = is_int; break;
+		case TOKEN_LESS_LESS:       ir_op = IrOp::SHL;    valid = is_int; break;
+		case TOKEN_GREATER_GREATER: ir_op = IrOp::SHR;    valid = is_int; break;
+		case TOKEN_EQUAL_EQUAL:     ir_op = IrOp::EQ;     valid = true; break;
+		case TOKEN_EXCLMARK_EQUAL:  ir_op = IrOp::NEQ;    valid = true; break;
+		case TOKEN_LESS:            ir_op = IrOp::LESS;   valid = is_number; break;
+		case TOKEN_LESS_EQUAL:      ir_op = IrOp::LESSE;  valid = is_number; break;
+		case TOKEN_GREATER:         ir_op = IrOp::GRT;    valid = is_number; break;
+		case TOKEN_GREATER_EQUAL:   ir_op = IrOp::GRTE;   valid = is_number; break;
+		case TOKEN_PLUS:            ir_op = IrOp::ADD;    valid = is_number; break;
+		case TOKEN_MINUS:           ir_op = IrOp::SUB;    valid = is_number; break;
+		case TOKEN_ASTERISK:        ir_op = IrOp::MUL;    valid = is_number; break;
+		case TOKEN_SLASH:           ir_op = IrOp::DIV;    valid = is_number; break;
+		case TOKEN_PERCENT:         ir_op = IrOp::MOD;    valid = is_int; break;
+		default:                    ir_op = IrOp::ADD;    valid = false; break;
+		}
+		if( !valid )
+		{
+			Fail();
+			return left;
+		}
+
+		const bool compare = (ir_op >= IrOp::EQ && ir_op <= IrOp::GRTE);
+		return Append( ir_op, compare ? IrType::BOOL : type, { left, right } );
+	}
+	void IrBuilder::VisitIntLiteral( IntLiteral* node )
+	{
+		m_iLine = node->Location().Line();
+		m_pValue = m_pFunction->NewConst( IrType::INT, node->value );
+	}
+	void IrBuilder::VisitFloatLiteral( FloatLiteral* node )
+	{
+		m_iLine = node->Location().Line();
+		m_pValue = m_pFunction->NewFloatConst( node->value );
+	}
+	void IrBuilder::VisitStringLiteral( StringLiteral* node )
+	{
+		m_iLine = node->Location().Line();
+		m_pValue = m_pFunction->NewConst( IrType::STRING, 0 );
+		m_pValue->name = node->value->chars;
+	}
+	void IrBuilder::VisitTokenLiteral( TokenLiteral* node )
+	{
+		m_iLine = node->Location().Line();
+		if( node->value == TOKEN_TRUE || node->value == TOKEN_FALSE )
+		{
+			m_pValue = m_pFunction->NewConst( IrType::BOOL, node->value == TOKEN_TRUE );
+		}
+	}
+	void IrBuilder::VisitArrayLiteral( ArrayLiteral* node )
+	{
+		Fail();
+	}
+	void IrBuilder::VisitBinaryExpr( BinaryExpr* node )
+	{
+		m_iLine = node->Location().Line();
+		if( node->Op() == TOKEN_AND || node->Op() == TOKEN_OR )
+		{
+			Fail();
+			return;
+		}
+
+		// Right before left, like the stack compiler, which matters for calls
+		IrInstr* right = BuildValue( node->Right() );
+		IrInstr* left = BuildValue( node->Left() );
+		IrType type;
+		if( ToIrType( node->Left()->Type(), type ) )
+		{
+			m_pValue = BuildBinary( node->Op(), type, left, right );
+		}
+	}
+	void IrBuilder::VisitUnaryExpr( UnaryExpr* node )
+	{
+		m_iLine = node->Location().Line();
+		IrInstr* value = BuildValue( node->Right() );
+		IrType type;
+		if( !ToIrType( node->Type(), type ) )
+		{
+			return;
+		}
+
+		switch( node->Op() )
+		{
+		case TOKEN_MINUS:    m_pValue = Append( IrOp::NEG, type, { value } ); break;
+		case TOKEN_EXCLMARK: m_pValue = Append( IrOp::NOT, type, { value } ); break;
+		case TOKEN_TILDE:    m_pValue = Append( IrOp::BITNOT, type, { value } ); break;
+		default:             Fail(); break;
+		}
+	}
+	void IrBuilder::VisitCallExpr( CallExpr* node )
+	{
+		m_iLine = node->Location().Line();
+		VarExpr* callee = node->Function()->ToVarExpr();
+		Symbol* symbol = callee ? m_pGlobals->GetSymbol( callee->Identifier().lexeme ) : nullptr;
+		FunctionSymbol* func = symbol ? symbol->AsFunction() : nullptr;
+		IrType type;
+		if( !func || IsLocal( callee->Identifier().lexeme ) || func->Signature().Async() || func->Signature().VarArgs() || !ToIrType( node->Type(), type ) )
+		{
+			Fail();
+			return;
+		}
+
+		std::vector<IrInstr*> args;
+		if( !BuildArgs( node, func, args ) )
+		{
+			return;
+		}
+
+		if( func->FuncKind() == FunctionKind::Native )
+		{
+			// Natives only see their arguments, so globals can stay where they are
+			m_pValue = Append( IrOp::NATIVE, type, std::move( args ), func->Address() );
+			m_pValue->name = callee->Identifier().lexeme;
+			return;
+		}
+
+		if( func == m_pFuncSymbol )
+		{
+			m_bRecursive = true;
+		}
+		if( m_InlinedFunctions.count( func ) )
+		{
+			m_pValue = BuildInline( node, func, std::move( args ) );
+			return;
+		}
+
+		const IrGlobalAccess* access = AccessOf( func );
+		SyncGlobals( access );
+		m_pValue = Append( IrOp::CALL, type, std::move( args ), func->Address() );
+		m_pValue->name = callee->Identifier().lexeme;
+		ClobberGlobals( access );
+	}
+	void IrBuilder::VisitIndexExpr( IndexExpr* node )
+	{
+		Fail();
+	}
+	void IrBuilder::VisitCastExpr( CastExpr* node )
+	{
+		m_iLine = node->Location().Line();
+		IrInstr* value = BuildValue( node->Expr() );
+		IrType from, to;
+		if( !ToIrType( node->Expr()->Type(), from ) || !ToIrType( node->TargetType(), to ) )
+		{
+			return;
+		}
+
+		const bool number = (from == IrType::INT || from == IrType::FLOAT);
+		if( from == IrType::INT && to == IrType::FLOAT )
+		{
+			m_pValue = Append( IrOp::ITOF, to, { value } );
+		}
+		else if( from == IrType::FLOAT && to == IrType::INT )
+		{
+			m_pValue = Append( IrOp::FTOI, to, { value } );
+		}
+		else if( number && to == IrType::BOOL )
+		{
+			m_pValue = Append( IrOp::TO_BOOL, to, { value } );
+		}
+		else
+		{
+			Fail();
+		}
+	}
+	void IrBuilder::VisitGroupExpr( GroupExpr* node )
+	{
+		m_iLine = node->Location().Line();
+		m_pValue = BuildValue( node->Expr() );
+	}
+	void IrBuilder::VisitVarExpr( VarExpr* node )
+	{
+		m_iLine = node->Location().Line();
+		const int var = LookupVariable( node->Identifier().lexeme );
+		if( var >= 0 )
+		{
+			m_pValue = ReadValue( var, m_pBlock );
+		}
+	}
+	void IrBuilder::VisitExpressionStmt( ExpressionStmt* node )
+	{
+		m_iLine = node->Location().Line();
+		BuildValue( node->Expr() );
+	}
+	void IrBuilder::VisitAssignStmt( AssignStmt* node )
+	{
+		m_iLine = node->Location().Line();
+		VarExpr* target = node->Left()->ToVarExpr();
+		IrType type;
+		if( !target || !ToIrType( node->Left()->Type(), type ) )
+		{
+			Fail();
+			return;
+		}
+
+		IrInstr* value = BuildValue( node->Right() );
+		const int var = LookupVariable( target->Identifier().lexeme );
+		if( var < 0 )
+		{
+			return;
+		}
+
+		if( node->Op() != TOKEN_EQUAL )
+		{
+			// The variable is read after the value is evaluated, like in Compiler::CompileAssign
+			TokenType op;
+			switch( node->Op() )
+			{
+			case TOKEN_PLUS_EQUAL:     op = TOKEN_PLUS; break;
+			case TOKEN_MINUS_EQUAL:    op = TOKEN_MINUS; break;
+			case TOKEN_ASTERISK_EQUAL: op = TOKEN_ASTERISK; break;
+			case TOKEN_SLASH_EQUAL:    op = TOKEN_SLASH; break;
+			case TOKEN_PERCENT_EQUAL:  op = TOKEN_PERCENT; break;
+			case TOKEN_AMP_EQUAL:      op = TOKEN_AMP; break;
+			case TOKEN_HAT_EQUAL:      op = TOKEN_HAT; break;
+			case TOKEN_BAR_EQUAL:      op = TOKEN_BAR; break;
+			default:                   Fail(); return;
+			}
+			value = BuildBinary( op, type, ReadValue( var, m_pBlock ), value );
+		}
+
+		AssignVariable( var, value );
+	}
+	void IrBuilder::VisitBlockStmt( BlockStmt* node )
+	{
+		m_iLine = node->Location().Line();
+		m_Scopes.emplace_back();
+		for( size_t i = 0; i < node->NumStatements() && !m_bFailed; i++ )
+		{
+			node->Stmt( i )->Accept( this );
+		}
+		m_Scopes.pop_back();
+	}
+	void IrBuilder::VisitPrintStmt( PrintStmt* node )
+	{
+		m_iLine = node->Location().Line();
+		IrInstr* value = BuildValue( node->Expr() );
+		Append( IrOp::PRINT, IrType::VOID, { value } );
+	}
+	void IrBuilder::VisitIfStmt( IfStmt* node )
+	{
+		m_iLine = node->Location().Line();
+
+		//  b0: ...; branch <condition> b1 b2
+		//  b1: ; then branch
+		//      jump b3
+		//  b2: ; else branch
+		//      jump b3
+		//  b3: ; ...
+		// Without an else branch, b0 branches to b3 directly
+		IrInstr* condition = BuildValue( node->Condition() );
+		IrBlock* then_block = NewBlock();
+		IrBlock* else_block = node->Else() ? NewBlock() : nullptr;
+		IrBlock* end = NewBlock();
+		Append( IrOp::BRANCH, IrType::VOID, { condition } );
+		m_pFunction->AddEdge( m_pBlock, then_block );
+		m_pFunction->AddEdge( m_pBlock, else_block ? else_block : end );
+
+		SealBlock( then_block );
+		SetBlock( then_block );
+		node->Then()->Accept( this );
+		Jump( end );
+
+		if( else_block )
+		{
+			SealBlock( else_block );
+			SetBlock( else_block );
+			node->Else()->Accept( this );
+			Jump( end );
+		}
+
+		SealBlock( end );
+		SetBlock( end );
+	}
+	void IrBuilder::VisitWhileStmt( WhileStmt* node )
+	{
+		m_iLine = node->Location().Line();
+
+		//  b0: ...; jump b1
+		//  b1: ; condition
+		//      branch <condition> b2 b3
+		//  b2: ; while body
+		//      jump b1
+		//  b3: ; ...
+		// The header isn't sealed until the back edge from the body is there
+		IrBlock* header = NewBlock();
+		Jump( header );
+		SetBlock( header );
+		IrInstr* condition = BuildValue( node->Condition() );
+		IrBlock* body = NewBlock();
+		IrBlock* out = NewBlock();
+		Append( IrOp::BRANCH, IrType::VOID, { condition } );
+		m_pFunction->AddEdge( m_pBlock, body );
+		m_pFunction->AddEdge( m_pBlock, out );
+
+		SealBlock( body );
+		SetBlock( body );
+		node->Body()->Accept( this );
+		Jump( header );
+		SealBlock( header );
+
+		SealBlock( out );
+		SetBlock( out );
+	}
+	void IrBuilder::VisitForStmt( ForStmt* node )
+	{
+		Fail();
+	}
+	void IrBuilder::VisitReturnStmt( ReturnStmt* node )
+	{
+		m_iLine = node->Location().Line();
+		if( m_pFunction->IsMainline() )
+		{
+			Fail();
+			return;
+		}
+
+		m_iNumReturns++;
+		if( BuildTailCall( node ) )
+		{
+			return;
+		}
+
+		IrInstr* value = node->RetExpr() ? BuildValue( node->RetExpr() ) : nullptr;
+		SyncGlobals();
+		m_iLine = node->Location().Line();
+		if( value )
+		{
+			Terminate( IrOp::RETURN, { value } );
+		}
+		else
+		{
+			Terminate( IrOp::RETURN );
+		}
+	}
+	void IrBuilder::VisitImportStmt( ImportStmt* node )
+	{
+		Fail();
+	}
+	void IrBuilder::VisitNativeStmt( NativeStmt* node )
+	{
+		Fail();
+	}
+	void IrBuilder::VisitVarDecl( VarDecl* node )
+	{
+		m_iLine = node->Location().Line();
+		IrType type;
+		if( !ToIrType( node->Type(), type ) )
+		{
+			return;
+		}
+
+		// Globals of the mainline, which the compiler allocated already
+		if( m_Scopes.empty() )
+		{
+			if( node->Initializer() )
+			{
+				IrInstr* value = BuildValue( node->Initializer() );
+				const int var = LookupVariable( node->Identifier().lexeme );
+				if( var >= 0 )
+				{
+					AssignVariable( var, value );
+				}
+			}
+			return;
+		}
+
+		IrInstr* value = node->Initializer() ? BuildValue( node->Initializer() ) : m_pFunction->NewConst( type, 0 );
+		const int var = AddVariable( type, -1, node->Identifier().lexeme );
+		m_Scopes.back()[node->Identifier().lexeme] = var;
+		WriteVariable( var, m_pBlock, value );
+	}
+	void IrBuilder::VisitFuncDecl( FuncDecl* node )
+	{
+		Fail();
+	}
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include "ast.h"
+#include "ir.h"
+#include "symbol_table.h"
+
+namespace Bat
+{
+	// Builds the IR of a function or the mainline from its analyzed syntax tree (see ir.h)
+	// Locals and parameters become SSA values as the code is walked, phis are placed on the fly like in
+	// "Simple and Efficient Construction of Static Single Assignment Form" (Braun et al.). Globals are kept in values
+	// as well while nothing else can see them: before calls and returns the ones the function assigns are stored, after
+	// calls they're loaded again when they're read.
+	// Calls of inlined functions are built in place, like the stack compiler does.
+	// Only the constructs that the optimizations are worth it for are supported, functions with arrays, async calls,
+	// function values and the like are left to the stack compiler.
+	class IrBuilder : public AstVisitor
+	{
+	public:
+		// Globals and functions are looked up in globals, the symbol table of the compiler, calls of functions in
+		// inlined are replaced by their bodies. Calls of functions in access only store and reload the globals that
+		// the function accesses, calls of other functions all of them.
+		IrBuilder( SymbolTable* globals, const std::unordered_set<FunctionSymbol*>& inlined,
+			const std::unordered_map<FunctionSymbol*, IrGlobalAccess>& access );
+
+		// Return nullptr if the code uses something that the IR doesn't support
+		std::unique_ptr<IrFunction> BuildFunction( FuncDecl* node, FunctionSymbol* func );
+		std::unique_ptr<IrFunction> BuildMainline( const std::vector<Statement*>& statements );
+
+		// Of the function built last, for deciding whether calls of it are inlined
+		int NumReturns() const { return m_iNumReturns; }
+		bool IsRecursive() const { return m_bRecursive; }
+		const IrGlobalAccess& GlobalAccess() const { return m_Access; }
+	private:
+		std::unique_ptr<IrFunction> Build( FuncDecl* node, const std::vector<Statement*>& statements );
+		void Fail() { m_bFailed = true; }
+
+		IrInstr* BuildValue( Expression* e );
+		IrInstr* Append( IrOp op, IrType type, std::vector<IrInstr*> args = {}, int64_t imm = 0 );
+		// Ends the current block, which continues in a new block without predecessors
+		IrInstr* Terminate( IrOp op, std::vector<IrInstr*> args = {}, int64_t imm = 0 );
+		void Jump( IrBlock* to );
+		IrBlock* NewBlock();
+		void SetBlock( IrBlock* block ) { m_pBlock = block; }
+		bool ToIrType( const Type* type, IrType& out );
+
+		// Variables are locals, parameters and globals
+		struct Variable
+		{
+			IrType type;
+			// Address of globals, -1 for the others
+			int64_t address;
+			std::string name;
+		};
+		int AddVariable( IrType type, int64_t address, const std::string& name );
+		// Finds a variable in scope, -1 if name is a function or isn't a variable
+		int LookupVariable( const std::string& name );
+		// Whether name is a local or parameter in scope, those hide functions
+		bool IsLocal( const std::string& name ) const;
+		// Writes the variable in the current block, globals are then stored by SyncGlobals
+		void AssignVariable( int var, IrInstr* value );
+		void WriteVariable( int var, IrBlock* block, IrInstr* value );
+		// The value of a variable at the end of block, or where the current block is at. Globals are loaded if
+		// memory holds their value there.
+		IrInstr* ReadValue( int var, IrBlock* block );
+		// Same, but returns m_Clobbered for globals instead of loading them
+		IrInstr* ReadVariable( int var, IrBlock* block );
+		IrInstr* ReadVariableRecursive( int var, IrBlock* block );
+		void AddPhiOperands( int var, IrInstr* phi );
+		void SealBlock( IrBlock* block );
+
+		// Stores the globals that the function assigns, before a call of a function that accesses them or before
+		// anything else that can see them if callee is nullptr
+		void SyncGlobals( const IrGlobalAccess* callee = nullptr );
+		// Memory holds the value of the globals that a call may write afterwards, all of them if callee is nullptr
+		void ClobberGlobals( const IrGlobalAccess* callee );
+		// Adds what calls of func access to what the function does, nullptr if that isn't known
+		const IrGlobalAccess* AccessOf( FunctionSymbol* func );
+
+		// Pushes the arguments of a call, including defaults
+		bool BuildArgs( CallExpr* node, FunctionSymbol* func, std::vector<IrInstr*>& args );
+		IrInstr* BuildInline( CallExpr* node, FunctionSymbol* func, std::vector<IrInstr*> args );
+		bool BuildTailCall( ReturnStmt* node );
+		IrInstr* BuildBinary( TokenType op, IrType type, IrInstr* left, IrInstr* right );
+	private:
+		virtual void VisitIntLiteral( IntLiteral* node ) override;
+		virtual void VisitFloatLiteral( FloatLiteral* node ) override;
+		virtual void VisitStringLiteral( StringLiteral* node ) override;
+		virtual void VisitTokenLiteral( TokenLiteral* node ) override;
+		virtual void VisitArrayLiteral( ArrayLiteral* node ) override;
+		virtual void VisitBinaryExpr( BinaryExpr* node ) override;
+		virtual void VisitUnaryExpr( UnaryExpr* node ) override;
+		virtual void VisitCallExpr( CallExpr* node ) override;
+		virtual void VisitIndexExpr( IndexExpr* node ) override;
+		virtual void VisitCastExpr( CastExpr* node ) override;
+		virtual void VisitGroupExpr( GroupExpr* node ) override;
+		virtual void VisitVarExpr( VarExpr* node ) override;
+		virtual void VisitExpressionStmt( ExpressionStmt* node ) override;
+		virtual void VisitAssignStmt( AssignStmt* node ) override;
+		virtual void VisitBlockStmt( BlockStmt* node ) override;
+		virtual void VisitPrintStmt( PrintStmt* node ) override;
+		virtual void VisitIfStmt( IfStmt* node ) override;
+		virtual void VisitWhileStmt( WhileStmt* node ) override;
+		virtual void VisitForStmt( ForStmt* node ) override;
+		virtual void VisitReturnStmt( ReturnStmt* node ) override;
+		virtual void VisitImportStmt( ImportStmt* node ) override;
+		virtual void VisitNativeStmt( NativeStmt* node ) override;
+		virtual void VisitVarDecl( VarDecl* node ) override;
+		virtual void VisitFuncDecl( FuncDecl* node ) override;
+	private:
+		SymbolTable* m_pGlobals;
+		const std::unordered_set<FunctionSymbol*>& m_InlinedFunctions;
+		const std::unordered_map<FunctionSymbol*, IrGlobalAccess>& m_CalleeAccess;
+
+		std::unique_ptr<IrFunction> m_pFunction;
+		FunctionSymbol* m_pFuncSymbol = nullptr;
+		size_t m_nArgs = 0;
+		IrBlock* m_pBlock = nullptr;
+		// Value of the expression visited last
+		IrInstr* m_pValue = nullptr;
+		int m_iLine = 0;
+		bool m_bFailed = false;
+		int m_iNumReturns = 0;
+		bool m_bRecursive = false;
+
+		std::vector<Variable> m_Vars;
+		// Innermost scope last, globals aren't in any of them
+		std::vector<std::unordered_map<std::string, int>> m_Scopes;
+		std::unordered_map<int64_t, int> m_GlobalVars;
+		// Per block id: the current value of every variable written in the block, whether all predecessors are known,
+		// and the phis that wait for that
+		std::vector<std::unordered_map<int, IrInstr*>> m_Defs;
+		std::vector<bool> m_Sealed;
+		std::vector<std::vector<std::pair<int, IrInstr*>>> m_IncompletePhis;
+		// Stands in for the value of a global whose value is in memory
+		IrInstr m_Clobbered;
+
+		// Globals that the function reads or writes, and those it writes, kept over restarts of the build: code
+		// before the first use of a global has to know about it already, e.g. a call in a loop before an assignment
+		std::map<int64_t, Variable> m_KnownGlobals;
+		std::set<int64_t> m_AssignedGlobals;
+		bool m_bClobbered = false;
+		bool m_bSynced = false;
+		bool m_bRestart = false;
+		IrGlobalAccess m_Access;
+	};
+}
@@ -0,0 +1,623 @@
+#include "ir_optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+
+namespace Bat
+{
+	static bool IsIntConst( const IrInstr* instr )
+	{
+		return instr->IsConst() && instr->type == IrType::INT;
+	}
+
+	void IrOptimizer::Optimize( IrFunction& func )
+	{
+		IrOptimizer optimizer( func );
+
+		// Folding branches drops blocks, which can leave phis with a single value, which can then be folded
+		do
+		{
+			while( optimizer.RemoveTrivialPhis() );
+		} while( optimizer.FoldConstants() );
+		optimizer.MergeBlocks();
+
+		optimizer.ComputeDominators();
+		optimizer.EliminateCommonSubexpressions();
+		for( const Loop& loop : optimizer.FindLoops() )
+		{
+			optimizer.HoistLoopInvariants( loop );
+			optimizer.ReduceStrength( loop );
+		}
+		while( optimizer.RemoveTrivialPhis() );
+		optimizer.RemoveDeadCode();
+	}
+	IrOptimizer::IrOptimizer( IrFunction& func )
+		:
+		m_Func( func )
+	{}
+	void IrOptimizer::Replace( IrInstr* instr, IrInstr* value )
+	{
+		m_Func.ReplaceUses( instr, value );
+		instr->block->Remove( instr );
+	}
+	bool IrOptimizer::RemoveTrivialPhis()
+	{
+		bool changed = false;
+		for( const auto& block : m_Func.Blocks() )
+		{
+			const std::vector<IrInstr*> phis = block->phis;
+			for( IrInstr* phi : phis )
+			{
+				// Trivial if it's one value, or that value and the phi itself, like a variable a loop doesn't assign
+				IrInstr* same = nullptr;
+				bool trivial = true;
+				for( IrInstr* arg : phi->args )
+				{
+					if( arg == same || arg == phi )
+					{
+						continue;
+					}
+					if( same )
+					{
+						trivial = false;
+						break;
+					}
+					same = arg;
+				}
+				if( trivial && same )
+				{
+					Replace( phi, same );
+					changed = true;
+				}
+			}
+		}
+		return changed;
+	}
+	bool IrOptimizer::FoldConstants()
+	{
+		bool changed = false;
+		bool removed_edges = false;
+		for( IrBlock* block : m_Func.ReversePostorder() )
+		{
+			const std::vector<IrInstr*> instrs = block->instrs;
+			for( IrInstr* instr : instrs )
+			{
+				if( instr->op == IrOp::BRANCH && instr->args[0]->IsConst() )
+				{
+					IrBlock* skipped = block->succs[instr->args[0]->imm ? 1 : 0];
+					m_Func.RemoveEdge( block, skipped );
+					instr->op = IrOp::JUMP;
+					instr->args.clear();
+					changed = removed_edges = true;
+					continue;
+				}
+
+				if( instr->op == IrOp::PHI || !instr->HasResult() || EffectOf( instr ) != IrEffect::NONE || instr->args.empty() ||
+					!std::all_of( instr->args.begin(), instr->args.end(), []( const IrInstr* arg ) { return arg->IsConst(); } ) )
+				{
+					continue;
+				}
+				if( IrInstr* value = Fold( instr ) )
+				{
+					Replace( instr, value );
+					changed = true;
+				}
+			}
+		}
+
+		if( removed_edges )
+		{
+			m_Func.RemoveUnreachableBlocks();
+		}
+		return changed;
+	}
+	IrInstr* IrOptimizer::Fold( IrInstr* instr )
+	{
+		// Same rules as AstOptimizer::FoldBinary, so the results match the runtime
+		const IrInstr* a = instr->args[0];
+		const IrInstr* b = (instr->args.size() > 1) ? instr->args[1] : nullptr;
+		auto wrap = []( uint64_t value ) { return (int64_t)value; };
+
+		if( !b )
+		{
+			switch( instr->op )
+			{
+			case IrOp::NEG:
+				if( a->type == IrType::INT ) return m_Func.NewConst( IrType::INT, wrap( 0 - (uint64_t)a->imm ) );
+				if( a->type == IrType::FLOAT ) return m_Func.NewFloatConst( -a->Float() );
+				return nullptr;
+			case IrOp::NOT:
+				// Floats aren't negated logically, since that tests their bits at runtime
+				return (a->type == IrType::INT || a->type == IrType::BOOL) ? m_Func.NewConst( IrType::BOOL, a->imm == 0 ) : nullptr;
+			case IrOp::TO_BOOL:
+				return (a->type == IrType::INT) ? m_Func.NewConst( IrType::BOOL, a->imm != 0 ) : nullptr;
+			case IrOp::BITNOT:
+				return (a->type == IrType::INT) ? m_Func.NewConst( IrType::INT, ~a->imm ) : nullptr;
+			case IrOp::ITOF:
+				return m_Func.NewFloatConst( (double)a->imm );
+			default:
+				return nullptr;
+			}
+		}
+
+		if( a->type != b->type )
+		{
+			return nullptr;
+		}
+		if( a->type == IrType::FLOAT )
+		{
+			const double x = a->Float(), y = b->Float();
+			switch( instr->op )
+			{
+			case IrOp::EQ:    return m_Func.NewConst( IrType::BOOL, x == y );
+			case IrOp::NEQ:   return m_Func.NewConst( IrType::BOOL, x != y );
+			case IrOp::LESS:  return m_Func.NewConst( IrType::BOOL, x < y );
+			case IrOp::LESSE: return m_Func.NewConst( IrType::BOOL, x <= y );
+			case IrOp::GRT:   return m_Func.NewConst( IrType::BOOL, x > y );
+			case IrOp::GRTE:  return m_Func.NewConst( IrType::BOOL, x >= y );
+			case IrOp::ADD:   return m_Func.NewFloatConst( x + y );
+			case IrOp::SUB:   return m_Func.NewFloatConst( x - y );
+			case IrOp::MUL:   return m_Func.NewFloatConst( x * y );
+			case IrOp::DIV:   return m_Func.NewFloatConst( x / y );
+			default:          return nullptr;
+			}
+		}
+		if( a->type != IrType::INT )
+		{
+			return nullptr;
+		}
+
+		const int64_t x = a->imm, y = b->imm;
+		switch( instr->op )
+		{
+		case IrOp::EQ:     return m_Func.NewConst( IrType::BOOL, x == y );
+		case IrOp::NEQ:    return m_Func.NewConst( IrType::BOOL, x != y );
+		case IrOp::LESS:   return m_Func.NewConst( IrType::BOOL, x < y );
+		case IrOp::LESSE:  return m_Func.NewConst( IrType::BOOL, x <= y );
+		case IrOp::GRT:    return m_Func.NewConst( IrType::BOOL, x > y );
+		case IrOp::GRTE:   return m_Func.NewConst( IrType::BOOL, x >= y );
+		case IrOp::BITOR:  return m_Func.NewConst( IrType::INT, x | y );
+		case IrOp::BITXOR: return m_Func.NewConst( IrType::INT, x ^ y );
+		case IrOp::BITAND: return m_Func.NewConst( IrType::INT, x & y );
+		case IrOp::ADD:    return m_Func.NewConst( IrType::INT, wrap( (uint64_t)x + (uint64_t)y ) );
+		case IrOp::SUB:    return m_Func.NewConst( IrType::INT, wrap( (uint64_t)x - (uint64_t)y ) );
+		case IrOp::MUL:    return m_Func.NewConst( IrType::INT, wrap( (uint64_t)x * (uint64_t)y ) );
+		case IrOp::SHL:    return (y < 0 || y > 63) ? nullptr : m_Func.NewConst( IrType::INT, wrap( (uint64_t)x << y ) );
+		case IrOp::SHR:    return (y < 0 || y > 63) ? nullptr : m_Func.NewConst( IrType::INT, x >> y );
+		case IrOp::DIV:
+		case IrOp::MOD:
+			if( y == 0 || (y == -1 && x == std::numeric_limits<int64_t>::min()) ) return nullptr;
+			return m_Func.NewConst( IrType::INT, (instr->op == IrOp::DIV) ? x / y : x % y );
+		default:
+			return nullptr;
+		}
+	}
+	bool IrOptimizer::MergeBlocks()
+	{
+		bool changed = false;
+		std::vector<bool> merged;
+		for( IrBlock* block : m_Func.ReversePostorder() )
+		{
+			if( (size_t)block->id < merged.size() && merged[block->id] )
+			{
+				continue;
+			}
+
+			while( block->Terminator()->op == IrOp::JUMP && block->succs[0] != block && block->succs[0]->preds.size() == 1 )
+			{
+				// Phis of a block with one predecessor only have one value
+				IrBlock* succ = block->succs[0];
+				const std::vector<IrInstr*> phis = succ->phis;
+				for( IrInstr* phi : phis )
+				{
+					Replace( phi, phi->args[0] );
+				}
+
+				block->instrs.pop_back();
+				for( IrInstr* instr : succ->instrs )
+				{
+					instr->block = block;
+					block->instrs.push_back( instr );
+				}
+				succ->instrs.clear();
+				block->succs = std::move( succ->succs );
+				succ->succs.clear();
+				succ->preds.clear();
+				for( IrBlock* next : block->succs )
+				{
+					std::replace( next->preds.begin(), next->preds.end(), succ, block );
+				}
+
+				merged.resize( std::max( merged.size(), (size_t)succ->id + 1 ), false );
+				merged[succ->id] = true;
+				changed = true;
+			}
+		}
+
+		if( changed )
+		{
+			m_Func.RemoveUnreachableBlocks();
+		}
+		return changed;
+	}
+	void IrOptimizer::ComputeDominators()
+	{
+		// "A Simple, Fast Dominance Algorithm" (Cooper, Harvey and Kennedy)
+		const std::vector<IrBlock*> order = m_Func.ReversePostorder();
+		int num_ids = 0;
+		for( const auto& block : m_Func.Blocks() )
+		{
+			num_ids = std::max( num_ids, block->id + 1 );
+		}
+		m_Order.assign( num_ids, -1 );
+		for( size_t i = 0; i < order.size(); i++ )
+		{
+			m_Order[order[i]->id] = (int)i;
+		}
+
+		m_Idom.assign( num_ids, nullptr );
+		m_Idom[order[0]->id] = order[0];
+		auto intersect = [this]( IrBlock* a, IrBlock* b )
+		{
+			while( a != b )
+			{
+				while( m_Order[a->id] > m_Order[b->id] ) a = m_Idom[a->id];
+				while( m_Order[b->id] > m_Order[a->id] ) b = m_Idom[b->id];
+			}
+			return a;
+		};
+		bool changed = true;
+		while( changed )
+		{
+			changed = false;
+			for( size_t i = 1; i < order.size(); i++ )
+			{
+				IrBlock* idom = nullptr;
+				for( IrBlock* pred : order[i]->preds )
+				{
+					if( m_Idom[pred->id] )
+					{
+						idom = idom ? intersect( pred, idom ) : pred;
+					}
+				}
+				if( m_Idom[order[i]->id] != idom )
+				{
+					m_Idom[order[i]->id] = idom;
+					changed = true;
+				}
+			}
+		}
+
+		m_DomChildren.assign( num_ids, {} );
+		for( size_t i = 1; i < order.size(); i++ )
+		{
+			m_DomChildren[m_Idom[order[i]->id]->id].push_back( order[i] );
+		}
+	}
+	bool IrOptimizer::Dominates( const IrBlock* a, const IrBlock* b ) const
+	{
+		while( b != a )
+		{
+			const IrBlock* idom = m_Idom[b->id];
+			if( idom == b )
+			{
+				return false;
+			}
+			b = idom;
+		}
+		return true;
+	}
+	void IrOptimizer::EliminateCommonSubexpressions()
+	{
+		std::unordered_map<std::string, IrInstr*> available;
+		EliminateCommonSubexpressions( m_Func.Entry(), available );
+	}
+	void IrOptimizer::EliminateCommonSubexpressions( IrBlock* block, std::unordered_map<std::string, IrInstr*>& available )
+	{
+		// Values are available in the blocks their block dominates, this walks the dominator tree so that the
+		// table only has those of the dominators of block
+		std::vector<std::string> added;
+		const std::vector<IrInstr*> instrs = block->instrs;
+		for( IrInstr* instr : instrs )
+		{
+			const IrEffect effect = EffectOf( instr );
+			if( !instr->HasResult() || instr->op == IrOp::PARAM || (effect != IrEffect::NONE && effect != IrEffect::TRAP) )
+			{
+				continue;
+			}
+
+			// e.g. "add int 0 v3 c5", constants are compared by value since each use has a constant of its own
+			std::vector<std::string> args;
+			for( const IrInstr* arg : instr->args )
+			{
+				args.push_back( arg->IsConst() ?
+					"c" + std::to_string( (int)arg->type ) + ":" + std::to_string( arg->imm ) + ":" + arg->name :
+					"v" + std::to_string( arg->id ) );
+			}
+			switch( instr->op )
+			{
+			case IrOp::ADD:
+			case IrOp::MUL:
+			case IrOp::BITAND:
+			case IrOp::BITOR:
+			case IrOp::BITXOR:
+			case IrOp::EQ:
+			case IrOp::NEQ:
+				std::sort( args.begin(), args.end() );
+				break;
+			default:
+				break;
+			}
+			std::string key = std::string( ToString( instr->op ) ) + " " + ToString( instr->type ) + " " + std::to_string( instr->imm );
+			for( const std::string& arg : args )
+			{
+				key += " " + arg;
+			}
+
+			auto it = available.find( key );
+			if( it != available.end() )
+			{
+				Replace( instr, it->second );
+				continue;
+			}
+			available[key] = instr;
+			added.push_back( std::move( key ) );
+		}
+
+		for( IrBlock* child : m_DomChildren[block->id] )
+		{
+			EliminateCommonSubexpressions( child, available );
+		}
+		for( const std::string& key : added )
+		{
+			available.erase( key );
+		}
+	}
+	std::vector<IrOptimizer::Loop> IrOptimizer::FindLoops() const
+	{
+		// Natural loops, of every back edge, i.e. an edge to a block that dominates where it comes from
+		std::map<int, Loop> loops;
+		for( IrBlock* header : m_Func.ReversePostorder() )
+		{
+			for( IrBlock* latch : header->preds )
+			{
+				if( !Dominates( header, latch ) )
+				{
+					continue;
+				}
+
+				auto it = loops.find( header->id );
+				if( it == loops.end() )
+				{
+					Loop loop = { header, nullptr, latch, std::vector<bool>( m_Order.size(), false ), 1 };
+					loop.blocks[header->id] = true;
+					it = loops.emplace( header->id, std::move( loop ) ).first;
+				}
+				else
+				{
+					it->second.latch = nullptr;
+				}
+
+				// Everything that reaches the latch without going through the header
+				Loop& loop = it->second;
+				std::vector<IrBlock*> work = { latch };
+				while( !work.empty() )
+				{
+					IrBlock* block = work.back();
+					work.pop_back();
+					if( loop.blocks[block->id] )
+					{
+						continue;
+					}
+					loop.blocks[block->id] = true;
+					loop.num_blocks++;
+					work.insert( work.end(), block->preds.begin(), block->preds.end() );
+				}
+			}
+		}
+
+		std::vector<Loop> result;
+		for( auto& [id, loop] : loops )
+		{
+			for( IrBlock* pred : loop.header->preds )
+			{
+				if( !loop.blocks[pred->id] )
+				{
+					loop.preheader = loop.preheader ? nullptr : pred;
+				}
+			}
+			// Code is only put in front of the loop if the preheader doesn't go anywhere else
+			if( loop.preheader && loop.preheader->succs.size() != 1 )
+			{
+				loop.preheader = nullptr;
+			}
+			result.push_back( std::move( loop ) );
+		}
+		std::stable_sort( result.begin(), result.end(), []( const Loop& a, const Loop& b ) { return a.num_blocks < b.num_blocks; } );
+		return result;
+	}
+	void IrOptimizer::HoistLoopInvariants( const Loop& loop )
+	{
+		if( !loop.preheader )
+		{
+			return;
+		}
+
+		// In dominator order, so whatever an instruction uses from the loop was considered before it
+		for( IrBlock* block : m_Func.ReversePostorder() )
+		{
+			if( !loop.blocks[block->id] )
+			{
+				continue;
+			}
+
+			const std::vector<IrInstr*> instrs = block->instrs;
+			for( IrInstr* instr : instrs )
+			{
+				const bool invariant = std::all_of( instr->args.begin(), instr->args.end(), [&]( const IrInstr* arg ) {
+					return !arg->block || !loop.blocks[arg->block->id];
+				} );
+				if( invariant && instr->HasResult() && instr->op != IrOp::PARAM && EffectOf( instr ) == IrEffect::NONE )
+				{
+					block->Remove( instr );
+					loop.preheader->InsertBeforeTerminator( instr );
+				}
+			}
+		}
+	}
+	void IrOptimizer::ReduceStrength( const Loop& loop )
+	{
+		if( !loop.preheader || !loop.latch || loop.header->preds.size() != 2 )
+		{
+			return;
+		}
+
+		// Induction variables i = phi(init, i + step) that are multiplied by a constant k get a variable of their own,
+		// j = phi(init * k, j + step * k), which is what the multiplication results in. Ints wrap around, so that
+		// holds for every i.
+		const size_t from_preheader = (loop.header->preds[0] == loop.preheader) ? 0 : 1;
+		const size_t from_latch = 1 - from_preheader;
+		const std::vector<IrInstr*> phis = loop.header->phis;
+		for( IrInstr* i : phis )
+		{
+			IrInstr* next = i->args[from_latch];
+			if( i->type != IrType::INT || next->type != IrType::INT || !next->block || !loop.blocks[next->block->id] )
+			{
+				continue;
+			}
+
+			int64_t step;
+			if( next->op == IrOp::ADD && next->args[0] == i && IsIntConst( next->args[1] ) )
+			{
+				step = next->args[1]->imm;
+			}
+			else if( next->op == IrOp::ADD && next->args[1] == i && IsIntConst( next->args[0] ) )
+			{
+				step = next->args[0]->imm;
+			}
+			else if( next->op == IrOp::SUB && next->args[0] == i && IsIntConst( next->args[1] ) )
+			{
+				step = (int64_t)(0 - (uint64_t)next->args[1]->imm);
+			}
+			else
+			{
+				continue;
+			}
+
+			// Multiplications by a power of 2 were turned into shifts by AstOptimizer
+			std::map<int64_t, std::vector<IrInstr*>> scaled;
+			for( const auto& block : m_Func.Blocks() )
+			{
+				if( !loop.blocks[block->id] )
+				{
+					continue;
+				}
+				for( IrInstr* instr : block->instrs )
+				{
+					if( instr->type != IrType::INT || instr->args.size() != 2 )
+					{
+						continue;
+					}
+					if( instr->op == IrOp::MUL && instr->args[0] == i && IsIntConst( instr->args[1] ) )
+					{
+						scaled[instr->args[1]->imm].push_back( instr );
+					}
+					else if( instr->op == IrOp::MUL && instr->args[1] == i && IsIntConst( instr->args[0] ) )
+					{
+						scaled[instr->args[0]->imm].push_back( instr );
+					}
+					else if( instr->op == IrOp::SHL && instr->args[0] == i && IsIntConst( instr->args[1] ) && instr->args[1]->imm >= 0 && instr->args[1]->imm < 63 )
+					{
+						scaled[(int64_t)1 << instr->args[1]->imm].push_back( instr );
+					}
+				}
+			}
+
+			for( const auto& [k, instrs] : scaled )
+			{
+				IrInstr* init = i->args[from_preheader];
+				IrInstr* scaled_init;
+				if( IsIntConst( init ) )
+				{
+					scaled_init = m_Func.NewConst( IrType::INT, (int64_t)((uint64_t)init->imm * (uint64_t)k) );
+				}
+				else
+				{
+					scaled_init = m_Func.NewInstr( IrOp::MUL, IrType::INT, { init, m_Func.NewConst( IrType::INT, k ) } );
+					scaled_init->line = instrs.front()->line;
+					loop.preheader->InsertBeforeTerminator( scaled_init );
+				}
+
+				IrInstr* j = m_Func.NewInstr( IrOp::PHI, IrType::INT, { nullptr, nullptr } );
+				j->block = loop.header;
+				loop.header->phis.push_back( j );
+
+				// Right after i is stepped, which dominates the latch
+				IrInstr* scaled_next = m_Func.NewInstr( IrOp::ADD, IrType::INT, { j, m_Func.NewConst( IrType::INT, (int64_t)((uint64_t)step * (uint64_t)k) ) } );
+				scaled_next->line = next->line;
+				scaled_next->block = next->block;
+				auto& list = next->block->instrs;
+				list.insert( std::find( list.begin(), list.end(), next ) + 1, scaled_next );
+
+				j->args[from_preheader] = scaled_init;
+				j->args[from_latch] = scaled_next;
+				for( IrInstr* instr : instrs )
+				{
+					Replace( instr, j );
+				}
+			}
+		}
+	}
+	void IrOptimizer::RemoveDeadCode()
+	{
+		// Everything with an effect is live, and so is whatever a live instruction uses. Loads of globals that aren't
+		// used are dropped as well.
+		std::vector<bool> live( 0 );
+		std::vector<IrInstr*> work;
+		auto mark = [&]( IrInstr* instr )
+		{
+			if( (size_t)instr->id >= live.size() )
+			{
+				live.resize( instr->id + 1, false );
+			}
+			if( !live[instr->id] )
+			{
+				live[instr->id] = true;
+				work.push_back( instr );
+			}
+		};
+		for( const auto& block : m_Func.Blocks() )
+		{
+			for( IrInstr* instr : block->instrs )
+			{
+				const IrEffect effect = EffectOf( instr );
+				if( effect != IrEffect::NONE && effect != IrEffect::READ_GLOBAL )
+				{
+					mark( instr );
+				}
+			}
+		}
+		while( !work.empty() )
+		{
+			IrInstr* instr = work.back();
+			work.pop_back();
+			for( IrInstr* arg : instr->args )
+			{
+				mark( arg );
+			}
+		}
+
+		for( const auto& block : m_Func.Blocks() )
+		{
+			for( auto* list : { &block->phis, &block->instrs } )
+			{
+				list->erase( std::remove_if( list->begin(), list->end(), [&]( IrInstr* instr ) {
+					return (size_t)instr->id >= live.size() || !live[instr->id];
+				} ), list->end() );
+			}
+		}
+	}
+}
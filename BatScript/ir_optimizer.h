@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ir.h"
+
+namespace Bat
+{
+	// Optimizes the IR of a function (see ir.h) for -O2:
+	//  copy propagation     phis that only ever see one value are replaced by that value
+	//  constant folding     2 * 3 -> 6, branches on constants become jumps and what they skip is dropped
+	//  common subexpressions  (a + b) * (a + b) computes a + b once, for any value that dominates the other
+	//  loop invariants      values a loop computes from values defined outside of it move in front of the loop
+	//  strength reduction   i * 8 for a counter i = i + 1 becomes a second counter j = j + 8
+	//  dead code            values that nothing uses are dropped
+	// Only instructions without effects are moved or dropped, so runtime errors, prints and calls happen in the same
+	// order and as often as they did (see IrEffect).
+	class IrOptimizer
+	{
+	public:
+		static void Optimize( IrFunction& func );
+	private:
+		IrOptimizer( IrFunction& func );
+
+		// Replaces the uses of instr by value and removes it
+		void Replace( IrInstr* instr, IrInstr* value );
+
+		// Each returns whether it changed anything
+		bool RemoveTrivialPhis();
+		bool FoldConstants();
+		IrInstr* Fold( IrInstr* instr );
+		// Appends blocks to the only block that enters them, e.g. what's left of ifs on constants
+		bool MergeBlocks();
+
+		void ComputeDominators();
+		bool Dominates( const IrBlock* a, const IrBlock* b ) const;
+
+		void EliminateCommonSubexpressions();
+		// available maps the key of every value computed in the dominators of block to that value
+		void EliminateCommonSubexpressions( IrBlock* block, std::unordered_map<std::string, IrInstr*>& available );
+
+		struct Loop
+		{
+			IrBlock* header;
+			// The only block outside the loop that enters it, nullptr if there are several
+			IrBlock* preheader;
+			// The only block that jumps back to the header, nullptr if there are several
+			IrBlock* latch;
+			// Indexed by block id
+			std::vector<bool> blocks;
+			size_t num_blocks;
+		};
+		// Innermost loops first
+		std::vector<Loop> FindLoops() const;
+		void HoistLoopInvariants( const Loop& loop );
+		void ReduceStrength( const Loop& loop );
+
+		void RemoveDeadCode();
+	private:
+		IrFunction& m_Func;
+		// Indexed by block id, the immediate dominator of the entry block is the entry block
+		std::vector<IrBlock*> m_Idom;
+		std::vector<int> m_Order;
+		std::vector<std::vector<IrBlock*>> m_DomChildren;
+	};
+}
@@ -0,0 +1,393 @@
+#include "ir_schedule.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+
+namespace Bat
+{
+	static bool IsBinary( const IrInstr* instr )
+	{
+		return instr->args.size() == 2 && instr->op >= IrOp::ADD && instr->op <= IrOp::GRTE;
+	}
+
+	IrStackSchedule::IrStackSchedule( IrFunction& func )
+	{
+		func.SplitCriticalEdges();
+		m_Layout = func.ReversePostorder();
+
+		int num_blocks = 0;
+		int num_ids = 0;
+		for( IrBlock* block : m_Layout )
+		{
+			num_blocks = std::max( num_blocks, block->id + 1 );
+			for( auto* list : { &block->phis, &block->instrs } )
+			{
+				for( IrInstr* instr : *list )
+				{
+					num_ids = std::max( num_ids, instr->id + 1 );
+					for( IrInstr* arg : instr->args )
+					{
+						num_ids = std::max( num_ids, arg->id + 1 );
+					}
+				}
+			}
+		}
+
+		m_Entries.resize( num_blocks );
+		m_NumUses.assign( num_ids, 0 );
+		m_Position.assign( num_ids, -1 );
+		m_Scheduled.assign( num_ids, false );
+		m_OnStack.assign( num_ids, false );
+		m_Slots.assign( num_ids, -1 );
+		for( IrBlock* block : m_Layout )
+		{
+			for( auto* list : { &block->phis, &block->instrs } )
+			{
+				for( IrInstr* instr : *list )
+				{
+					for( IrInstr* arg : instr->args )
+					{
+						m_NumUses[arg->id]++;
+					}
+				}
+			}
+			for( size_t i = 0; i < block->instrs.size(); i++ )
+			{
+				m_Position[block->instrs[i]->id] = (int)i;
+			}
+		}
+
+		for( IrBlock* block : m_Layout )
+		{
+			ScheduleBlock( block );
+		}
+		AllocateSlots();
+	}
+	void IrStackSchedule::ScheduleBlock( IrBlock* block )
+	{
+		// Built from the end, so that every instruction can take the operands that are left to compute from the stack
+		std::vector<Entry> reversed;
+		for( size_t i = block->instrs.size(); i-- > 0; )
+		{
+			IrInstr* instr = block->instrs[i];
+			if( m_Scheduled[instr->id] || instr->op == IrOp::PARAM )
+			{
+				continue;
+			}
+
+			if( instr->op == IrOp::JUMP && !block->succs[0]->phis.empty() )
+			{
+				m_Scheduled[instr->id] = true;
+				reversed.push_back( { EntryKind::INSTR, instr } );
+				reversed.push_back( { EntryKind::PHI_COPIES, nullptr } );
+				continue;
+			}
+			Schedule( instr, reversed );
+		}
+
+		m_Entries[block->id].assign( reversed.rbegin(), reversed.rend() );
+	}
+	void IrStackSchedule::Schedule( IrInstr* instr, std::vector<Entry>& reversed )
+	{
+		m_Scheduled[instr->id] = true;
+		reversed.push_back( { EntryKind::INSTR, instr } );
+
+		// Binary ops take their left operand from the top of the stack, so it's pushed last
+		std::vector<IrInstr*> pushes = instr->args;
+		if( IsBinary( instr ) )
+		{
+			std::swap( pushes[0], pushes[1] );
+		}
+		for( auto it = pushes.rbegin(); it != pushes.rend(); ++it )
+		{
+			if( CanStack( *it, instr ) )
+			{
+				m_OnStack[(*it)->id] = true;
+				Schedule( *it, reversed );
+			}
+			else
+			{
+				reversed.push_back( { EntryKind::GET, *it } );
+			}
+		}
+	}
+	bool IrStackSchedule::CanStack( const IrInstr* value, const IrInstr* user ) const
+	{
+		if( !value->block || value->block != user->block || value->op == IrOp::PHI || value->op == IrOp::PARAM ||
+			m_NumUses[value->id] != 1 || m_Scheduled[value->id] )
+		{
+			return false;
+		}
+		if( EffectOf( value ) == IrEffect::NONE )
+		{
+			return true;
+		}
+
+		// Instructions that haven't been scheduled yet end up before value, those that have after it. Those that
+		// change places with it that way can't conflict with it.
+		const int position = m_Position[value->id];
+		for( const IrInstr* other : value->block->instrs )
+		{
+			const int other_position = m_Position[other->id];
+			const bool moved_before = other_position > position && !m_Scheduled[other->id];
+			const bool moved_after = other_position < position && m_Scheduled[other->id];
+			if( (moved_before || moved_after) && Conflicts( value, other ) )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	void IrStackSchedule::AllocateSlots()
+	{
+		auto needs_slot = [this]( const IrInstr* value )
+		{
+			if( value->op == IrOp::PHI )
+			{
+				return true;
+			}
+			return !m_OnStack[value->id] && value->HasResult() && value->op != IrOp::PARAM && value->op != IrOp::CONST &&
+				m_NumUses[value->id] > 0;
+		};
+		auto edge_index = []( const IrBlock* from )
+		{
+			const IrBlock* to = from->succs[0];
+			return (size_t)(std::find( to->preds.begin(), to->preds.end(), from ) - to->preds.begin());
+		};
+
+		// Positions number the entries of all blocks in layout order
+		const size_t num_ids = m_Slots.size();
+		std::vector<int> start( m_Entries.size() ), end( m_Entries.size() );
+		std::vector<std::vector<bool>> uses( m_Entries.size() ), defs( m_Entries.size() );
+		int position = 0;
+		for( IrBlock* block : m_Layout )
+		{
+			auto& use = uses[block->id];
+			auto& def = defs[block->id];
+			use.assign( num_ids, false );
+			def.assign( num_ids, false );
+			auto read = [&]( const IrInstr* value )
+			{
+				if( needs_slot( value ) && !def[value->id] )
+				{
+					use[value->id] = true;
+				}
+			};
+
+			start[block->id] = position;
+			for( const Entry& entry : m_Entries[block->id] )
+			{
+				switch( entry.kind )
+				{
+				case EntryKind::GET:
+					read( entry.instr );
+					break;
+				case EntryKind::INSTR:
+					if( needs_slot( entry.instr ) )
+					{
+						def[entry.instr->id] = true;
+					}
+					break;
+				case EntryKind::PHI_COPIES:
+				{
+					// All arguments are read before any phi is written
+					const size_t index = edge_index( block );
+					for( const IrInstr* phi : block->succs[0]->phis )
+					{
+						read( phi->args[index] );
+					}
+					for( const IrInstr* phi : block->succs[0]->phis )
+					{
+						def[phi->id] = true;
+					}
+					break;
+				}
+				}
+				position++;
+			}
+			end[block->id] = position - 1;
+		}
+
+		// Phis are live into their block, they're written at the end of its predecessors
+		std::vector<std::vector<bool>> live_in( m_Entries.size() ), live_out( m_Entries.size() );
+		for( IrBlock* block : m_Layout )
+		{
+			live_in[block->id] = uses[block->id];
+			live_out[block->id].assign( num_ids, false );
+			for( const IrInstr* phi : block->phis )
+			{
+				live_in[block->id][phi->id] = true;
+			}
+		}
+		bool changed = true;
+		while( changed )
+		{
+			changed = false;
+			for( auto it = m_Layout.rbegin(); it != m_Layout.rend(); ++it )
+			{
+				IrBlock* block = *it;
+				auto& in = live_in[block->id];
+				auto& out = live_out[block->id];
+				for( IrBlock* succ : block->succs )
+				{
+					const auto& succ_in = live_in[succ->id];
+					for( size_t id = 0; id < num_ids; id++ )
+					{
+						if( succ_in[id] && !out[id] )
+						{
+							out[id] = true;
+							if( !defs[block->id][id] )
+							{
+								in[id] = true;
+							}
+							changed = true;
+						}
+					}
+				}
+			}
+		}
+
+		// Every value gets the interval of positions that it's live in, which covers where it's used and defined
+		std::vector<int> low( num_ids, INT_MAX ), high( num_ids, -1 );
+		auto extend = [&]( const IrInstr* value, int at )
+		{
+			low[value->id] = std::min( low[value->id], at );
+			high[value->id] = std::max( high[value->id], at );
+		};
+		position = 0;
+		for( IrBlock* block : m_Layout )
+		{
+			for( size_t id = 0; id < num_ids; id++ )
+			{
+				if( live_in[block->id][id] )
+				{
+					low[id] = std::min( low[id], start[block->id] );
+					high[id] = std::max( high[id], start[block->id] );
+				}
+				if( live_out[block->id][id] )
+				{
+					low[id] = std::min( low[id], end[block->id] );
+					high[id] = std::max( high[id], end[block->id] );
+				}
+			}
+			for( const Entry& entry : m_Entries[block->id] )
+			{
+				if( entry.kind == EntryKind::PHI_COPIES )
+				{
+					const size_t index = edge_index( block );
+					for( const IrInstr* phi : block->succs[0]->phis )
+					{
+						extend( phi, position );
+						if( needs_slot( phi->args[index] ) )
+						{
+							extend( phi->args[index], position );
+						}
+					}
+				}
+				else if( needs_slot( entry.instr ) )
+				{
+					extend( entry.instr, position );
+				}
+				position++;
+			}
+		}
+
+		// A value that a predecessor computes just for a phi is put in the phi's slot right away, which saves the copy.
+		// That works if the old value of the phi isn't read after that, and the value isn't needed after the block.
+		std::vector<int> group( num_ids );
+		std::vector<bool> grouped( num_ids, false );
+		for( size_t id = 0; id < num_ids; id++ )
+		{
+			group[id] = (int)id;
+		}
+		for( IrBlock* block : m_Layout )
+		{
+			const auto& entries = m_Entries[block->id];
+			if( entries.size() < 2 || entries[entries.size() - 2].kind != EntryKind::PHI_COPIES )
+			{
+				continue;
+			}
+
+			const size_t index = edge_index( block );
+			const auto& phis = block->succs[0]->phis;
+			for( IrInstr* phi : phis )
+			{
+				IrInstr* value = phi->args[index];
+				if( value->block != block || value->op == IrOp::PHI || !needs_slot( value ) || grouped[value->id] ||
+					live_out[block->id][value->id] )
+				{
+					continue;
+				}
+				const bool phi_copied = std::any_of( phis.begin(), phis.end(), [&]( const IrInstr* other ) {
+					return other->args[index] == phi;
+				} );
+				bool phi_read = false;
+				bool after_def = false;
+				for( const Entry& entry : entries )
+				{
+					after_def = after_def || (entry.kind == EntryKind::INSTR && entry.instr == value);
+					phi_read = phi_read || (after_def && entry.kind == EntryKind::GET && entry.instr == phi);
+				}
+				if( phi_copied || phi_read )
+				{
+					continue;
+				}
+
+				grouped[value->id] = true;
+				group[value->id] = phi->id;
+				low[phi->id] = std::min( low[phi->id], low[value->id] );
+				high[phi->id] = std::max( high[phi->id], high[value->id] );
+			}
+		}
+
+		// Linear scan, a slot is free again once the interval of the group in it has ended
+		std::vector<int> order;
+		for( size_t id = 0; id < num_ids; id++ )
+		{
+			if( group[id] == (int)id && high[id] >= 0 )
+			{
+				order.push_back( (int)id );
+			}
+		}
+		std::sort( order.begin(), order.end(), [&]( int a, int b ) { return low[a] < low[b]; } );
+		std::vector<std::pair<int, int>> active;
+		std::vector<int> free_slots;
+		for( int id : order )
+		{
+			for( auto it = active.begin(); it != active.end(); )
+			{
+				if( it->first < low[id] )
+				{
+					free_slots.push_back( it->second );
+					it = active.erase( it );
+				}
+				else
+				{
+					++it;
+				}
+			}
+
+			int slot;
+			if( free_slots.empty() )
+			{
+				slot = m_nSlots++;
+			}
+			else
+			{
+				auto lowest = std::min_element( free_slots.begin(), free_slots.end() );
+				slot = *lowest;
+				free_slots.erase( lowest );
+			}
+			m_Slots[id] = slot;
+			active.push_back( { high[id], slot } );
+		}
+		for( size_t id = 0; id < num_ids; id++ )
+		{
+			if( group[id] != (int)id )
+			{
+				m_Slots[id] = m_Slots[group[id]];
+			}
+		}
+	}
+}
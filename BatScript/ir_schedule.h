@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include "ir.h"
+
+namespace Bat
+{
+	// Decides how the IR of a function (see ir.h) maps onto the stack VM, for Compiler::CompileIr:
+	// - the order of the blocks, with jumps to the next block left out
+	// - which values are left on the VM stack for the instruction that uses them, like the stack compiler does with
+	//   the operands of expressions, and which ones are kept in slots of the frame instead
+	// - the slots, values that are never live at the same time share one, and so do phis and the values they get
+	//   from a predecessor where that saves a copy
+	class IrStackSchedule
+	{
+	public:
+		// Splits the critical edges of func, so phi copies have a block of their own
+		explicit IrStackSchedule( IrFunction& func );
+
+		enum class EntryKind
+		{
+			// Pushes instr, which is a constant, a parameter or in a slot
+			GET,
+			// Executes instr, whose operands were pushed by the entries before it
+			INSTR,
+			// Copies the arguments of the phis of the only successor into their slots, before the block's jump
+			PHI_COPIES
+		};
+		struct Entry
+		{
+			EntryKind kind;
+			IrInstr* instr;
+		};
+
+		const std::vector<IrBlock*>& Layout() const { return m_Layout; }
+		const std::vector<Entry>& Entries( const IrBlock* block ) const { return m_Entries[block->id]; }
+		// Whether value stays on the VM stack for the instruction that uses it
+		bool OnStack( const IrInstr* value ) const { return m_OnStack[value->id]; }
+		// Slot of a value that isn't on the stack, -1 for constants, parameters and values that aren't used
+		int Slot( const IrInstr* value ) const { return m_Slots[value->id]; }
+		int NumSlots() const { return m_nSlots; }
+	private:
+		void ScheduleBlock( IrBlock* block );
+		// Appends the entries of instr and the operands it takes from the stack, in reverse
+		void Schedule( IrInstr* instr, std::vector<Entry>& reversed );
+		bool CanStack( const IrInstr* value, const IrInstr* user ) const;
+		void AllocateSlots();
+	private:
+		std::vector<IrBlock*> m_Layout;
+		// Indexed by block id
+		std::vector<std::vector<Entry>> m_Entries;
+		// Indexed by instruction id
+		std::vector<int> m_NumUses;
+		std::vector<int> m_Position;
+		std::vector<bool> m_Scheduled;
+		std::vector<bool> m_OnStack;
+		std::vector<int> m_Slots;
+		int m_nSlots = 0;
+	};
+}
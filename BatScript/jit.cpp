@@ -0,0 +1,723 @@
+#include "jit.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <initializer_list>
+#include "errorsys.h"
+#include "instructions.h"
+
+#if BAT_JIT
+#include <sys/mman.h>
+#endif
+
+namespace Bat
+{
+	namespace
+	{
+		void PrintInt( int64_t val )
+		{
+			std::cout << val << std::endl;
+		}
+		void PrintFloat( double val )
+		{
+			std::cout << std::to_string( val ) << std::endl;
+		}
+		void PrintBool( int64_t val )
+		{
+			std::cout << (val ? "true" : "false") << std::endl;
+		}
+
+#if BAT_JIT
+		enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+		enum Xmm { XMM0, XMM1 };
+		enum Cond { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_P = 0xA, CC_NP = 0xB, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+		// [base + index << scale + disp]
+		struct Mem
+		{
+			int base;
+			int32_t disp = 0;
+			int index = -1;
+			int scale = 0;
+		};
+
+		bool Fits8( int64_t val ) { return val >= INT8_MIN && val <= INT8_MAX; }
+		bool Fits32( int64_t val ) { return val >= INT32_MIN && val <= INT32_MAX; }
+
+		// Just enough of an x86-64 encoder for the instruction templates in Jit::Translate
+		class Assembler
+		{
+		public:
+			size_t Size() const { return m_Bytes.size(); }
+			const uint8_t* Bytes() const { return m_Bytes.data(); }
+
+			void Byte( uint8_t b ) { m_Bytes.push_back( b ); }
+			void Dword( int32_t val )
+			{
+				uint8_t bytes[4];
+				memcpy( bytes, &val, 4 );
+				m_Bytes.insert( m_Bytes.end(), bytes, bytes + 4 );
+			}
+			void Qword( int64_t val )
+			{
+				uint8_t bytes[8];
+				memcpy( bytes, &val, 8 );
+				m_Bytes.insert( m_Bytes.end(), bytes, bytes + 8 );
+			}
+			void PatchDword( size_t at, int32_t val ) { memcpy( &m_Bytes[at], &val, 4 ); }
+
+			// Instruction with a register (or opcode extension) and a memory operand, prefix 0 for none
+			void Op( uint8_t prefix, bool w, std::initializer_list<uint8_t> opcode, int reg, const Mem& mem )
+			{
+				if( prefix ) Byte( prefix );
+				Rex( w, reg, (mem.index < 0) ? 0 : mem.index, mem.base );
+				for( auto b : opcode ) Byte( b );
+
+				// rbp and r13 as base always need a displacement, rsp and r12 always need a SIB byte
+				const int mod = (mem.disp == 0 && (mem.base & 7) != RBP) ? 0 : Fits8( mem.disp ) ? 1 : 2;
+				if( mem.index >= 0 )
+				{
+					assert( mem.index != RSP );
+					Byte( (uint8_t)((mod << 6) | ((reg & 7) << 3) | 4) );
+					Byte( (uint8_t)((mem.scale << 6) | ((mem.index & 7) << 3) | (mem.base & 7)) );
+				}
+				else
+				{
+					Byte( (uint8_t)((mod << 6) | ((reg & 7) << 3) | (mem.base & 7)) );
+					if( (mem.base & 7) == RSP ) Byte( 0x24 );
+				}
+
+				if( mod == 1 ) Byte( (uint8_t)mem.disp );
+				else if( mod == 2 ) Dword( mem.disp );
+			}
+			// Instruction with two register operands
+			void OpRR( uint8_t prefix, bool w, std::initializer_list<uint8_t> opcode, int reg, int rm )
+			{
+				if( prefix ) Byte( prefix );
+				Rex( w, reg, 0, rm );
+				for( auto b : opcode ) Byte( b );
+				Byte( (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)) );
+			}
+
+			void Load( int reg, const Mem& mem ) { Op( 0, true, { 0x8B }, reg, mem ); }
+			void Store( const Mem& mem, int reg ) { Op( 0, true, { 0x89 }, reg, mem ); }
+			void StoreImm( const Mem& mem, int32_t imm ) { Op( 0, true, { 0xC7 }, 0, mem ); Dword( imm ); }
+			void Lea( int reg, const Mem& mem ) { Op( 0, true, { 0x8D }, reg, mem ); }
+			void Mov( int dst, int src ) { OpRR( 0, true, { 0x89 }, src, dst ); }
+			void MovImm( int reg, int64_t imm )
+			{
+				if( Fits32( imm ) )
+				{
+					OpRR( 0, true, { 0xC7 }, 0, reg );
+					Dword( (int32_t)imm );
+				}
+				else
+				{
+					Rex( true, 0, 0, reg );
+					Byte( (uint8_t)(0xB8 + (reg & 7)) );
+					Qword( imm );
+				}
+			}
+			// Group 1 arithmetic with an immediate, ext selects the operation (0 add, 4 and, 5 sub, 7 cmp)
+			void AluImm( int ext, const Mem& mem, int32_t imm )
+			{
+				if( Fits8( imm ) )
+				{
+					Op( 0, true, { 0x83 }, ext, mem );
+					Byte( (uint8_t)imm );
+				}
+				else
+				{
+					Op( 0, true, { 0x81 }, ext, mem );
+					Dword( imm );
+				}
+			}
+			void AluImm( int ext, int reg, int8_t imm )
+			{
+				OpRR( 0, true, { 0x83 }, ext, reg );
+				Byte( (uint8_t)imm );
+			}
+			// al = cc ? 1 : 0 for reg 0, cl for reg 1
+			void SetCC( Cond cc, int reg ) { Byte( 0x0F ); Byte( (uint8_t)(0x90 + cc) ); Byte( (uint8_t)(0xC0 | reg) ); }
+			// movzx eax, al
+			void ZeroExtendAL() { Byte( 0x0F ); Byte( 0xB6 ); Byte( 0xC0 ); }
+
+			void Push( int reg ) { Rex( false, 0, 0, reg ); Byte( (uint8_t)(0x50 + (reg & 7)) ); }
+			void Pop( int reg ) { Rex( false, 0, 0, reg ); Byte( (uint8_t)(0x58 + (reg & 7)) ); }
+			void Ret() { Byte( 0xC3 ); }
+
+			// Relative jumps and calls return the offset of their displacement, to be patched once the target is known
+			size_t Jmp() { Byte( 0xE9 ); return Rel32(); }
+			size_t Jcc( Cond cc ) { Byte( 0x0F ); Byte( (uint8_t)(0x80 + cc) ); return Rel32(); }
+			size_t Call() { Byte( 0xE8 ); return Rel32(); }
+		private:
+			void Rex( bool w, int reg, int index, int base )
+			{
+				uint8_t rex = (uint8_t)(0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0));
+				if( rex != 0x40 ) Byte( rex );
+			}
+			size_t Rel32()
+			{
+				size_t at = Size();
+				Dword( 0 );
+				return at;
+			}
+		private:
+			std::vector<uint8_t> m_Bytes;
+		};
+
+		// void entry( char* stack, Jit* jit )
+		using EntryFunc = void (*)(char*, Jit*);
+
+		bool IsJump( OpCode op )
+		{
+			switch( op )
+			{
+			case OpCode::JMP: case OpCode::JZ: case OpCode::JNZ:
+			case OpCode::JEQ: case OpCode::JNE: case OpCode::JLT: case OpCode::JLE: case OpCode::JGT: case OpCode::JGE:
+				return true;
+			default:
+				return false;
+			}
+		}
+#endif
+	}
+
+	Jit::~Jit()
+	{
+		Release();
+	}
+
+	bool Jit::Run( const BatCode& bc )
+	{
+#if BAT_JIT
+		if( bc.isa != InstructionSet::STACK || !Decode( bc ) || !Translate( bc ) )
+		{
+			return false;
+		}
+
+		m_Strings.Reset( bc.string_literals );
+		m_pNativeInfos = &bc.natives;
+		m_ResolvedNatives = m_Natives.Resolve( bc.natives );
+		m_iOverflowAt = -1;
+		reinterpret_cast<EntryFunc>(m_pEntry)(m_Stack, this);
+		if( m_iOverflowAt >= 0 )
+		{
+			const auto& lines = bc.debug_info.line_mapping;
+			ErrorSys::Report( (size_t)m_iOverflowAt < lines.size() ? lines[m_iOverflowAt] : 0, 0, "Stack overflow" );
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void Jit::AddNative( const std::string& name, BatNativeCallback callback )
+	{
+		m_Natives.Add( name, std::move( callback ) );
+	}
+
+	void Jit::PrintString( Jit* jit, int64_t idx )
+	{
+		std::cout << jit->m_Strings.Get( idx )->chars << std::endl;
+	}
+
+	char* Jit::CallNative( Jit* jit, char* sp )
+	{
+		sp -= sizeof( int64_t );
+		const int64_t native_idx = *reinterpret_cast<const int64_t*>(sp);
+		const BatNativeInfo& native = (*jit->m_pNativeInfos)[native_idx];
+		const size_t num_args = native.desc.param_types.size();
+		sp -= num_args * sizeof( int64_t );
+		*reinterpret_cast<int64_t*>(sp) = NativeTable::Call( jit->m_ResolvedNatives[native_idx], native, reinterpret_cast<const int64_t*>(sp), num_args, jit->m_Strings );
+		return sp + sizeof( int64_t );
+	}
+
+	void Jit::StackOverflow( Jit* jit, int64_t instruction )
+	{
+		jit->m_iOverflowAt = instruction;
+	}
+
+	void Jit::Release()
+	{
+#if BAT_JIT
+		if( m_pNative )
+		{
+			munmap( m_pNative, m_iNativeSize );
+		}
+#endif
+		m_pNative = nullptr;
+		m_iNativeSize = 0;
+		m_pEntry = nullptr;
+	}
+
+#if BAT_JIT
+	bool Jit::Decode( const BatCode& bc )
+	{
+		const char* code = bc.CodeBase();
+		const size_t size = bc.CodeSize();
+
+		m_Instructions.clear();
+		m_InstructionAt.assign( size, -1 );
+		m_Labels.assign( size, false );
+
+		// Array arguments are handles into the VM's heap, which the translated code doesn't have
+		bool natives_take_arrays = false;
+		for( const auto& native : bc.natives )
+		{
+			const auto& params = native.desc.param_types;
+			natives_take_arrays |= std::find( params.begin(), params.end(), TYPE_ARRAY ) != params.end();
+		}
+
+		for( size_t pc = 0; pc < size; )
+		{
+			auto decoded = DecodeOp( (unsigned char)code[pc] );
+			if( (decoded.op == OpCode::NATIVE && natives_take_arrays) || decoded.op == OpCode::AWAIT || decoded.op == OpCode::SPAWN || decoded.op == OpCode::TASK_END || IsArrayOp( decoded.op ) )
+			{
+				return false;
+			}
+
+			Instruction instr{ pc, decoded.op, 0 };
+			pc++;
+			if( OPCODE_OPERANDS[(size_t)decoded.op] )
+			{
+				instr.operand = ReadOperand( code + pc, decoded.width );
+				pc += decoded.width;
+			}
+
+			m_InstructionAt[instr.pc] = (int)m_Instructions.size();
+			m_Instructions.push_back( instr );
+		}
+
+		auto is_instruction = [&]( int64_t addr ) { return addr >= 0 && (size_t)addr < size && m_InstructionAt[addr] >= 0; };
+		for( const auto& instr : m_Instructions )
+		{
+			if( (instr.op == OpCode::CALL || instr.op == OpCode::TAILCALL) && (!is_instruction( instr.operand ) || m_Instructions[m_InstructionAt[instr.operand]].op != OpCode::PROC) )
+			{
+				return false;
+			}
+			if( IsJump( instr.op ) )
+			{
+				if( !is_instruction( instr.operand ) )
+				{
+					return false;
+				}
+				m_Labels[instr.operand] = true;
+			}
+		}
+
+		return is_instruction( bc.entry_point );
+	}
+
+	bool Jit::Translate( const BatCode& bc )
+	{
+		Assembler a;
+		// Native offset of each instruction
+		std::vector<size_t> native_offsets( m_Instructions.size() );
+		// Displacements to patch: offset of the displacement, index of the instruction it refers to
+		std::vector<std::pair<size_t, int>> fixups;
+		// Jumps taken when a proc or stack overflows: offset of the displacement, index of the instruction
+		std::vector<std::pair<size_t, int>> overflows;
+
+		// Registers while running:
+		//  rbx  base of the stack, globals are addressed from here
+		//  r12  base pointer
+		//  r13  stack pointer, lagging `deferred` bytes behind within straight line code
+		//  r15  the Jit, for the helpers
+		//  rbp  native stack pointer at entry, restored by halt
+		// Frames on the stack look like the VM's (see FRAME_LINK_SIZE), except that the return address slot is left
+		// alone because calls return through the native stack.
+
+		const size_t entry = a.Size();
+		for( int reg : { RBP, RBX, R12, R13, R15 } )
+		{
+			a.Push( reg );
+		}
+		a.Mov( RBP, RSP );
+		a.Mov( RBX, RDI );
+		a.Mov( R12, RDI );
+		a.Mov( R13, RDI );
+		a.Mov( R15, RSI );
+		fixups.emplace_back( a.Jmp(), m_InstructionAt[bc.entry_point] );
+
+		int32_t deferred = 0;
+		auto top = [&]( int depth ) { return Mem{ R13, deferred - 8 * (depth + 1) }; };
+		auto push = [&]( int reg )
+		{
+			a.Store( Mem{ R13, deferred }, reg );
+			deferred += 8;
+		};
+		// lea leaves the flags alone, so this can go between a compare and its jump
+		auto flush = [&]()
+		{
+			if( deferred != 0 )
+			{
+				a.Lea( R13, Mem{ R13, deferred } );
+				deferred = 0;
+			}
+		};
+		// The native stack isn't necessarily 16 byte aligned in between instructions, so realign it around the call
+		auto call_helper = [&]( const void* helper )
+		{
+			a.MovImm( RAX, (int64_t)helper );
+			a.Push( RSP );
+			a.Op( 0, false, { 0xFF }, 6, Mem{ RSP } ); // push [rsp]
+			a.AluImm( 4, RSP, -16 );
+			a.OpRR( 0, false, { 0xFF }, 2, RAX ); // call rax
+			a.Load( RSP, Mem{ RSP, 8 } );
+		};
+		// Returns from the entry, wherever the native stack is
+		auto halt = [&]()
+		{
+			a.Mov( RSP, RBP );
+			for( int reg : { R15, R13, R12, RBX, RBP } )
+			{
+				a.Pop( reg );
+			}
+			a.Ret();
+		};
+		auto binary = [&]( std::initializer_list<uint8_t> opcode )
+		{
+			a.Load( RAX, top( 0 ) );
+			a.Op( 0, true, opcode, RAX, top( 1 ) );
+			a.Store( top( 1 ), RAX );
+			deferred -= 8;
+		};
+		auto compare = [&]( Cond cc )
+		{
+			a.Load( RAX, top( 0 ) );
+			a.Op( 0, true, { 0x3B }, RAX, top( 1 ) );
+			a.SetCC( cc, RAX );
+			a.ZeroExtendAL();
+			a.Store( top( 1 ), RAX );
+			deferred -= 8;
+		};
+		// Quotient is left in rax, remainder in rdx
+		auto divide = [&]( int result )
+		{
+			a.Load( RAX, top( 0 ) );
+			a.Byte( 0x48 ); a.Byte( 0x99 ); // cqo
+			a.Op( 0, true, { 0xF7 }, 7, top( 1 ) ); // idiv
+			a.Store( top( 1 ), result );
+			deferred -= 8;
+		};
+		auto shift = [&]( int ext )
+		{
+			a.Load( RAX, top( 0 ) );
+			a.Load( RCX, top( 1 ) );
+			a.OpRR( 0, true, { 0xD3 }, ext, RAX );
+			a.Store( top( 1 ), RAX );
+			deferred -= 8;
+		};
+		auto binary_float = [&]( uint8_t opcode )
+		{
+			a.Op( 0xF2, false, { 0x0F, 0x10 }, XMM0, top( 0 ) );
+			a.Op( 0xF2, false, { 0x0F, opcode }, XMM0, top( 1 ) );
+			a.Op( 0xF2, false, { 0x0F, 0x11 }, XMM0, top( 1 ) );
+			deferred -= 8;
+		};
+		// Comparisons of floats push 1.0 or 0.0, same as the VM
+		// ucomisd reports unordered as ZF = PF = CF = 1, so NaN compares false except with !=
+		auto compare_float = [&]( OpCode op )
+		{
+			a.Op( 0xF2, false, { 0x0F, 0x10 }, XMM0, top( 0 ) );
+			a.Op( 0xF2, false, { 0x0F, 0x10 }, XMM1, top( 1 ) );
+			const bool swap = (op == OpCode::LESSF || op == OpCode::LESSEF);
+			a.OpRR( 0x66, false, { 0x0F, 0x2E }, swap ? XMM1 : XMM0, swap ? XMM0 : XMM1 );
+			switch( op )
+			{
+			case OpCode::GRTF: case OpCode::LESSF:   a.SetCC( CC_A, RAX ); break;
+			case OpCode::GRTEF: case OpCode::LESSEF: a.SetCC( CC_AE, RAX ); break;
+			case OpCode::EQF:
+				a.SetCC( CC_E, RAX );
+				a.SetCC( CC_NP, RCX );
+				a.Byte( 0x20 ); a.Byte( 0xC8 ); // and al, cl
+				break;
+			case OpCode::NEQF:
+				a.SetCC( CC_NE, RAX );
+				a.SetCC( CC_P, RCX );
+				a.Byte( 0x08 ); a.Byte( 0xC8 ); // or al, cl
+				break;
+			default:
+				assert( false );
+			}
+			a.ZeroExtendAL();
+			a.OpRR( 0xF2, true, { 0x0F, 0x2A }, XMM0, RAX ); // cvtsi2sd
+			a.Op( 0xF2, false, { 0x0F, 0x11 }, XMM0, top( 1 ) );
+			deferred -= 8;
+		};
+		for( size_t i = 0; i < m_Instructions.size(); i++ )
+		{
+			const Instruction& instr = m_Instructions[i];
+			// Jumps and calls arrive with the stack pointer written back
+			if( m_Labels[instr.pc] || instr.op == OpCode::PROC )
+			{
+				flush();
+			}
+			native_offsets[i] = a.Size();
+
+			if( instr.op != OpCode::PUSH && !Fits32( instr.operand ) )
+			{
+				return false;
+			}
+			const int32_t imm = (int32_t)instr.operand;
+
+			switch( instr.op )
+			{
+			case OpCode::NOP:
+				break;
+
+			case OpCode::PUSH:
+				if( Fits32( instr.operand ) )
+				{
+					a.StoreImm( Mem{ R13, deferred }, imm );
+					deferred += 8;
+				}
+				else
+				{
+					a.MovImm( RAX, instr.operand );
+					push( RAX );
+				}
+				break;
+			case OpCode::POP:
+				deferred -= 8;
+				break;
+			case OpCode::DUP:
+				a.Load( RAX, top( 0 ) );
+				push( RAX );
+				break;
+			case OpCode::DUPX1:
+				a.Load( RAX, top( 0 ) );
+				a.Load( RCX, top( 1 ) );
+				a.Store( top( 1 ), RAX );
+				a.Store( top( 0 ), RCX );
+				push( RAX );
+				break;
+			case OpCode::PROC:
+			case OpCode::STACK:
+				// Same check as VirtualMachine::HasStack, the frame's locals and STACK_RESERVE have to fit
+				a.Lea( RAX, Mem{ R13, deferred + imm + (int32_t)STACK_RESERVE } );
+				a.Lea( RCX, Mem{ RBX, (int32_t)STACK_SIZE } );
+				a.OpRR( 0, true, { 0x3B }, RAX, RCX ); // cmp rax, rcx
+				overflows.emplace_back( a.Jcc( CC_A ), (int)i );
+				deferred += imm;
+				break;
+
+			case OpCode::LOAD_LOCAL:
+			case OpCode::LOAD_GLOBAL:
+				a.Load( RAX, top( 0 ) );
+				a.Load( RAX, Mem{ (instr.op == OpCode::LOAD_LOCAL) ? R12 : RBX, 0, RAX } );
+				a.Store( top( 0 ), RAX );
+				break;
+			case OpCode::STORE_LOCAL:
+			case OpCode::STORE_GLOBAL:
+				a.Load( RAX, top( 0 ) );
+				a.Load( RCX, top( 1 ) );
+				a.Store( Mem{ (instr.op == OpCode::STORE_LOCAL) ? R12 : RBX, 0, RCX }, RAX );
+				deferred -= 16;
+				break;
+			case OpCode::LOADL_IMM:
+			case OpCode::LOADG_IMM:
+				a.Load( RAX, Mem{ (instr.op == OpCode::LOADL_IMM) ? R12 : RBX, imm } );
+				push( RAX );
+				break;
+			case OpCode::STOREL_IMM:
+			case OpCode::STOREG_IMM:
+				a.Load( RAX, top( 0 ) );
+				a.Store( Mem{ (instr.op == OpCode::STOREL_IMM) ? R12 : RBX, imm }, RAX );
+				deferred -= 8;
+				break;
+
+			case OpCode::BITAND: binary( { 0x23 } ); break;
+			case OpCode::BITOR:  binary( { 0x0B } ); break;
+			case OpCode::BITXOR: binary( { 0x33 } ); break;
+			case OpCode::BITNOT: a.Op( 0, true, { 0xF7 }, 2, top( 0 ) ); break;
+			case OpCode::SHL:    shift( 4 ); break;
+			case OpCode::SHR:    shift( 7 ); break;
+
+			case OpCode::EQ:     compare( CC_E ); break;
+			case OpCode::NEQ:    compare( CC_NE ); break;
+			case OpCode::LESS:   compare( CC_L ); break;
+			case OpCode::LESSE:  compare( CC_LE ); break;
+			case OpCode::GRT:    compare( CC_G ); break;
+			case OpCode::GRTE:   compare( CC_GE ); break;
+			case OpCode::NOT:
+				a.AluImm( 7, top( 0 ), 0 );
+				a.SetCC( CC_E, RAX );
+				a.ZeroExtendAL();
+				a.Store( top( 0 ), RAX );
+				break;
+
+			case OpCode::ADD:    binary( { 0x03 } ); break;
+			case OpCode::SUB:    binary( { 0x2B } ); break;
+			case OpCode::MUL:    binary( { 0x0F, 0xAF } ); break;
+			case OpCode::DIV:    divide( RAX ); break;
+			case OpCode::MOD:    divide( RDX ); break;
+			case OpCode::NEG:    a.Op( 0, true, { 0xF7 }, 3, top( 0 ) ); break;
+			case OpCode::ADDI:   a.AluImm( 0, top( 0 ), imm ); break;
+			case OpCode::SUBI:   a.AluImm( 5, top( 0 ), imm ); break;
+
+			case OpCode::ITOF:
+				a.Op( 0xF2, true, { 0x0F, 0x2A }, XMM0, top( 0 ) );
+				a.Op( 0xF2, false, { 0x0F, 0x11 }, XMM0, top( 0 ) );
+				break;
+			case OpCode::FTOI:
+				a.Op( 0xF2, true, { 0x0F, 0x2C }, RAX, top( 0 ) );
+				a.Store( top( 0 ), RAX );
+				break;
+			case OpCode::ADDF:   binary_float( 0x58 ); break;
+			case OpCode::SUBF:   binary_float( 0x5C ); break;
+			case OpCode::MULF:   binary_float( 0x59 ); break;
+			case OpCode::DIVF:   binary_float( 0x5E ); break;
+			case OpCode::NEGF:
+				a.MovImm( RAX, INT64_MIN );
+				a.Op( 0, true, { 0x31 }, RAX, top( 0 ) ); // xor [top], rax
+				break;
+
+			case OpCode::EQF:
+			case OpCode::NEQF:
+			case OpCode::LESSF:
+			case OpCode::LESSEF:
+			case OpCode::GRTF:
+			case OpCode::GRTEF:
+				compare_float( instr.op );
+				break;
+
+			case OpCode::JMP:
+				flush();
+				fixups.emplace_back( a.Jmp(), m_InstructionAt[instr.operand] );
+				break;
+			case OpCode::JZ:
+			case OpCode::JNZ:
+				a.AluImm( 7, top( 0 ), 0 );
+				deferred -= 8;
+				flush();
+				fixups.emplace_back( a.Jcc( (instr.op == OpCode::JZ) ? CC_E : CC_NE ), m_InstructionAt[instr.operand] );
+				break;
+			case OpCode::JEQ:
+			case OpCode::JNE:
+			case OpCode::JLT:
+			case OpCode::JLE:
+			case OpCode::JGT:
+			case OpCode::JGE:
+			{
+				static const Cond conditions[] = { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE };
+				a.Load( RAX, top( 0 ) );
+				a.Op( 0, true, { 0x3B }, RAX, top( 1 ) );
+				deferred -= 16;
+				flush();
+				fixups.emplace_back( a.Jcc( conditions[(int)instr.op - (int)OpCode::JEQ] ), m_InstructionAt[instr.operand] );
+				break;
+			}
+			case OpCode::CALL:
+				a.Store( Mem{ R13, deferred + 8 }, R12 );
+				a.Lea( R12, Mem{ R13, deferred + (int32_t)FRAME_LINK_SIZE } );
+				a.Mov( R13, R12 );
+				deferred = 0;
+				fixups.emplace_back( a.Call(), m_InstructionAt[instr.operand] );
+				break;
+			case OpCode::TAILCALL:
+				// Keeps the native return address of the frame, its arguments are stored over already
+				a.Mov( R13, R12 );
+				deferred = 0;
+				fixups.emplace_back( a.Jmp(), m_InstructionAt[instr.operand] );
+				break;
+			case OpCode::RET:
+				a.Load( RAX, top( 0 ) );
+				a.Lea( R13, Mem{ R12, -(int32_t)FRAME_LINK_SIZE - imm } );
+				a.Load( R12, Mem{ R12, -8 } );
+				a.Store( Mem{ R13 }, RAX );
+				a.Lea( R13, Mem{ R13, 8 } );
+				a.Ret();
+				deferred = 0;
+				break;
+
+			case OpCode::PRINTI:
+			case OpCode::PRINTB:
+				a.Load( RDI, top( 0 ) );
+				deferred -= 8;
+				call_helper( (instr.op == OpCode::PRINTI) ? (const void*)&PrintInt : (const void*)&PrintBool );
+				break;
+			case OpCode::PRINTF:
+				a.Op( 0xF2, false, { 0x0F, 0x10 }, XMM0, top( 0 ) );
+				deferred -= 8;
+				call_helper( (const void*)&PrintFloat );
+				break;
+			case OpCode::PRINTS:
+				a.Load( RSI, top( 0 ) );
+				a.Mov( RDI, R15 );
+				deferred -= 8;
+				call_helper( (const void*)&Jit::PrintString );
+				break;
+
+			case OpCode::NATIVE:
+				flush();
+				a.Mov( RDI, R15 );
+				a.Mov( RSI, R13 );
+				call_helper( (const void*)&Jit::CallNative );
+				a.Mov( R13, RAX );
+				break;
+
+			case OpCode::HALT:
+				halt();
+				deferred = 0;
+				break;
+
+			default:
+				return false;
+			}
+		}
+
+		// Out of line, every overflow check jumps to its own stub, which passes the instruction on to the helper and halts
+		const size_t overflow = a.Size();
+		a.Mov( RDI, R15 );
+		call_helper( (const void*)&Jit::StackOverflow );
+		halt();
+		for( const auto& check : overflows )
+		{
+			a.PatchDword( check.first, (int32_t)(a.Size() - (check.first + 4)) );
+			a.MovImm( RSI, check.second );
+			const size_t jmp = a.Jmp();
+			a.PatchDword( jmp, (int32_t)(overflow - (jmp + 4)) );
+		}
+
+		for( const auto& fixup : fixups )
+		{
+			a.PatchDword( fixup.first, (int32_t)(native_offsets[fixup.second] - (fixup.first + 4)) );
+		}
+
+		Release();
+		void* native = mmap( nullptr, a.Size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+		if( native == MAP_FAILED )
+		{
+			return false;
+		}
+		memcpy( native, a.Bytes(), a.Size() );
+		m_pNative = native;
+		m_iNativeSize = a.Size();
+		// Writable or executable, never both
+		if( mprotect( native, a.Size(), PROT_READ | PROT_EXEC ) != 0 )
+		{
+			Release();
+			return false;
+		}
+
+		const char* base = static_cast<const char*>(native);
+		m_pEntry = base + entry;
+
+		return true;
+	}
+#else
+	bool Jit::Decode( const BatCode& bc )
+	{
+		return false;
+	}
+
+	bool Jit::Translate( const BatCode& bc )
+	{
+		return false;
+	}
+#endif
+}
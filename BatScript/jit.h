@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "compiler.h"
+#include "native_binding.h"
+#include "stringpool.h"
+
+// The JIT emits x86-64 code for the System V calling convention, elsewhere Jit::Run always falls back to the VM
+#if defined( __x86_64__ ) && defined( __linux__ )
+#define BAT_JIT 1
+#else
+#define BAT_JIT 0
+#endif
+
+namespace Bat
+{
+	// Baseline JIT for stack code: every instruction is translated to a fixed template of machine code.
+	// The translated code keeps the VM's memory layout (one byte addressed stack holding globals, locals and temporaries),
+	// so addresses in the code mean the same thing, but calls and returns go through the native call stack.
+	// Stack pointer updates within straight line code are folded into the addressing of the instructions that follow
+	// and are only written back before jumps, calls and jump targets.
+	// Natives are called through a helper. Code that can't be translated (tasks, arrays and natives that take arrays for
+	// now) makes Run decline the whole program, the caller then runs it on the VM.
+	class Jit
+	{
+	public:
+		Jit() = default;
+		~Jit();
+		Jit( const Jit& ) = delete;
+		Jit& operator=( const Jit& ) = delete;
+
+		void AddNative( const std::string& name, BatNativeCallback callback );
+		// Binds a C++ function as a native, see NativeBinding::Typed
+		template <typename R, typename... Args>
+		void Bind( const std::string& name, R (*function)( Args... ) )
+		{
+			m_Natives.Bind( name, function );
+		}
+		NativeTable& Natives() { return m_Natives; }
+
+		// Translates and runs bc, returns false without running anything if bc can't be translated
+		bool Run( const BatCode& bc );
+	private:
+		struct Instruction
+		{
+			size_t pc;
+			OpCode op;
+			int64_t operand;
+		};
+
+		bool Decode( const BatCode& bc );
+		bool Translate( const BatCode& bc );
+		void Release();
+
+		static void PrintString( Jit* jit, int64_t idx );
+		// Calls the native whose index is on top of the stack at sp like the VM's NATIVE, returns the new stack pointer
+		static char* CallNative( Jit* jit, char* sp );
+		// Called by the code when the frame or block starting at instruction doesn't fit on the stack, the code halts after
+		static void StackOverflow( Jit* jit, int64_t instruction );
+	private:
+		std::vector<Instruction> m_Instructions;
+		// Indexed by code offset: index of the instruction starting there, -1 inside of instructions
+		std::vector<int> m_InstructionAt;
+		// Indexed by code offset: whether anything jumps there
+		std::vector<bool> m_Labels;
+
+		void* m_pNative = nullptr;
+		size_t m_iNativeSize = 0;
+		const void* m_pEntry = nullptr;
+
+		// Aligned to a cache line, so where the Jit happens to be placed doesn't decide the cost of the hot slots
+		alignas( 64 ) char m_Stack[STACK_SIZE];
+		StringTable m_Strings;
+		NativeTable m_Natives;
+		// Natives of the running code and their bindings, indexed alike
+		const std::vector<BatNativeInfo>* m_pNativeInfos = nullptr;
+		std::vector<const NativeBinding*> m_ResolvedNatives;
+		// Index of the instruction that overflowed the stack, -1 if none did
+		int64_t m_iOverflowAt = -1;
+	};
+}
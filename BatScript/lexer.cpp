@@ -401,7 +401,7 @@ namespace Bat
 		Advance(); // Eat ending quote
 
 		std::string lexeme = GetCurrLexeme();
-		const char* str = stringpool.AddString( m_szText.substr( m_iStart + 1, m_iCurrent - m_iStart - 2 ) );
+		BatString* str = stringpool.Intern( std::string_view( m_szText ).substr( m_iStart + 1, m_iCurrent - m_iStart - 2 ) );
 
 		m_Tokens.emplace_back( str, lexeme, m_iLine, GetCurrColumn() );
 	}
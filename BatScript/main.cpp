@@ -1,6 +1,11 @@
 #include <iostream>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <limits>
 #include <chrono>
+#include <thread>
+#include <algorithm>
 
 #include "stringlib.h"
 #include "memory_stream.h"
@@ -9,13 +14,26 @@
 #include "semantic_analysis.h"
 #include "errorsys.h"
 #include "ast_printer.h"
+#include "ast_optimizer.h"
 #include "interpreter.h"
 #include "bat_callable.h"
 #include "runtime_error.h"
 #include "compiler.h"
+#include "bytecode_image.h"
+#include "compile_cache.h"
+#include "module_loader.h"
 #include "disassembler.h"
 #include "vm.h"
+#include "peephole.h"
+#include "reg_compiler.h"
+#include "reg_vm.h"
 #include "optparse.h"
+#include "embed.h"
+#include "jit.h"
+#include "aot.h"
+#include "profiler.h"
+#include "batch.h"
+#include "arraylib.h"
 
 using namespace Bat;
 
@@ -23,21 +41,153 @@ Interpreter interpreter;
 SemanticAnalysis sa;
 Compiler compiler;
 VirtualMachine vm;
+RegCompiler regcompiler;
+RegisterVM regvm;
+Jit jit;
 
 // Options
 enum class ExecuteMethod
 {
 	NONE,
 	INTERPRETER,
-	VM
+	VM,
+	REGVM,
+	// Stack code translated to machine code, anything the JIT can't translate runs on the VM
+	JIT
 };
 
 bool print_ast = false;
 bool disassemble = false;
+bool peephole = true;
+bool ast_optimizer = true;
+// Script functions of at most this many instructions are inlined by the stack compiler, 0 turns inlining off
+size_t inline_limit = Compiler::DEFAULT_INLINE_LIMIT;
+// -O2 compiles through the optimized IR (see ir.h), -O0 turns off the optimizations that -O1 does by default
+int optimize_level = 1;
+// When set, the script is only compiled and the code is written as an image to this file
+std::string image_output;
+// When set, the script is only compiled and translated to C source in this file (see aot.h)
+std::string c_output;
+// When set, the script is profiled and the samples are written to this file as collapsed stacks (see profiler.h)
+std::string profile_output;
+// Samples per second of CPU time while profiling
+constexpr int PROFILE_HZ = 1000;
+// Directory of the compile cache, empty if compiled code isn't cached
+std::string cache_dir;
 ExecuteMethod exec_method = ExecuteMethod::INTERPRETER;
+// When set, the compiled code runs on this many instances at the same time, one thread each
+int num_instances = 0;
+// When set, the compiled code runs once for every input listed in this file, on num_instances workers (see batch.h)
+std::string batch_list;
+std::vector<std::string> batch_inputs;
+// Natives bound by the host, for instances and modules which are created later
+NativeTable natives;
+AwaitableTable awaitables;
+
+// Runs the code on num_instances instances in parallel (see embed.h) and reports the throughput
+void RunInstances( const BatCode& code )
+{
+	auto program = Program::FromCode( code );
+	std::vector<std::unique_ptr<Instance>> instances;
+	for( int i = 0; i < num_instances; i++ )
+	{
+		auto instance = std::make_unique<Instance>( program );
+		instance->Natives() = natives;
+		for( const auto& [name, callback] : awaitables )
+		{
+			instance->BindAwaitable( name, callback );
+		}
+		instances.push_back( std::move( instance ) );
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for( auto& instance : instances )
+	{
+		threads.emplace_back( [&instance]() { instance->Run(); } );
+	}
+	for( auto& thread : threads )
+	{
+		thread.join();
+	}
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	std::cerr << num_instances << " instances: " << seconds * 1000.0 << " ms, " << num_instances / seconds << " runs/s\n";
+}
+
+// Runs the code once per batch input on a pool of instances and reports the throughput
+void RunBatch( const BatCode& code )
+{
+	BatchRunner runner( Program::FromCode( code ), natives, awaitables, num_instances );
+
+	auto start = std::chrono::steady_clock::now();
+	runner.Run( batch_inputs, std::cout );
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	std::cerr << batch_inputs.size() << " runs on " << runner.NumWorkers() << " instances: " << seconds * 1000.0 << " ms, "
+		<< batch_inputs.size() / seconds << " runs/s\n";
+}
+
+void Execute( BatCode& code )
+{
+	if( exec_method == ExecuteMethod::NONE )
+	{
+		return;
+	}
+
+	if( !batch_list.empty() )
+	{
+		RunBatch( code );
+		return;
+	}
+
+	if( num_instances > 0 )
+	{
+		RunInstances( code );
+		return;
+	}
+
+	if( code.isa == InstructionSet::REGISTER )
+	{
+		regvm.Run( code );
+	}
+	else if( exec_method != ExecuteMethod::JIT || !jit.Run( code ) )
+	{
+		vm.Run( code );
+	}
+}
+
+// Everything that changes the compiled code of a script, part of the compile cache key
+std::string CompileOptions()
+{
+	std::string options = (exec_method == ExecuteMethod::REGVM) ? "regvm" : "vm";
+	if( !peephole ) options += " no-peephole";
+	if( !ast_optimizer ) options += " no-ast-optimizer";
+	if( inline_limit != Compiler::DEFAULT_INLINE_LIMIT ) options += " inline-limit=" + std::to_string( inline_limit );
+	if( optimize_level >= 2 ) options += " O2";
+	return options;
+}
 
 void Run( const std::string& src, bool print_expression_results = false )
 {
+	const bool use_cache = !cache_dir.empty() && image_output.empty() && c_output.empty() &&
+		(exec_method == ExecuteMethod::VM || exec_method == ExecuteMethod::REGVM || exec_method == ExecuteMethod::JIT);
+	if( use_cache )
+	{
+		BatCode code;
+		if( CompileCache( cache_dir ).Load( src, CompileOptions(), code ) )
+		{
+			if( disassemble )
+			{
+				Disassembler disasm( code, src );
+				disasm.Disassemble();
+			}
+
+			Execute( code );
+			return;
+		}
+	}
+
 	Lexer l( src );
 	auto tokens = l.Scan();
 
@@ -55,6 +205,12 @@ void Run( const std::string& src, bool print_expression_results = false )
 
 	if( ErrorSys::HadError() ) return;
 
+	// Expression statements at the prompt print their results, so they aren't dropped as unused
+	if( ast_optimizer && !print_expression_results )
+	{
+		AstOptimizer::Optimize( res );
+	}
+
 	try
 	{
 		for( size_t i = 0; i < res.size(); i++ )
@@ -66,6 +222,7 @@ void Run( const std::string& src, bool print_expression_results = false )
 
 			if( print_expression_results && res[i]->IsExpressionStmt() )
 			{
+				interpreter.Resolve( res[i].get() );
 				auto expr_res = interpreter.Evaluate( res[i]->AsExpressionStmt()->Expr() );
 				std::cout << expr_res.ToString() << std::endl;
 			}
@@ -79,11 +236,23 @@ void Run( const std::string& src, bool print_expression_results = false )
 
 		if( exec_method != ExecuteMethod::INTERPRETER )
 		{
-			compiler.Compile( std::move( res ) );
-
-			if( ErrorSys::HadError() ) return;
-
-			auto code = compiler.Code();
+			BatCode code;
+			if( exec_method == ExecuteMethod::REGVM )
+			{
+				regcompiler.Compile( std::move( res ) );
+				if( ErrorSys::HadError() ) return;
+				code = regcompiler.Code();
+			}
+			else
+			{
+				compiler.Compile( std::move( res ) );
+				if( ErrorSys::HadError() ) return;
+				code = compiler.Code();
+				if( peephole )
+				{
+					PeepholeOptimizer::Optimize( code );
+				}
+			}
 
 			if( disassemble )
 			{
@@ -91,10 +260,28 @@ void Run( const std::string& src, bool print_expression_results = false )
 				disasm.Disassemble();
 			}
 
-			if( exec_method == ExecuteMethod::VM )
+			if( !image_output.empty() )
 			{
-				vm.Run( code );
+				BytecodeImage::Save( code, image_output );
+				return;
 			}
+
+			if( !c_output.empty() )
+			{
+				std::string source;
+				if( AotTranslator::Translate( code, source ) )
+				{
+					std::ofstream( c_output ) << source;
+				}
+				return;
+			}
+
+			if( use_cache )
+			{
+				CompileCache( cache_dir ).Store( src, CompileOptions(), code, ModuleLoader::Dependencies() );
+			}
+
+			Execute( code );
 		}
 	}
 	catch( const RuntimeError& )
@@ -103,8 +290,48 @@ void Run( const std::string& src, bool print_expression_results = false )
 	}
 }
 
+void RunImage( const std::string& filename )
+{
+	ErrorSys::SetSource( filename );
+
+	BatCode code;
+	if( !BytecodeImage::Load( filename, code ) ) return;
+
+	if( disassemble )
+	{
+		Disassembler disasm( code );
+		disasm.Disassemble();
+	}
+
+	Execute( code );
+}
+
+// Runs a script that was translated to C and built into a shared library
+void RunModule( const std::string& filename )
+{
+	ErrorSys::SetSource( filename );
+
+	AotModule module;
+	if( !module.Load( filename ) ) return;
+
+	module.Natives() = natives;
+	module.Run();
+}
+
 void RunFromFile( const std::string& filename )
 {
+	if( AotModule::IsModuleFile( filename ) )
+	{
+		RunModule( filename );
+		return;
+	}
+
+	if( BytecodeImage::IsImageFile( filename ) )
+	{
+		RunImage( filename );
+		return;
+	}
+
 	ErrorSys::SetSource( filename );
 	auto source = MemoryStream::FromFile( filename, FileMode::TEXT );
 	Run( source.Base() );
@@ -129,6 +356,25 @@ void AddNative( const std::string& name, BatNativeCallback callback )
 {
 	interpreter.AddNative( name, callback );
 	vm.AddNative( name, callback );
+	regvm.AddNative( name, callback );
+	jit.AddNative( name, callback );
+	natives.Add( name, callback );
+}
+
+template <typename R, typename... Args>
+void Bind( const std::string& name, R (*function)( Args... ) )
+{
+	interpreter.Bind( name, function );
+	vm.Bind( name, function );
+	regvm.Bind( name, function );
+	jit.Bind( name, function );
+	natives.Bind( name, function );
+}
+
+void BindAwaitable( const std::string& name, AwaitableCallback callback )
+{
+	vm.BindAwaitable( name, callback );
+	awaitables[name] = callback;
 }
 
 using namespace std::chrono;
@@ -141,8 +387,20 @@ int fib( int n )
 
 int main( int argc, char** argv )
 {
-	AddNative( "time", []( const std::vector<BatObject>& args ) {
-		return BatObject( duration_cast<milliseconds>( system_clock::now().time_since_epoch() ).count() );
+	Bind( "time", +[]() -> int64_t {
+		return duration_cast<milliseconds>( system_clock::now().time_since_epoch() ).count();
+	} );
+	Bind( "sqrt", +[]( double x ) { return std::sqrt( x ); } );
+	Bind( "strlen", +[]( const char* s ) -> int64_t { return (int64_t)strlen( s ); } );
+	BindArrayLib( []( const std::string& name, auto function ) { Bind( name, function ); } );
+
+	// Awaitables, only the stack VM runs tasks (see scheduler.h)
+	// sleep resumes the task after the given milliseconds, yield lets every other runnable task run first
+	BindAwaitable( "sleep", []( Scheduler& scheduler, TaskId task, const int64_t* args, size_t ) {
+		scheduler.CompleteAfter( task, milliseconds( args[0] ), args[0] );
+	} );
+	BindAwaitable( "yield", []( Scheduler& scheduler, TaskId task, const int64_t*, size_t ) {
+		scheduler.Complete( task, 0 );
 	} );
 
 	// YUCK! Should make my own format func in the future, this is leaky and disgusting
@@ -176,7 +434,20 @@ int main( int argc, char** argv )
 		OptParse optparse;
 		optparse.AddFlagOption( "disasm", 'd' )
 			.AddFlagOption( "ast", 'a' )
-			.AddArgOption( "method", 'm' );
+			.AddFlagOption( "no-peephole" )
+			.AddFlagOption( "no-ast-optimizer" )
+			.AddFlagOption( "opstats" )
+			.AddArgOption( "method", 'm' )
+			.AddArgOption( "compile", 'c' )
+			.AddArgOption( "emit-c" )
+			.AddArgOption( "cache" )
+			.AddArgOption( "instances" )
+			.AddArgOption( "batch" )
+			.AddArgOption( "simd" )
+			.AddArgOption( "inline-limit" )
+			.AddArgOption( "optimize", 'O' )
+			.AddFlagOption( "dump-ir" )
+			.AddArgOption( "profile" );
 		optparse.Process( argc, argv );
 
 		if( optparse["disasm"] )
@@ -189,12 +460,35 @@ int main( int argc, char** argv )
 			print_ast = true;
 		}
 
+		if( optparse["no-peephole"] )
+		{
+			peephole = false;
+		}
+
+		if( optparse["no-ast-optimizer"] )
+		{
+			ast_optimizer = false;
+		}
+
+		if( optparse["opstats"] )
+		{
+			vm.EnableOpStats( true );
+		}
+
 		if( optparse["method"] )
 		{
 			if( optparse["method"] == "vm"s )
 			{
 				exec_method = ExecuteMethod::VM;
 			}
+			else if( optparse["method"] == "regvm"s )
+			{
+				exec_method = ExecuteMethod::REGVM;
+			}
+			else if( optparse["method"] == "jit"s )
+			{
+				exec_method = ExecuteMethod::JIT;
+			}
 			else if( optparse["method"] == "interpreter"s )
 			{
 				exec_method = ExecuteMethod::INTERPRETER;
@@ -205,12 +499,171 @@ int main( int argc, char** argv )
 			}
 			else
 			{
-				std::cerr << "Method must be one of: none, vm, interpreter\n";
+				std::cerr << "Method must be one of: none, vm, regvm, jit, interpreter\n";
+				return -1;
+			}
+		}
+
+		if( optparse["compile"] )
+		{
+			image_output = optparse["compile"];
+			if( image_output.empty() )
+			{
+				std::cerr << "Compile requires an output file, e.g. -c out.batc\n";
 				return -1;
 			}
+
+			// Images hold compiled code, so compile for the stack VM unless the register VM was asked for
+			if( exec_method != ExecuteMethod::REGVM )
+			{
+				exec_method = ExecuteMethod::VM;
+			}
+		}
+
+		if( optparse["emit-c"] )
+		{
+			c_output = optparse["emit-c"];
+			if( c_output.empty() )
+			{
+				std::cerr << "Translating to C requires an output file, e.g. --emit-c out.c\n";
+				return -1;
+			}
+
+			// Translation works on stack code
+			exec_method = ExecuteMethod::VM;
+		}
+
+		if( optparse["cache"] )
+		{
+			cache_dir = optparse["cache"];
+		}
+
+		if( optparse["inline-limit"] )
+		{
+			const int limit = atoi( optparse["inline-limit"] );
+			if( limit < 0 )
+			{
+				std::cerr << "Inline limit must be a number of instructions, 0 turns inlining off\n";
+				return -1;
+			}
+			inline_limit = (size_t)limit;
+			compiler.SetInlineLimit( inline_limit );
+		}
+
+		if( optparse["optimize"] )
+		{
+			const std::string level = optparse["optimize"];
+			if( level != "0" && level != "1" && level != "2" )
+			{
+				std::cerr << "Optimization level must be 0, 1 or 2, e.g. -O2\n";
+				return -1;
+			}
+			optimize_level = level[0] - '0';
+			if( optimize_level == 0 )
+			{
+				ast_optimizer = false;
+				peephole = false;
+				inline_limit = 0;
+				compiler.SetInlineLimit( 0 );
+			}
+			compiler.SetOptimizeIr( optimize_level >= 2 );
+		}
+
+		if( optparse["dump-ir"] )
+		{
+			compiler.SetIrDump( &std::cout );
+		}
+
+		if( optparse["simd"] )
+		{
+			ArrayLib::InstructionSet set;
+			if( !ArrayLib::FromString( optparse["simd"], set ) || !ArrayLib::Select( set ) )
+			{
+				std::cerr << "Array builtins can use scalar, sse4.2 or avx2 kernels, this CPU supports up to " << ArrayLib::ToString( ArrayLib::Supported() ) << "\n";
+				return -1;
+			}
+		}
+
+		if( optparse["instances"] )
+		{
+			num_instances = atoi( optparse["instances"] );
+			if( num_instances < 1 )
+			{
+				std::cerr << "Number of instances must be at least 1\n";
+				return -1;
+			}
+			if( exec_method != ExecuteMethod::VM && exec_method != ExecuteMethod::REGVM )
+			{
+				std::cerr << "Running instances requires the vm or regvm method\n";
+				return -1;
+			}
+		}
+
+		if( optparse["batch"] )
+		{
+			batch_list = optparse["batch"];
+			std::ifstream list( batch_list );
+			if( batch_list.empty() || !list )
+			{
+				std::cerr << "Batch requires a file that lists one input per line, e.g. --batch inputs.txt\n";
+				return -1;
+			}
+			std::string input;
+			while( std::getline( list, input ) )
+			{
+				if( !input.empty() && input.back() == '\r' ) input.pop_back();
+				if( !input.empty() ) batch_inputs.push_back( input );
+			}
+			if( exec_method != ExecuteMethod::VM && exec_method != ExecuteMethod::REGVM )
+			{
+				std::cerr << "Running a batch requires the vm or regvm method\n";
+				return -1;
+			}
+			// --instances is the size of the pool, by default one instance per hardware thread
+			if( num_instances == 0 )
+			{
+				num_instances = std::max( (int)std::thread::hardware_concurrency(), 1 );
+			}
+		}
+
+		if( optparse["profile"] )
+		{
+			profile_output = optparse["profile"];
+			if( profile_output.empty() )
+			{
+				std::cerr << "Profiling requires an output file, e.g. --profile out.folded\n";
+				return -1;
+			}
+			if( (exec_method != ExecuteMethod::VM && exec_method != ExecuteMethod::INTERPRETER) || num_instances > 0 )
+			{
+				std::cerr << "Profiling requires the vm or interpreter method\n";
+				return -1;
+			}
+		}
+
+		Profiler profiler;
+		if( !profile_output.empty() )
+		{
+			vm.SetProfiler( &profiler );
+			interpreter.SetProfiler( &profiler );
+			if( !profiler.Start( PROFILE_HZ ) )
+			{
+				return 1;
+			}
 		}
 
 		RunFromFile( optparse.GetArg( 0 ) );
+
+		if( !profile_output.empty() )
+		{
+			profiler.Stop();
+			vm.SetProfiler( nullptr );
+			interpreter.SetProfiler( nullptr );
+
+			std::ofstream out( profile_output );
+			profiler.Write( out );
+			std::cerr << profiler.NumSamples() << " samples written to " << profile_output << "\n";
+		}
 	}
 	else
 	{
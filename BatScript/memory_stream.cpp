@@ -86,6 +86,7 @@ void MemoryStream::WriteByte( const char byte )
 	{
 		m_Bytes.emplace_back( byte );
 		m_iCurrentByte++;
+		return;
 	}
 
 	m_Bytes[m_iCurrentByte++] = byte;
@@ -95,11 +96,8 @@ void MemoryStream::WriteBytes( const char* pBytes, const size_t size )
 {
 	if( EndOfStream() )
 	{
-		m_Bytes.reserve( m_Bytes.size() + size );
-		for( size_t i = 0; i < size; i++ )
-		{
-			m_Bytes.emplace_back( pBytes[i] );
-		}
+		// No exact reserve here, that would defeat the vector's geometric growth and make appending quadratic
+		m_Bytes.insert( m_Bytes.end(), pBytes, pBytes + size );
 
 		m_iCurrentByte += size;
 	}
@@ -107,9 +105,8 @@ void MemoryStream::WriteBytes( const char* pBytes, const size_t size )
 	{
 		const size_t total_size = m_Bytes.size();
 		const size_t needed = (m_iCurrentByte + size) - total_size;
-		m_Bytes.reserve( total_size + needed );
 
-		for( size_t i = m_iCurrentByte; i < total_size; i++ )
+		for( size_t i = 0; i < total_size - m_iCurrentByte; i++ )
 		{
 			m_Bytes[m_iCurrentByte + i] = pBytes[i];
 		}
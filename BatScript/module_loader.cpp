@@ -0,0 +1,68 @@
+#include "module_loader.h"
+
+#include <fstream>
+#include "errorsys.h"
+#include "lexer.h"
+#include "memory_stream.h"
+#include "parser.h"
+
+namespace Bat
+{
+	static std::vector<ModuleDependency> s_Dependencies;
+
+	bool ModuleLoader::Load( ImportStmt* node, std::vector<std::unique_ptr<Statement>>& statements )
+	{
+		std::string filename;
+		if( !FindModule( node->ModuleName(), filename ) )
+		{
+			ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Module '" + node->ModuleName() + "' not found" );
+			return false;
+		}
+
+		auto source = MemoryStream::FromFile( filename, FileMode::TEXT );
+		// Empty files don't get a terminator
+		std::string text = (source.Size() > 0) ? source.Base() : "";
+		s_Dependencies.push_back( { filename, Hash( text.data(), text.size() ) } );
+
+		Lexer l( text );
+		auto tokens = l.Scan();
+
+		if( ErrorSys::HadError() ) return false;
+
+		Parser p( std::move( tokens ) );
+		statements = p.Parse();
+
+		return !ErrorSys::HadError();
+	}
+
+	bool ModuleLoader::FindModule( const std::string& module_name, std::string& filename )
+	{
+		for( const char* extension : { ".bat", ".bs" } )
+		{
+			filename = module_name + extension;
+			if( std::ifstream( filename ) )
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const std::vector<ModuleDependency>& ModuleLoader::Dependencies()
+	{
+		return s_Dependencies;
+	}
+
+	uint64_t ModuleLoader::Hash( const char* data, size_t size, uint64_t seed )
+	{
+		uint64_t hash = seed;
+		for( size_t i = 0; i < size; i++ )
+		{
+			hash ^= (unsigned char)data[i];
+			hash *= 0x100000001b3ull;
+		}
+
+		return hash;
+	}
+}
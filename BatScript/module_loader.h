@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "ast.h"
+
+namespace Bat
+{
+	struct ModuleDependency
+	{
+		std::string filename;
+		uint64_t hash;
+	};
+
+	// Finds, reads and parses imported modules
+	// Semantic analysis loads each import once and attaches the statements to the ImportStmt, the interpreter and
+	// compilers then work on that same analyzed AST instead of reading the module again.
+	// Every file that's loaded is recorded with a hash of its contents, so cached compilation results that depend on
+	// it can be checked (see compile_cache.h).
+	class ModuleLoader
+	{
+	public:
+		// Reports an error and returns false if the module can't be found or parsed
+		static bool Load( ImportStmt* node, std::vector<std::unique_ptr<Statement>>& statements );
+		// Returns false if neither <module>.bat nor <module>.bs exists
+		static bool FindModule( const std::string& module_name, std::string& filename );
+
+		static const std::vector<ModuleDependency>& Dependencies();
+
+		// 64-bit FNV-1a
+		static uint64_t Hash( const char* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull );
+	};
+}
@@ -0,0 +1,121 @@
+#include "native_binding.h"
+
+#include <cassert>
+#include "compiler.h"
+#include "errorsys.h"
+
+namespace Bat
+{
+	namespace
+	{
+		// Generic natives take objects, converted from the slots by their declared types
+		int64_t InvokeCallbackSlots( const NativeBinding& native, const BatNativeDesc& desc, const int64_t* args, size_t num_args, StringTable& strings )
+		{
+			std::vector<BatObject> params( num_args );
+			for( size_t i = 0; i < num_args; i++ )
+			{
+				// Varargs don't have a type, pass them through as raw values
+				ObjectType type = (i < desc.param_types.size()) ? desc.param_types[i] : TYPE_INT;
+				switch( type )
+				{
+				case TYPE_BOOL:
+					params[i] = BatObject( (bool)args[i] );
+					break;
+				case TYPE_INT:
+					params[i] = BatObject( args[i] );
+					break;
+				case TYPE_FLOAT:
+					params[i] = BatObject( NativeTypes::FromSlot<double>( args[i], strings ) );
+					break;
+				case TYPE_STR:
+					params[i] = BatObject( strings.Get( args[i] ) );
+					break;
+				default:
+					assert( false );
+				}
+			}
+
+			BatObject result = native.callback( params );
+
+			switch( result.type )
+			{
+			case TYPE_BOOL:
+				return result.Bool();
+			case TYPE_INT:
+				return result.Int();
+			case TYPE_FLOAT:
+				return NativeTypes::ToSlot( result.Float(), strings );
+			case TYPE_STR:
+				return strings.Add( result.value.str );
+			default:
+				assert( false );
+				return 0;
+			}
+		}
+		BatObject InvokeCallbackObjects( const NativeBinding& native, const std::vector<BatObject>& args )
+		{
+			return native.callback( args );
+		}
+	}
+
+	NativeBinding NativeBinding::Generic( BatNativeCallback callback )
+	{
+		NativeBinding binding;
+		binding.invoke_slots = &InvokeCallbackSlots;
+		binding.invoke_objects = &InvokeCallbackObjects;
+		binding.callback = std::move( callback );
+		return binding;
+	}
+
+	void NativeTable::Add( const std::string& name, BatNativeCallback callback )
+	{
+		Insert( name, NativeBinding::Generic( std::move( callback ) ) );
+	}
+
+	void NativeTable::Insert( const std::string& name, NativeBinding binding )
+	{
+		assert( m_Bindings.count( name ) == 0 );
+		m_Bindings.emplace( name, std::move( binding ) );
+	}
+
+	std::vector<const NativeBinding*> NativeTable::Resolve( const std::vector<BatNativeInfo>& natives ) const
+	{
+		std::vector<const NativeBinding*> resolved( natives.size(), nullptr );
+		for( size_t i = 0; i < natives.size(); i++ )
+		{
+			auto it = m_Bindings.find( natives[i].name );
+			if( it == m_Bindings.end() )
+			{
+				continue;
+			}
+
+			const NativeBinding& binding = it->second;
+			if( binding.typed && binding.param_types != natives[i].desc.param_types )
+			{
+				// TODO: proper line/column report
+				ErrorSys::Report( 0, 0, "Native '" + natives[i].name + "' is bound with different parameter types than it's declared with" );
+				continue;
+			}
+			if( binding.typed && binding.return_type != natives[i].desc.return_type )
+			{
+				// TODO: proper line/column report
+				ErrorSys::Report( 0, 0, "Native '" + natives[i].name + "' is bound with a different return type than it's declared with" );
+				continue;
+			}
+			resolved[i] = &binding;
+		}
+		return resolved;
+	}
+
+	int64_t NativeTable::Call( const NativeBinding* binding, const BatNativeInfo& native, const int64_t* args, size_t num_args, StringTable& strings )
+	{
+		if( !binding )
+		{
+			// TODO: proper line/column report
+			ErrorSys::Report( 0, 0, std::string( "Native '" ) + native.name + "' not bound" );
+			return 0;
+		}
+
+		return binding->invoke_slots( *binding, native.desc, args, num_args, strings );
+	}
+}
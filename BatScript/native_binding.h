@@ -0,0 +1,275 @@
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "bat_object.h"
+#include "stringpool.h"
+
+namespace Bat
+{
+	struct BatNativeInfo;
+
+	using BatNativeCallback = std::function<BatObject( const std::vector<BatObject>& )>;
+
+	struct BatNativeDesc
+	{
+		std::vector<ObjectType> param_types;
+		// TYPE_NULL for natives that don't return anything
+		ObjectType return_type = TYPE_NULL;
+	};
+
+	// Elements of an int[] (T = int64_t) or float[] (T = double) argument of a typed native, which the native may modify
+	// The element type isn't checked against the declaration, only that the parameter is an array.
+	template <typename T>
+	struct ArrayRef
+	{
+		static_assert( std::is_same_v<T, int64_t> || std::is_same_v<T, double>, "Only int and float arrays can be passed to natives" );
+
+		T* data;
+		size_t length;
+	};
+
+	// Typed natives take and return plain C++ values:
+	//  bool              bool
+	//  int               any other integral type
+	//  float             float or double
+	//  string            const char* or BatString* as parameters (valid for the duration of the call),
+	//                    const char* or std::string as return values (copied)
+	//  int[], float[]    ArrayRef<int64_t> or ArrayRef<double> as parameters (valid for the duration of the call)
+	//  nothing           void as return value
+	namespace NativeTypes
+	{
+		template <typename T>
+		constexpr bool IsString = std::is_same_v<T, const char*> || std::is_same_v<T, BatString*> || std::is_same_v<T, std::string>;
+		template <typename T>
+		constexpr bool IsArray = std::is_same_v<T, ArrayRef<int64_t>> || std::is_same_v<T, ArrayRef<double>>;
+
+		template <typename T>
+		constexpr ObjectType TypeOf()
+		{
+			static_assert( std::is_arithmetic_v<T> || IsString<T> || IsArray<T>, "Unsupported native parameter or return type" );
+			if constexpr( IsArray<T> ) return TYPE_ARRAY;
+			else if constexpr( std::is_same_v<T, bool> ) return TYPE_BOOL;
+			else if constexpr( std::is_integral_v<T> ) return TYPE_INT;
+			else if constexpr( std::is_floating_point_v<T> ) return TYPE_FLOAT;
+			else return TYPE_STR;
+		}
+
+		// Raw stack slots, strings are indices into the VM's string table
+		// Arrays are passed as the address of their length, which the elements follow (see VirtualMachine::PassArrays)
+		template <typename T>
+		T FromSlot( int64_t slot, const StringTable& strings )
+		{
+			if constexpr( IsArray<T> )
+			{
+				int64_t* array = reinterpret_cast<int64_t*>(slot);
+				return { reinterpret_cast<decltype(T::data)>(array + 1), (size_t)array[0] };
+			}
+			else if constexpr( std::is_same_v<T, bool> ) return slot != 0;
+			else if constexpr( std::is_integral_v<T> ) return (T)slot;
+			else if constexpr( std::is_floating_point_v<T> )
+			{
+				double val;
+				memcpy( &val, &slot, sizeof( val ) );
+				return (T)val;
+			}
+			else if constexpr( std::is_same_v<T, const char*> ) return strings.Get( slot )->chars;
+			else return strings.Get( slot );
+		}
+		template <typename T>
+		int64_t ToSlot( const T& val, StringTable& strings )
+		{
+			if constexpr( std::is_same_v<T, const char*> || std::is_same_v<T, std::string> ) return strings.Add( std::string_view( val ) );
+			else if constexpr( std::is_floating_point_v<T> )
+			{
+				double d = (double)val;
+				int64_t slot;
+				memcpy( &slot, &d, sizeof( slot ) );
+				return slot;
+			}
+			else return (int64_t)val;
+		}
+
+		// Objects, for the interpreter
+		template <typename T>
+		T FromObject( const BatObject& obj )
+		{
+			if constexpr( std::is_same_v<T, bool> ) return obj.Bool();
+			else if constexpr( std::is_integral_v<T> ) return (T)obj.Int();
+			else if constexpr( std::is_floating_point_v<T> ) return (T)obj.Float();
+			else if constexpr( std::is_same_v<T, const char*> ) return obj.String();
+			else return obj.value.str;
+		}
+		template <typename T>
+		BatObject ToObject( const T& val )
+		{
+			if constexpr( std::is_same_v<T, bool> ) return BatObject( val );
+			else if constexpr( std::is_integral_v<T> ) return BatObject( (int64_t)val );
+			else if constexpr( std::is_floating_point_v<T> ) return BatObject( (double)val );
+			else if constexpr( std::is_same_v<T, std::string> ) return BatObject( val.c_str() );
+			else return BatObject( val );
+		}
+
+		// Argument of a typed native called by the interpreter, for the duration of the call
+		template <typename T>
+		class ObjectArg
+		{
+		public:
+			ObjectArg( const BatObject& obj ) : value( FromObject<T>( obj ) ) {}
+			T Get() const { return value; }
+		private:
+			T value;
+		};
+		// Array elements are objects, so they're copied out for the call and back in afterwards
+		// Only elements the native changed are copied back, the same array may be passed as more than one argument.
+		template <typename T>
+		class ObjectArg<ArrayRef<T>>
+		{
+		public:
+			ObjectArg( const BatObject& obj )
+				:
+				array( obj ),
+				original( obj.ArraySize() )
+			{
+				for( size_t i = 0; i < original.size(); i++ )
+				{
+					original[i] = FromObject<T>( array.Array()[i] );
+				}
+				elements = original;
+			}
+			~ObjectArg()
+			{
+				for( size_t i = 0; i < elements.size(); i++ )
+				{
+					if( memcmp( &elements[i], &original[i], sizeof( T ) ) != 0 )
+					{
+						array.Array()[i] = BatObject( elements[i] );
+					}
+				}
+			}
+			ArrayRef<T> Get() { return { elements.data(), elements.size() }; }
+		private:
+			BatObject array;
+			std::vector<T> original;
+			std::vector<T> elements;
+		};
+	}
+
+	// A native as bound by the host, either typed (see NativeBinding::Typed) or a generic callback on objects
+	struct NativeBinding
+	{
+		// Arguments are raw stack slots in declaration order, the result is a raw slot as well
+		using SlotInvoker = int64_t (*)( const NativeBinding& native, const BatNativeDesc& desc, const int64_t* args, size_t num_args, StringTable& strings );
+		using ObjectInvoker = BatObject (*)( const NativeBinding& native, const std::vector<BatObject>& args );
+
+		SlotInvoker invoke_slots = nullptr;
+		ObjectInvoker invoke_objects = nullptr;
+		// Typed natives: the C++ function, cast back to its real type by the invokers
+		void (*function)() = nullptr;
+		// Typed natives: parameter and return types deduced from the function, checked against the declaration when resolved
+		std::vector<ObjectType> param_types;
+		ObjectType return_type = TYPE_NULL;
+		bool typed = false;
+		// Generic natives
+		BatNativeCallback callback;
+
+		static NativeBinding Generic( BatNativeCallback callback );
+
+		// Deduces the signature of function at compile time and marshals arguments straight from the stack, without
+		// going through objects or allocating
+		template <typename R, typename... Args>
+		static NativeBinding Typed( R (*function)( Args... ) )
+		{
+			static_assert( !std::is_same_v<std::decay_t<R>, BatString*>, "BatString* is only valid as a parameter, natives return strings as const char* or std::string" );
+			static_assert( !NativeTypes::IsArray<std::decay_t<R>>, "Natives can't return arrays" );
+
+			NativeBinding binding;
+			binding.invoke_slots = &InvokeSlots<R, Args...>;
+			binding.invoke_objects = &InvokeObjects<R, Args...>;
+			binding.function = reinterpret_cast<void (*)()>(function);
+			binding.param_types = { NativeTypes::TypeOf<std::decay_t<Args>>()... };
+			if constexpr( !std::is_void_v<R> )
+			{
+				binding.return_type = NativeTypes::TypeOf<std::decay_t<R>>();
+			}
+			binding.typed = true;
+			return binding;
+		}
+	private:
+		template <typename R, typename... Args, size_t... I>
+		static int64_t InvokeSlotsImpl( const NativeBinding& native, const int64_t* args, StringTable& strings, std::index_sequence<I...> )
+		{
+			auto function = reinterpret_cast<R (*)( Args... )>(native.function);
+			if constexpr( std::is_void_v<R> )
+			{
+				function( NativeTypes::FromSlot<std::decay_t<Args>>( args[I], strings )... );
+				return 0;
+			}
+			else
+			{
+				return NativeTypes::ToSlot<std::decay_t<R>>( function( NativeTypes::FromSlot<std::decay_t<Args>>( args[I], strings )... ), strings );
+			}
+		}
+		template <typename R, typename... Args>
+		static int64_t InvokeSlots( const NativeBinding& native, const BatNativeDesc& desc, const int64_t* args, size_t num_args, StringTable& strings )
+		{
+			return InvokeSlotsImpl<R, Args...>( native, args, strings, std::index_sequence_for<Args...>() );
+		}
+
+		template <typename R, typename... Args, size_t... I>
+		static BatObject InvokeObjectsImpl( const NativeBinding& native, const std::vector<BatObject>& args, std::index_sequence<I...> )
+		{
+			auto function = reinterpret_cast<R (*)( Args... )>(native.function);
+			std::tuple<NativeTypes::ObjectArg<std::decay_t<Args>>...> marshalled( args[I]... );
+			if constexpr( std::is_void_v<R> )
+			{
+				function( std::get<I>( marshalled ).Get()... );
+				return BatObject();
+			}
+			else
+			{
+				return NativeTypes::ToObject<std::decay_t<R>>( function( std::get<I>( marshalled ).Get()... ) );
+			}
+		}
+		template <typename R, typename... Args>
+		static BatObject InvokeObjects( const NativeBinding& native, const std::vector<BatObject>& args )
+		{
+			assert( args.size() == sizeof...( Args ) );
+			return InvokeObjectsImpl<R, Args...>( native, args, std::index_sequence_for<Args...>() );
+		}
+	};
+
+	// Natives bound to one VM, by name
+	// Code refers to natives by index into BatCode::natives, Resolve turns those into bindings once when the code is
+	// loaded so calls don't look anything up.
+	class NativeTable
+	{
+	public:
+		void Add( const std::string& name, BatNativeCallback callback );
+		template <typename R, typename... Args>
+		void Bind( const std::string& name, R (*function)( Args... ) )
+		{
+			Insert( name, NativeBinding::Typed( function ) );
+		}
+
+		// Returns the binding of every native in natives, in the same order
+		// Natives that aren't bound resolve to nullptr and report an error when called. Typed natives that are bound with
+		// different parameter or return types than they are declared with are reported right away.
+		std::vector<const NativeBinding*> Resolve( const std::vector<BatNativeInfo>& natives ) const;
+
+		// Calls a resolved native, args are num_args raw slots
+		static int64_t Call( const NativeBinding* binding, const BatNativeInfo& native, const int64_t* args, size_t num_args, StringTable& strings );
+	private:
+		void Insert( const std::string& name, NativeBinding binding );
+	private:
+		std::unordered_map<std::string, NativeBinding> m_Bindings;
+	};
+}
@@ -0,0 +1,126 @@
+#include "opstats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+namespace Bat
+{
+	static const char* const s_Mnemonics[] = {
+#define _(name, operands, pushes, pops, mnemonic) #mnemonic,
+		OPCODES( _ )
+#undef _
+	};
+
+	// Only the most executed pairs are listed, the tail is noise
+	constexpr size_t MAX_REPORTED_PAIRS = 25;
+
+	OpStats::OpStats()
+	{
+		for( size_t i = 0; i < NUM_ENCODED_OPCODES; i++ )
+		{
+			m_Decoded[i] = (unsigned char)DecodeOp( (unsigned char)i ).op;
+		}
+
+		m_iOverhead = UINT64_MAX;
+		for( int i = 0; i < 1000; i++ )
+		{
+			const uint64_t start = Timestamp();
+			m_iOverhead = std::min( m_iOverhead, Timestamp() - start );
+		}
+		Reset();
+	}
+
+	void OpStats::Stop()
+	{
+		if( m_iPrev != NUM_OPCODES )
+		{
+			m_Cycles[m_iPrev] += Timestamp() - m_iLastTimestamp;
+		}
+		m_iPrev = NUM_OPCODES;
+	}
+
+	void OpStats::Reset()
+	{
+		memset( m_Counts, 0, sizeof( m_Counts ) );
+		memset( m_Cycles, 0, sizeof( m_Cycles ) );
+		memset( m_Pairs, 0, sizeof( m_Pairs ) );
+		m_iPrev = NUM_OPCODES;
+	}
+
+	void OpStats::Report( std::ostream& out ) const
+	{
+		const char* unit = BAT_RDTSC ? "cycles" : "ns";
+
+		uint64_t total_count = 0;
+		uint64_t total_cycles = 0;
+		std::vector<size_t> ops;
+		for( size_t op = 0; op < NUM_OPCODES; op++ )
+		{
+			if( m_Counts[op] == 0 ) continue;
+			total_count += m_Counts[op];
+			total_cycles += m_Cycles[op];
+			ops.push_back( op );
+		}
+		if( total_count == 0 ) return;
+
+		std::sort( ops.begin(), ops.end(), [this]( size_t a, size_t b ) {
+			return m_Cycles[a] != m_Cycles[b] ? m_Cycles[a] > m_Cycles[b] : m_Counts[a] > m_Counts[b];
+		} );
+
+		auto percent = []( uint64_t part, uint64_t total ) {
+			return total ? 100.0 * (double)part / (double)total : 0.0;
+		};
+
+		out << std::fixed << std::setprecision( 1 );
+		out << "Opcodes: " << total_count << " executed, " << total_cycles << " " << unit
+			<< " (including about " << m_iOverhead << " " << unit << " of measurement per op)\n";
+		out << std::left << std::setw( 20 ) << "opcode" << std::right
+			<< std::setw( 14 ) << "count" << std::setw( 8 ) << "%"
+			<< std::setw( 16 ) << unit << std::setw( 8 ) << "%"
+			<< std::setw( 10 ) << "per op" << "\n";
+		for( size_t op : ops )
+		{
+			out << std::left << std::setw( 20 ) << s_Mnemonics[op] << std::right
+				<< std::setw( 14 ) << m_Counts[op] << std::setw( 8 ) << percent( m_Counts[op], total_count )
+				<< std::setw( 16 ) << m_Cycles[op] << std::setw( 8 ) << percent( m_Cycles[op], total_cycles )
+				<< std::setw( 10 ) << (double)m_Cycles[op] / (double)m_Counts[op] << "\n";
+		}
+
+		struct Pair
+		{
+			size_t first;
+			size_t second;
+			uint64_t count;
+		};
+		std::vector<Pair> pairs;
+		uint64_t total_pairs = 0;
+		for( size_t first = 0; first < NUM_OPCODES; first++ )
+		{
+			for( size_t second = 0; second < NUM_OPCODES; second++ )
+			{
+				if( m_Pairs[first][second] == 0 ) continue;
+				total_pairs += m_Pairs[first][second];
+				pairs.push_back( { first, second, m_Pairs[first][second] } );
+			}
+		}
+		std::sort( pairs.begin(), pairs.end(), []( const Pair& a, const Pair& b ) { return a.count > b.count; } );
+		if( pairs.size() > MAX_REPORTED_PAIRS )
+		{
+			pairs.resize( MAX_REPORTED_PAIRS );
+		}
+
+		out << "\nPairs: " << total_pairs << " executed\n";
+		out << std::left << std::setw( 40 ) << "first -> second" << std::right
+			<< std::setw( 14 ) << "count" << std::setw( 8 ) << "%" << "\n";
+		for( const Pair& pair : pairs )
+		{
+			std::string name = std::string( s_Mnemonics[pair.first] ) + " -> " + s_Mnemonics[pair.second];
+			out << std::left << std::setw( 40 ) << name << std::right
+				<< std::setw( 14 ) << pair.count << std::setw( 8 ) << percent( pair.count, total_pairs ) << "\n";
+		}
+		out << std::defaultfloat << std::flush;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include "instructions.h"
+
+#if defined( _MSC_VER ) && (defined( _M_X64 ) || defined( _M_IX86 ))
+#include <intrin.h>
+#define BAT_RDTSC 1
+#elif defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#define BAT_RDTSC 1
+#else
+#include <chrono>
+#define BAT_RDTSC 0
+#endif
+
+namespace Bat
+{
+	// Execution histogram of the stack VM (--opstats): how often every opcode and every pair of adjacent opcodes ran,
+	// and the time from dispatching an opcode to dispatching the next one.
+	// Wide forms count as their plain opcode. Pairs that run a lot are the candidates for superinstructions (see peephole.h).
+	class OpStats
+	{
+	public:
+		OpStats();
+
+		// Called by the VM before dispatching every instruction
+		void Record( unsigned char encoded )
+		{
+			const uint64_t now = Timestamp();
+			const size_t op = m_Decoded[encoded];
+			if( m_iPrev != NUM_OPCODES )
+			{
+				m_Cycles[m_iPrev] += now - m_iLastTimestamp;
+				m_Pairs[m_iPrev][op]++;
+			}
+			m_Counts[op]++;
+			m_iPrev = op;
+			m_iLastTimestamp = now;
+		}
+		// Ends a run, the next instruction recorded doesn't pair up with the last one
+		void Stop();
+		void Reset();
+
+		// Opcodes sorted by time spent, then the most executed pairs
+		void Report( std::ostream& out ) const;
+
+		// Cycles where rdtsc is available, nanoseconds elsewhere
+		static uint64_t Timestamp()
+		{
+#if BAT_RDTSC
+			return __rdtsc();
+#else
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
+		}
+	private:
+		unsigned char m_Decoded[NUM_ENCODED_OPCODES];
+		uint64_t m_Counts[NUM_OPCODES];
+		uint64_t m_Cycles[NUM_OPCODES];
+		// Indexed by [first][second]
+		uint64_t m_Pairs[NUM_OPCODES][NUM_OPCODES];
+		// Last opcode recorded, NUM_OPCODES if none
+		size_t m_iPrev = NUM_OPCODES;
+		uint64_t m_iLastTimestamp = 0;
+		// Smallest difference between back to back timestamps, part of every opcode's time
+		uint64_t m_iOverhead = 0;
+	};
+}
@@ -115,6 +115,14 @@ private:
 			{
 				if( o.shortname == shortoptions[i] )
 				{
+					// The rest of the string is the argument if it's attached to the first option
+					// e.g. -O2
+					if( i == 0 && shortoptions.size() > 1 && o.has_argument )
+					{
+						option_args[o.longname] = shortoptions.substr( 1 );
+						return index;
+					}
+
 					// No args allowed for multiple short args
 					// e.g. -abcd
 					if( shortoptions.size() == 1 &&
@@ -152,6 +152,7 @@ namespace Bat
 				case TOKEN_ENUM:
 				case TOKEN_IMPORT:
 				case TOKEN_NATIVE:
+				case TOKEN_ASYNC:
 				case TOKEN_TYPEDEF:
 				case TOKEN_ALIASDEF:
 					return;
@@ -164,6 +165,7 @@ namespace Bat
 		try
 		{
 			if( Check( TOKEN_DEF ) ||
+				Check( TOKEN_ASYNC ) ||
 				Check( TOKEN_IF ) ||
 				Check( TOKEN_WHILE ) ||
 				Check( TOKEN_FOR ) )
@@ -186,6 +188,7 @@ namespace Bat
 		if( Match( TOKEN_WHILE ) )  return ParseWhile();
 		if( Match( TOKEN_FOR ) )    return ParseFor();
 		if( Match( TOKEN_DEF ) )    return ParseFuncDeclaration();
+		if( Match( TOKEN_ASYNC ) )  return ParseAsync();
 
 		assert( false && "Unexpected token" );
 		return nullptr;
@@ -372,15 +375,24 @@ namespace Bat
 		return std::make_unique<ImportStmt>( loc, module_name );
 	}
 
-	std::unique_ptr<Statement> Parser::ParseNative()
+	std::unique_ptr<Statement> Parser::ParseNative( bool async )
 	{
 		SourceLoc loc = Previous().loc;
 
-		FunctionSignature sig = ParseFuncSignature();
+		FunctionSignature sig = ParseFuncSignature( async );
 		ExpectTerminator();
 		return std::make_unique<NativeStmt>( loc, std::move( sig ) );
 	}
 
+	std::unique_ptr<Statement> Parser::ParseAsync()
+	{
+		if( Match( TOKEN_DEF ) )    return ParseFuncDeclaration( true );
+		if( Match( TOKEN_NATIVE ) ) return ParseNative( true );
+
+		Error( "Expected 'def' or 'native' after 'async'" );
+		throw ParseError();
+	}
+
 	std::unique_ptr<Statement> Parser::ParseVarDeclaration()
 	{
 		SourceLoc loc = Peek().loc;
@@ -407,11 +419,11 @@ namespace Bat
 		return std::make_unique<VarDecl>( loc, std::move( type_name ), ident, std::move( init ) );
 	}
 
-	std::unique_ptr<Statement> Parser::ParseFuncDeclaration()
+	std::unique_ptr<Statement> Parser::ParseFuncDeclaration( bool async )
 	{
 		SourceLoc loc = Previous().loc;
 
-		FunctionSignature sig = ParseFuncSignature();
+		FunctionSignature sig = ParseFuncSignature( async );
 		Expect( TOKEN_COLON, "Expected ':' after function declaration" );
 
 		std::unique_ptr<Statement> body;
@@ -427,7 +439,7 @@ namespace Bat
 		return std::make_unique<FuncDecl>( loc, std::move( sig ), std::move( body ) );
 	}
 
-	FunctionSignature Parser::ParseFuncSignature()
+	FunctionSignature Parser::ParseFuncSignature( bool async )
 	{
 		Token name = Expect( TOKEN_IDENT, "Expected function name" );
 		Expect( TOKEN_LPAREN, "Expected '(' after function name" );
@@ -477,7 +489,7 @@ namespace Bat
 			return_type = ExpectType( "Expected function return type" );
 		}
 
-		return FunctionSignature( std::move( return_type ), name, std::move( types ), params, std::move( defaults ), varargs );
+		return FunctionSignature( std::move( return_type ), name, std::move( types ), params, std::move( defaults ), varargs, async );
 	}
 
 	std::unique_ptr<Expression> Parser::ParseExpression()
@@ -652,6 +664,18 @@ namespace Bat
 			return std::make_unique<UnaryExpr>( loc, op.type, std::move( right ) );
 		}
 
+		if( Match( TOKEN_AWAIT ) )
+		{
+			auto call = ParseCallOrIndex();
+			if( !call->IsCallExpr() )
+			{
+				Error( "Expected a call after 'await'" );
+				throw ParseError();
+			}
+			call->AsCallExpr()->SetAwait( true );
+			return call;
+		}
+
 		return ParseCallOrIndex();
 	}
 
@@ -48,11 +48,12 @@ namespace Bat
 		std::unique_ptr<Statement> ParseFor();
 		std::unique_ptr<Statement> ParseReturn();
 		std::unique_ptr<Statement> ParseImport();
-		std::unique_ptr<Statement> ParseNative();
+		std::unique_ptr<Statement> ParseNative( bool async = false );
+		std::unique_ptr<Statement> ParseAsync();
 		std::unique_ptr<Statement> ParseVarDeclaration();
-		std::unique_ptr<Statement> ParseFuncDeclaration();
+		std::unique_ptr<Statement> ParseFuncDeclaration( bool async = false );
 
-		FunctionSignature ParseFuncSignature();
+		FunctionSignature ParseFuncSignature( bool async );
 
 		// Expression parsing
 		std::unique_ptr<Expression> ParseExpression();
@@ -0,0 +1,431 @@
+#include "peephole.h"
+
+#include <cassert>
+#include <unordered_map>
+
+namespace Bat
+{
+	static constexpr int s_NumPushes[] = {
+#define _(name, operands, pushes, pops, mnemonic) pushes,
+		OPCODES( _ )
+#undef _
+	};
+	static constexpr int s_NumPops[] = {
+#define _(name, operands, pushes, pops, mnemonic) pops,
+		OPCODES( _ )
+#undef _
+	};
+
+	static bool IsJump( OpCode op )
+	{
+		switch( op )
+		{
+		case OpCode::JMP:
+		case OpCode::JZ:
+		case OpCode::JNZ:
+		case OpCode::JEQ:
+		case OpCode::JNE:
+		case OpCode::JLT:
+		case OpCode::JLE:
+		case OpCode::JGT:
+		case OpCode::JGE:
+		// The spawning task continues at the operand
+		case OpCode::SPAWN:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Instructions with effects on control flow or the stack frame that can't be moved around
+	static bool IsBarrier( OpCode op )
+	{
+		switch( op )
+		{
+		case OpCode::PROC:
+		case OpCode::STACK:
+		case OpCode::CALL:
+		case OpCode::TAILCALL:
+		case OpCode::RET:
+		case OpCode::NATIVE:
+		case OpCode::AWAIT:
+		case OpCode::TASK_END:
+		case OpCode::HALT:
+		// Pops as many values as its operand says
+		case OpCode::ARRAY_NEW:
+			return true;
+		default:
+			return IsJump( op );
+		}
+	}
+
+	static void WriteOperand( MemoryStream& code, int64_t operand, size_t width )
+	{
+		switch( width )
+		{
+		case 1:  code.WriteByte( (char)operand ); break;
+		case 2:  code.WriteInt16( (int16_t)operand ); break;
+		case 4:  code.WriteInt32( (int32_t)operand ); break;
+		default: code.WriteInt64( operand ); break;
+		}
+	}
+
+	void PeepholeOptimizer::Optimize( BatCode& bc )
+	{
+		assert( bc.isa == InstructionSet::STACK );
+
+		PeepholeOptimizer optimizer( bc );
+		optimizer.Decode();
+
+		optimizer.FuseCompoundAssigns();
+		optimizer.Compact();
+		optimizer.FuseLoads();
+		optimizer.Compact();
+		optimizer.DropUnusedPushes();
+		optimizer.Compact();
+		optimizer.SinkStores();
+		optimizer.Compact();
+		optimizer.FuseImmediateArithmetic();
+		optimizer.Compact();
+		optimizer.FuseCompareJumps();
+		optimizer.Compact();
+
+		optimizer.Encode();
+	}
+	PeepholeOptimizer::PeepholeOptimizer( BatCode& bc )
+		:
+		m_Code( bc )
+	{}
+	void PeepholeOptimizer::Decode()
+	{
+		const char* code = m_Code.code.Base();
+		const size_t size = m_Code.code.Size();
+
+		std::unordered_map<int64_t, size_t> index_of;
+		for( size_t addr = 0; addr < size; )
+		{
+			DecodedOp decoded = DecodeOp( (unsigned char)code[addr] );
+
+			Instruction ins;
+			ins.op = decoded.op;
+			ins.operand = 0;
+			ins.line = m_Code.debug_info.line_mapping[m_Instructions.size()];
+
+			const int operands = OPCODE_OPERANDS[(size_t)ins.op];
+			assert( operands <= 1 );
+			if( operands > 0 )
+			{
+				ins.operand = ReadOperand( &code[addr + sizeof( OpCode )], decoded.width );
+			}
+
+			index_of[(int64_t)addr] = m_Instructions.size();
+			m_Instructions.push_back( ins );
+			addr += sizeof( OpCode ) + operands * decoded.width;
+		}
+
+		// Code addresses become instruction indices so that they survive instructions being added and removed
+		for( size_t i = 0; i < m_Instructions.size(); i++ )
+		{
+			Instruction& ins = m_Instructions[i];
+			if( IsJump( ins.op ) || ins.op == OpCode::CALL || ins.op == OpCode::TAILCALL )
+			{
+				assert( index_of.count( ins.operand ) );
+				ins.operand = (int64_t)index_of[ins.operand];
+				ins.code_ref = true;
+			}
+		}
+
+		assert( index_of.count( m_Code.entry_point ) );
+		m_iEntryPoint = index_of[m_Code.entry_point];
+
+		Compact();
+	}
+	void PeepholeOptimizer::Encode()
+	{
+		const size_t count = m_Instructions.size();
+
+		// Code addresses depend on the width of every operand before them, so start with the smallest width for
+		// each code address and keep widening the ones that don't fit until nothing changes
+		std::vector<size_t> widths( count );
+		for( size_t i = 0; i < count; i++ )
+		{
+			widths[i] = m_Instructions[i].code_ref ? 1 : OperandWidthFor( m_Instructions[i].operand );
+		}
+
+		std::vector<int64_t> addresses( count );
+		bool changed = true;
+		while( changed )
+		{
+			int64_t addr = 0;
+			for( size_t i = 0; i < count; i++ )
+			{
+				addresses[i] = addr;
+				addr += sizeof( OpCode ) + OPCODE_OPERANDS[(size_t)m_Instructions[i].op] * widths[i];
+			}
+
+			changed = false;
+			for( size_t i = 0; i < count; i++ )
+			{
+				const Instruction& ins = m_Instructions[i];
+				if( ins.code_ref && OperandWidthFor( addresses[ins.operand] ) > widths[i] )
+				{
+					widths[i] = OperandWidthFor( addresses[ins.operand] );
+					changed = true;
+				}
+			}
+		}
+
+		MemoryStream code;
+		std::vector<int> line_mapping;
+		for( size_t i = 0; i < count; i++ )
+		{
+			const Instruction& ins = m_Instructions[i];
+			if( OPCODE_OPERANDS[(size_t)ins.op] == 0 )
+			{
+				code.Write( EncodeOp( ins.op ) );
+			}
+			else
+			{
+				code.Write( EncodeOp( ins.op, widths[i] ) );
+				WriteOperand( code, ins.code_ref ? addresses[ins.operand] : ins.operand, widths[i] );
+			}
+			line_mapping.push_back( ins.line );
+		}
+
+		code.Seek( SeekPosition::START );
+		m_Code.code = std::move( code );
+		m_Code.entry_point = addresses[m_iEntryPoint];
+		m_Code.debug_info.line_mapping = std::move( line_mapping );
+	}
+	void PeepholeOptimizer::Compact()
+	{
+		// Removed instructions map to whatever instruction ends up after them
+		std::vector<size_t> new_index( m_Instructions.size() );
+		std::vector<Instruction> kept;
+		for( size_t i = 0; i < m_Instructions.size(); i++ )
+		{
+			new_index[i] = kept.size();
+			if( !m_Instructions[i].removed )
+			{
+				kept.push_back( m_Instructions[i] );
+			}
+		}
+
+		for( auto& ins : kept )
+		{
+			ins.label = false;
+			if( ins.code_ref )
+			{
+				ins.operand = (int64_t)new_index[ins.operand];
+			}
+		}
+		m_iEntryPoint = new_index[m_iEntryPoint];
+
+		for( const auto& ins : kept )
+		{
+			if( ins.code_ref )
+			{
+				kept[ins.operand].label = true;
+			}
+		}
+		kept[m_iEntryPoint].label = true;
+
+		m_Instructions = std::move( kept );
+	}
+	void PeepholeOptimizer::FuseCompoundAssigns()
+	{
+		//  push addr; dupx1; local.load; <op>; local.store  ->  local.load.imm addr; <op>; local.store.imm addr
+		for( size_t i = 0; i + 4 < m_Instructions.size(); i++ )
+		{
+			Instruction* ins = &m_Instructions[i];
+			if( !IsImmediatePush( i ) || ins[1].op != OpCode::DUPX1 )
+			{
+				continue;
+			}
+
+			bool local = (ins[2].op == OpCode::LOAD_LOCAL && ins[4].op == OpCode::STORE_LOCAL);
+			bool global = (ins[2].op == OpCode::LOAD_GLOBAL && ins[4].op == OpCode::STORE_GLOBAL);
+			bool binary_op = (s_NumPushes[(size_t)ins[3].op] == 1 && s_NumPops[(size_t)ins[3].op] == 2 && !IsBarrier( ins[3].op ));
+			if( !(local || global) || !binary_op || ins[1].label || ins[2].label || ins[3].label || ins[4].label )
+			{
+				continue;
+			}
+
+			ins[0].op = local ? OpCode::LOADL_IMM : OpCode::LOADG_IMM;
+			ins[1].removed = true;
+			ins[2].removed = true;
+			ins[4].op = local ? OpCode::STOREL_IMM : OpCode::STOREG_IMM;
+			ins[4].operand = ins[0].operand;
+			i += 4;
+		}
+	}
+	void PeepholeOptimizer::FuseLoads()
+	{
+		//  push addr; local.load  ->  local.load.imm addr
+		for( size_t i = 0; i + 1 < m_Instructions.size(); i++ )
+		{
+			Instruction* ins = &m_Instructions[i];
+			if( !IsImmediatePush( i ) || ins[1].label )
+			{
+				continue;
+			}
+
+			if( ins[1].op == OpCode::LOAD_LOCAL )
+			{
+				ins[0].op = OpCode::LOADL_IMM;
+			}
+			else if( ins[1].op == OpCode::LOAD_GLOBAL )
+			{
+				ins[0].op = OpCode::LOADG_IMM;
+			}
+			else
+			{
+				continue;
+			}
+
+			ins[1].removed = true;
+			i++;
+		}
+	}
+	void PeepholeOptimizer::DropUnusedPushes()
+	{
+		//  push 0; pop  ->  nothing
+		// e.g. the value of an inlined void function called as a statement
+		for( size_t i = 0; i + 1 < m_Instructions.size(); i++ )
+		{
+			Instruction* ins = &m_Instructions[i];
+			if( IsSimplePush( i ) && !ins[1].label && ins[1].op == OpCode::POP )
+			{
+				ins[0].removed = true;
+				ins[1].removed = true;
+				i++;
+			}
+		}
+	}
+	void PeepholeOptimizer::SinkStores()
+	{
+		//  push addr; <value>; local.store  ->  <value>; local.store.imm addr
+		// The value can be any straight line sequence, we just follow the stack depth until the store that consumes the address
+		for( size_t i = 0; i < m_Instructions.size(); i++ )
+		{
+			if( !IsImmediatePush( i ) )
+			{
+				continue;
+			}
+
+			// Number of values above the address on the stack
+			int depth = 0;
+			for( size_t j = i + 1; j < m_Instructions.size(); j++ )
+			{
+				Instruction& ins = m_Instructions[j];
+				if( ins.label || IsBarrier( ins.op ) )
+				{
+					break;
+				}
+
+				if( depth == 1 && (ins.op == OpCode::STORE_LOCAL || ins.op == OpCode::STORE_GLOBAL) )
+				{
+					ins.op = (ins.op == OpCode::STORE_LOCAL) ? OpCode::STOREL_IMM : OpCode::STOREG_IMM;
+					ins.operand = m_Instructions[i].operand;
+					m_Instructions[i].removed = true;
+					break;
+				}
+
+				const int pops = s_NumPops[(size_t)ins.op];
+				if( pops > depth )
+				{
+					break;
+				}
+				depth += s_NumPushes[(size_t)ins.op] - pops;
+			}
+		}
+	}
+	void PeepholeOptimizer::FuseImmediateArithmetic()
+	{
+		//  push k; add           ->  addi k
+		//  push k; <value>; add  ->  <value>; addi k
+		//  push k; <value>; sub  ->  <value>; subi k
+		for( size_t i = 0; i + 1 < m_Instructions.size(); i++ )
+		{
+			Instruction* ins = &m_Instructions[i];
+			if( !IsImmediatePush( i ) )
+			{
+				continue;
+			}
+
+			if( ins[1].op == OpCode::ADD && !ins[1].label )
+			{
+				ins[1].op = OpCode::ADDI;
+				ins[1].operand = ins[0].operand;
+				ins[0].removed = true;
+				i++;
+				continue;
+			}
+
+			if( i + 2 >= m_Instructions.size() || !IsSimplePush( i + 1 ) || ins[1].label || ins[2].label )
+			{
+				continue;
+			}
+
+			if( ins[2].op == OpCode::ADD )
+			{
+				ins[2].op = OpCode::ADDI;
+			}
+			else if( ins[2].op == OpCode::SUB )
+			{
+				ins[2].op = OpCode::SUBI;
+			}
+			else
+			{
+				continue;
+			}
+
+			ins[2].operand = ins[0].operand;
+			ins[0].removed = true;
+			i += 2;
+		}
+	}
+	void PeepholeOptimizer::FuseCompareJumps()
+	{
+		//  less; jz target  ->  jge target
+		for( size_t i = 0; i + 1 < m_Instructions.size(); i++ )
+		{
+			Instruction* ins = &m_Instructions[i];
+			if( ins[1].label || (ins[1].op != OpCode::JZ && ins[1].op != OpCode::JNZ) )
+			{
+				continue;
+			}
+
+			// Fused jump when the comparison is true, and when it's false
+			OpCode if_true;
+			OpCode if_false;
+			switch( ins[0].op )
+			{
+			case OpCode::EQ:    if_true = OpCode::JEQ; if_false = OpCode::JNE; break;
+			case OpCode::NEQ:   if_true = OpCode::JNE; if_false = OpCode::JEQ; break;
+			case OpCode::LESS:  if_true = OpCode::JLT; if_false = OpCode::JGE; break;
+			case OpCode::LESSE: if_true = OpCode::JLE; if_false = OpCode::JGT; break;
+			case OpCode::GRT:   if_true = OpCode::JGT; if_false = OpCode::JLE; break;
+			case OpCode::GRTE:  if_true = OpCode::JGE; if_false = OpCode::JLT; break;
+			default:
+				continue;
+			}
+
+			ins[0].op = (ins[1].op == OpCode::JNZ) ? if_true : if_false;
+			ins[0].operand = ins[1].operand;
+			ins[0].code_ref = true;
+			ins[1].removed = true;
+			i++;
+		}
+	}
+	bool PeepholeOptimizer::IsSimplePush( size_t index ) const
+	{
+		const Instruction& ins = m_Instructions[index];
+		return IsImmediatePush( index ) || ins.op == OpCode::LOADL_IMM || ins.op == OpCode::LOADG_IMM;
+	}
+	bool PeepholeOptimizer::IsImmediatePush( size_t index ) const
+	{
+		const Instruction& ins = m_Instructions[index];
+		return ins.op == OpCode::PUSH && !ins.code_ref;
+	}
+}
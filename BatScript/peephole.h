@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include "compiler.h"
+#include "instructions.h"
+
+namespace Bat
+{
+	// Rewrites common instruction sequences of compiled stack code into superinstructions, e.g.
+	//  push addr; local.load            ->  local.load.imm addr
+	//  push addr; <value>; local.store  ->  <value>; local.store.imm addr
+	//  push 1; <value>; add             ->  <value>; addi 1
+	//  less; jz target                  ->  jge target
+	//  push 0; pop                      ->  nothing
+	// Jump targets, function addresses, the entry point and the line mapping are all updated to match.
+	class PeepholeOptimizer
+	{
+	public:
+		static void Optimize( BatCode& bc );
+	private:
+		struct Instruction
+		{
+			OpCode op;
+			int64_t operand;
+			int line;
+			// Whether the operand is the index of another instruction rather than an immediate
+			bool code_ref = false;
+			// Whether anything jumps to this instruction
+			bool label = false;
+			bool removed = false;
+		};
+
+		PeepholeOptimizer( BatCode& bc );
+
+		void Decode();
+		void Encode();
+		// Drops removed instructions and points anything that referenced them at the next instruction that's kept
+		void Compact();
+
+		void FuseCompoundAssigns();
+		void FuseLoads();
+		void DropUnusedPushes();
+		void SinkStores();
+		void FuseImmediateArithmetic();
+		void FuseCompareJumps();
+
+		// Whether instruction at index is a single push of an immediate or variable
+		bool IsSimplePush( size_t index ) const;
+		bool IsImmediatePush( size_t index ) const;
+	private:
+		BatCode& m_Code;
+		std::vector<Instruction> m_Instructions;
+		size_t m_iEntryPoint = 0;
+	};
+}
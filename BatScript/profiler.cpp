@@ -0,0 +1,202 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include "compiler.h"
+#include "errorsys.h"
+#include "instructions.h"
+
+#if BAT_PROFILER
+#include <sys/time.h>
+#endif
+
+namespace Bat
+{
+	volatile std::sig_atomic_t Profiler::s_SamplePending = 0;
+	std::atomic<void*>* Profiler::s_pRedirectTable = nullptr;
+	void* Profiler::s_pRedirectTarget = nullptr;
+	std::atomic<size_t> Profiler::s_iRedirectSize{ 0 };
+
+	Profiler::~Profiler()
+	{
+		Stop();
+	}
+
+	bool Profiler::Start( int hz )
+	{
+#if BAT_PROFILER
+		if( hz <= 0 || hz > 1000000 )
+		{
+			ErrorSys::Report( 0, 0, "Sampling rate must be between 1 and 1000000 Hz" );
+			return false;
+		}
+
+		struct sigaction action = {};
+		action.sa_handler = &Profiler::HandleSignal;
+		action.sa_flags = SA_RESTART;
+		sigemptyset( &action.sa_mask );
+		if( sigaction( SIGPROF, &action, nullptr ) != 0 )
+		{
+			ErrorSys::Report( 0, 0, "Can't install the SIGPROF handler" );
+			return false;
+		}
+
+		struct itimerval timer = {};
+		const long interval = 1000000 / hz;
+		timer.it_interval.tv_sec = interval / 1000000;
+		timer.it_interval.tv_usec = interval % 1000000;
+		timer.it_value = timer.it_interval;
+		if( setitimer( ITIMER_PROF, &timer, nullptr ) != 0 )
+		{
+			ErrorSys::Report( 0, 0, "Can't start the profiling timer" );
+			return false;
+		}
+
+		s_SamplePending = 0;
+		m_bRunning = true;
+		return true;
+#else
+		(void)hz;
+		ErrorSys::Report( 0, 0, "Profiling isn't supported on this platform" );
+		return false;
+#endif
+	}
+
+	void Profiler::Stop()
+	{
+#if BAT_PROFILER
+		if( !m_bRunning )
+		{
+			return;
+		}
+
+		struct itimerval timer = {};
+		setitimer( ITIMER_PROF, &timer, nullptr );
+		signal( SIGPROF, SIG_IGN );
+		s_SamplePending = 0;
+		m_bRunning = false;
+#endif
+	}
+
+	void Profiler::RedirectOnSample( std::atomic<void*>* table, size_t size, void* target )
+	{
+		StopRedirecting();
+		s_pRedirectTable = table;
+		s_pRedirectTarget = target;
+		s_iRedirectSize.store( size, std::memory_order_release );
+	}
+
+	void Profiler::StopRedirecting()
+	{
+		s_iRedirectSize.store( 0, std::memory_order_release );
+	}
+
+	void Profiler::HandleSignal( int )
+	{
+		s_SamplePending = 1;
+
+		const size_t size = s_iRedirectSize.load( std::memory_order_acquire );
+		for( size_t i = 0; i < size; i++ )
+		{
+			s_pRedirectTable[i].store( s_pRedirectTarget, std::memory_order_relaxed );
+		}
+	}
+
+	void Profiler::MapCode( const BatCode& bc )
+	{
+		const char* base = bc.CodeBase();
+		const size_t size = bc.CodeSize();
+		const auto& lines = bc.debug_info.line_mapping;
+		const auto& names = bc.debug_info.function_names;
+
+		m_Map.code = &bc;
+		m_Map.function_at.assign( size, -1 );
+		m_Map.line_at.assign( size, 0 );
+		m_Map.functions.clear();
+
+		size_t pc = 0;
+		size_t index = 0;
+		while( pc < size )
+		{
+			auto decoded = DecodeOp( (unsigned char)base[pc] );
+			const size_t length = 1 + OPCODE_OPERANDS[(size_t)decoded.op] * decoded.width;
+			const int line = index < lines.size() ? lines[index] : 0;
+
+			if( decoded.op == OpCode::PROC )
+			{
+				std::string name;
+				if( (CodeLoc_t)pc == bc.entry_point ) name = "main";
+				else if( m_Map.functions.size() < names.size() ) name = names[m_Map.functions.size()];
+				else name = "function@" + std::to_string( line );
+				m_Map.functions.push_back( std::move( name ) );
+			}
+
+			for( size_t i = pc; i < pc + length && i < size; i++ )
+			{
+				m_Map.function_at[i] = (int)m_Map.functions.size() - 1;
+				m_Map.line_at[i] = line;
+			}
+
+			pc += length;
+			index++;
+		}
+	}
+
+	void Profiler::AddSample( const BatCode& bc, const int64_t* pcs, size_t count )
+	{
+		s_SamplePending = 0;
+
+		if( m_Map.code != &bc || m_Map.line_at.size() != bc.CodeSize() )
+		{
+			MapCode( bc );
+		}
+
+		std::string stack;
+		for( size_t i = 0; i < count; i++ )
+		{
+			if( pcs[i] < 0 || (size_t)pcs[i] >= m_Map.line_at.size() ) continue;
+
+			const int function = m_Map.function_at[pcs[i]];
+			if( !stack.empty() ) stack += ';';
+			stack += function >= 0 ? m_Map.functions[function] : "?";
+			stack += ':';
+			stack += std::to_string( m_Map.line_at[pcs[i]] );
+		}
+		AddStack( stack );
+	}
+
+	void Profiler::AddSample( const std::vector<Frame>& frames )
+	{
+		s_SamplePending = 0;
+
+		std::string stack;
+		for( const Frame& frame : frames )
+		{
+			if( !stack.empty() ) stack += ';';
+			stack += *frame.function;
+			stack += ':';
+			stack += std::to_string( frame.line );
+		}
+		AddStack( stack );
+	}
+
+	void Profiler::AddStack( const std::string& stack )
+	{
+		if( stack.empty() )
+		{
+			return;
+		}
+
+		m_Stacks[stack]++;
+		m_iNumSamples++;
+	}
+
+	void Profiler::Write( std::ostream& out ) const
+	{
+		std::vector<std::pair<std::string, uint64_t>> stacks( m_Stacks.begin(), m_Stacks.end() );
+		std::sort( stacks.begin(), stacks.end() );
+		for( const auto& stack : stacks )
+		{
+			out << stack.first << ' ' << stack.second << '\n';
+		}
+	}
+}
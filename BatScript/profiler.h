@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sampling needs SIGPROF and setitimer, elsewhere Profiler::Start always fails
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define BAT_PROFILER 1
+#else
+#define BAT_PROFILER 0
+#endif
+
+namespace Bat
+{
+	struct BatCode;
+
+	// Statistical profiler (--profile): a SIGPROF interval timer fires at a fixed rate of CPU time and only flags that a
+	// sample is due. The VM or interpreter records its call stack at the next instruction or statement, where its state
+	// is consistent and taking the sample is allowed to allocate.
+	// Samples are aggregated as collapsed stacks, one "main:12;fib:4;fib:3 57" line per distinct stack, which is what
+	// flamegraph.pl and most other flame graph tools take as input.
+	class Profiler
+	{
+	public:
+		// Frame of the interpreter, function points into the AST
+		struct Frame
+		{
+			const std::string* function;
+			int line;
+		};
+
+		Profiler() = default;
+		~Profiler();
+		Profiler( const Profiler& ) = delete;
+		Profiler& operator=( const Profiler& ) = delete;
+
+		// The timer is process wide, so only one profiler can run at a time
+		// Returns false if it can't be started, errors are reported through ErrorSys
+		bool Start( int hz );
+		void Stop();
+
+		// Checked by the VM and interpreter at every instruction or statement
+		static bool SamplePending() { return s_SamplePending != 0; }
+		// Threaded dispatch loops don't check, instead the signal handler points every entry of their dispatch table at
+		// target, which takes the sample and puts the table back. Only one table can be redirected at a time.
+		static void RedirectOnSample( std::atomic<void*>* table, size_t size, void* target );
+		static void StopRedirecting();
+
+		// Stack code: code offset of the current instruction in every frame, outermost first
+		void AddSample( const BatCode& bc, const int64_t* pcs, size_t count );
+		// Interpreter: frames outermost first
+		void AddSample( const std::vector<Frame>& frames );
+
+		uint64_t NumSamples() const { return m_iNumSamples; }
+		void Write( std::ostream& out ) const;
+	private:
+		// Function and line of every byte of the code, built the first time a sample is taken from it
+		struct CodeMap
+		{
+			const BatCode* code = nullptr;
+			std::vector<int> function_at;
+			std::vector<int> line_at;
+			std::vector<std::string> functions;
+		};
+		void MapCode( const BatCode& bc );
+		void AddStack( const std::string& stack );
+
+		static void HandleSignal( int signal );
+	private:
+		static volatile std::sig_atomic_t s_SamplePending;
+		static std::atomic<void*>* s_pRedirectTable;
+		static void* s_pRedirectTarget;
+		// Set last and cleared first, the handler only touches the table while it's non-zero
+		static std::atomic<size_t> s_iRedirectSize;
+
+		std::unordered_map<std::string, uint64_t> m_Stacks;
+		uint64_t m_iNumSamples = 0;
+		CodeMap m_Map;
+		bool m_bRunning = false;
+	};
+}
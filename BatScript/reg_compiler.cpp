@@ -0,0 +1,939 @@
+#include "reg_compiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include "errorsys.h"
+#include "lexer.h"
+#include "parser.h"
+#include "type_manager.h"
+
+namespace Bat
+{
+	RegCompiler::RegCompiler()
+	{
+		m_pSymTab = new SymbolTable;
+	}
+	RegCompiler::~RegCompiler()
+	{
+		delete m_pSymTab;
+	}
+	void RegCompiler::Compile( std::vector<std::unique_ptr<Statement>> statements )
+	{
+		// Do imports first
+		for( const auto& stmt : statements )
+		{
+			if( ImportStmt* impt = stmt->ToImportStmt() )
+			{
+				Compile( impt );
+			}
+		}
+
+		m_iFrameTop = 0;
+
+		// Global vars second, these take up the bottom slots of the stack
+		for( const auto& stmt : statements )
+		{
+			if( VarDecl* var = stmt->ToVarDecl() )
+			{
+				AllocateGlobalVariable( var );
+			}
+		}
+
+		// Natives before functions, so function bodies can call them
+		for( const auto& stmt : statements )
+		{
+			if( NativeStmt* native = stmt->ToNativeStmt() )
+			{
+				Compile( native );
+			}
+		}
+
+		RegOperand_t globals_top = m_iFrameTop;
+
+		// Functions third
+		for( const auto& stmt : statements )
+		{
+			if( FuncDecl* func = stmt->ToFuncDecl() )
+			{
+				Compile( func );
+			}
+		}
+
+		m_iEntryPoint = IP();
+
+		// Everything else gets put into a pseudo-function as the mainline
+		// Its frame starts at the bottom of the stack, so the globals are its first registers
+		m_iFrameTop = globals_top;
+		CodeLoc_t enter = EmitEnter();
+		for( const auto& stmt : statements )
+		{
+			if( !stmt->IsImportStmt() && !stmt->IsFuncDecl() && !stmt->IsNativeStmt() )
+			{
+				Compile( stmt.get() );
+			}
+		}
+		PatchEnter( enter );
+
+		Emit( RegOpCode::HALT );
+
+		// Symbols keep pointing into the AST (e.g. native signatures used by Code()), so it has to outlive compilation
+		for( auto& stmt : statements )
+		{
+			m_pStatements.push_back( std::move( stmt ) );
+		}
+	}
+	void RegCompiler::Compile( std::unique_ptr<Statement> s )
+	{
+		Compile( s.get() );
+		m_pStatements.push_back( std::move( s ) );
+	}
+	void RegCompiler::Compile( Statement* s )
+	{
+		// Temporaries only live until the end of the statement that created them
+		// Variable declarations are the exception, they keep their slot until the end of the scope
+		RegOperand_t top = m_iFrameTop;
+		s->Accept( this );
+		if( !s->IsVarDecl() )
+		{
+			m_iFrameTop = top;
+		}
+	}
+	RegOperand_t RegCompiler::CompileRValue( Expression* e, RegOperand_t target )
+	{
+		m_iTarget = target;
+		e->Accept( this );
+		m_iTarget = NO_REGISTER;
+
+		assert( target == NO_REGISTER || m_iResult == target );
+		return m_iResult;
+	}
+	CodeLoc_t RegCompiler::Emit( RegOpCode op )
+	{
+		m_LineMapping.push_back( m_iCurrentLine );
+
+		auto loc = IP();
+		code.Write( op );
+		return loc;
+	}
+	CodeLoc_t RegCompiler::Emit( RegOpCode op, RegOperand_t a )
+	{
+		auto loc = Emit( op );
+		EmitOperand( a );
+		return loc;
+	}
+	CodeLoc_t RegCompiler::Emit( RegOpCode op, RegOperand_t a, RegOperand_t b )
+	{
+		auto loc = Emit( op, a );
+		EmitOperand( b );
+		return loc;
+	}
+	CodeLoc_t RegCompiler::Emit( RegOpCode op, RegOperand_t a, RegOperand_t b, RegOperand_t c )
+	{
+		auto loc = Emit( op, a, b );
+		EmitOperand( c );
+		return loc;
+	}
+	CodeLoc_t RegCompiler::Emit( RegOpCode op, RegOperand_t a, RegOperand_t b, RegOperand_t c, RegOperand_t d )
+	{
+		auto loc = Emit( op, a, b, c );
+		EmitOperand( d );
+		return loc;
+	}
+	CodeLoc_t RegCompiler::EmitLoadImmediate( RegOperand_t dst, int64_t imm )
+	{
+		auto loc = Emit( RegOpCode::LOADI, dst );
+		code.WriteInt64( imm );
+		return loc;
+	}
+	CodeLoc_t RegCompiler::EmitOperand( RegOperand_t operand )
+	{
+		auto loc = IP();
+		code.Write( operand );
+		return loc;
+	}
+	CodeLoc_t RegCompiler::EmitJumpToPatch( RegOpCode op, RegOperand_t cond )
+	{
+		if( op == RegOpCode::JMP )
+		{
+			Emit( op );
+		}
+		else
+		{
+			assert( cond != NO_REGISTER );
+			Emit( op, cond );
+		}
+		return EmitOperand( 0 );
+	}
+	void RegCompiler::PatchJump( CodeLoc_t operand_addr )
+	{
+		PatchOperand( operand_addr, (RegOperand_t)IP() );
+	}
+	CodeLoc_t RegCompiler::EmitEnter()
+	{
+		m_iFrameSize = m_iFrameTop;
+		return Emit( RegOpCode::ENTER, 0 );
+	}
+	void RegCompiler::PatchEnter( CodeLoc_t enter )
+	{
+		PatchOperand( enter + 1, m_iFrameSize );
+	}
+	void RegCompiler::PatchOperand( CodeLoc_t operand_addr, RegOperand_t value )
+	{
+		auto old = code.Tell();
+		code.Seek( (size_t)operand_addr, SeekPosition::START );
+		code.Write( value );
+		code.Seek( old, SeekPosition::START );
+	}
+	BatCode RegCompiler::Code() const
+	{
+		BatCode bc;
+		bc.isa = InstructionSet::REGISTER;
+		bc.code = code;
+		bc.code.Seek( SeekPosition::START );
+		bc.entry_point = m_iEntryPoint;
+		bc.string_literals = m_StringLiterals;
+		bc.debug_info.line_mapping = m_LineMapping;
+
+		for( size_t i = 0; i < m_Natives.size(); i++ )
+		{
+			BatNativeInfo info;
+			info.name = m_Natives[i];
+
+			FunctionSymbol* ntv = GetSymbol( info.name )->AsFunction();
+			FunctionSignature& sig = ntv->Signature();
+			for( size_t param_idx = 0; param_idx < sig.NumParams(); param_idx++ )
+			{
+				Type* t = TypeSpecifierToType( sig.ParamType( param_idx ) );
+				ObjectType obj_type = TypeToObjectType( t );
+
+				info.desc.param_types.push_back( obj_type );
+			}
+			// Natives declared without a return type don't have one
+			info.desc.return_type = sig.ReturnType() ? TypeToObjectType( sig.ReturnType() ) : TYPE_NULL;
+
+			bc.natives.push_back( info );
+		}
+
+		return bc;
+	}
+	void RegCompiler::CompileAssign( AssignStmt* node )
+	{
+		if( !node->Left()->IsVarExpr() )
+		{
+			ReportArrays( node );
+			return;
+		}
+
+		VariableSymbol* var = GetSymbol( node->Left() )->ToVariable();
+		RegOperand_t first_temp = m_iFrameTop;
+
+		/* Straight assignment evaluates right into the variable's register */
+		if( node->Op() == TOKEN_EQUAL )
+		{
+			if( IsRegister( var ) )
+			{
+				CompileRValue( node->Right(), (RegOperand_t)var->Address() );
+			}
+			else
+			{
+				RegOperand_t value = CompileRValue( node->Right() );
+				Emit( RegOpCode::STORE_GLOBAL, (RegOperand_t)var->Address(), value );
+			}
+			return;
+		}
+
+		RegOperand_t value = CompileRValue( node->Right() );
+
+		//  ; right -> value
+		//  op var, var, value
+		//
+		// or for globals from inside a function:
+		//  ; right -> value
+		//  global.load tmp, var
+		//  op tmp, tmp, value
+		//  global.store var, tmp
+
+		RegOperand_t reg;
+		if( IsRegister( var ) )
+		{
+			reg = (RegOperand_t)var->Address();
+		}
+		else
+		{
+			reg = AllocSlot();
+			Emit( RegOpCode::LOAD_GLOBAL, reg, (RegOperand_t)var->Address() );
+		}
+
+		PrimitiveKind kind = node->Left()->Type()->ToPrimitive()->PrimKind();
+
+		RegOpCode op;
+		switch( node->Op() )
+		{
+		case TOKEN_PLUS_EQUAL:     op = (kind == PrimitiveKind::Int) ? RegOpCode::ADD : RegOpCode::ADDF; break;
+		case TOKEN_MINUS_EQUAL:    op = (kind == PrimitiveKind::Int) ? RegOpCode::SUB : RegOpCode::SUBF; break;
+		case TOKEN_ASTERISK_EQUAL: op = (kind == PrimitiveKind::Int) ? RegOpCode::MUL : RegOpCode::MULF; break;
+		case TOKEN_SLASH_EQUAL:    op = (kind == PrimitiveKind::Int) ? RegOpCode::DIV : RegOpCode::DIVF; break;
+		case TOKEN_PERCENT_EQUAL:  op = RegOpCode::MOD; break;
+		case TOKEN_AMP_EQUAL:      op = RegOpCode::BITAND; break;
+		case TOKEN_HAT_EQUAL:      op = RegOpCode::BITXOR; break;
+		case TOKEN_BAR_EQUAL:      op = RegOpCode::BITOR; break;
+		default:                   assert( false && "Unhandled assign op" ); return;
+		}
+
+		Emit( op, reg, reg, value );
+
+		if( !IsRegister( var ) )
+		{
+			Emit( RegOpCode::STORE_GLOBAL, (RegOperand_t)var->Address(), reg );
+		}
+
+		m_iFrameTop = first_temp;
+	}
+	RegOperand_t RegCompiler::AllocSlot()
+	{
+		m_iFrameSize = std::max( m_iFrameSize, m_iFrameTop + 1 );
+		return m_iFrameTop++;
+	}
+	RegOperand_t RegCompiler::Destination( RegOperand_t target, RegOperand_t first_temp )
+	{
+		m_iFrameTop = first_temp;
+		if( target != NO_REGISTER )
+		{
+			return target;
+		}
+
+		return AllocSlot();
+	}
+	VariableSymbol* RegCompiler::AddVariable( AstNode* node, const std::string& name, StorageClass storage, Type* type )
+	{
+		m_pSymTab->AddSymbol( name, std::make_unique<VariableSymbol>( node, type ) );
+		VariableSymbol* var = m_pSymTab->GetSymbol( name )->ToVariable();
+		var->SetStorage( storage );
+		return var;
+	}
+	Symbol* RegCompiler::GetSymbol( const std::string& name ) const
+	{
+		return m_pSymTab->GetSymbol( name );
+	}
+	Symbol* RegCompiler::GetSymbol( Expression* node ) const
+	{
+		assert( node->IsLValue() );
+		if( VarExpr* var = node->AsVarExpr() )
+		{
+			return GetSymbol( var->Identifier().lexeme );
+		}
+
+		assert( false );
+		return nullptr;
+	}
+	FunctionSymbol* RegCompiler::AddFunction( AstNode* node, const std::string& name )
+	{
+		m_pSymTab->AddSymbol( name, std::make_unique<FunctionSymbol>( node, FunctionKind::Script ) );
+		FunctionSymbol* func = m_pSymTab->GetSymbol( name )->ToFunction();
+		func->SetAddress( IP() );
+		return func;
+	}
+	FunctionSymbol* RegCompiler::AddNative( NativeStmt* node, const std::string& name )
+	{
+		m_pSymTab->AddSymbol( name, std::make_unique<FunctionSymbol>( node, FunctionKind::Native ) );
+		FunctionSymbol* ntv = m_pSymTab->GetSymbol( name )->ToFunction();
+		auto& sig = ntv->Signature();
+		sig.SetReturnType( TypeSpecifierToType( sig.ReturnTypeSpec() ) ); // HACK: imported natives dont get passed to us from sema pass, so they don't have their return type filled in.
+		ntv->SetAddress( m_Natives.size() );
+		m_Natives.push_back( name );
+		return ntv;
+	}
+	void RegCompiler::AllocateGlobalVariable( VarDecl* node )
+	{
+		UpdateCurrLine( node );
+
+		VariableSymbol* var = AddVariable( node, node->Identifier().lexeme, StorageClass::GLOBAL, node->Type() );
+		var->SetAddress( AllocSlot() );
+	}
+	void RegCompiler::PushScope()
+	{
+		m_pSymTab = new SymbolTable( m_pSymTab );
+	}
+	void RegCompiler::PopScope()
+	{
+		assert( m_pSymTab->Enclosing() != nullptr );
+		SymbolTable* temp = m_pSymTab;
+		m_pSymTab = m_pSymTab->Enclosing();
+		delete temp;
+	}
+	int64_t RegCompiler::AddStringLiteral( const std::string& literal )
+	{
+		for( size_t i = 0; i < m_StringLiterals.size(); i++ )
+		{
+			if( m_StringLiterals[i] == literal )
+			{
+				return (int64_t)i;
+			}
+		}
+
+		auto idx = (int64_t)m_StringLiterals.size();
+		m_StringLiterals.push_back( literal );
+		return idx;
+	}
+	void RegCompiler::UpdateCurrLine( AstNode* node )
+	{
+		m_iCurrentLine = node->Location().Line();
+	}
+	void RegCompiler::ReportArrays( AstNode* node )
+	{
+		ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Arrays are only supported by the stack VM" );
+	}
+	void RegCompiler::VisitIntLiteral( IntLiteral* node )
+	{
+		UpdateCurrLine( node );
+
+		m_iResult = Destination( m_iTarget, m_iFrameTop );
+		EmitLoadImmediate( m_iResult, node->value );
+	}
+	void RegCompiler::VisitFloatLiteral( FloatLiteral* node )
+	{
+		UpdateCurrLine( node );
+
+		int64_t bits;
+		static_assert( sizeof( bits ) == sizeof( node->value ) );
+		std::memcpy( &bits, &node->value, sizeof( bits ) );
+
+		m_iResult = Destination( m_iTarget, m_iFrameTop );
+		EmitLoadImmediate( m_iResult, bits );
+	}
+	void RegCompiler::VisitStringLiteral( StringLiteral* node )
+	{
+		UpdateCurrLine( node );
+
+		int64_t index = AddStringLiteral( node->value->chars );
+		m_iResult = Destination( m_iTarget, m_iFrameTop );
+		EmitLoadImmediate( m_iResult, index );
+	}
+	void RegCompiler::VisitTokenLiteral( TokenLiteral* node )
+	{
+		UpdateCurrLine( node );
+
+		m_iResult = Destination( m_iTarget, m_iFrameTop );
+
+		switch( node->value )
+		{
+		case TOKEN_TRUE:
+			EmitLoadImmediate( m_iResult, 1 );
+			break;
+		case TOKEN_FALSE:
+			EmitLoadImmediate( m_iResult, 0 );
+			break;
+		case TOKEN_NIL:
+			EmitLoadImmediate( m_iResult, 0 );
+			break;
+		default:
+			assert( false && "Unhandled token literal" );
+			EmitLoadImmediate( m_iResult, 0 );
+			break;
+		}
+	}
+	void RegCompiler::VisitArrayLiteral( ArrayLiteral* node )
+	{
+		UpdateCurrLine( node );
+
+		ReportArrays( node );
+		m_iResult = Destination( m_iTarget, m_iFrameTop );
+		EmitLoadImmediate( m_iResult, 0 );
+	}
+	void RegCompiler::VisitBinaryExpr( BinaryExpr* node )
+	{
+		UpdateCurrLine( node );
+
+		RegOperand_t target = m_iTarget;
+		RegOperand_t first_temp = m_iFrameTop;
+
+		// Logical operators like and/or have short-circuiting, so they have to be handled a little different
+		// The result is built up in a temporary since the target could be read by the right expression
+		if( node->Op() == TOKEN_AND || node->Op() == TOKEN_OR )
+		{
+			//  ; left expression -> tmp
+			//  jz/jnz tmp, end
+			//  ; right expression -> tmp
+			// end:
+			//  mov target, tmp
+
+			RegOperand_t tmp = AllocSlot();
+			CompileRValue( node->Left(), tmp );
+			CodeLoc_t end_target = EmitJumpToPatch( (node->Op() == TOKEN_AND) ? RegOpCode::JZ : RegOpCode::JNZ, tmp );
+			m_iFrameTop = tmp + 1;
+			CompileRValue( node->Right(), tmp );
+			PatchJump( end_target );
+
+			if( target != NO_REGISTER )
+			{
+				Emit( RegOpCode::MOV, target, tmp );
+			}
+			m_iResult = Destination( target, first_temp );
+			return;
+		}
+
+		RegOperand_t left = CompileRValue( node->Left() );
+		RegOperand_t right = CompileRValue( node->Right() );
+		RegOperand_t dst = Destination( target, first_temp );
+
+		PrimitiveKind kind = node->Left()->Type()->ToPrimitive()->PrimKind();
+
+		RegOpCode op;
+		switch( node->Op() )
+		{
+		case TOKEN_BAR:             op = RegOpCode::BITOR; break;
+		case TOKEN_HAT:             op = RegOpCode::BITXOR; break;
+		case TOKEN_AMP:             op = RegOpCode::BITAND; break;
+		case TOKEN_LESS_LESS:       op = RegOpCode::SHL; break;
+		case TOKEN_GREATER_GREATER: op = RegOpCode::SHR; break;
+		case TOKEN_EQUAL_EQUAL:     op = (kind == PrimitiveKind::Int) ? RegOpCode::EQ : RegOpCode::EQF; break;
+		case TOKEN_EXCLMARK_EQUAL:  op = (kind == PrimitiveKind::Int) ? RegOpCode::NEQ : RegOpCode::NEQF; break;
+		case TOKEN_LESS:            op = (kind == PrimitiveKind::Int) ? RegOpCode::LESS : RegOpCode::LESSF; break;
+		case TOKEN_LESS_EQUAL:      op = (kind == PrimitiveKind::Int) ? RegOpCode::LESSE : RegOpCode::LESSEF; break;
+		case TOKEN_GREATER:         op = (kind == PrimitiveKind::Int) ? RegOpCode::GRT : RegOpCode::GRTF; break;
+		case TOKEN_GREATER_EQUAL:   op = (kind == PrimitiveKind::Int) ? RegOpCode::GRTE : RegOpCode::GRTEF; break;
+		case TOKEN_PLUS:            op = (kind == PrimitiveKind::Int) ? RegOpCode::ADD : RegOpCode::ADDF; break;
+		case TOKEN_MINUS:           op = (kind == PrimitiveKind::Int) ? RegOpCode::SUB : RegOpCode::SUBF; break;
+		case TOKEN_ASTERISK:        op = (kind == PrimitiveKind::Int) ? RegOpCode::MUL : RegOpCode::MULF; break;
+		case TOKEN_SLASH:           op = (kind == PrimitiveKind::Int) ? RegOpCode::DIV : RegOpCode::DIVF; break;
+		case TOKEN_PERCENT:         op = RegOpCode::MOD; break;
+		default:                    assert( false && "Unhandled binary op" ); return;
+		}
+
+		Emit( op, dst, left, right );
+		m_iResult = dst;
+	}
+	void RegCompiler::VisitUnaryExpr( UnaryExpr* node )
+	{
+		UpdateCurrLine( node );
+
+		RegOperand_t target = m_iTarget;
+		RegOperand_t first_temp = m_iFrameTop;
+
+		RegOperand_t right = CompileRValue( node->Right() );
+		RegOperand_t dst = Destination( target, first_temp );
+
+		PrimitiveKind kind = node->Type()->ToPrimitive()->PrimKind();
+
+		switch( node->Op() )
+		{
+		case TOKEN_MINUS:    Emit( (kind == PrimitiveKind::Int) ? RegOpCode::NEG : RegOpCode::NEGF, dst, right ); break;
+		case TOKEN_EXCLMARK: Emit( RegOpCode::NOT, dst, right ); break;
+		case TOKEN_TILDE:    Emit( RegOpCode::BITNOT, dst, right ); break;
+		default:
+			assert( false && "Unhandled unary op" );
+		}
+
+		m_iResult = dst;
+	}
+	void RegCompiler::VisitCallExpr( CallExpr* node )
+	{
+		UpdateCurrLine( node );
+
+		RegOperand_t target = m_iTarget;
+
+		FunctionSymbol* func_symbol = CalledFunction( node );
+
+		// Arguments go into consecutive registers at the top of the frame, for script functions these become
+		// the first registers of the callee's frame
+		//  ; arg 0 -> base
+		//  ; arg 1 -> base + 1
+		//  ; ...
+		//  call dst, func, base
+
+		RegOperand_t base = m_iFrameTop;
+		RegOperand_t num_args = CompileArgs( node, func_symbol );
+
+		RegOperand_t dst = Destination( target, base );
+
+		if( func_symbol->FuncKind() == FunctionKind::Script )
+		{
+			Emit( RegOpCode::CALL, dst, (RegOperand_t)func_symbol->Address(), base );
+		}
+		else if( func_symbol->FuncKind() == FunctionKind::Native )
+		{
+			Emit( RegOpCode::NATIVE, dst, (RegOperand_t)func_symbol->Address(), base, num_args );
+		}
+
+		m_iResult = dst;
+	}
+	FunctionSymbol* RegCompiler::CalledFunction( CallExpr* node ) const
+	{
+		VarExpr* callee = node->Function()->ToVarExpr();
+		return m_pSymTab->GetSymbol( callee->Identifier().lexeme )->ToFunction();
+	}
+	RegOperand_t RegCompiler::CompileArgs( CallExpr* node, FunctionSymbol* func )
+	{
+		auto& sig = func->Signature();
+
+		RegOperand_t base = m_iFrameTop;
+		RegOperand_t num_args = 0;
+		for( size_t i = 0; i < node->NumArgs(); i++ )
+		{
+			m_iFrameTop = base + num_args;
+			CompileRValue( node->Arg( i ), AllocSlot() );
+			num_args++;
+		}
+
+		// Missing arguments get their defaults filled in here at the call site, defaults only see the globals
+		if( func->FuncKind() == FunctionKind::Script )
+		{
+			SymbolTable* scope = m_pSymTab;
+			while( m_pSymTab->Enclosing() )
+			{
+				m_pSymTab = m_pSymTab->Enclosing();
+			}
+			for( size_t i = node->NumArgs(); i < sig.NumParams(); i++ )
+			{
+				assert( sig.ParamDefault( i ) );
+				m_iFrameTop = base + num_args;
+				CompileRValue( sig.ParamDefault( i ), AllocSlot() );
+				num_args++;
+			}
+			m_pSymTab = scope;
+		}
+
+		return num_args;
+	}
+	bool RegCompiler::CompileTailCall( ReturnStmt* node )
+	{
+		// `return f(...)` enters f in this function's frame, which starts at the arguments whatever their number.
+		// The arguments are all evaluated before they replace this function's, since they may depend on them:
+		//  ; arg 0 -> base
+		//  ; ...
+		//  mov r0, base
+		//  ; ...
+		//  tailcall func
+		// f then returns straight to this function's caller.
+		CallExpr* call = node->RetExpr() ? node->RetExpr()->ToCallExpr() : nullptr;
+		if( !call || !m_bInFunction )
+		{
+			return false;
+		}
+
+		FunctionSymbol* func = CalledFunction( call );
+		if( func->FuncKind() != FunctionKind::Script )
+		{
+			return false;
+		}
+
+		UpdateCurrLine( call );
+		RegOperand_t base = m_iFrameTop;
+		RegOperand_t num_args = CompileArgs( call, func );
+		for( RegOperand_t i = 0; i < num_args; i++ )
+		{
+			Emit( RegOpCode::MOV, i, base + i );
+		}
+		Emit( RegOpCode::TAILCALL, (RegOperand_t)func->Address() );
+		return true;
+	}
+	void RegCompiler::VisitIndexExpr( IndexExpr* node )
+	{
+		UpdateCurrLine( node );
+
+		ReportArrays( node );
+		m_iResult = Destination( m_iTarget, m_iFrameTop );
+		EmitLoadImmediate( m_iResult, 0 );
+	}
+	void RegCompiler::VisitCastExpr( CastExpr* node )
+	{
+		UpdateCurrLine( node );
+
+		RegOperand_t target = m_iTarget;
+		RegOperand_t first_temp = m_iFrameTop;
+
+		Expression* base = node->Expr();
+		PrimitiveType* base_type = base->Type()->ToPrimitive();
+		PrimitiveType* target_type = node->TargetType()->ToPrimitive();
+
+		// Only casting between primitives is supported for now
+		assert( base_type && target_type );
+
+		RegOperand_t src = CompileRValue( base );
+		RegOperand_t dst = Destination( target, first_temp );
+
+		if( base_type->PrimKind() == PrimitiveKind::Int && target_type->PrimKind() == PrimitiveKind::Float )
+		{
+			Emit( RegOpCode::ITOF, dst, src );
+		}
+		else if( base_type->PrimKind() == PrimitiveKind::Float && target_type->PrimKind() == PrimitiveKind::Int )
+		{
+			Emit( RegOpCode::FTOI, dst, src );
+		}
+		else if( base_type->PrimKind() == PrimitiveKind::Int && target_type->PrimKind() == PrimitiveKind::Bool )
+		{
+			Emit( RegOpCode::NOT, dst, src );
+			Emit( RegOpCode::NOT, dst, dst );
+		}
+		else if( base_type->PrimKind() == PrimitiveKind::Float && target_type->PrimKind() == PrimitiveKind::Bool )
+		{
+			Emit( RegOpCode::NOT, dst, src );
+			Emit( RegOpCode::NOT, dst, dst );
+		}
+		else
+		{
+			assert( false && "Unhandled cast type" );
+		}
+
+		m_iResult = dst;
+	}
+	void RegCompiler::VisitGroupExpr( GroupExpr* node )
+	{
+		UpdateCurrLine( node );
+
+		m_iResult = CompileRValue( node->Expr(), m_iTarget );
+	}
+	void RegCompiler::VisitVarExpr( VarExpr* node )
+	{
+		UpdateCurrLine( node );
+
+		RegOperand_t target = m_iTarget;
+
+		VariableSymbol* var = GetSymbol( node->Identifier().lexeme )->ToVariable();
+		auto addr = (RegOperand_t)var->Address();
+
+		if( !IsRegister( var ) )
+		{
+			m_iResult = Destination( target, m_iFrameTop );
+			Emit( RegOpCode::LOAD_GLOBAL, m_iResult, addr );
+			return;
+		}
+
+		// Variables are already in a register, only need to move if the value is wanted somewhere else
+		if( target != NO_REGISTER && target != addr )
+		{
+			Emit( RegOpCode::MOV, target, addr );
+			m_iResult = target;
+			return;
+		}
+
+		m_iResult = addr;
+	}
+	void RegCompiler::VisitExpressionStmt( ExpressionStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		CompileRValue( node->Expr() );
+	}
+	void RegCompiler::VisitAssignStmt( AssignStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		CompileAssign( node );
+	}
+	void RegCompiler::VisitBlockStmt( BlockStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		PushScope();
+		size_t count = node->NumStatements();
+		for( size_t i = 0; i < count; i++ )
+		{
+			Compile( node->Stmt( i ) );
+		}
+		PopScope();
+	}
+	void RegCompiler::VisitPrintStmt( PrintStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		RegOperand_t value = CompileRValue( node->Expr() );
+
+		PrimitiveType* t = node->Expr()->Type()->ToPrimitive();
+		assert( t );
+
+		switch( t->PrimKind() )
+		{
+		case PrimitiveKind::Bool:
+			Emit( RegOpCode::PRINTB, value );
+			break;
+		case PrimitiveKind::Int:
+			Emit( RegOpCode::PRINTI, value );
+			break;
+		case PrimitiveKind::Float:
+			Emit( RegOpCode::PRINTF, value );
+			break;
+		case PrimitiveKind::String:
+			Emit( RegOpCode::PRINTS, value );
+			break;
+		}
+	}
+	void RegCompiler::VisitIfStmt( IfStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		//  ; condition -> cond
+		//  jz cond, else_branch
+		//  ; then branch body
+		//  jmp end
+		// else_branch:
+		//  ; else branch body
+		// end:
+		//  ; ....
+
+		RegOperand_t top = m_iFrameTop;
+		RegOperand_t cond = CompileRValue( node->Condition() );
+		m_iFrameTop = top;
+
+		if( node->Else() )
+		{
+			CodeLoc_t else_target = EmitJumpToPatch( RegOpCode::JZ, cond );
+			Compile( node->Then() );
+			CodeLoc_t end_target = EmitJumpToPatch( RegOpCode::JMP );
+			PatchJump( else_target );
+			Compile( node->Else() );
+			PatchJump( end_target );
+		}
+		else
+		{
+			CodeLoc_t end_target = EmitJumpToPatch( RegOpCode::JZ, cond );
+			Compile( node->Then() );
+			PatchJump( end_target );
+		}
+	}
+	void RegCompiler::VisitWhileStmt( WhileStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		// Condition is checked at the bottom so that each iteration only takes one jump
+		//  jmp check
+		// body:
+		//  ; while body
+		// check:
+		//  ; condition -> cond
+		//  jnz cond, body
+		//  ; ...
+
+		CodeLoc_t check_patch = EmitJumpToPatch( RegOpCode::JMP );
+		CodeLoc_t body_addr = IP();
+		Compile( node->Body() );
+
+		PatchJump( check_patch );
+		UpdateCurrLine( node );
+		RegOperand_t cond = CompileRValue( node->Condition() );
+		Emit( RegOpCode::JNZ, cond, (RegOperand_t)body_addr );
+	}
+	void RegCompiler::VisitForStmt( ForStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		assert( false );
+	}
+	void RegCompiler::VisitReturnStmt( ReturnStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		if( CompileTailCall( node ) )
+		{
+			return;
+		}
+
+		if( node->RetExpr() )
+		{
+			Emit( RegOpCode::RET, CompileRValue( node->RetExpr() ) );
+		}
+		else
+		{
+			Emit( RegOpCode::RETV );
+		}
+	}
+	void RegCompiler::VisitImportStmt( ImportStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		for( const auto& stmt : node->Statements() )
+		{
+			Compile( stmt.get() );
+		}
+	}
+	void RegCompiler::VisitNativeStmt( NativeStmt* node )
+	{
+		UpdateCurrLine( node );
+
+		if( node->Signature().Async() )
+		{
+			ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Async natives are only supported by the stack VM" );
+		}
+		for( size_t i = 0; i < node->Signature().NumParams(); i++ )
+		{
+			if( TypeSpecifierToType( node->Signature().ParamType( i ) )->IsArray() )
+			{
+				ReportArrays( node );
+				break;
+			}
+		}
+
+		AddNative( node, node->Signature().Identifier().lexeme );
+	}
+	void RegCompiler::VisitVarDecl( VarDecl* node )
+	{
+		UpdateCurrLine( node );
+
+		// Allocate a slot for local variables
+		// Global variables are specially handled
+		if( !InGlobalScope() )
+		{
+			VariableSymbol* var = AddVariable( node, node->Identifier().lexeme, StorageClass::LOCAL, node->Type() );
+			var->SetAddress( AllocSlot() );
+		}
+
+		VariableSymbol* var = GetSymbol( node->Identifier().lexeme )->AsVariable();
+		if( var->VarType()->IsArray() )
+		{
+			ReportArrays( node );
+			return;
+		}
+
+		if( node->Initializer() )
+		{
+			RegOperand_t top = m_iFrameTop;
+			if( IsRegister( var ) )
+			{
+				CompileRValue( node->Initializer(), (RegOperand_t)var->Address() );
+			}
+			else
+			{
+				Emit( RegOpCode::STORE_GLOBAL, (RegOperand_t)var->Address(), CompileRValue( node->Initializer() ) );
+			}
+			m_iFrameTop = top;
+		}
+	}
+	void RegCompiler::VisitFuncDecl( FuncDecl* node )
+	{
+		UpdateCurrLine( node );
+
+		auto& sig = node->Signature();
+		AddFunction( node, sig.Identifier().lexeme );
+
+		if( sig.Async() )
+		{
+			ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Async functions are only supported by the stack VM" );
+		}
+
+		// Arguments are the first registers of the frame, they're put there by the caller
+		m_bInFunction = true;
+		m_iFrameTop = 0;
+		CodeLoc_t enter = EmitEnter();
+
+		PushScope();
+
+		for( size_t i = 0; i < sig.NumParams(); i++ )
+		{
+			Type* arg_type = TypeSpecifierToType( sig.ParamType( i ) );
+			if( arg_type->IsArray() )
+			{
+				ReportArrays( node );
+			}
+			VariableSymbol* arg = AddVariable( node, sig.ParamIdent( i ).lexeme, StorageClass::ARGUMENT, arg_type );
+			arg->SetAddress( AllocSlot() );
+		}
+
+		Compile( node->Body() );
+		PatchEnter( enter );
+
+		PopScope();
+
+		m_bInFunction = false;
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "ast.h"
+#include "compiler.h"
+#include "reg_instructions.h"
+#include "memory_stream.h"
+#include "symbol_table.h"
+
+namespace Bat
+{
+	// Compiles to the register instruction set (see reg_instructions.h)
+	// Every variable lives in a slot of its function's frame and expressions read their operands straight out of those
+	// slots, so e.g. `x = y + z` is a single instruction instead of the 5-6 that the stack instruction set needs.
+	class RegCompiler : public AstVisitor
+	{
+	public:
+		RegCompiler();
+		~RegCompiler();
+
+		void Compile( std::vector<std::unique_ptr<Statement>> statements );
+
+		BatCode Code() const;
+	private:
+		static constexpr RegOperand_t NO_REGISTER = -1;
+
+		CodeLoc_t Emit( RegOpCode op );
+		CodeLoc_t Emit( RegOpCode op, RegOperand_t a );
+		CodeLoc_t Emit( RegOpCode op, RegOperand_t a, RegOperand_t b );
+		CodeLoc_t Emit( RegOpCode op, RegOperand_t a, RegOperand_t b, RegOperand_t c );
+		CodeLoc_t Emit( RegOpCode op, RegOperand_t a, RegOperand_t b, RegOperand_t c, RegOperand_t d );
+		CodeLoc_t EmitLoadImmediate( RegOperand_t dst, int64_t imm );
+		CodeLoc_t EmitOperand( RegOperand_t operand );
+
+		// Emits a jump with the target left empty, returns the address of the target operand to pass to PatchJump
+		CodeLoc_t EmitJumpToPatch( RegOpCode op, RegOperand_t cond = NO_REGISTER );
+		// Patches the target operand at a given address to point to current instruction pointer
+		void PatchJump( CodeLoc_t operand_addr );
+		// Emits the enter instruction that starts a frame, returns the address to pass to PatchEnter
+		CodeLoc_t EmitEnter();
+		// Patches the enter instruction at a given address with the size the frame grew to
+		void PatchEnter( CodeLoc_t enter );
+		void PatchOperand( CodeLoc_t operand_addr, RegOperand_t value );
+
+		void Compile( std::unique_ptr<Statement> s );
+		void Compile( Statement* s );
+		// Compiles expression and returns the register that holds the result
+		// If a target register is given then the result is always placed in it
+		RegOperand_t CompileRValue( Expression* e, RegOperand_t target = NO_REGISTER );
+
+		void CompileAssign( AssignStmt* node );
+		FunctionSymbol* CalledFunction( CallExpr* node ) const;
+		// Compiles the arguments of a call, defaults included, into consecutive registers from the top of the frame on
+		// Returns the number of arguments.
+		RegOperand_t CompileArgs( CallExpr* node, FunctionSymbol* func );
+		// Compiles `return f(...)` to a tail call if f is a script function, returns false if it isn't
+		bool CompileTailCall( ReturnStmt* node );
+
+		// Global variables are only addressable as registers from the mainline, whose frame starts at the bottom of the stack
+		bool IsRegister( VariableSymbol* var ) const { return !m_bInFunction || var->Storage() != StorageClass::GLOBAL; }
+
+		RegOperand_t AllocSlot();
+		// Returns the register that an expression should write its result to
+		// Temporaries above first_temp are dead by the time the result is written, so their slots get reused
+		RegOperand_t Destination( RegOperand_t target, RegOperand_t first_temp );
+
+		VariableSymbol* AddVariable( AstNode* node, const std::string& name, StorageClass storage, Type* type );
+		Symbol* GetSymbol( const std::string& name ) const;
+		Symbol* GetSymbol( Expression* node ) const;
+		FunctionSymbol* AddFunction( AstNode* node, const std::string& name );
+		FunctionSymbol* AddNative( NativeStmt* node, const std::string& name );
+
+		bool InGlobalScope() const { return m_pSymTab->Enclosing() == nullptr; }
+		void AllocateGlobalVariable( VarDecl* decl );
+		void PushScope();
+		void PopScope();
+
+		int64_t AddStringLiteral( const std::string& literal );
+		void UpdateCurrLine( AstNode* node );
+		// The register VM has no heap for arrays, the code that uses them is reported instead of compiled
+		void ReportArrays( AstNode* node );
+
+		// Returns address of current instruction
+		CodeLoc_t IP() const { return code.Size(); }
+	private:
+		virtual void VisitIntLiteral( IntLiteral* node ) override;
+		virtual void VisitFloatLiteral( FloatLiteral* node ) override;
+		virtual void VisitStringLiteral( StringLiteral* node ) override;
+		virtual void VisitTokenLiteral( TokenLiteral* node ) override;
+		virtual void VisitArrayLiteral( ArrayLiteral* node ) override;
+		virtual void VisitBinaryExpr( BinaryExpr* node ) override;
+		virtual void VisitUnaryExpr( UnaryExpr* node ) override;
+		virtual void VisitCallExpr( CallExpr* node ) override;
+		virtual void VisitIndexExpr( IndexExpr* node ) override;
+		virtual void VisitCastExpr( CastExpr* node ) override;
+		virtual void VisitGroupExpr( GroupExpr* node ) override;
+		virtual void VisitVarExpr( VarExpr* node ) override;
+		virtual void VisitExpressionStmt( ExpressionStmt* node ) override;
+		virtual void VisitAssignStmt( AssignStmt* node ) override;
+		virtual void VisitBlockStmt( BlockStmt* node ) override;
+		virtual void VisitPrintStmt( PrintStmt* node ) override;
+		virtual void VisitIfStmt( IfStmt* node ) override;
+		virtual void VisitWhileStmt( WhileStmt* node ) override;
+		virtual void VisitForStmt( ForStmt* node ) override;
+		virtual void VisitReturnStmt( ReturnStmt* node ) override;
+		virtual void VisitImportStmt( ImportStmt* node ) override;
+		virtual void VisitNativeStmt( NativeStmt* node ) override;
+		virtual void VisitVarDecl( VarDecl* node ) override;
+		virtual void VisitFuncDecl( FuncDecl* node ) override;
+	private:
+		MemoryStream code;
+		std::vector<std::string> m_StringLiterals;
+		std::vector<std::string> m_Natives;
+		int m_iCurrentLine = 1;
+		std::vector<int> m_LineMapping;
+		std::vector<std::unique_ptr<Statement>> m_pStatements;
+		SymbolTable* m_pSymTab;
+		CodeLoc_t m_iEntryPoint = 0;
+		bool m_bInFunction = false;
+		// First free slot of the current frame
+		RegOperand_t m_iFrameTop = 0;
+		// Highest m_iFrameTop of the current frame so far, the number of registers it needs
+		RegOperand_t m_iFrameSize = 0;
+		// Register requested by whoever is compiling the current expression, and the register it actually ended up in
+		RegOperand_t m_iTarget = NO_REGISTER;
+		RegOperand_t m_iResult = NO_REGISTER;
+	};
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include "util.h"
+
+// Register instruction set, operands name 8 byte frame slots directly instead of going through the value stack
+// Operand kinds:
+//   r - register, index of a slot relative to the frame base
+//   g - global, index of a slot relative to the bottom of the stack
+//   a - code address
+//   n - native index
+//   c - argument count
+//   s - frame size, number of registers
+//   i - 64-bit immediate
+// Every operand is 32-bit except for immediates
+//
+// Opcode name, operand kinds, mnemonic
+#define REG_OPCODES(_) \
+	_(NOP,          "",     nop)                \
+	/* Moves */                                 \
+	_(MOV,          "rr",   mov)                \
+	_(LOADI,        "ri",   loadi)              \
+	_(LOAD_GLOBAL,  "rg",   global.load)        \
+	_(STORE_GLOBAL, "gr",   global.store)       \
+	/* Bitwise operations */                    \
+	_(BITOR,        "rrr",  bitor)              \
+	_(BITAND,       "rrr",  bitand)             \
+	_(BITXOR,       "rrr",  bitxor)             \
+	_(BITNOT,       "rr",   bitnot)             \
+	_(SHL,          "rrr",  shl)                \
+	_(SHR,          "rrr",  shr)                \
+	/* Logical operations */                    \
+	_(EQ,           "rrr",  eq)                 \
+	_(NEQ,          "rrr",  neq)                \
+	_(LESS,         "rrr",  less)               \
+	_(LESSE,        "rrr",  lesse)              \
+	_(GRT,          "rrr",  grt)                \
+	_(GRTE,         "rrr",  grte)               \
+	_(NOT,          "rr",   not)                \
+	/* Jump instructions */                     \
+	_(JMP,          "a",    jmp)                \
+	_(JZ,           "ra",   jz)                 \
+	_(JNZ,          "ra",   jnz)                \
+	_(CALL,         "rar",  call)               \
+	_(TAILCALL,     "a",    tailcall)           \
+	_(RET,          "r",    ret)                \
+	_(RETV,         "",     retv)               \
+	_(ENTER,        "s",    enter)              \
+	/* Integer arithmetic */                    \
+	_(ADD,          "rrr",  add)                \
+	_(SUB,          "rrr",  sub)                \
+	_(DIV,          "rrr",  div)                \
+	_(MUL,          "rrr",  mul)                \
+	_(MOD,          "rrr",  mod)                \
+	_(NEG,          "rr",   neg)                \
+	/* Floating point arithmetic */             \
+	_(ITOF,         "rr",   itof)               \
+	_(FTOI,         "rr",   ftoi)               \
+	_(ADDF,         "rrr",  addf)               \
+	_(SUBF,         "rrr",  subf)               \
+	_(DIVF,         "rrr",  divf)               \
+	_(MULF,         "rrr",  mulf)               \
+	_(NEGF,         "rr",   negf)               \
+	/* Floating point logical operations */     \
+	_(EQF,          "rrr",  eqf)                \
+	_(NEQF,         "rrr",  neqf)               \
+	_(LESSF,        "rrr",  lessf)              \
+	_(LESSEF,       "rrr",  lessef)             \
+	_(GRTF,         "rrr",  grtf)               \
+	_(GRTEF,        "rrr",  grtef)              \
+	/* Special */                               \
+	_(HALT,         "",     halt)               \
+	_(PRINTI,       "r",    int.print)          \
+	_(PRINTF,       "r",    float.print)        \
+	_(PRINTS,       "r",    str.print)          \
+	_(PRINTB,       "r",    bool.print)         \
+	_(NATIVE,       "rnrc", native)
+
+namespace Bat
+{
+	enum class RegOpCode : char
+	{
+#define _(name, operands, mnemonic) name,
+		REG_OPCODES( _ )
+#undef _
+	};
+
+	// Total number of register opcodes, used to size tables that are indexed by opcode
+	constexpr size_t NUM_REG_OPCODES = 0
+#define _(name, operands, mnemonic) + 1
+		REG_OPCODES( _ );
+#undef _
+
+	using RegOperand_t = int32_t;
+
+	// Size in bytes of an operand of the given kind
+	constexpr size_t RegOperandSize( char kind )
+	{
+		return (kind == 'i') ? sizeof( int64_t ) : sizeof( RegOperand_t );
+	}
+}
@@ -0,0 +1,384 @@
+#include "reg_vm.h"
+
+#include <cassert>
+#include <iostream>
+#include "errorsys.h"
+
+// Register helpers for the dispatch loop, these work on the locals cached by RegisterVM::Run
+#define READ_OP() (*reinterpret_cast<const RegOpCode*>(ip++))
+#define READ_OPERAND() (ip += sizeof( RegOperand_t ), ReadUnaligned<RegOperand_t>( ip - sizeof( RegOperand_t ) ))
+#define READ_I64() (ip += sizeof( int64_t ), ReadUnaligned<int64_t>( ip - sizeof( int64_t ) ))
+#define REG(r) (frame[r])
+#define REGF(r) (*reinterpret_cast<double*>(&frame[r]))
+#define GOTO(addr) (ip = code + (addr))
+
+#define BINARY_OP(op) \
+	do \
+	{ \
+		auto dst = READ_OPERAND(); \
+		auto a = READ_OPERAND(); \
+		auto b = READ_OPERAND(); \
+		REG( dst ) = REG( a ) op REG( b ); \
+	} while( false )
+
+#define UNARY_OP(op) \
+	do \
+	{ \
+		auto dst = READ_OPERAND(); \
+		auto a = READ_OPERAND(); \
+		REG( dst ) = op REG( a ); \
+	} while( false )
+
+#define BINARY_OP_F(op) \
+	do \
+	{ \
+		auto dst = READ_OPERAND(); \
+		auto a = READ_OPERAND(); \
+		auto b = READ_OPERAND(); \
+		REGF( dst ) = REGF( a ) op REGF( b ); \
+	} while( false )
+
+#define UNARY_OP_F(op) \
+	do \
+	{ \
+		auto dst = READ_OPERAND(); \
+		auto a = READ_OPERAND(); \
+		REGF( dst ) = op REGF( a ); \
+	} while( false )
+
+// Float comparisons produce an int bool
+#define COMPARE_OP_F(op) \
+	do \
+	{ \
+		auto dst = READ_OPERAND(); \
+		auto a = READ_OPERAND(); \
+		auto b = READ_OPERAND(); \
+		REG( dst ) = REGF( a ) op REGF( b ); \
+	} while( false )
+
+// Same dispatch setup as the stack VM, see vm.cpp
+#if !defined( BAT_NO_COMPUTED_GOTO ) && (defined( __GNUC__ ) || defined( __clang__ ))
+#define BAT_COMPUTED_GOTO 1
+#else
+#define BAT_COMPUTED_GOTO 0
+#endif
+
+#if BAT_COMPUTED_GOTO
+#define TARGET(op) TARGET_##op
+#define DISPATCH_LABEL(name, operands, mnemonic) &&TARGET_##name,
+#define DISPATCH() \
+	do \
+	{ \
+		auto next_op = (unsigned char)READ_OP(); \
+		assert( next_op < NUM_REG_OPCODES && "Unhandled opcode" ); \
+		goto *s_DispatchTable[next_op]; \
+	} while( false )
+#else
+#define TARGET(op) case RegOpCode::op
+#define DISPATCH() continue
+#endif
+
+namespace Bat
+{
+	// Operand kinds of each opcode, to step over instructions
+	static const char* const s_OperandKinds[] = {
+#define _(name, operands, mnemonic) operands,
+		REG_OPCODES( _ )
+#undef _
+	};
+
+	// The line mapping has one entry per instruction, in the order they were emitted
+	static int LineAt( const BatCode& bc, int64_t pc )
+	{
+		const char* code = bc.CodeBase();
+		const auto& lines = bc.debug_info.line_mapping;
+		int64_t at = 0;
+		for( size_t index = 0; at < (int64_t)bc.CodeSize(); index++ )
+		{
+			at++;
+			for( const char* kind = s_OperandKinds[(unsigned char)code[at - 1]]; *kind; kind++ )
+			{
+				at += RegOperandSize( *kind );
+			}
+			if( pc < at )
+			{
+				return index < lines.size() ? lines[index] : 0;
+			}
+		}
+		return 0;
+	}
+
+	void RegisterVM::ReportStackOverflow( const BatCode& bc, int64_t pc ) const
+	{
+		ErrorSys::Report( LineAt( bc, pc ), 0, "Stack overflow" );
+	}
+
+	void RegisterVM::AddNative( const std::string& name, BatNativeCallback callback )
+	{
+		m_Natives.Add( name, std::move( callback ) );
+	}
+	void RegisterVM::Run( const BatCode& bc )
+	{
+		assert( bc.isa == InstructionSet::REGISTER );
+
+		const char* code = bc.CodeBase();
+		const char* ip = code + bc.entry_point;
+		m_Strings.Reset( bc.string_literals );
+		m_ResolvedNatives = m_Natives.Resolve( bc.natives );
+		// The mainline's frame starts at the bottom of the stack, its first registers are the globals
+		int64_t* frame = m_Stack;
+		CallFrame* csp = m_CallStack;
+
+#if BAT_COMPUTED_GOTO
+		static void* const s_DispatchTable[] = {
+			REG_OPCODES( DISPATCH_LABEL )
+		};
+		static_assert( sizeof( s_DispatchTable ) / sizeof( s_DispatchTable[0] ) == NUM_REG_OPCODES );
+
+		DISPATCH();
+#else
+		while( true )
+		{
+		switch( READ_OP() )
+		{
+#endif
+
+		TARGET(NOP): DISPATCH();
+
+		TARGET(MOV):
+		{
+			auto dst = READ_OPERAND();
+			auto src = READ_OPERAND();
+			REG( dst ) = REG( src );
+
+			DISPATCH();
+		}
+		TARGET(LOADI):
+		{
+			auto dst = READ_OPERAND();
+			REG( dst ) = READ_I64();
+
+			DISPATCH();
+		}
+		TARGET(LOAD_GLOBAL):
+		{
+			auto dst = READ_OPERAND();
+			auto global = READ_OPERAND();
+			REG( dst ) = m_Stack[global];
+
+			DISPATCH();
+		}
+		TARGET(STORE_GLOBAL):
+		{
+			auto global = READ_OPERAND();
+			auto src = READ_OPERAND();
+			m_Stack[global] = REG( src );
+
+			DISPATCH();
+		}
+
+		TARGET(BITAND): BINARY_OP( & ); DISPATCH();
+		TARGET(BITOR):  BINARY_OP( | ); DISPATCH();
+		TARGET(BITXOR): BINARY_OP( ^ ); DISPATCH();
+		TARGET(BITNOT): UNARY_OP( ~ ); DISPATCH();
+		TARGET(SHL):    BINARY_OP( << ); DISPATCH();
+		TARGET(SHR):    BINARY_OP( >> ); DISPATCH();
+
+		TARGET(EQ):     BINARY_OP( == ); DISPATCH();
+		TARGET(NEQ):    BINARY_OP( != ); DISPATCH();
+		TARGET(LESS):   BINARY_OP( < ); DISPATCH();
+		TARGET(LESSE):  BINARY_OP( <= ); DISPATCH();
+		TARGET(GRT):    BINARY_OP( > ); DISPATCH();
+		TARGET(GRTE):   BINARY_OP( >= ); DISPATCH();
+		TARGET(NOT):    UNARY_OP( ! ); DISPATCH();
+
+		TARGET(ADD):    BINARY_OP( + ); DISPATCH();
+		TARGET(SUB):    BINARY_OP( - ); DISPATCH();
+		TARGET(DIV):    BINARY_OP( / ); DISPATCH();
+		TARGET(MUL):    BINARY_OP( * ); DISPATCH();
+		TARGET(MOD):    BINARY_OP( % ); DISPATCH();
+		TARGET(NEG):    UNARY_OP( - ); DISPATCH();
+
+		TARGET(ITOF):
+		{
+			auto dst = READ_OPERAND();
+			auto src = READ_OPERAND();
+			REGF( dst ) = (double)REG( src );
+
+			DISPATCH();
+		}
+		TARGET(FTOI):
+		{
+			auto dst = READ_OPERAND();
+			auto src = READ_OPERAND();
+			REG( dst ) = (int64_t)REGF( src );
+
+			DISPATCH();
+		}
+		TARGET(ADDF):   BINARY_OP_F( + ); DISPATCH();
+		TARGET(SUBF):   BINARY_OP_F( - ); DISPATCH();
+		TARGET(DIVF):   BINARY_OP_F( / ); DISPATCH();
+		TARGET(MULF):   BINARY_OP_F( * ); DISPATCH();
+		TARGET(NEGF):   UNARY_OP_F( - ); DISPATCH();
+
+		TARGET(EQF):    COMPARE_OP_F( == ); DISPATCH();
+		TARGET(NEQF):   COMPARE_OP_F( != ); DISPATCH();
+		TARGET(LESSF):  COMPARE_OP_F( < ); DISPATCH();
+		TARGET(LESSEF): COMPARE_OP_F( <= ); DISPATCH();
+		TARGET(GRTF):   COMPARE_OP_F( > ); DISPATCH();
+		TARGET(GRTEF):  COMPARE_OP_F( >= ); DISPATCH();
+
+		TARGET(JMP):
+		{
+			GOTO( READ_OPERAND() );
+
+			DISPATCH();
+		}
+		TARGET(JZ):
+		{
+			auto cond = READ_OPERAND();
+			auto target = READ_OPERAND();
+			if( REG( cond ) == 0 )
+			{
+				GOTO( target );
+			}
+
+			DISPATCH();
+		}
+		TARGET(JNZ):
+		{
+			auto cond = READ_OPERAND();
+			auto target = READ_OPERAND();
+			if( REG( cond ) != 0 )
+			{
+				GOTO( target );
+			}
+
+			DISPATCH();
+		}
+		TARGET(CALL):
+		{
+			int64_t pc = ip - 1 - code;
+			auto dst = READ_OPERAND();
+			auto func = READ_OPERAND();
+			auto base = READ_OPERAND();
+
+			// Every function starts with an enter, the call checks the frame it asks for and skips it
+			const char* callee = code + func;
+			const auto size = ReadUnaligned<RegOperand_t>( callee + 1 );
+			if( !HasStack( bc, pc, csp + 1, frame + base, size ) )
+			{
+				return;
+			}
+			*csp++ = { ip, frame, dst };
+
+			// Callee's frame starts at the arguments
+			frame += base;
+			ip = callee + 1 + sizeof( RegOperand_t );
+
+			DISPATCH();
+		}
+		TARGET(TAILCALL):
+		{
+			// Like a call, except the callee takes over this frame and its entry of the call stack
+			int64_t pc = ip - 1 - code;
+			auto func = READ_OPERAND();
+
+			const char* callee = code + func;
+			const auto size = ReadUnaligned<RegOperand_t>( callee + 1 );
+			if( !HasStack( bc, pc, csp, frame, size ) )
+			{
+				return;
+			}
+			ip = callee + 1 + sizeof( RegOperand_t );
+
+			DISPATCH();
+		}
+		TARGET(RET):
+		{
+			auto retval = REG( READ_OPERAND() );
+
+			const CallFrame& caller = *--csp;
+			frame = caller.frame;
+			ip = caller.return_address;
+			REG( caller.dst ) = retval;
+
+			DISPATCH();
+		}
+		TARGET(RETV):
+		{
+			const CallFrame& caller = *--csp;
+			frame = caller.frame;
+			ip = caller.return_address;
+
+			DISPATCH();
+		}
+
+		TARGET(ENTER):
+		{
+			int64_t pc = ip - 1 - code;
+			auto size = READ_OPERAND();
+			if( !HasStack( bc, pc, csp, frame, size ) )
+			{
+				return;
+			}
+
+			DISPATCH();
+		}
+
+		TARGET(PRINTB):
+		{
+			auto val = REG( READ_OPERAND() );
+			*m_pOut << (val ? "true" : "false") << std::endl;
+
+			DISPATCH();
+		}
+		TARGET(PRINTI):
+		{
+			auto val = REG( READ_OPERAND() );
+			*m_pOut << val << std::endl;
+
+			DISPATCH();
+		}
+		TARGET(PRINTF):
+		{
+			auto val = REGF( READ_OPERAND() );
+			*m_pOut << std::to_string( val ) << std::endl;
+
+			DISPATCH();
+		}
+		TARGET(PRINTS):
+		{
+			auto val = REG( READ_OPERAND() );
+			*m_pOut << m_Strings.Get( val )->chars << std::endl;
+
+			DISPATCH();
+		}
+
+		TARGET(NATIVE):
+		{
+			auto dst = READ_OPERAND();
+			auto native_idx = READ_OPERAND();
+			auto base = READ_OPERAND();
+			auto num_args = READ_OPERAND();
+			REG( dst ) = NativeTable::Call( m_ResolvedNatives[native_idx], bc.natives[native_idx], &REG( base ), num_args, m_Strings );
+
+			DISPATCH();
+		}
+
+		TARGET(HALT):
+		{
+			return;
+		}
+
+#if !BAT_COMPUTED_GOTO
+		default:
+		{
+			assert( false && "Unhandled opcode" );
+			return;
+		}
+		}
+		}
+#endif
+	}
+}
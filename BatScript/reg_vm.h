@@ -0,0 +1,64 @@
+#pragma once
+
+#include <iostream>
+#include "bat_callable.h"
+#include "compiler.h"
+#include "reg_instructions.h"
+#include "stringpool.h"
+
+namespace Bat
+{
+	// Runs code compiled for the register instruction set (see reg_compiler.h)
+	// Every frame is a window of registers on m_Stack, starting at the caller's arguments. Functions start with an enter
+	// instruction that holds the size of the window, calls check that it fits and that there's room on m_CallStack to
+	// return before they enter the function past it. The mainline executes its enter. Tail calls enter the function
+	// in the current frame and only check its window.
+	class RegisterVM
+	{
+	public:
+		void AddNative( const std::string& name, BatNativeCallback callback );
+		// Binds a C++ function as a native, see NativeBinding::Typed
+		template <typename R, typename... Args>
+		void Bind( const std::string& name, R (*function)( Args... ) )
+		{
+			m_Natives.Bind( name, function );
+		}
+		NativeTable& Natives() { return m_Natives; }
+
+		// Only reads bc, any number of VMs can run the same code at the same time
+		void Run( const BatCode& bc );
+		// Where print statements write to, std::cout by default
+		void SetOutput( std::ostream& out ) { m_pOut = &out; }
+	private:
+		struct CallFrame
+		{
+			const char* return_address;
+			int64_t* frame;
+			RegOperand_t dst;
+		};
+		// Returns false, after reporting an error at the instruction at pc, if the call stack would go past its end at
+		// csp or there isn't room for size registers from frame on
+		bool HasStack( const BatCode& bc, int64_t pc, const CallFrame* csp, const int64_t* frame, int64_t size ) const
+		{
+			if( csp <= m_CallStack + CALL_STACK_SIZE && size <= m_Stack + STACK_SLOTS - frame )
+			{
+				return true;
+			}
+			ReportStackOverflow( bc, pc );
+			return false;
+		}
+		void ReportStackOverflow( const BatCode& bc, int64_t pc ) const;
+	private:
+		// Each call takes an entry of the call stack and the registers of its caller below the arguments, two or three
+		// for a small recursive function, so recursion goes about 64K calls deep, deeper than on the stack VM (see STACK_SIZE)
+		static constexpr size_t STACK_SLOTS = 256 * 1024;
+		static constexpr size_t CALL_STACK_SIZE = 64 * 1024;
+		int64_t m_Stack[STACK_SLOTS];
+		CallFrame m_CallStack[CALL_STACK_SIZE];
+		NativeTable m_Natives;
+		// Bindings of the running code's natives, indexed like BatCode::natives
+		std::vector<const NativeBinding*> m_ResolvedNatives;
+		StringTable m_Strings;
+		std::ostream* m_pOut = &std::cout;
+	};
+}
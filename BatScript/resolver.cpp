@@ -0,0 +1,199 @@
+#include "resolver.h"
+
+namespace Bat
+{
+	void Resolver::Resolve( Statement* s )
+	{
+		s->Accept( this );
+	}
+
+	void Resolver::Resolve( Expression* e )
+	{
+		e->Accept( this );
+	}
+
+	int Resolver::GlobalSlot( const std::string& name )
+	{
+		auto it = m_mapGlobals.find( name );
+		if( it != m_mapGlobals.end() )
+		{
+			return it->second;
+		}
+
+		int slot = (int)m_mapGlobals.size();
+		m_mapGlobals[name] = slot;
+		return slot;
+	}
+
+	void Resolver::PushScope()
+	{
+		m_Scopes.emplace_back();
+	}
+
+	size_t Resolver::PopScope()
+	{
+		size_t num_slots = m_Scopes.back().size();
+		m_Scopes.pop_back();
+		return num_slots;
+	}
+
+	VarSlot Resolver::Declare( const std::string& name )
+	{
+		if( m_Scopes.empty() )
+		{
+			return { VarSlot::GLOBAL, GlobalSlot( name ) };
+		}
+
+		auto& scope = m_Scopes.back();
+		int index = (int)scope.size();
+		scope[name] = index;
+		return { 0, index };
+	}
+
+	VarSlot Resolver::Lookup( const std::string& name )
+	{
+		for( size_t i = m_Scopes.size(); i-- > 0; )
+		{
+			auto it = m_Scopes[i].find( name );
+			if( it != m_Scopes[i].end() )
+			{
+				return { (int)(m_Scopes.size() - 1 - i), it->second };
+			}
+		}
+
+		return { VarSlot::GLOBAL, GlobalSlot( name ) };
+	}
+
+	void Resolver::VisitIntLiteral( IntLiteral* node )
+	{
+	}
+	void Resolver::VisitFloatLiteral( FloatLiteral* node )
+	{
+	}
+	void Resolver::VisitStringLiteral( StringLiteral* node )
+	{
+	}
+	void Resolver::VisitTokenLiteral( TokenLiteral* node )
+	{
+	}
+	void Resolver::VisitArrayLiteral( ArrayLiteral* node )
+	{
+		for( size_t i = 0; i < node->NumValues(); i++ )
+		{
+			Resolve( node->ValueAt( i ) );
+		}
+	}
+	void Resolver::VisitBinaryExpr( BinaryExpr* node )
+	{
+		Resolve( node->Left() );
+		Resolve( node->Right() );
+	}
+	void Resolver::VisitUnaryExpr( UnaryExpr* node )
+	{
+		Resolve( node->Right() );
+	}
+	void Resolver::VisitCallExpr( CallExpr* node )
+	{
+		Resolve( node->Function() );
+		for( size_t i = 0; i < node->NumArgs(); i++ )
+		{
+			Resolve( node->Arg( i ) );
+		}
+	}
+	void Resolver::VisitIndexExpr( IndexExpr* node )
+	{
+		Resolve( node->Array() );
+		Resolve( node->Index() );
+	}
+	void Resolver::VisitCastExpr( CastExpr* node )
+	{
+		Resolve( node->Expr() );
+	}
+	void Resolver::VisitGroupExpr( GroupExpr* node )
+	{
+		Resolve( node->Expr() );
+	}
+	void Resolver::VisitVarExpr( VarExpr* node )
+	{
+		node->SetSlot( Lookup( node->Identifier().lexeme ) );
+	}
+	void Resolver::VisitExpressionStmt( ExpressionStmt* node )
+	{
+		Resolve( node->Expr() );
+	}
+	void Resolver::VisitAssignStmt( AssignStmt* node )
+	{
+		Resolve( node->Left() );
+		Resolve( node->Right() );
+	}
+	void Resolver::VisitBlockStmt( BlockStmt* node )
+	{
+		PushScope();
+		for( size_t i = 0; i < node->NumStatements(); i++ )
+		{
+			Resolve( node->Stmt( i ) );
+		}
+		node->SetNumSlots( PopScope() );
+	}
+	void Resolver::VisitPrintStmt( PrintStmt* node )
+	{
+		Resolve( node->Expr() );
+	}
+	void Resolver::VisitIfStmt( IfStmt* node )
+	{
+		Resolve( node->Condition() );
+		Resolve( node->Then() );
+		if( node->Else() ) Resolve( node->Else() );
+	}
+	void Resolver::VisitWhileStmt( WhileStmt* node )
+	{
+		Resolve( node->Condition() );
+		Resolve( node->Body() );
+	}
+	void Resolver::VisitForStmt( ForStmt* node )
+	{
+		// The interpreter doesn't create an environment for the loop itself, only its body can declare variables
+		if( node->Initializer() ) Resolve( node->Initializer() );
+		if( node->Condition() )   Resolve( node->Condition() );
+		if( node->Increment() )   Resolve( node->Increment() );
+		Resolve( node->Body() );
+	}
+	void Resolver::VisitReturnStmt( ReturnStmt* node )
+	{
+		if( node->RetExpr() ) Resolve( node->RetExpr() );
+	}
+	void Resolver::VisitImportStmt( ImportStmt* node )
+	{
+		for( const auto& stmt : node->Statements() )
+		{
+			Resolve( stmt.get() );
+		}
+	}
+	void Resolver::VisitNativeStmt( NativeStmt* node )
+	{
+	}
+	void Resolver::VisitVarDecl( VarDecl* node )
+	{
+		// Initializer first, `x := x` refers to the x of an enclosing scope
+		if( node->Initializer() ) Resolve( node->Initializer() );
+		node->SetSlot( Declare( node->Identifier().lexeme ) );
+	}
+	void Resolver::VisitFuncDecl( FuncDecl* node )
+	{
+		auto& sig = node->Signature();
+		node->SetSlot( Declare( sig.Identifier().lexeme ) );
+
+		// Defaults are evaluated for the caller, so like in the compiled code they only see the globals
+		for( size_t i = 0; i < sig.NumParams(); i++ )
+		{
+			if( sig.ParamDefault( i ) ) Resolve( sig.ParamDefault( i ) );
+		}
+		PushScope();
+		for( size_t i = 0; i < sig.NumParams(); i++ )
+		{
+			Declare( sig.ParamIdent( i ).lexeme );
+		}
+		Resolve( node->Body() );
+		node->SetNumParamSlots( PopScope() );
+	}
+}
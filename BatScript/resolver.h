@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+namespace Bat
+{
+	// Works out where each variable lives at runtime, so the interpreter can index environments instead of looking names up
+	// Scopes mirror the environments the interpreter creates: the globals, one for the parameters of a call and one per block.
+	// Globals get their slot the first time they're seen, so functions can refer to globals declared after them.
+	class Resolver : public AstVisitor
+	{
+	public:
+		void Resolve( Statement* s );
+		int GlobalSlot( const std::string& name );
+		size_t NumGlobals() const { return m_mapGlobals.size(); }
+	private:
+		void Resolve( Expression* e );
+
+		void PushScope();
+		// Returns the number of slots the scope needed
+		size_t PopScope();
+		VarSlot Declare( const std::string& name );
+		VarSlot Lookup( const std::string& name );
+	private:
+		virtual void VisitIntLiteral( IntLiteral* node ) override;
+		virtual void VisitFloatLiteral( FloatLiteral* node ) override;
+		virtual void VisitStringLiteral( StringLiteral* node ) override;
+		virtual void VisitTokenLiteral( TokenLiteral* node ) override;
+		virtual void VisitArrayLiteral( ArrayLiteral* node ) override;
+		virtual void VisitBinaryExpr( BinaryExpr* node ) override;
+		virtual void VisitUnaryExpr( UnaryExpr* node ) override;
+		virtual void VisitCallExpr( CallExpr* node ) override;
+		virtual void VisitIndexExpr( IndexExpr* node ) override;
+		virtual void VisitCastExpr( CastExpr* node ) override;
+		virtual void VisitGroupExpr( GroupExpr* node ) override;
+		virtual void VisitVarExpr( VarExpr* node ) override;
+		virtual void VisitExpressionStmt( ExpressionStmt* node ) override;
+		virtual void VisitAssignStmt( AssignStmt* node ) override;
+		virtual void VisitBlockStmt( BlockStmt* node ) override;
+		virtual void VisitPrintStmt( PrintStmt* node ) override;
+		virtual void VisitIfStmt( IfStmt* node ) override;
+		virtual void VisitWhileStmt( WhileStmt* node ) override;
+		virtual void VisitForStmt( ForStmt* node ) override;
+		virtual void VisitReturnStmt( ReturnStmt* node ) override;
+		virtual void VisitImportStmt( ImportStmt* node ) override;
+		virtual void VisitNativeStmt( NativeStmt* node ) override;
+		virtual void VisitVarDecl( VarDecl* node ) override;
+		virtual void VisitFuncDecl( FuncDecl* node ) override;
+	private:
+		std::unordered_map<std::string, int> m_mapGlobals;
+		std::vector<std::unordered_map<std::string, int>> m_Scopes;
+	};
+}
@@ -0,0 +1,173 @@
+#include "scheduler.h"
+
+#include <cassert>
+#include <algorithm>
+#include <thread>
+
+namespace Bat
+{
+	Scheduler::Scheduler()
+	{
+		Reset();
+	}
+
+	void Scheduler::Reset()
+	{
+		for( size_t i = 0; i < m_Slots.size(); i++ )
+		{
+			m_Slots[i].state = State::FREE;
+			m_Slots[i].generation++;
+		}
+		if( m_Slots.empty() )
+		{
+			m_Slots.emplace_back();
+		}
+
+		m_FreeSlots.clear();
+		for( size_t i = m_Slots.size() - 1; i > 0; i-- )
+		{
+			m_FreeSlots.push_back( i );
+		}
+		m_iRunnableHead = 0;
+		m_iNumRunnable = 0;
+		m_Timers = {};
+
+		// The mainline always takes the first slot
+		m_Slots[0].state = State::RUNNING;
+		m_iCurrent = Id( 0 );
+		m_iNumTasks = 1;
+	}
+
+	Scheduler::Task& Scheduler::Spawn()
+	{
+		size_t index;
+		if( !m_FreeSlots.empty() )
+		{
+			index = m_FreeSlots.back();
+			m_FreeSlots.pop_back();
+		}
+		else
+		{
+			index = m_Slots.size();
+			m_Slots.emplace_back();
+		}
+
+		Slot& slot = m_Slots[index];
+		slot.state = State::RUNNABLE;
+		PushRunnable( Id( index ) );
+		m_iNumTasks++;
+		return slot.task;
+	}
+
+	void Scheduler::Wait()
+	{
+		Slot& slot = m_Slots[Index( m_iCurrent )];
+		assert( slot.state == State::RUNNING );
+		slot.state = State::WAITING;
+	}
+
+	void Scheduler::End()
+	{
+		const size_t index = Index( m_iCurrent );
+		Slot& slot = m_Slots[index];
+		assert( slot.state == State::RUNNING );
+		slot.state = State::FREE;
+		slot.generation++;
+		m_FreeSlots.push_back( index );
+		m_iNumTasks--;
+	}
+
+	bool Scheduler::Complete( TaskId task, int64_t result )
+	{
+		Slot* slot = Find( task );
+		if( !slot || slot->state != State::WAITING )
+		{
+			return false;
+		}
+
+		slot->task.has_result = true;
+		slot->task.result = result;
+
+		slot->state = State::RUNNABLE;
+		PushRunnable( task );
+		return true;
+	}
+
+	void Scheduler::CompleteAfter( TaskId task, Clock::duration delay, int64_t result )
+	{
+		m_Timers.push( { Clock::now() + delay, m_iTimerSequence++, task, result } );
+	}
+
+	bool Scheduler::Next()
+	{
+		while( m_iNumRunnable == 0 )
+		{
+			if( m_iNumTasks == 0 )
+			{
+				return false;
+			}
+
+			FireTimers( Clock::now() );
+			if( m_iNumRunnable > 0 )
+			{
+				break;
+			}
+
+			const Clock::time_point deadline = m_Timers.empty() ? Clock::time_point::max() : m_Timers.top().deadline;
+			if( m_IdleHook && m_IdleHook( deadline ) )
+			{
+				continue;
+			}
+			if( m_Timers.empty() )
+			{
+				// Every task waits on an awaitable that has nothing outstanding
+				return false;
+			}
+			std::this_thread::sleep_until( deadline );
+		}
+
+		m_iCurrent = m_Runnable[m_iRunnableHead];
+		m_iRunnableHead = (m_iRunnableHead + 1) & (m_Runnable.size() - 1);
+		m_iNumRunnable--;
+		m_Slots[Index( m_iCurrent )].state = State::RUNNING;
+		return true;
+	}
+
+	Scheduler::Slot* Scheduler::Find( TaskId task )
+	{
+		const size_t index = Index( task );
+		if( index >= m_Slots.size() || Id( index ) != task || m_Slots[index].state == State::FREE )
+		{
+			return nullptr;
+		}
+		return &m_Slots[index];
+	}
+
+	void Scheduler::PushRunnable( TaskId task )
+	{
+		if( m_iNumRunnable == m_Runnable.size() )
+		{
+			// Unwrap into a buffer twice the size, the size stays a power of 2
+			std::vector<TaskId> grown( std::max<size_t>( 2 * m_Runnable.size(), 16 ) );
+			for( size_t i = 0; i < m_iNumRunnable; i++ )
+			{
+				grown[i] = m_Runnable[(m_iRunnableHead + i) & (m_Runnable.size() - 1)];
+			}
+			m_Runnable = std::move( grown );
+			m_iRunnableHead = 0;
+		}
+
+		m_Runnable[(m_iRunnableHead + m_iNumRunnable) & (m_Runnable.size() - 1)] = task;
+		m_iNumRunnable++;
+	}
+
+	void Scheduler::FireTimers( Clock::time_point now )
+	{
+		while( !m_Timers.empty() && m_Timers.top().deadline <= now )
+		{
+			const Timer timer = m_Timers.top();
+			m_Timers.pop();
+			Complete( timer.task, timer.result );
+		}
+	}
+}
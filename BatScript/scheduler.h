@@ -0,0 +1,144 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Bat
+{
+	class Scheduler;
+
+	// Handle of a task, never refers to a different task after the one it was given for ended
+	using TaskId = uint64_t;
+
+	// Natives declared `async native` start an operation on behalf of the task that awaits them and finish it with
+	// Scheduler::Complete, right away or later from a timer or the idle hook. The arguments are only valid during the call.
+	using AwaitableCallback = std::function<void( Scheduler& scheduler, TaskId task, const int64_t* args, size_t num_args )>;
+	// Awaitables by name, like a host binds them to every VM that runs its scripts
+	using AwaitableTable = std::unordered_map<std::string, AwaitableCallback>;
+
+	// Coroutines of the stack VM, all run on the thread that runs the VM.
+	// Calling an async function without await spawns a task that runs it, awaiting an async native suspends the running
+	// task until the native completes. The mainline is a task as well, the code halts when every task has ended.
+	// Tasks run until they await or end, then the next runnable task runs, in the order they became runnable.
+	//
+	// Only the running task lives on the VM stack. When it's suspended, everything above the globals is moved into the
+	// task's own stack buffer, which grows to what the task uses, and copied back to the same addresses when it resumes,
+	// so that the frame addresses on the stack stay valid.
+	// Switching tasks costs two copies of the live part of the stack, tens of bytes for typical tasks, and code that
+	// doesn't use tasks pays nothing.
+	class Scheduler
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		// Saved state of a task that isn't running
+		struct Task
+		{
+			int64_t ip = 0;
+			int64_t bp = 0;
+			std::vector<char> stack;
+			// Set when an awaitable completed the task, the value is pushed when the task resumes
+			bool has_result = false;
+			int64_t result = 0;
+		};
+
+		// Called when no task can run before deadline, which is Clock::time_point::max() if no timer is pending
+		// Should wait until at most the deadline for outstanding operations of awaitables and complete them,
+		// returns false if none are outstanding.
+		using IdleHook = std::function<bool( Clock::time_point deadline )>;
+
+		Scheduler();
+
+		// Forgets all tasks, the mainline is the only one and it's running
+		void Reset();
+
+		TaskId Current() const { return m_iCurrent; }
+		Task& CurrentTask() { return m_Slots[Index( m_iCurrent )].task; }
+		// Tasks that haven't ended yet, including the running one
+		size_t NumTasks() const { return m_iNumTasks; }
+
+		// New runnable task, its state has to be set up by the caller
+		Task& Spawn();
+		// The running task waits until an awaitable completes it, its state has to be saved by the caller first
+		void Wait();
+		// The running task is over
+		void End();
+		// Makes a waiting task runnable again, the VM pushes result on its stack when it resumes
+		// Returns false if the task isn't waiting, e.g. because it was completed already
+		bool Complete( TaskId task, int64_t result );
+		// Completes a waiting task once delay has passed
+		void CompleteAfter( TaskId task, Clock::duration delay, int64_t result );
+
+		// Picks the next runnable task as the running one, waiting for timers and the idle hook if none is
+		// Returns false if there are no tasks left or all remaining ones wait for something that never completes
+		bool Next();
+
+		void SetIdleHook( IdleHook hook ) { m_IdleHook = std::move( hook ); }
+
+		// Calls visit with every task that is saved, runnable or waiting, not the running one
+		template <typename F>
+		void ForEachSaved( F&& visit ) const
+		{
+			for( const Slot& slot : m_Slots )
+			{
+				if( slot.state == State::RUNNABLE || slot.state == State::WAITING )
+				{
+					visit( slot.task );
+				}
+			}
+		}
+	private:
+		enum class State
+		{
+			FREE,
+			RUNNING,
+			RUNNABLE,
+			WAITING
+		};
+		struct Slot
+		{
+			Task task;
+			State state = State::FREE;
+			// Bumped every time the slot is reused, part of the task id
+			uint32_t generation = 0;
+		};
+		struct Timer
+		{
+			Clock::time_point deadline;
+			// Timers with the same deadline fire in the order they were started
+			uint64_t sequence;
+			TaskId task;
+			int64_t result;
+
+			bool operator>( const Timer& other ) const
+			{
+				return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+			}
+		};
+
+		static size_t Index( TaskId task ) { return (size_t)(task & 0xffffffff); }
+		TaskId Id( size_t index ) const { return ((TaskId)m_Slots[index].generation << 32) | index; }
+		// Slot of the task if it's still alive, nullptr otherwise
+		Slot* Find( TaskId task );
+		void PushRunnable( TaskId task );
+		void FireTimers( Clock::time_point now );
+	private:
+		// Slots are reused, and keep the buffers of the tasks that ran in them
+		std::vector<Slot> m_Slots;
+		std::vector<size_t> m_FreeSlots;
+		// Queue of runnable tasks, a ring buffer that doubles when it's full
+		std::vector<TaskId> m_Runnable;
+		size_t m_iRunnableHead = 0;
+		size_t m_iNumRunnable = 0;
+		std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_Timers;
+		uint64_t m_iTimerSequence = 0;
+		TaskId m_iCurrent = 0;
+		size_t m_iNumTasks = 0;
+		IdleHook m_IdleHook;
+	};
+}
@@ -1,9 +1,11 @@
 #include "semantic_analysis.h"
 
+#include <algorithm>
 #include <fstream>
 #include "type_manager.h"
 #include "errorsys.h"
 #include "lexer.h"
+#include "module_loader.h"
 #include "parser.h"
 #include "memory_stream.h"
 
@@ -105,6 +107,11 @@ namespace Bat
 			{
 				return nullptr;
 			}
+			// Elements are never cast
+			if( !IsSameType( from_arr->Inner(), to_arr->Inner() ) )
+			{
+				return nullptr;
+			}
 
 			return from;
 		}
@@ -122,6 +129,22 @@ namespace Bat
 
 		return nullptr;
 	}
+	bool SemanticAnalysis::CoerceArrayLiteral( Expression* e, Type* to )
+	{
+		ArrayLiteral* literal = e->ToArrayLiteral();
+		ArrayType* to_arr = to->ToArray();
+		if( !literal || !to_arr || !to_arr->HasFixedSize() || to_arr->FixedSize() != literal->NumValues() )
+		{
+			return false;
+		}
+		if( !IsSameType( GetExprType( literal )->AsArray()->Inner(), to_arr->Inner() ) )
+		{
+			return false;
+		}
+
+		literal->SetType( to );
+		return true;
+	}
 	void SemanticAnalysis::VisitIntLiteral( IntLiteral* node )
 	{
 		node->SetType( typeman.NewPrimitive( PrimitiveKind::Int ) );
@@ -148,6 +171,14 @@ namespace Bat
 	}
 	void SemanticAnalysis::VisitArrayLiteral( ArrayLiteral* node )
 	{
+		if( node->NumValues() == 0 )
+		{
+			// Uninitialized array variables are empty instead
+			Error( node->Location(), "Empty array literals are not supported" );
+			node->SetType( typeman.NewArray( typeman.NewPrimitive( PrimitiveKind::Int ), ArrayType::UNSIZED ) );
+			return;
+		}
+
 		Type* inner = nullptr;
 		for( size_t i = 0; i < node->NumValues(); i++ )
 		{
@@ -489,9 +520,34 @@ namespace Bat
 		auto& sig = func_symbol->Signature();
 		Type* ret_type = sig.ReturnType();
 
-		if( !sig.VarArgs() && (node->NumArgs() != sig.NumParams()) ) // TODO: handle defaults
+		if( node->IsAwait() && !sig.Async() )
 		{
-			Error( node->Location(), "Expected " + std::to_string( sig.NumParams() ) + " argument(s), got " + std::to_string( node->NumArgs() ) );
+			Error( node->Location(), "Only async functions and natives can be awaited" );
+		}
+		else if( node->IsAwait() && m_pCurrentFunc && !m_pCurrentFunc->Signature().Async() )
+		{
+			Error( node->Location(), "'await' is only allowed in async functions and at the top level" );
+		}
+		else if( !node->IsAwait() && sig.Async() )
+		{
+			if( func_symbol->FuncKind() == FunctionKind::Native )
+			{
+				Error( node->Location(), "Async native '" + callee->Identifier().lexeme + "' has to be awaited" );
+			}
+			// Calling an async function without awaiting it spawns a task, which has no result
+			ret_type = typeman.NewPrimitive( PrimitiveKind::Void );
+		}
+
+		// Calls of script functions can leave out parameters with defaults, the caller fills those in
+		const size_t num_required = (func_symbol->FuncKind() == FunctionKind::Script) ? sig.NumRequiredParams() : sig.NumParams();
+		if( !sig.VarArgs() && (node->NumArgs() < num_required || node->NumArgs() > sig.NumParams()) )
+		{
+			std::string expected = std::to_string( sig.NumParams() );
+			if( num_required != sig.NumParams() )
+			{
+				expected = std::to_string( num_required ) + " to " + expected;
+			}
+			Error( node->Location(), "Expected " + expected + " argument(s), got " + std::to_string( node->NumArgs() ) );
 		}
 		else if( sig.VarArgs() && (node->NumArgs() < sig.NumParams()) ) // It's fine to have more params if its a varargs func
 		{
@@ -499,10 +555,14 @@ namespace Bat
 		}
 		else
 		{
-			for( size_t i = 0; i < sig.NumParams(); i++ )
+			for( size_t i = 0; i < std::min( node->NumArgs(), sig.NumParams() ); i++ )
 			{
 				Type* expected_type = TypeSpecifierToType( sig.ParamType( i ) );
 				Type* arg_type = GetExprType( node->Arg( i ) );
+				if( CoerceArrayLiteral( node->Arg( i ), expected_type ) )
+				{
+					arg_type = expected_type;
+				}
 
 				Type* coerced = Coerce( arg_type, expected_type );
 				if( !coerced )
@@ -546,6 +606,35 @@ namespace Bat
 			node->SetIndex( std::move( cast ) );
 		}
 
+		// Constant indices into fixed size arrays are checked here, so that they don't have to be at runtime
+		ArrayType* arr = arr_type->AsArray();
+		Expression* index = node->Index();
+		UnaryExpr* negated = index->ToUnaryExpr();
+		if( negated && negated->Op() == TOKEN_MINUS )
+		{
+			index = negated->Right();
+		}
+		if( arr->HasFixedSize() && index->IsIntLiteral() )
+		{
+			const int64_t length = (int64_t)arr->FixedSize();
+			int64_t constant = negated ? -index->AsIntLiteral()->value : index->AsIntLiteral()->value;
+			// Negative indices count from the end
+			if( constant < 0 )
+			{
+				constant += length;
+			}
+			if( constant < 0 || constant >= length )
+			{
+				Error( node->Index()->Location(), "Array index " + std::to_string( constant < 0 ? constant - length : constant ) + " is out of bounds for type " + arr->ToString() );
+			}
+			else if( negated )
+			{
+				auto wrapped = std::make_unique<IntLiteral>( node->Index()->Location(), constant );
+				wrapped->SetType( int_type );
+				node->SetIndex( std::move( wrapped ) );
+			}
+		}
+
 		node->SetType( inner );
 	}
 	void SemanticAnalysis::VisitCastExpr( CastExpr* node )
@@ -611,6 +700,14 @@ namespace Bat
 				}
 			}
 		}
+		else if( left->IsArray() )
+		{
+			// Arrays can only be assigned as a whole
+			if( node->Op() != TOKEN_EQUAL || (!CoerceArrayLiteral( node->Right(), left ) && !Coerce( right, left )) )
+			{
+				Error( node->Right()->Location(), "Cannot assign expression of type " + right->ToString() + " to variable of type " + left->ToString() );
+			}
+		}
 	}
 	void SemanticAnalysis::VisitBlockStmt( BlockStmt* node )
 	{
@@ -656,6 +753,10 @@ namespace Bat
 		Type* rettype = node->RetExpr() ? GetExprType( node->RetExpr() ) : typeman.NewPrimitive( PrimitiveKind::Void );
 		if( m_pCurrentFunc->Signature().ReturnType() != nullptr )
 		{
+			if( node->RetExpr() && CoerceArrayLiteral( node->RetExpr(), m_pCurrentFunc->Signature().ReturnType() ) )
+			{
+				rettype = m_pCurrentFunc->Signature().ReturnType();
+			}
 			Type* coerced = Coerce( rettype, m_pCurrentFunc->Signature().ReturnType() );
 
 			if( !coerced )
@@ -675,32 +776,11 @@ namespace Bat
 	}
 	void SemanticAnalysis::VisitImportStmt( ImportStmt* node )
 	{
-		std::string filename = node->ModuleName() + ".bat";
-		if( !std::ifstream( filename ) )
-		{
-			filename = node->ModuleName() + ".bs";
-			if( !std::ifstream( filename ) )
-			{
-				ErrorSys::Report( node->Location().Line(), node->Location().Column(), "Module '" + node->ModuleName() + "' not found" );
-			}
-		}
-
-		auto source = MemoryStream::FromFile( filename, FileMode::TEXT );
-
-		Lexer l( source.Base() );
-		auto tokens = l.Scan();
-
-		if( ErrorSys::HadError() ) return;
-
-		Parser p( std::move( tokens ) );
-		std::vector<std::unique_ptr<Statement>> res = p.Parse();
-
-		if( ErrorSys::HadError() ) return;
+		if( !ModuleLoader::Load( node, node->Statements() ) ) return;
 
-		for( size_t i = 0; i < res.size(); i++ )
+		for( const auto& stmt : node->Statements() )
 		{
-			Analyze( res[i].get() );
-			m_pStatements.push_back( std::move( res[i] ) );
+			Analyze( stmt.get() );
 		}
 	}
 	void SemanticAnalysis::VisitNativeStmt( NativeStmt* node )
@@ -724,6 +804,10 @@ namespace Bat
 			if( node->Initializer() )
 			{
 				Type* init_type = GetExprType( node->Initializer() );
+				if( CoerceArrayLiteral( node->Initializer(), var_type ) )
+				{
+					init_type = var_type;
+				}
 				Type* coerced = Coerce( init_type, var_type );
 				if( !coerced )
 				{
@@ -770,6 +854,16 @@ namespace Bat
 		auto& sig = node->Signature();
 		AddFunction( node, sig.Identifier().lexeme );
 
+		// Defaults are evaluated by the caller (see Compiler::VisitCallExpr), so they only see the globals
+		std::vector<Type*> default_types( sig.NumParams(), nullptr );
+		for( size_t i = 0; i < sig.NumParams(); i++ )
+		{
+			if( sig.ParamDefault( i ) )
+			{
+				default_types[i] = GetExprType( sig.ParamDefault( i ) );
+			}
+		}
+
 		PushScope();
 		m_pCurrentFunc = node;
 		for( size_t i = 0; i < sig.NumParams(); i++ )
@@ -781,7 +875,7 @@ namespace Bat
 			else if( sig.ParamDefault( i ) && sig.ParamType( i ).HasTypeName() )
 			{
 				Type* param_type = TypeSpecifierToType( sig.ParamType( i ) );
-				Type* default_expr_type = GetExprType( sig.ParamDefault( i ) );
+				Type* default_expr_type = default_types[i];
 				Type* coerced = Coerce( default_expr_type, param_type );
 				if( !coerced )
 				{
@@ -799,8 +893,7 @@ namespace Bat
 			}
 			else if( sig.ParamDefault( i ) )
 			{
-				Type* default_expr_type = GetExprType( sig.ParamDefault( i ) );
-				AddVariable( node, sig.ParamIdent( i ), default_expr_type );
+				AddVariable( node, sig.ParamIdent( i ), default_types[i] );
 			}
 			else
 			{
@@ -30,6 +30,9 @@ namespace Bat
 		// Returns `to` if an implicit cast is needed
 		// Returned nullptr if no coercion is possible
 		Type* Coerce( Type* from, Type* to );
+		// Array literals take the type of a fixed size array with the same element type if they have a value for every
+		// element, returns true if the literal e now has type to
+		bool CoerceArrayLiteral( Expression* e, Type* to );
 	private:
 		virtual void VisitIntLiteral( IntLiteral* node ) override;
 		virtual void VisitFloatLiteral( FloatLiteral* node ) override;
@@ -62,6 +65,5 @@ namespace Bat
 		Type* m_pResult = nullptr;
 		FuncDecl* m_pCurrentFunc = nullptr;
 		SymbolTable* m_pSymTab = nullptr;
-		std::vector<std::unique_ptr<Statement>> m_pStatements;
 	};
 }
\ No newline at end of file
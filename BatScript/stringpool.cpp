@@ -4,32 +4,79 @@ namespace Bat
 {
 	StringPool stringpool;
 
-	StringPool::~StringPool()
+	BatString* StringPool::Intern( std::string_view str )
 	{
-		delete m_pPool;
+		{
+			std::shared_lock<std::shared_mutex> lock( m_Mutex );
+			auto it = m_Strings.find( str );
+			if( it != m_Strings.end() )
+			{
+				return it->second;
+			}
+		}
+
+		std::unique_lock<std::shared_mutex> lock( m_Mutex );
+		// Another thread may have pooled it since the lookup above
+		auto it = m_Strings.find( str );
+		if( it != m_Strings.end() )
+		{
+			return it->second;
+		}
+
+		BatString* pooled = BatString::Create( str.data(), str.size() );
+		pooled->interned = true;
+		m_Strings.emplace( std::string_view( pooled->chars, pooled->length ), pooled );
+		return pooled;
 	}
 
-	const char* Bat::StringPool::AddString( const std::string& str )
+	void StringTable::Reset( const std::vector<std::string>& literals )
 	{
-		auto it = m_StringsSet.find( str );
-		if( it != m_StringsSet.end() )
+		Clear();
+		for( const auto& literal : literals )
 		{
-			return it->second;
+			BatString* str = stringpool.Intern( literal );
+			m_Indices.emplace( std::string_view( str->chars, str->length ), (int64_t)m_Strings.size() );
+			m_Strings.push_back( str );
 		}
+	}
 
-		if( m_pPool == nullptr )
+	int64_t StringTable::Add( BatString* str )
+	{
+		auto it = m_Indices.find( std::string_view( str->chars, str->length ) );
+		if( it != m_Indices.end() )
 		{
-			m_pPool = new StringEntry( str );
-			m_pTail = m_pPool;
+			return it->second;
 		}
-		else
+
+		str->Retain();
+		auto index = (int64_t)m_Strings.size();
+		m_Indices.emplace( std::string_view( str->chars, str->length ), index );
+		m_Strings.push_back( str );
+		return index;
+	}
+
+	int64_t StringTable::Add( std::string_view str )
+	{
+		auto it = m_Indices.find( str );
+		if( it != m_Indices.end() )
 		{
-			m_pTail->next = new StringEntry( str );
-			m_pTail = m_pTail->next;
+			return it->second;
 		}
 
-		const char* pooled_str = m_pTail->str.c_str();
-		m_StringsSet[str] = pooled_str;
-		return pooled_str;
+		BatString* copy = BatString::Create( str.data(), str.size() );
+		auto index = (int64_t)m_Strings.size();
+		m_Indices.emplace( std::string_view( copy->chars, copy->length ), index );
+		m_Strings.push_back( copy );
+		return index;
+	}
+
+	void StringTable::Clear()
+	{
+		for( BatString* str : m_Strings )
+		{
+			str->Release();
+		}
+		m_Strings.clear();
+		m_Indices.clear();
 	}
-}
\ No newline at end of file
+}
@@ -1,37 +1,57 @@
 #pragma once
 
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+#include "bat_string.h"
 
 namespace Bat
 {
-	// Implemented as a linked list to ensure no reallocations so pointer references are always valid
+	// Interns strings, every distinct value gets one BatString
+	// Pooled strings live until the process exits, so values anywhere can keep pointing at them.
+	// Safe to use from multiple threads. Only compile-time constants belong in here: the lexer interns string literals
+	// and each VM run looks the program's literals up once when it starts (see StringTable::Reset). Lookups of strings
+	// that are already pooled share the lock, so runs starting on several threads don't wait on each other.
 	class StringPool
 	{
 	public:
-		~StringPool();
-
-		const char* AddString( const std::string& str );
+		BatString* Intern( std::string_view str );
 	private:
-		class StringEntry
-		{
-		public:
-			StringEntry( const std::string& str )
-				:
-				str( str )
-			{}
-			~StringEntry()
-			{
-				delete next;
-			}
-
-			std::string str;
-			StringEntry* next = nullptr;
-		};
-		StringEntry* m_pPool = nullptr;
-		StringEntry* m_pTail = nullptr;
-		std::unordered_map<std::string, const char*> m_StringsSet;
+		std::shared_mutex m_Mutex;
+		// Keys view the chars of the pooled string
+		std::unordered_map<std::string_view, BatString*> m_Strings;
 	};
 
 	extern StringPool stringpool;
-}
\ No newline at end of file
+
+	// Strings a VM can refer to by index, the stack only holds integers
+	// The program's string literals come first, interned, strings returned by natives get appended. Those stay out of
+	// the pool: the table holds a reference to each one until the next Reset or until the table is destroyed.
+	// A string that comes back again with the same value reuses its index.
+	// Used by one VM on one thread, nothing in here is synchronized.
+	class StringTable
+	{
+	public:
+		StringTable() = default;
+		StringTable( const StringTable& ) = delete;
+		StringTable& operator=( const StringTable& ) = delete;
+		~StringTable() { Clear(); }
+
+		void Reset( const std::vector<std::string>& literals );
+		BatString* Get( int64_t index ) const { return m_Strings[(size_t)index]; }
+		// Takes a new reference to str if it wasn't in the table yet
+		int64_t Add( BatString* str );
+		// Copies str into a new string unless the table already has one with its value
+		int64_t Add( std::string_view str );
+	private:
+		void Clear();
+
+		std::vector<BatString*> m_Strings;
+		// Keys view the chars of the strings in m_Strings
+		std::unordered_map<std::string_view, int64_t> m_Indices;
+	};
+}
@@ -0,0 +1,4 @@
+// methods: interpreter vm
+// Indices out of bounds are runtime errors in release builds too, including in arrays that were never assigned
+h : int[]
+print h[0]
@@ -0,0 +1,10 @@
+// methods: vm jit
+// Awaiting an async native that the host didn't bind halts at the await
+async native missing(ms : int) -> int
+
+async def wait():
+	print await missing(10)
+
+print 1
+await wait()
+print 2
@@ -0,0 +1,5 @@
+// methods: vm regvm jit aot
+// The host binds sqrt to a function that returns a double, so declaring it with another return type is an error
+native sqrt(x : float) -> int
+
+print sqrt(4.0)
@@ -0,0 +1,5 @@
+// methods: regvm
+// The register VM reports array code instead of compiling it
+xs := [1, 2, 3]
+xs[0] = 5
+print xs[1]
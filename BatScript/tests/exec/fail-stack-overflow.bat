@@ -0,0 +1,5 @@
+// Unbounded recursion reports an error instead of running off the stack
+def forever(n : int) -> int:
+	return forever(n + 1) + 1
+
+print forever(0)
@@ -0,0 +1,63 @@
+// methods: vm jit interpreter
+native isum(xs : int[]) -> int
+native imin(xs : int[]) -> int
+native imax(xs : int[]) -> int
+native idot(xs : int[], ys : int[]) -> int
+native iadd(dst : int[], xs : int[], ys : int[])
+native imul(dst : int[], xs : int[], ys : int[])
+native iscale(dst : int[], xs : int[], k : int)
+native ifill(dst : int[], x : int)
+native icount_less(xs : int[], x : int) -> int
+native icount_equal(xs : int[], x : int) -> int
+native icount_greater(xs : int[], x : int) -> int
+native iprefix_sum(dst : int[], xs : int[])
+native fsum(xs : float[]) -> float
+native fmax(xs : float[]) -> float
+native fdot(xs : float[], ys : float[]) -> float
+native fscale(dst : float[], xs : float[], k : float)
+native fcount_greater(xs : float[], x : float) -> int
+native fprefix_sum(dst : float[], xs : float[])
+
+a := [3, -1, 4, 1, -5, 9, 2, 6, 5]
+b := [1, 2, 3, 4, 5, 6, 7, 8, 9]
+print isum(a)
+print imin(a)
+print imax(a)
+print idot(a, b)
+print icount_less(a, 2)
+print icount_equal(a, 1)
+print icount_greater(a, 2)
+
+c := [0, 0, 0, 0, 0, 0, 0, 0, 0]
+iadd(c, a, b)
+print c[0] + c[8]
+imul(c, a, b)
+print c[5]
+iscale(c, c, 2)
+print c[5]
+iprefix_sum(c, b)
+print c[8]
+ifill(c, 7)
+print isum(c)
+
+// Only as many elements as the shortest array has
+short := [10, 20]
+iadd(short, a, b)
+print short[1]
+
+// Fixed size arrays are passed by copy, so they can't be written to
+fixed : int[4] = [1, 2, 3, 4]
+print isum(fixed)
+ifill(fixed, 0)
+print fixed[0]
+
+f := [0.5, 1.5, -2.0, 4.0, 0.25]
+print fsum(f)
+print fmax(f)
+print fdot(f, f)
+print fcount_greater(f, 0.75)
+g := [0.0, 0.0, 0.0, 0.0, 0.0]
+fscale(g, f, 2.0)
+print g[2]
+fprefix_sum(g, f)
+print g[4]
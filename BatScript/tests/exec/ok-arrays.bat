@@ -0,0 +1,69 @@
+// methods: vm jit interpreter
+a : int[4]
+a[1] = 5
+a[-1] = 7
+print a[0]
+print a[1]
+print a[3]
+
+b := [1, 2, 3]
+print b[2]
+print b[-3]
+b[0] += 10
+print b[0]
+
+c : int[3] = [4, 5, 6]
+d : int[3] = c
+d[0] = 40
+print c[0]
+print d[0]
+
+e : int[]
+e = b
+e[1] = 20
+print b[1]
+
+def sum(xs : int[], n : int) -> int:
+	total := 0
+	i := 0
+	while i < n:
+		total += xs[i]
+		i += 1
+	return total
+
+print sum(c, 3)
+print sum(b, 3)
+
+def squares() -> int:
+	l : int[5]
+	j := 0
+	while j < 5:
+		l[j] = j * j
+		j += 1
+	l[2] += 100
+	m : int[5] = l
+	m[0] = 9
+	return l[0] + l[2] + l[-1] + m[0]
+
+print squares()
+
+def make() -> int[]:
+	t : int[2] = [8, 9]
+	return t
+
+r := make()
+print r[1]
+
+f : float[2] = [1.5, 2.5]
+f[1] *= 2.0
+print f[1]
+
+total := 0
+k := 0
+while k < 2:
+	n := 0
+	while n < 3:
+		total += c[n]
+		n += 1
+	k += 1
+print total
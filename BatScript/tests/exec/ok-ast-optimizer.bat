@@ -0,0 +1,68 @@
+// methods: vm jit interpreter aot
+// Constants fold the way the operations run
+print 2 * 3 + 4
+print 9223372036854775807 + 1
+print (1 << 62) * 4
+print -(-9223372036854775807 - 1)
+print 7 / 2 + 7 % 2
+print 1.5 * 2 + 0.25
+print 2 * 1.5
+print 3 > 2
+print !(1 < 2)
+
+// Identities keep the other operand, multiplying by a power of two shifts it
+x := 5
+print x * 1 + 0
+print 1 * (x - 0)
+print x * 8
+print 16 * x
+print -x * 4
+print x * 0
+neg := -0.0
+print neg * 1.0
+print neg - 0.0
+print neg + 0.0
+
+// Constant conditions only keep the branch that runs
+if false:
+	print 100
+else:
+	print 200
+if 1 < 2:
+	print 300
+while false:
+	print 400
+
+// Statements after a return never run
+def first(n : int) -> int:
+	if n > 0:
+		return 1
+	else:
+		return -1
+	print 500
+	return 0
+
+print first(3)
+print first(-3)
+
+// Unused values of calls are still computed
+calls := 0
+def count() -> int:
+	calls += 1
+	return calls
+count() + 1
+x + 1
+print calls
+
+// Folded indices are checked like literal ones
+a : int[3] = [10, 20, 30]
+print a[1 + 1]
+print a[0 - 1]
+a[2 - 1] = 25
+print a[1]
+
+// Returned values are converted to the return type
+def half(n : int) -> float:
+	return n / 2
+
+print half(7)
@@ -0,0 +1,31 @@
+// methods: vm jit
+async native sleep(ms : int) -> int
+async native yield() -> int
+
+done := 0
+
+// Spawned tasks run in the order they were spawned until they await
+async def worker(id : int, delay : int):
+	print id
+	slept := await sleep(delay)
+	print id * 100 + slept
+	done += 1
+
+async def ping(n : int):
+	i := 0
+	while i < n:
+		print 1000 + i
+		await yield()
+		i += 1
+
+// Awaiting an async function runs it in the awaiting task
+async def twice(x : int) -> int:
+	await yield()
+	return x * 2
+
+worker(1, 60)
+worker(2, 20)
+worker(3, 40)
+ping(3)
+print await twice(21)
+print done
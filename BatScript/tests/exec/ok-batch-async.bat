@@ -0,0 +1,15 @@
+// methods: vm
+// options: --batch ok-batch-async.inputs --instances 2
+// Every instance of the batch binds the same awaitables as the global VM
+async native sleep(ms : int) -> int
+async native yield() -> int
+native input() -> string
+
+async def worker(id : int, delay : int):
+	slept := await sleep(delay)
+	print id * 100 + slept
+
+worker(1, 20)
+worker(2, 10)
+await yield()
+print input()
@@ -0,0 +1,15 @@
+// Recursion far deeper than the old 4 KB stack allowed, none of these are tail calls
+def sum(n : int) -> int:
+	if n == 0:
+		return 0
+	return n + sum(n - 1)
+
+def depth(n : int, a : int, b : int) -> int:
+	local := a * b
+	if n == 0:
+		return local
+	return depth(n - 1, b, a) + 1
+
+print sum(300)
+print sum(5000)
+print depth(3000, 2, 3)
@@ -0,0 +1,31 @@
+g := 10
+
+def next() -> int:
+	g += 1
+	return g
+
+def add(a : int, b : int = 2, c : float = 0.5) -> float:
+	return a + b + c
+
+def scaled(x : int, by : int = g) -> int:
+	return x * by
+
+def counted(x : int = next()) -> int:
+	return x
+
+def outer(g : int) -> int:
+	// The default sees the global g, not this parameter
+	return scaled(g)
+
+print add(1)
+print add(1, 3)
+print add(1, 3, 1.25)
+print scaled(3)
+g = 4
+print scaled(3)
+print scaled(3, 5)
+print outer(2)
+print counted()
+print counted()
+print counted(1)
+print g
@@ -0,0 +1,45 @@
+// methods: vm jit aot
+// options: -O1 | -O2
+// The stack code evaluates the right operand of binary operators first, optimized code has to keep that order
+g := 1
+
+def a() -> int:
+	print 1
+	return 10
+
+def b() -> int:
+	print 2
+	return 3
+
+def bump() -> int:
+	g += 10
+	return 1
+
+def pair(x : int, y : int) -> int:
+	return x * 100 + y
+
+def in_function(n : int) -> int:
+	return a() - b() + n
+
+def with_globals() -> int:
+	return g * 1000 - bump()
+
+def in_loop(n : int) -> int:
+	total := 0
+	while n > 0:
+		total += a() * b()
+		n -= 1
+	return total
+
+def compound() -> int:
+	g -= bump()
+	return g
+
+print a() - b()
+print a() < b()
+print in_function(5)
+print with_globals()
+print in_loop(2)
+print pair(a(), b())
+print compound()
+print g - bump()
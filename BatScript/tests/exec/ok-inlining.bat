@@ -0,0 +1,75 @@
+// Small functions behave the same when their calls are inlined
+g := 0
+x := 100
+
+def bump():
+	g += 1
+
+def next_g() -> int:
+	g += 1
+	return g
+
+def add(x : int, y : int = 10) -> int:
+	return x + y
+
+def add_twice(a : int) -> int:
+	return add(add(a))
+
+def global_x() -> int:
+	return x
+
+def scaled(n : int) -> float:
+	return n / 2
+
+def sum_to(n : int) -> int:
+	total := 0
+	i := 1
+	while i <= n:
+		total += i
+		i += 1
+	return total
+
+def sign(n : int) -> int:
+	if n < 0:
+		return -1
+	return 1
+
+def countdown(n : int) -> int:
+	if n == 0:
+		return 0
+	return countdown(n - 1)
+
+// Void calls as statements, and calls whose values are used
+bump()
+bump()
+print next_g()
+print g
+
+// Defaults and nested calls
+print add(1, 2)
+print add(5)
+print add_twice(1)
+
+// The arguments are evaluated once, before the body
+print add(next_g(), next_g())
+
+// Bodies see the globals, not the caller's locals or its parameters of the same name
+def caller(x : int) -> int:
+	y := 7
+	return global_x() + add(x, y)
+
+print caller(3)
+
+// Returned values are converted to the return type
+print scaled(7)
+
+// Locals of the body, also inlined into loops
+i := 0
+while i < 3:
+	print sum_to(i + 3)
+	i += 1
+
+// Functions that return early or call themselves aren't inlined
+print sign(-5)
+print sign(5)
+print countdown(10)
@@ -0,0 +1,13 @@
+native format(fmt : string, v : int) -> string
+
+greeting := "hello"
+copy := greeting
+
+def pass_through(s : string) -> string:
+	return s
+
+print pass_through(copy)
+print format("v=%d", 5)
+s := format("%d apples", 3)
+print s
+print format("v=%d", 5)
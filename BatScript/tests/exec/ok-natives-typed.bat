@@ -0,0 +1,11 @@
+native sqrt(x : float) -> float
+native strlen(s : string) -> int
+
+def hypot(a : float, b : float) -> float:
+	return sqrt(a * a + b * b)
+
+name := "batscript"
+print strlen(name)
+print strlen("")
+print hypot(3.0, 4.0)
+print sqrt(2.25) + strlen("abc")
@@ -0,0 +1,28 @@
+x := 1
+
+def get_x():
+	return x
+
+def shadow(x : int):
+	if x > 0:
+		x := 30
+		print x
+	return x
+
+def loop(a : int, b : int):
+	c := a + b
+	while c < 10:
+		d := c
+		c = d + 4
+	return c
+
+def caller():
+	x := 100
+	return get_x()
+
+print shadow(3)
+print caller()
+print loop(1, 2)
+print loop(1, 20)
+x = 5
+print get_x()
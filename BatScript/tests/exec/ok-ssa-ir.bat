@@ -0,0 +1,129 @@
+// options: -O2
+// Code compiled through the optimized IR computes the same as without it
+g := 1
+h := 0
+
+def scaled_sum(n : int, w : int, k : int) -> int:
+	total := 0
+	i := 0
+	while i < n:
+		total += (i * 24 + w * k) % 1000 + (i * 24 + w * k) / 7 + i * 3
+		i += 1
+	return total
+
+// Counters that count down, and a multiplier that doesn't fit a shift
+def countdown_products(n : int) -> int:
+	total := 0
+	i := n
+	while i > 0:
+		total += i * 7 + (i << 3)
+		i -= 2
+	return total
+
+// Nested loops, the inner counter restarts for every row
+def grid(rows : int, cols : int) -> int:
+	total := 0
+	r := 0
+	while r < rows:
+		c := 0
+		while c < cols:
+			total += r * cols + c * 5
+			c += 1
+		r += 1
+	return total
+
+// Variables that swap every iteration
+def fib_loop(n : int) -> int:
+	a := 0
+	b := 1
+	i := 0
+	while i < n:
+		t := a + b
+		a = b
+		b = t
+		i += 1
+	return a
+
+def rotate(n : int) -> int:
+	x := 1
+	y := 2
+	z := 3
+	while n > 0:
+		t := x
+		x = y
+		y = z
+		z = t
+		n -= 1
+	return x * 100 + y * 10 + z
+
+// Values that only some paths assign
+def classify(n : int) -> int:
+	result : int
+	if n < 0:
+		result = -1
+	else:
+		if n == 0:
+			result = 0
+		else:
+			result = n * n
+	return result + 1
+
+def mixed(x : float, n : int) -> float:
+	y := x * 2.0 + x * 2.0
+	if n > 2:
+		y = y / 4.0
+	return y - 0.5
+
+// Globals that the loop assigns, and calls that read and write them
+def bump_g() -> int:
+	g += 1
+	return g
+
+def read_g() -> int:
+	return g * 10
+
+def no_globals(n : int) -> int:
+	return n + 1
+
+def uses_globals(n : int) -> int:
+	i := 0
+	while i < n:
+		h += bump_g()
+		h += read_g()
+		h += no_globals(i)
+		i += 1
+	return h
+
+def tail(n : int, acc : int) -> int:
+	if n == 0:
+		return acc
+	return tail(n - 1, acc + n * 4)
+
+print scaled_sum(1000, 640, 480)
+print countdown_products(101)
+print grid(7, 9)
+print fib_loop(50)
+print rotate(4)
+print rotate(5)
+print classify(-5)
+print classify(0)
+print classify(6)
+print mixed(1.5, 1)
+print mixed(1.5, 3)
+print uses_globals(5)
+print g
+print h
+print tail(1000, 0)
+
+// The mainline keeps globals in values between calls too
+i := 0
+total := 0
+while i < 10:
+	total += i * 16 + g
+	if i == 5:
+		g = bump_g() * 2
+	i += 1
+print total
+print g
+print i == 10
+print "done"
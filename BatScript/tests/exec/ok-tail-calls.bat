@@ -0,0 +1,47 @@
+// Far deeper than the stack, so these only work as tail calls
+def sum(n : int, acc : int) -> int:
+	if n == 0:
+		return acc
+	return sum(n - 1, acc + n)
+
+// Other functions with as many arguments are entered in the same frame too
+def count_up(n : int, acc : int) -> int:
+	return sum(n, acc + 1)
+
+// The arguments are all evaluated before any of them is replaced
+def gcd(a : int, b : int) -> int:
+	if b == 0:
+		return a
+	return gcd(b, a % b)
+
+def swap_down(a : int, b : int, n : int) -> int:
+	if n == 0:
+		return a * 10 + b
+	return swap_down(b, a, n - 1)
+
+// Recursion keeps the frame and its locals
+def countdown(n : int) -> int:
+	left := n - 1
+	if left < 0:
+		return 0
+	return countdown(left)
+
+// Calls of functions with other arguments are regular calls
+def plus(a : int, b : int) -> int:
+	return a + b
+
+def twice(n : int) -> int:
+	return plus(n, n)
+
+def with_default(n : int, step : int = 2) -> int:
+	if n <= 0:
+		return n
+	return with_default(n - step)
+
+print sum(100000, 0)
+print count_up(100000, 0)
+print gcd(1071, 462)
+print swap_down(1, 2, 3)
+print countdown(100000)
+print twice(21)
+print with_default(100001)
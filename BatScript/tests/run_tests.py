@@ -1,7 +1,9 @@
 import os
+import re
 import sys
 import subprocess
 import argparse
+import tempfile
 
 def get_tests_impl(tests, test_paths, root, relroot):
     for filename in os.listdir(root):
@@ -24,10 +26,39 @@ def get_tests():
     get_tests_impl(tests, test_paths, os.path.dirname(os.path.abspath(__file__)), '')
     return tests, test_paths
 
-def run_tests(tests, test_paths, method=None, compiler_path=None):
+def get_methods(path):
+    # Tests of features that only some methods support list them with a comment like "// methods: vm jit",
+    # the others skip the test. Translating to C counts as method "aot".
+    with open(path, 'r') as f:
+        for line in f:
+            m = re.match(r'\s*//\s*methods:(.*)', line)
+            if m:
+                return m.group(1).split()
+    return None
+
+def get_options(path):
+    # Tests of features behind a compiler option list them with a comment like "// options: -O2", they're passed
+    # to every compile of the test. Tests that have to behave the same under different options separate them with
+    # '|', like "// options: -O1 | -O2", and run once for each.
+    with open(path, 'r') as f:
+        for line in f:
+            m = re.match(r'\s*//\s*options:(.*)', line)
+            if m:
+                return [variant.split() for variant in m.group(1).split('|')]
+    return [[]]
+
+def variant_name(variant):
+    return ' (%s)' % ' '.join(variant) if variant else ''
+
+def run_tests(tests, test_paths, method=None, compiler_path=None, image=False, aot=None, options=[]):
     all_passed = True
     for test, test_path in zip(tests, test_paths):
         test_name = os.path.basename(test)
+
+        methods = get_methods(test_path + '.bat')
+        if methods != None and ('aot' if aot else method) not in methods:
+            print('Test %s ... SKIP' % test)
+            continue
         
         if 'ok-' in test_name:
             kind = 'ok'
@@ -37,56 +68,74 @@ def run_tests(tests, test_paths, method=None, compiler_path=None):
             print("Invalid test %s. Test name must begin with 'ok-' or 'fail-'" % test)
             continue
         
-        try:
-            argv = [compiler_path, test_path + '.bat']
-            if method != None:
-                argv += ['--method', method]
-            p = subprocess.Popen(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
-            stdout, stderr = p.communicate()
-            out = stdout if kind == 'ok' else stderr
+        for variant in get_options(test_path + '.bat'):
+            try:
+                test_options = options + variant
+                argv = [compiler_path, test_path + '.bat'] + test_options
+                if method != None:
+                    argv += ['--method', method]
+                if image and kind == 'ok':
+                    # Compile to an image first, then run the image with the same options instead of the source
+                    image_path = os.path.join(tempfile.gettempdir(), test_name + '.batc')
+                    subprocess.run(argv + ['-c', image_path], cwd=os.path.dirname(test_path), stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+                    argv = [compiler_path, image_path] + argv[2:]
+                if aot and kind == 'ok':
+                    # Translate to C and build a shared library with the given C compiler, then run the library
+                    base_path = os.path.join(tempfile.gettempdir(), test_name)
+                    subprocess.run([compiler_path, test_path + '.bat', '--emit-c', base_path + '.c'] + test_options, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+                    subprocess.run([aot, '-O2', '-shared', '-fPIC', base_path + '.c', '-o', base_path + '.so'], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+                    argv = [compiler_path, base_path + '.so']
+                # Run in the test's directory, so files named in its options are found next to it
+                p = subprocess.Popen(argv, cwd=os.path.dirname(test_path), stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+                stdout, stderr = p.communicate()
+                out = stdout if kind == 'ok' else stderr
 
-            if not os.path.exists(test_path + '.out'):
-                print('No expected result file for %s, creating one ...' % test)
-                with open(test_path + '.out', 'w') as f:
-                    f.write(out)
-            else:
-                with open(test_path + '.out', 'r') as f:
-                    expected = f.read()
+                if not os.path.exists(test_path + '.out'):
+                    print('No expected result file for %s, creating one ...' % test)
+                    with open(test_path + '.out', 'w') as f:
+                        f.write(out)
+                else:
+                    with open(test_path + '.out', 'r') as f:
+                        expected = f.read()
                 
-                failed = False
-                if kind == 'ok' and expected != stdout:
-                    failed = True
-                elif kind == 'fail':
-                    expected_lines = expected.split('\n')
-                    actual_lines = [line.split('Error: ')[-1] for line in stderr.split('\n')]
-                    for i in range(len(expected_lines)):
-                        if i >= len(actual_lines):
-                            failed = True
-                            break
-                        if not actual_lines[i] in expected_lines[i]:
-                            failed = True
-                            break
+                    failed = False
+                    if kind == 'ok' and expected != stdout:
+                        failed = True
+                    elif kind == 'fail':
+                        expected_lines = expected.split('\n')
+                        actual_lines = [line.split('Error: ')[-1] for line in stderr.split('\n')]
+                        for i in range(len(expected_lines)):
+                            if i >= len(actual_lines):
+                                failed = True
+                                break
+                            if not actual_lines[i] in expected_lines[i]:
+                                failed = True
+                                break
                 
-                if failed:
-                    all_passed = False
-                    print('Test %s ... FAIL' % test)
-                    print('Dumping output...')
-                    print(out)
-                else:
-                    print('Test %s ... PASS' % test)
-        except Exception as e:
-            raise
-            sys.stderr.write('Failed! %s' % e.message)
+                    if failed:
+                        all_passed = False
+                        print('Test %s ... FAIL' % (test + variant_name(variant)))
+                        print('Dumping output...')
+                        print(out)
+                    else:
+                        print('Test %s ... PASS' % (test + variant_name(variant)))
+            except Exception as e:
+                raise
+                sys.stderr.write('Failed! %s' % e.message)
     return all_passed
 
 def main():
     parser = argparse.ArgumentParser()
     parser.add_argument('--method', type=str, default='vm')
     parser.add_argument('--compiler', type=str, default='BatScript.exe')
+    parser.add_argument('--image', action='store_true', help='compile each test to a .batc image and run that')
+    parser.add_argument('--aot', type=str, metavar='CC', help='translate each test to C, build it with this C compiler and run the library')
+    parser.add_argument('--optimize', type=str, metavar='LEVEL', help='compile every test with -O<LEVEL>')
     args = parser.parse_args()
 
+    options = ['-O' + args.optimize] if args.optimize else []
     tests, test_paths = get_tests()
-    all_passed = run_tests(tests, test_paths, compiler_path=args.compiler, method=args.method)
+    all_passed = run_tests(tests, test_paths, compiler_path=args.compiler, method=args.method, image=args.image, aot=args.aot, options=options)
     if all_passed:
         sys.exit(0)
     else:
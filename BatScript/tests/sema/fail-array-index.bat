@@ -0,0 +1,8 @@
+a : int[4]
+a[4] = 1
+print a[-5]
+print a[-4]
+b : int[3] = [1, 2]
+c : float[2] = [1, 2]
+a += 1
+x := []
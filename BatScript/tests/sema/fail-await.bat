@@ -0,0 +1,11 @@
+async native sleep(ms : int) -> int
+
+def f():
+	await sleep(1)
+
+async def g() -> int:
+	return 1
+
+sleep(3)
+x := g()
+print await f()
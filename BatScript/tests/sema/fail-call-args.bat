@@ -0,0 +1,13 @@
+def f(a : int, b : int = 1) -> int:
+	return a + b
+
+def g(a : int) -> int:
+	return a
+
+def h(a : int, b : int = a) -> int:
+	return b
+
+f()
+f(1, 2, 3)
+g()
+g(1, 2)
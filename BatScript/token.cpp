@@ -62,7 +62,7 @@ namespace Bat
 		literal.i64 = i64;
 	}
 
-	Token::Token( const char* str, const std::string& lexeme, int line, int column )
+	Token::Token( BatString* str, const std::string& lexeme, int line, int column )
 		:
 		type( TOKEN_STRING_LITERAL ),
 		lexeme( lexeme ),
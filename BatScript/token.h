@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include "bat_string.h"
 #include "sourceloc.h"
 
 #define KEYWORD_TYPES(_) \
@@ -118,7 +119,7 @@ namespace Bat
 		Token( TokenType type, const std::string& lexeme, int line, int column );
 		Token( double f64, const std::string& lexeme, int line, int column );
 		Token( int64_t i64, const std::string& lexeme, int line, int column );
-		Token( const char* str, const std::string& lexeme, int line, int column );
+		Token( BatString* str, const std::string& lexeme, int line, int column );
 
 		TokenType type;
 		std::string lexeme;
@@ -127,7 +128,7 @@ namespace Bat
 		{
 			int64_t i64;
 			double f64;
-			const char* str;
+			BatString* str; // Interned
 		} literal;
 	};
 }
\ No newline at end of file
@@ -1,356 +1,1021 @@
 #include "vm.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include "errorsys.h"
 #include "instructions.h"
 
+// Register helpers for the dispatch loop, these work on the locals cached by VirtualMachine::Run
+#define READ_OP() (*reinterpret_cast<const unsigned char*>(ip++))
+#define READ_I8() (*reinterpret_cast<const int8_t*>(ip++))
+#define READ_I16() (ip += sizeof( int16_t ), ReadUnaligned<int16_t>( ip - sizeof( int16_t ) ))
+#define READ_I32() (ip += sizeof( int32_t ), ReadUnaligned<int32_t>( ip - sizeof( int32_t ) ))
+#define READ_I64() (ip += sizeof( int64_t ), ReadUnaligned<int64_t>( ip - sizeof( int64_t ) ))
+#define PUSH(val) (*reinterpret_cast<int64_t*>(&m_Stack[sp]) = (val), sp += sizeof( int64_t ))
+#define PUSHF(val) (*reinterpret_cast<double*>(&m_Stack[sp]) = (val), sp += sizeof( double ))
+#define POP() (sp -= sizeof( int64_t ), *reinterpret_cast<int64_t*>(&m_Stack[sp]))
+#define POPF() (sp -= sizeof( double ), *reinterpret_cast<double*>(&m_Stack[sp]))
+#define GOTO(addr) (ip = m_pCode + (addr))
+#define SAVE_REGISTERS() \
+	do \
+	{ \
+		m_iIP = (int)(ip - m_pCode); \
+		m_iStackPointer = sp; \
+		m_iBasePointer = bp; \
+	} while( false )
+#define LOAD_REGISTERS() \
+	do \
+	{ \
+		ip = m_pCode + m_iIP; \
+		sp = m_iStackPointer; \
+		bp = m_iBasePointer; \
+	} while( false )
+
 #define BINARY_OP(op) \
 	do \
 	{ \
-		auto a = Pop(); \
-		auto b = Pop(); \
-		Push( a op b ); \
+		auto a = POP(); \
+		auto b = POP(); \
+		PUSH( a op b ); \
 	} while( false )
 
 #define UNARY_OP(op) \
 	do \
 	{ \
-		auto a = Pop(); \
-		Push( op a ); \
+		auto a = POP(); \
+		PUSH( op a ); \
 	} while( false )
 
 #define BINARY_OP_F(op) \
 	do \
 	{ \
-		auto a = PopF(); \
-		auto b = PopF(); \
-		PushF( a op b ); \
+		auto a = POPF(); \
+		auto b = POPF(); \
+		PUSHF( a op b ); \
 	} while( false )
 
 #define UNARY_OP_F(op) \
 	do \
 	{ \
-		auto a = PopF(); \
-		PushF( op a ); \
+		auto a = POPF(); \
+		PUSHF( op a ); \
 	} while( false )
 
-#define TARGET(op) OpCode::op: \
-	TARGET_##op
+#define COMPARE_JUMP(op) \
+	do \
+	{ \
+		auto a = POP(); \
+		auto b = POP(); \
+		if( a op b ) \
+		{ \
+			GOTO( operand ); \
+		} \
+	} while( false )
 
-#define DISPATCH_CASE(name, operands, pushes, pops, mnemonic) case OpCode::name: goto TARGET_##name;
+// Threaded dispatch: every handler jumps straight to the next handler through a table of label addresses
+// instead of going back through a central switch. This needs labels-as-values so it's only available on GCC/Clang,
+// other compilers fall back to a single switch inside a loop.
+// Define BAT_NO_COMPUTED_GOTO to force the switch fallback.
+#if !defined( BAT_NO_COMPUTED_GOTO ) && (defined( __GNUC__ ) || defined( __clang__ ))
+#define BAT_COMPUTED_GOTO 1
+#else
+#define BAT_COMPUTED_GOTO 0
+#endif
+
+// Runs before dispatching every instruction, compiles to nothing in the plain instantiation of the loop
+// With threaded dispatch, profiling doesn't check for due samples here at all: the profiler redirects the dispatch
+// table to the SAMPLE handler when one is due (see Profiler::RedirectOnSample). Even a well predicted check at every
+// instruction costs 5-10% on dispatch heavy code.
+#if BAT_COMPUTED_GOTO
+#define INSTRUMENT(next_op) \
+	do \
+	{ \
+		if constexpr( INSTRUMENTATION == Instrumentation::OPSTATS ) \
+		{ \
+			m_pOpStats->Record( next_op ); \
+		} \
+	} while( false )
+#define DISPATCH_TABLE(op) \
+	(INSTRUMENTATION == Instrumentation::PROFILE ? s_ProfileDispatchTable[op].load( std::memory_order_relaxed ) : s_DispatchTable[op])
+#else
+#define INSTRUMENT(next_op) \
+	do \
+	{ \
+		if constexpr( INSTRUMENTATION == Instrumentation::OPSTATS ) \
+		{ \
+			m_pOpStats->Record( next_op ); \
+		} \
+		else if constexpr( INSTRUMENTATION == Instrumentation::PROFILE ) \
+		{ \
+			if( Profiler::SamplePending() ) Sample( bc, ip - 1 - m_pCode, bp ); \
+		} \
+	} while( false )
+#endif
+
+#if BAT_COMPUTED_GOTO
+#define TARGET(op) TARGET_##op
+#define WIDE_TARGET(op, width) TARGET_##op##_##width
+#define DISPATCH_LABEL(name, operands, pushes, pops, mnemonic) &&TARGET_##name,
+#define WIDE_DISPATCH_LABELS(name, operands, pushes, pops, mnemonic) WIDE_DISPATCH_LABELS_##operands( name )
+#define WIDE_DISPATCH_LABELS_0(name)
+#define WIDE_DISPATCH_LABELS_1(name) &&TARGET_##name##_2, &&TARGET_##name##_4, &&TARGET_##name##_8,
 #define DISPATCH() \
-	switch( ReadOp() ) \
+	do \
 	{ \
-		OPCODES(DISPATCH_CASE) \
-	}
+		auto next_op = READ_OP(); \
+		assert( next_op < NUM_ENCODED_OPCODES && "Unhandled opcode" ); \
+		INSTRUMENT( next_op ); \
+		goto *DISPATCH_TABLE( next_op ); \
+	} while( false )
+#else
+#define TARGET(op) case EncodeOp( OpCode::op )
+#define WIDE_TARGET(op, width) case EncodeOp( OpCode::op, width )
+#define DISPATCH() continue
+#endif
+
+// Keeps GCC from laying out the common 1 byte forms as stubs that jump into the body shared with the wide forms
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define COLD_LABEL __attribute__(( cold ));
+#else
+#define COLD_LABEL
+#endif
+
+// Opcodes with an operand have a handler for each operand width (see instructions.h)
+// The plain form reads a 1 byte operand, the wide forms read theirs and then jump to the shared body after it
+#define TARGET_WITH_OPERAND(op) TARGET(op): operand = READ_I8(); BODY_##op
+#define WIDE_TARGETS(name, operands, pushes, pops, mnemonic) WIDE_TARGETS_##operands( name )
+#define WIDE_TARGETS_0(name)
+#define WIDE_TARGETS_1(name) \
+	WIDE_TARGET(name, 2): COLD_LABEL operand = READ_I16(); goto BODY_##name; \
+	WIDE_TARGET(name, 4): COLD_LABEL operand = READ_I32(); goto BODY_##name; \
+	WIDE_TARGET(name, 8): COLD_LABEL operand = READ_I64(); goto BODY_##name;
 
 namespace Bat
 {
 	void VirtualMachine::AddNative( const std::string& name, BatNativeCallback callback )
 	{
-		assert( m_Natives.count( name ) == 0 );
-		m_Natives[name] = std::move( callback );
+		m_Natives.Add( name, std::move( callback ) );
 	}
-	void VirtualMachine::Run( BatCode& bc )
+	void VirtualMachine::BindAwaitable( const std::string& name, AwaitableCallback callback )
 	{
-		bc.code.Seek( SeekPosition::START );
-
-		m_pCode = bc.code.Base();
+		m_Awaitables[name] = std::move( callback );
+	}
+	void VirtualMachine::Run( const BatCode& bc )
+	{
+		m_pCode = bc.CodeBase();
 		m_iIP = (int)bc.entry_point;
-
-		while( true )
+		m_iStackPointer = 0;
+		m_iBasePointer = 0;
+		m_Strings.Reset( bc.string_literals );
+		m_Heap.assign( 1, 0 );
+		m_Arrays.clear();
+		m_FreeSlots.clear();
+		m_iSlotsInUse = 1;
+		m_iCollectAt = MIN_COLLECT_AT;
+		m_ResolvedNatives = m_Natives.Resolve( bc.natives );
+		m_ResolvedAwaitables.assign( bc.natives.size(), nullptr );
+		m_NativeTakesArrays.assign( bc.natives.size(), false );
+		for( size_t i = 0; i < bc.natives.size(); i++ )
 		{
-			auto op = ReadOp();
-			switch( op )
+			const auto& params = bc.natives[i].desc.param_types;
+			m_NativeTakesArrays[i] = std::find( params.begin(), params.end(), TYPE_ARRAY ) != params.end();
+
+			auto it = m_Awaitables.find( bc.natives[i].name );
+			if( it != m_Awaitables.end() )
 			{
-			case TARGET(NOP): break;
+				m_ResolvedAwaitables[i] = &it->second;
+			}
+		}
+
+		// The mainline's proc reserves the globals, tasks share those and own the stack above
+		m_Scheduler.Reset();
+		m_iTaskStackBase = 0;
+		const char* entry = m_pCode + bc.entry_point;
+		auto globals = DecodeOp( (unsigned char)entry[0] );
+		if( globals.op == OpCode::PROC )
+		{
+			m_iTaskStackBase = ReadOperand( entry + sizeof( OpCode ), globals.width );
+		}
+
+		if( m_pOpStats )
+		{
+			m_pOpStats->Reset();
+			Execute<Instrumentation::OPSTATS>( bc );
+		}
+		else if( m_pProfiler )
+		{
+			Execute<Instrumentation::PROFILE>( bc );
+		}
+		else
+		{
+			Execute<Instrumentation::NONE>( bc );
+		}
+	}
 
-			case TARGET(PUSH):
+	void VirtualMachine::EnableOpStats( bool enable )
+	{
+		if( !enable )
+		{
+			m_pOpStats.reset();
+		}
+		else if( !m_pOpStats )
+		{
+			m_pOpStats = std::make_unique<OpStats>();
+		}
+	}
+
+	void VirtualMachine::Sample( const BatCode& bc, int64_t pc, int64_t bp )
+	{
+		// Frames link to their caller's frame right below their base pointer, the mainline and the start of every task
+		// have a base pointer of 0. Return addresses point after the call that made the frame.
+		m_SamplePcs.clear();
+		m_SamplePcs.push_back( pc );
+		while( bp >= FRAME_LINK_SIZE )
+		{
+			const int64_t* link = reinterpret_cast<const int64_t*>(&m_Stack[bp - FRAME_LINK_SIZE]);
+			m_SamplePcs.push_back( link[0] - 1 );
+			bp = link[1];
+		}
+		std::reverse( m_SamplePcs.begin(), m_SamplePcs.end() );
+
+		m_pProfiler->AddSample( bc, m_SamplePcs.data(), m_SamplePcs.size() );
+	}
+
+	// Line of the instruction that the byte at pc belongs to, only for error reports
+	static int LineAt( const BatCode& bc, int64_t pc )
+	{
+		const char* code = bc.CodeBase();
+		const auto& lines = bc.debug_info.line_mapping;
+		int64_t at = 0;
+		for( size_t index = 0; at < (int64_t)bc.CodeSize(); index++ )
+		{
+			auto decoded = DecodeOp( (unsigned char)code[at] );
+			at += 1 + OPCODE_OPERANDS[(size_t)decoded.op] * decoded.width;
+			if( pc < at )
 			{
-				auto val = ReadI64();
-				Push( val );
+				return index < lines.size() ? lines[index] : 0;
+			}
+		}
+		return 0;
+	}
+
+	void VirtualMachine::SpawnTask( int64_t num_slots, int64_t start )
+	{
+		// The arguments move to the new task's stack, it starts by calling the function right after them
+		const int64_t size = num_slots * (int64_t)sizeof( int64_t );
+		m_iStackPointer -= size;
+
+		Scheduler::Task& task = m_Scheduler.Spawn();
+		task.ip = start;
+		task.bp = 0;
+		task.stack.assign( &m_Stack[m_iStackPointer], &m_Stack[m_iStackPointer + size] );
+		task.has_result = false;
+	}
+
+	bool VirtualMachine::AwaitNative( const BatCode& bc, int64_t pc, int64_t native_idx )
+	{
+		const BatNativeInfo& native = bc.natives[native_idx];
+		const size_t num_args = native.desc.param_types.size();
+		m_iStackPointer -= num_args * sizeof( int64_t );
 
-				DISPATCH();
+		const AwaitableCallback* callback = m_ResolvedAwaitables[native_idx];
+		if( !callback )
+		{
+			ErrorSys::Report( LineAt( bc, pc ), 0, "Async native '" + native.name + "' not bound" );
+			return false;
+		}
+
+		// The arguments stay where they are until the next task is loaded, after the callback returns
+		const TaskId task = m_Scheduler.Current();
+		SaveTask( m_Scheduler.CurrentTask() );
+		m_Scheduler.Wait();
+		(*callback)( m_Scheduler, task, reinterpret_cast<const int64_t*>(&m_Stack[m_iStackPointer]), num_args );
+
+		return SwitchTask();
+	}
+
+	bool VirtualMachine::SwitchTask()
+	{
+		if( !m_Scheduler.Next() )
+		{
+			if( m_Scheduler.NumTasks() > 0 )
+			{
+				ErrorSys::Report( 0, 0, std::to_string( m_Scheduler.NumTasks() ) + " task(s) wait for async natives that never complete" );
 			}
-			case TARGET(POP):
+			return false;
+		}
+
+		LoadTask( m_Scheduler.CurrentTask() );
+		return true;
+	}
+
+	// Tasks only keep a few slots on the stack, copying them one by one is cheaper than calling memcpy
+	static void CopySlots( char* to, const char* from, size_t size )
+	{
+		for( size_t i = 0; i < size; i += sizeof( int64_t ) )
+		{
+			*reinterpret_cast<int64_t*>(to + i) = *reinterpret_cast<const int64_t*>(from + i);
+		}
+	}
+
+	void VirtualMachine::SaveTask( Scheduler::Task& task ) const
+	{
+		task.ip = m_iIP;
+		task.bp = m_iBasePointer;
+		task.stack.resize( (size_t)(m_iStackPointer - m_iTaskStackBase) );
+		CopySlots( task.stack.data(), &m_Stack[m_iTaskStackBase], task.stack.size() );
+	}
+
+	void VirtualMachine::LoadTask( Scheduler::Task& task )
+	{
+		m_iIP = (int)task.ip;
+		m_iBasePointer = task.bp;
+		CopySlots( &m_Stack[m_iTaskStackBase], task.stack.data(), task.stack.size() );
+		m_iStackPointer = m_iTaskStackBase + (int64_t)task.stack.size();
+
+		// Result of the awaitable that suspended the task
+		if( task.has_result )
+		{
+			Push( task.result );
+			task.has_result = false;
+		}
+	}
+
+	int64_t VirtualMachine::NewArray( int64_t length, const char* elements, int64_t stack_top )
+	{
+		const int64_t size = 1 + length;
+		auto free = m_FreeSlots.lower_bound( size );
+		if( free == m_FreeSlots.end() && m_iSlotsInUse + (size_t)size > m_iCollectAt )
+		{
+			CollectArrays( stack_top );
+			free = m_FreeSlots.lower_bound( size );
+		}
+
+		int64_t handle;
+		if( free != m_FreeSlots.end() )
+		{
+			// Best fit, what's left of the run stays free
+			handle = free->second;
+			if( free->first > size )
 			{
-				Pop();
+				m_FreeSlots.emplace( free->first - size, handle + size );
+			}
+			m_FreeSlots.erase( free );
+		}
+		else
+		{
+			handle = (int64_t)m_Heap.size();
+			m_Heap.resize( m_Heap.size() + (size_t)size );
+		}
+		m_Arrays.push_back( handle );
+		m_iSlotsInUse += (size_t)size;
+
+		m_Heap[handle] = length;
+		if( elements )
+		{
+			memcpy( &m_Heap[handle + 1], elements, (size_t)length * sizeof( int64_t ) );
+		}
+		else
+		{
+			std::fill_n( &m_Heap[handle + 1], (size_t)length, 0 );
+		}
+		return handle | HANDLE_TAG;
+	}
 
-				DISPATCH();
+	void VirtualMachine::CollectArrays( int64_t stack_top )
+	{
+		std::sort( m_Arrays.begin(), m_Arrays.end() );
+		m_ArrayMarks.assign( m_Arrays.size(), false );
+		m_MarkStack.clear();
+
+		auto mark = [this]( int64_t value )
+		{
+			if( (value & ~HANDLE_MASK) != HANDLE_TAG )
+			{
+				return;
 			}
-			case TARGET(DUP):
+			value &= HANDLE_MASK;
+			if( value >= (int64_t)m_Heap.size() )
 			{
-				auto val = Pop();
-				Push( val );
-				Push( val );
-
-				DISPATCH();
+				return;
 			}
-			case TARGET(DUPX1):
+			auto it = std::upper_bound( m_Arrays.begin(), m_Arrays.end(), value );
+			if( it == m_Arrays.begin() )
 			{
-				auto val1 = Pop();
-				auto val2 = Pop();
-				Push( val1 );
-				Push( val2 );
-				Push( val1 );
-
-				DISPATCH();
+				return;
 			}
-			case TARGET(PROC):
+			--it;
+			const size_t index = (size_t)(it - m_Arrays.begin());
+			if( value <= *it + m_Heap[*it] && !m_ArrayMarks[index] )
 			{
-				PushCallStack( m_iBasePointer );
-				m_iBasePointer = m_iStackPointer;
-
-				DISPATCH();
+				m_ArrayMarks[index] = true;
+				m_MarkStack.push_back( *it );
 			}
-			case TARGET(STACK):
+		};
+		auto mark_slots = [&]( const char* slots, size_t size )
+		{
+			for( size_t i = 0; i + sizeof( int64_t ) <= size; i += sizeof( int64_t ) )
 			{
-				m_iStackPointer += ReadI64();
-
-				DISPATCH();
+				int64_t value;
+				memcpy( &value, slots + i, sizeof( int64_t ) );
+				mark( value );
 			}
+		};
 
-			case TARGET(LOAD_LOCAL):
+		mark_slots( m_Stack, (size_t)stack_top );
+		m_Scheduler.ForEachSaved( [&]( const Scheduler::Task& task ) {
+			mark_slots( task.stack.data(), task.stack.size() );
+			if( task.has_result )
 			{
-				auto addr = Pop();
-				auto value = *reinterpret_cast<int64_t*>(&m_Stack[m_iBasePointer + addr]);
-				Push( value );
-
-				DISPATCH();
+				mark( task.result );
 			}
-			case TARGET(LOAD_GLOBAL):
-			{
-				auto addr = Pop();
-				auto value = *reinterpret_cast<int64_t*>(&m_Stack[addr]);
-				Push( value );
+		} );
+		while( !m_MarkStack.empty() )
+		{
+			const int64_t handle = m_MarkStack.back();
+			m_MarkStack.pop_back();
+			mark_slots( reinterpret_cast<const char*>(&m_Heap[handle + 1]), (size_t)m_Heap[handle] * sizeof( int64_t ) );
+		}
 
-				DISPATCH();
-			}
-			case TARGET(STORE_LOCAL):
+		// The gaps between the arrays that are left are the free runs, the heap ends after the last one
+		m_FreeSlots.clear();
+		int64_t end = 1;
+		size_t num_live = 0;
+		m_iSlotsInUse = 1;
+		for( size_t i = 0; i < m_Arrays.size(); i++ )
+		{
+			if( !m_ArrayMarks[i] )
 			{
-				auto value = Pop();
-				auto addr = Pop();
-				*reinterpret_cast<int64_t*>(&m_Stack[m_iBasePointer + addr]) = value;
-
-				DISPATCH();
+				continue;
 			}
-			case TARGET(STORE_GLOBAL):
+			const int64_t handle = m_Arrays[i];
+			if( handle > end )
 			{
-				auto value = Pop();
-				auto addr = Pop();
-				*reinterpret_cast<int64_t*>(&m_Stack[addr]) = value;
-
-				DISPATCH();
+				m_FreeSlots.emplace( handle - end, end );
 			}
+			end = handle + 1 + m_Heap[handle];
+			m_Arrays[num_live++] = handle;
+			m_iSlotsInUse += 1 + (size_t)m_Heap[handle];
+		}
+		m_Arrays.resize( num_live );
+		m_Heap.resize( (size_t)end );
 
-			case TARGET(BITAND): BINARY_OP( & ); DISPATCH();
-			case TARGET(BITOR):  BINARY_OP( | ); DISPATCH();
-			case TARGET(BITXOR): BINARY_OP( ^ ); DISPATCH();
-			case TARGET(BITNOT): UNARY_OP( ~ ); DISPATCH();
-			case TARGET(SHL):    BINARY_OP( << ); DISPATCH();
-			case TARGET(SHR):    BINARY_OP( >> ); DISPATCH();
-
-			case TARGET(EQ):     BINARY_OP( == ); DISPATCH();
-			case TARGET(NEQ):    BINARY_OP( != ); DISPATCH();
-			case TARGET(LESS):   BINARY_OP( < ); DISPATCH();
-			case TARGET(LESSE):  BINARY_OP( <= ); DISPATCH();
-			case TARGET(GRT):    BINARY_OP( > ); DISPATCH();
-			case TARGET(GRTE):   BINARY_OP( >= ); DISPATCH();
-			case TARGET(NOT):    UNARY_OP( ! ); DISPATCH();
-
-			case TARGET(ADD):    BINARY_OP( + ); DISPATCH();
-			case TARGET(SUB):    BINARY_OP( - ); DISPATCH();
-			case TARGET(DIV):    BINARY_OP( / ); DISPATCH();
-			case TARGET(MUL):    BINARY_OP( * ); DISPATCH();
-			case TARGET(MOD):    BINARY_OP( % ); DISPATCH();
-			case TARGET(NEG):    UNARY_OP( - ); DISPATCH();
-
-			case TARGET(ITOF):
-			{
-				auto a = Pop();
-				PushF( (double)a );
+		m_iCollectAt = std::max( MIN_COLLECT_AT, 2 * m_iSlotsInUse );
+	}
 
-				DISPATCH();
-			}
-			case TARGET(FTOI):
+	void VirtualMachine::PassArrays( const BatNativeInfo& native, int64_t* args )
+	{
+		for( size_t i = 0; i < native.desc.param_types.size(); i++ )
+		{
+			if( native.desc.param_types[i] == TYPE_ARRAY )
 			{
-				auto a = PopF();
-				Push( (int64_t)a );
-
-				DISPATCH();
+				args[i] = reinterpret_cast<int64_t>(&m_Heap[(size_t)(args[i] & HANDLE_MASK)]);
 			}
-			case TARGET(ADDF):   BINARY_OP_F( + ); DISPATCH();
-			case TARGET(SUBF):   BINARY_OP_F( - ); DISPATCH();
-			case TARGET(DIVF):   BINARY_OP_F( / ); DISPATCH();
-			case TARGET(MULF):   BINARY_OP_F( * ); DISPATCH();
-			case TARGET(NEGF):   UNARY_OP_F( - ); DISPATCH();
-
-			case TARGET(EQF):    BINARY_OP_F( == ); DISPATCH();
-			case TARGET(NEQF):   BINARY_OP_F( != ); DISPATCH();
-			case TARGET(LESSF):  BINARY_OP_F( < ); DISPATCH();
-			case TARGET(LESSEF): BINARY_OP_F( <= ); DISPATCH();
-			case TARGET(GRTF):   BINARY_OP_F( > ); DISPATCH();
-			case TARGET(GRTEF):  BINARY_OP_F( >= ); DISPATCH();
-
-			case TARGET(JMP):
-			{
-				GoTo( ReadI64() );
+		}
+	}
 
-				DISPATCH();
-			}
-			case TARGET(JZ):
-			{
-				auto target = ReadI64();
-				if( Pop() == 0 )
-				{
-					GoTo( target );
-				}
+	bool VirtualMachine::WrapIndex( const BatCode& bc, int64_t pc, int64_t& index, int64_t length ) const
+	{
+		if( index < 0 && index + length >= 0 )
+		{
+			index += length;
+			return true;
+		}
 
-				DISPATCH();
-			}
-			case TARGET(JNZ):
-			{
-				auto target = ReadI64();
-				if( Pop() != 0 )
-				{
-					GoTo( target );
-				}
+		ErrorSys::Report( LineAt( bc, pc ), 0, "Array index " + std::to_string( index ) + " out of bounds for length " + std::to_string( length ) );
+		return false;
+	}
 
-				DISPATCH();
-			}
-			case TARGET(CALL):
-			{
-				auto func = Pop();
-				PushCallStack( m_iIP );
-				GoTo( func );
+	bool VirtualMachine::HasStack( const BatCode& bc, int64_t pc, int64_t sp, int64_t size ) const
+	{
+		if( sp + size + STACK_RESERVE <= (int64_t)sizeof( m_Stack ) )
+		{
+			return true;
+		}
 
-				DISPATCH();
-			}
-			case TARGET(RET):
+		ErrorSys::Report( LineAt( bc, pc ), 0, "Stack overflow" );
+		return false;
+	}
+
+	template <VirtualMachine::Instrumentation INSTRUMENTATION>
+	void VirtualMachine::Execute( const BatCode& bc )
+	{
+		// The hot registers live in locals for the duration of the loop so that the compiler can keep them in machine
+		// registers instead of reloading them through `this` after every stack write.
+		// They're written back to the members when the code halts.
+		const char* ip = m_pCode + m_iIP;
+		int64_t sp = m_iStackPointer;
+		int64_t bp = m_iBasePointer;
+		int64_t operand;
+
+#if BAT_COMPUTED_GOTO
+		static void* const s_DispatchTable[] = {
+			OPCODES( DISPATCH_LABEL )
+			OPCODES( WIDE_DISPATCH_LABELS )
+		};
+		static_assert( sizeof( s_DispatchTable ) / sizeof( s_DispatchTable[0] ) == NUM_ENCODED_OPCODES );
+
+		// Copy of the table that the profiler points at SAMPLE while a sample is due
+		static std::atomic<void*> s_ProfileDispatchTable[NUM_ENCODED_OPCODES];
+		if constexpr( INSTRUMENTATION == Instrumentation::PROFILE )
+		{
+			for( size_t i = 0; i < NUM_ENCODED_OPCODES; i++ )
 			{
-				auto retval = Pop();
+				s_ProfileDispatchTable[i].store( s_DispatchTable[i], std::memory_order_relaxed );
+			}
+			Profiler::RedirectOnSample( s_ProfileDispatchTable, NUM_ENCODED_OPCODES, &&TARGET_SAMPLE );
+		}
 
-				m_iStackPointer = m_iBasePointer;
-				m_iBasePointer = PopCallStack();
+		DISPATCH();
+#else
+		while( true )
+		{
+		auto next_op = READ_OP();
+		INSTRUMENT( next_op );
+		switch( next_op )
+		{
+#endif
 
-				auto size = ReadI64();
-				m_iStackPointer -= size;
+		TARGET(NOP): DISPATCH();
 
-				auto ret_addr = PopCallStack();
-				GoTo( ret_addr );
+		TARGET_WITH_OPERAND(PUSH):
+		{
+			PUSH( operand );
 
-				Push( retval );
+			DISPATCH();
+		}
+		TARGET(POP):
+		{
+			POP();
 
-				DISPATCH();
-			}
+			DISPATCH();
+		}
+		TARGET(DUP):
+		{
+			auto val = POP();
+			PUSH( val );
+			PUSH( val );
 
-			case TARGET(PRINTB):
-			{
-				auto val = Pop();
-				std::cout << (val ? "true" : "false") << std::endl;
+			DISPATCH();
+		}
+		TARGET(DUPX1):
+		{
+			auto val1 = POP();
+			auto val2 = POP();
+			PUSH( val1 );
+			PUSH( val2 );
+			PUSH( val1 );
 
-				DISPATCH();
-			}
-			case TARGET(PRINTI):
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(PROC):
+		{
+			// The call already set up the frame, only the locals are left
+			if( !HasStack( bc, ip - 1 - m_pCode, sp, operand ) )
 			{
-				auto val = Pop();
-				std::cout << val << std::endl;
-
-				DISPATCH();
+				goto halt;
 			}
-			case TARGET(PRINTF):
+			sp += operand;
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(STACK):
+		{
+			if( !HasStack( bc, ip - 1 - m_pCode, sp, operand ) )
 			{
-				auto val = PopF();
-				std::cout << std::to_string( val ) << std::endl;
+				goto halt;
+			}
+			sp += operand;
+
+			DISPATCH();
+		}
+
+		TARGET(LOAD_LOCAL):
+		{
+			auto addr = POP();
+			auto value = *reinterpret_cast<int64_t*>(&m_Stack[bp + addr]);
+			PUSH( value );
 
-				DISPATCH();
+			DISPATCH();
+		}
+		TARGET(LOAD_GLOBAL):
+		{
+			auto addr = POP();
+			auto value = *reinterpret_cast<int64_t*>(&m_Stack[addr]);
+			PUSH( value );
+
+			DISPATCH();
+		}
+		TARGET(STORE_LOCAL):
+		{
+			auto value = POP();
+			auto addr = POP();
+			*reinterpret_cast<int64_t*>(&m_Stack[bp + addr]) = value;
+
+			DISPATCH();
+		}
+		TARGET(STORE_GLOBAL):
+		{
+			auto value = POP();
+			auto addr = POP();
+			*reinterpret_cast<int64_t*>(&m_Stack[addr]) = value;
+
+			DISPATCH();
+		}
+
+		TARGET(BITAND): BINARY_OP( & ); DISPATCH();
+		TARGET(BITOR):  BINARY_OP( | ); DISPATCH();
+		TARGET(BITXOR): BINARY_OP( ^ ); DISPATCH();
+		TARGET(BITNOT): UNARY_OP( ~ ); DISPATCH();
+		TARGET(SHL):    BINARY_OP( << ); DISPATCH();
+		TARGET(SHR):    BINARY_OP( >> ); DISPATCH();
+
+		TARGET(EQ):     BINARY_OP( == ); DISPATCH();
+		TARGET(NEQ):    BINARY_OP( != ); DISPATCH();
+		TARGET(LESS):   BINARY_OP( < ); DISPATCH();
+		TARGET(LESSE):  BINARY_OP( <= ); DISPATCH();
+		TARGET(GRT):    BINARY_OP( > ); DISPATCH();
+		TARGET(GRTE):   BINARY_OP( >= ); DISPATCH();
+		TARGET(NOT):    UNARY_OP( ! ); DISPATCH();
+
+		TARGET(ADD):    BINARY_OP( + ); DISPATCH();
+		TARGET(SUB):    BINARY_OP( - ); DISPATCH();
+		TARGET(DIV):    BINARY_OP( / ); DISPATCH();
+		TARGET(MUL):    BINARY_OP( * ); DISPATCH();
+		TARGET(MOD):    BINARY_OP( % ); DISPATCH();
+		TARGET(NEG):    UNARY_OP( - ); DISPATCH();
+
+		TARGET(ITOF):
+		{
+			auto a = POP();
+			PUSHF( (double)a );
+
+			DISPATCH();
+		}
+		TARGET(FTOI):
+		{
+			auto a = POPF();
+			PUSH( (int64_t)a );
+
+			DISPATCH();
+		}
+		TARGET(ADDF):   BINARY_OP_F( + ); DISPATCH();
+		TARGET(SUBF):   BINARY_OP_F( - ); DISPATCH();
+		TARGET(DIVF):   BINARY_OP_F( / ); DISPATCH();
+		TARGET(MULF):   BINARY_OP_F( * ); DISPATCH();
+		TARGET(NEGF):   UNARY_OP_F( - ); DISPATCH();
+
+		TARGET(EQF):    BINARY_OP_F( == ); DISPATCH();
+		TARGET(NEQF):   BINARY_OP_F( != ); DISPATCH();
+		TARGET(LESSF):  BINARY_OP_F( < ); DISPATCH();
+		TARGET(LESSEF): BINARY_OP_F( <= ); DISPATCH();
+		TARGET(GRTF):   BINARY_OP_F( > ); DISPATCH();
+		TARGET(GRTEF):  BINARY_OP_F( >= ); DISPATCH();
+
+		TARGET_WITH_OPERAND(JMP):
+		{
+			GOTO( operand );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(JZ):
+		{
+			if( POP() == 0 )
+			{
+				GOTO( operand );
 			}
-			case TARGET(PRINTS):
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(JNZ):
+		{
+			if( POP() != 0 )
 			{
-				auto val = Pop();
-				std::cout << bc.string_literals[val] << std::endl;
+				GOTO( operand );
+			}
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(CALL):
+		{
+			// Links the new frame to the caller's (see FRAME_LINK_SIZE)
+			PUSH( ip - m_pCode );
+			PUSH( bp );
+			bp = sp;
+			GOTO( operand );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(TAILCALL):
+		{
+			// The arguments are in place already, only the locals go
+			sp = bp;
+			GOTO( operand );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(RET):
+		{
+			auto retval = POP();
+
+			sp = bp;
+			bp = POP();
+			auto ret_addr = POP();
+			GOTO( ret_addr );
+
+			sp -= operand;
+			PUSH( retval );
+
+			DISPATCH();
+		}
+
+		TARGET(PRINTB):
+		{
+			auto val = POP();
+			*m_pOut << (val ? "true" : "false") << std::endl;
+
+			DISPATCH();
+		}
+		TARGET(PRINTI):
+		{
+			auto val = POP();
+			*m_pOut << val << std::endl;
+
+			DISPATCH();
+		}
+		TARGET(PRINTF):
+		{
+			auto val = POPF();
+			*m_pOut << std::to_string( val ) << std::endl;
+
+			DISPATCH();
+		}
+		TARGET(PRINTS):
+		{
+			auto val = POP();
+			*m_pOut << m_Strings.Get( val )->chars << std::endl;
 
-				DISPATCH();
+			DISPATCH();
+		}
+
+		TARGET(NATIVE):
+		{
+			auto native_idx = POP();
+			const BatNativeInfo& native = bc.natives[native_idx];
+			// Arguments were pushed left to right, so they're already laid out in order on the stack
+			const size_t num_args = native.desc.param_types.size();
+			sp -= num_args * sizeof( int64_t );
+			if( m_NativeTakesArrays[native_idx] )
+			{
+				PassArrays( native, reinterpret_cast<int64_t*>(&m_Stack[sp]) );
 			}
+			auto result = NativeTable::Call( m_ResolvedNatives[native_idx], native, reinterpret_cast<const int64_t*>(&m_Stack[sp]), num_args, m_Strings );
+			PUSH( result );
+
+			DISPATCH();
+		}
 
-			case TARGET(NATIVE):
+		TARGET(AWAIT):
+		{
+			auto native_idx = POP();
+			SAVE_REGISTERS();
+			if( !AwaitNative( bc, ip - 1 - m_pCode, native_idx ) )
 			{
-				auto native_idx = Pop();
-				const BatNativeInfo& native = bc.natives[native_idx];
-				HandleNative( bc, native );
+				goto halt;
+			}
+			LOAD_REGISTERS();
 
-				DISPATCH();
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(SPAWN):
+		{
+			// The new task starts at the next instruction, the spawning one continues at the operand
+			auto num_slots = POP();
+			SAVE_REGISTERS();
+			SpawnTask( num_slots, ip - m_pCode );
+			sp = m_iStackPointer;
+			GOTO( operand );
+
+			DISPATCH();
+		}
+		TARGET(TASK_END):
+		{
+			SAVE_REGISTERS();
+			m_Scheduler.End();
+			if( !SwitchTask() )
+			{
+				goto halt;
 			}
+			LOAD_REGISTERS();
+
+			DISPATCH();
+		}
 
-			case TARGET(HALT):
+		TARGET_WITH_OPERAND(ELEM):
+		{
+			// Element of a fixed size array in the frame or the globals, the operand is its length
+			auto index = POP();
+			auto base = POP();
+			if( (uint64_t)index >= (uint64_t)operand && !WrapIndex( bc, ip - 1 - m_pCode, index, operand ) )
 			{
-				return;
+				goto halt;
 			}
+			PUSH( base + index * (int64_t)sizeof( int64_t ) );
+
+			DISPATCH();
+		}
+		TARGET(LOCAL_ADDR):
+		{
+			auto addr = POP();
+			PUSH( bp + addr );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(ZERO):
+		{
+			auto addr = POP();
+			memset( &m_Stack[addr], 0, (size_t)operand * sizeof( int64_t ) );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(COPY):
+		{
+			auto from = POP();
+			auto to = POP();
+			memmove( &m_Stack[to], &m_Stack[from], (size_t)operand * sizeof( int64_t ) );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(ARRAY_NEW):
+		{
+			// The elements were pushed in order
+			sp -= operand * (int64_t)sizeof( int64_t );
+			auto handle = NewArray( operand, &m_Stack[sp], sp + operand * (int64_t)sizeof( int64_t ) );
+			PUSH( handle );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(ARRAY_FROM):
+		{
+			auto addr = POP();
+			auto handle = NewArray( operand, &m_Stack[addr], sp );
+			PUSH( handle );
 
-			default:
+			DISPATCH();
+		}
+		TARGET(ARRAY_ELEM):
+		{
+			auto index = POP();
+			auto handle = POP() & HANDLE_MASK;
+			const int64_t length = m_Heap[handle];
+			if( (uint64_t)index >= (uint64_t)length && !WrapIndex( bc, ip - 1 - m_pCode, index, length ) )
 			{
-				assert( false && "Unhandled opcode" );
-				return;
+				goto halt;
 			}
+			PUSH( (handle + 1 + index) | HANDLE_TAG );
+
+			DISPATCH();
+		}
+		TARGET(ARRAY_LOAD):
+		{
+			auto index = POP();
+			auto handle = POP() & HANDLE_MASK;
+			const int64_t length = m_Heap[handle];
+			if( (uint64_t)index >= (uint64_t)length && !WrapIndex( bc, ip - 1 - m_pCode, index, length ) )
+			{
+				goto halt;
 			}
+			PUSH( m_Heap[handle + 1 + index] );
+
+			DISPATCH();
 		}
-	}
+		TARGET(HEAP_LOAD):
+		{
+			auto addr = POP();
+			PUSH( m_Heap[addr & HANDLE_MASK] );
 
-	void VirtualMachine::GoTo( int64_t addr )
-	{
-		m_iIP = (int)addr;
-	}
-	void VirtualMachine::HandleNative( const BatCode& bc, const BatNativeInfo& native )
-	{
-		auto it = m_Natives.find( native.name );
-		if( it == m_Natives.end() )
+			DISPATCH();
+		}
+		TARGET(HEAP_STORE):
 		{
-			// TODO: proper line/column report
-			ErrorSys::Report( 0, 0, std::string( "Native '" ) + native.name + "' not bound" );
-			return;
+			auto value = POP();
+			auto addr = POP();
+			m_Heap[addr & HANDLE_MASK] = value;
+
+			DISPATCH();
 		}
 
-		std::vector<BatObject> params;
-		auto& callback = it->second;
+		TARGET_WITH_OPERAND(LOADL_IMM):
+		{
+			PUSH( *reinterpret_cast<int64_t*>(&m_Stack[bp + operand]) );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(LOADG_IMM):
+		{
+			PUSH( *reinterpret_cast<int64_t*>(&m_Stack[operand]) );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(STOREL_IMM):
+		{
+			*reinterpret_cast<int64_t*>(&m_Stack[bp + operand]) = POP();
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(STOREG_IMM):
+		{
+			*reinterpret_cast<int64_t*>(&m_Stack[operand]) = POP();
 
-		const auto& param_types = native.desc.param_types;
-		for( size_t param_idx = 0; param_idx < param_types.size(); param_idx++ )
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(ADDI):
+		{
+			auto a = POP();
+			PUSH( a + operand );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(SUBI):
+		{
+			auto a = POP();
+			PUSH( a - operand );
+
+			DISPATCH();
+		}
+		TARGET_WITH_OPERAND(JEQ): COMPARE_JUMP( == ); DISPATCH();
+		TARGET_WITH_OPERAND(JNE): COMPARE_JUMP( != ); DISPATCH();
+		TARGET_WITH_OPERAND(JLT): COMPARE_JUMP( < ); DISPATCH();
+		TARGET_WITH_OPERAND(JLE): COMPARE_JUMP( <= ); DISPATCH();
+		TARGET_WITH_OPERAND(JGT): COMPARE_JUMP( > ); DISPATCH();
+		TARGET_WITH_OPERAND(JGE): COMPARE_JUMP( >= ); DISPATCH();
+
+		TARGET(HALT):
 		{
-			switch( param_types[param_idx] )
+			// The mainline is over, tasks it spawned may still have to run
+			if( m_Scheduler.NumTasks() > 1 )
+			{
+				SAVE_REGISTERS();
+				m_Scheduler.End();
+				if( SwitchTask() )
+				{
+					LOAD_REGISTERS();
+					DISPATCH();
+				}
+			}
+		halt:
+			SAVE_REGISTERS();
+#if BAT_COMPUTED_GOTO
+			if constexpr( INSTRUMENTATION == Instrumentation::PROFILE )
+			{
+				Profiler::StopRedirecting();
+			}
+#endif
+			if constexpr( INSTRUMENTATION == Instrumentation::OPSTATS )
 			{
-			case TYPE_BOOL:
-				params.emplace_back( (bool)Pop() );
-				break;
-			case TYPE_INT:
-				params.emplace_back( (int64_t)Pop() );
-				break;
-			case TYPE_FLOAT:
-				params.emplace_back( (double)Pop() );
-				break;
-			case TYPE_STR:
-				params.emplace_back( bc.string_literals[Pop()].c_str() );
-				break;
-			default:
-				assert( false );
+				m_pOpStats->Stop();
+				m_pOpStats->Report( std::cerr );
 			}
+			return;
 		}
 
-		BatObject result = callback( params );
+		OPCODES( WIDE_TARGETS )
 
-		switch( result.type )
+#if BAT_COMPUTED_GOTO
+		// Every opcode lands here while a sample is due, see INSTRUMENT
+		// The handlers are put back first, a signal arriving before the sample is taken only means another sample.
+		TARGET_SAMPLE:
 		{
-		case TYPE_BOOL:
-			Push( result.Bool() );
-			break;
-		case TYPE_INT:
-			Push( result.Int() );
-			break;
-		case TYPE_FLOAT:
-			PushF( result.Float() );
-			break;
+			if constexpr( INSTRUMENTATION == Instrumentation::PROFILE )
+			{
+				for( size_t i = 0; i < NUM_ENCODED_OPCODES; i++ )
+				{
+					s_ProfileDispatchTable[i].store( s_DispatchTable[i], std::memory_order_relaxed );
+				}
+				Sample( bc, ip - 1 - m_pCode, bp );
+			}
+			ip--;
+
+			DISPATCH();
+		}
+#endif
+
+#if !BAT_COMPUTED_GOTO
 		default:
-			assert( false );
+		{
+			assert( false && "Unhandled opcode" );
+			return;
+		}
+		}
 		}
+#endif
+	}
+
+	void VirtualMachine::GoTo( int64_t addr )
+	{
+		m_iIP = (int)addr;
 	}
 }
\ No newline at end of file
@@ -1,18 +1,91 @@
 #pragma once
 
+#include <iostream>
+#include <map>
+#include <memory>
+#include <unordered_map>
 #include "memory_stream.h"
 #include "bat_callable.h"
 #include "compiler.h"
+#include "opstats.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "stringpool.h"
 
 namespace Bat
 {
+	// Arrays: fixed size arrays live inline in the frame or the globals, one slot per element, and are addressed like
+	// any other variable. The code only checks indices that the compiler can't prove to be in range (see ELEM).
+	// All other arrays are handles into the VM's heap, a single buffer of slots where every array is its length followed
+	// by its elements. Arrays are never resized or moved. When the arrays would use twice the slots that were live after
+	// the last collection, the ones that nothing refers to anymore are freed and their slots reused (see CollectArrays).
+	// Handles are the array's index in the heap with HANDLE_TAG set, so that the collector can tell them, and the
+	// addresses of elements that ARRAY_ELEM pushes, from ints and floats. Handle 0 is an empty array, for array variables
+	// that weren't initialized.
 	class VirtualMachine
 	{
 	public:
 		void AddNative( const std::string& name, BatNativeCallback callback );
+		// Binds a C++ function as a native, see NativeBinding::Typed
+		template <typename R, typename... Args>
+		void Bind( const std::string& name, R (*function)( Args... ) )
+		{
+			m_Natives.Bind( name, function );
+		}
+		NativeTable& Natives() { return m_Natives; }
+		// Binds a native declared as `async native`, see scheduler.h
+		void BindAwaitable( const std::string& name, AwaitableCallback callback );
+		// Scheduler of the running code's tasks, e.g. to complete awaitables from its idle hook
+		Scheduler& Tasks() { return m_Scheduler; }
 
-		void Run( BatCode& bc );
+		// Only reads bc, any number of VMs can run the same code at the same time
+		void Run( const BatCode& bc );
+
+		// Counts opcodes and opcode pairs while running and reports them when the code halts (see opstats.h)
+		// The dispatch loop is instantiated separately for this, so it costs nothing while disabled.
+		void EnableOpStats( bool enable );
+		// Takes samples for profiler while running (see profiler.h), nullptr to stop
+		// Like opstats this has its own instantiation of the dispatch loop.
+		void SetProfiler( Profiler* profiler ) { m_pProfiler = profiler; }
+		// Where print statements write to, std::cout by default
+		void SetOutput( std::ostream& out ) { m_pOut = &out; }
 	private:
+		// What the dispatch loop does besides executing, every kind has its own instantiation of the loop
+		enum class Instrumentation
+		{
+			NONE,
+			OPSTATS,
+			PROFILE
+		};
+		template <Instrumentation INSTRUMENTATION>
+		void Execute( const BatCode& bc );
+		void Sample( const BatCode& bc, int64_t pc, int64_t bp );
+
+		// Tasks (see scheduler.h), these work on the registers saved by the dispatch loop
+		void SpawnTask( int64_t num_slots, int64_t start );
+		// Returns false if the VM has to halt because the native isn't bound or no task can run anymore,
+		// pc is the AWAIT instruction for the report
+		bool AwaitNative( const BatCode& bc, int64_t pc, int64_t native_idx );
+		// Runs the next task after the running one was saved or ended, returns false if there is none
+		bool SwitchTask();
+
+		// Allocates an array of length slots on the heap, copied from elements if given, and returns its handle
+		// The stack up to stack_top is what the running code still uses, the arrays it refers to are kept.
+		int64_t NewArray( int64_t length, const char* elements, int64_t stack_top );
+		// Frees every array that isn't reachable from the stack up to stack_top or from the saved tasks
+		// Slots don't say whether they hold a handle, so every value that points into an array keeps it, the same way
+		// ARRAY_ELEM leaves the address of an element on the stack. Arrays are marked through their elements too.
+		void CollectArrays( int64_t stack_top );
+		// Negative indices count from the end, like in the interpreter
+		// Returns false, after reporting an error at the instruction at pc, if the index is out of bounds either way
+		bool WrapIndex( const BatCode& bc, int64_t pc, int64_t& index, int64_t length ) const;
+		// Whether size more bytes and STACK_RESERVE fit on the stack above sp, reports an error at the instruction at pc if not
+		bool HasStack( const BatCode& bc, int64_t pc, int64_t sp, int64_t size ) const;
+		// Array arguments of natives are handles, natives get the address of the array's length instead (see ArrayRef)
+		void PassArrays( const BatNativeInfo& native, int64_t* args );
+		void SaveTask( Scheduler::Task& task ) const;
+		void LoadTask( Scheduler::Task& task );
+
 		template <typename T>
 		void PushAny( T val )
 		{
@@ -28,23 +101,9 @@ namespace Bat
 			return *reinterpret_cast<T*>(&m_Stack[m_iStackPointer]);
 		}
 		template <typename T>
-		void PushAnyCallStack( T val )
-		{
-			assert( m_iCallStackPointer + sizeof( T ) <= sizeof( m_CallStack ) );
-			*reinterpret_cast<T*>(&m_CallStack[m_iCallStackPointer]) = val;
-			m_iCallStackPointer += sizeof( T );
-		}
-		template <typename T>
-		T PopAnyCallStack()
-		{
-			assert( m_iCallStackPointer - sizeof( T ) >= 0 );
-			m_iCallStackPointer -= sizeof( T );
-			return *reinterpret_cast<T*>(&m_CallStack[m_iCallStackPointer]);
-		}
-		template <typename T>
 		T ReadCode()
 		{
-			T val = *reinterpret_cast<T*>(&m_pCode[m_iIP]);
+			T val = ReadUnaligned<T>( &m_pCode[m_iIP] );
 			m_iIP += sizeof( T );
 			return val;
 		}
@@ -52,23 +111,49 @@ namespace Bat
 		int64_t ReadI64() { return ReadCode<int64_t>(); }
 
 		void Push( int64_t val ) { PushAny( val ); }
-		void PushCallStack( int64_t val ) { PushAnyCallStack( val ); }
 		void PushF( double val ) { PushAny( val ); }
 		int64_t Pop() { return PopAny<int64_t>(); }
-		int64_t PopCallStack() { return PopAnyCallStack<int64_t>(); }
 		double PopF() { return PopAny<double>(); }
 
 		void GoTo( int64_t addr );
-
-		void HandleNative( const BatCode& bc, const BatNativeInfo& native );
 	private:
-		char m_Stack[4096];
-		char m_CallStack[4096];
-		char* m_pCode = nullptr;
+		char m_Stack[STACK_SIZE];
+		const char* m_pCode = nullptr;
 		int m_iIP = 0;
 		int64_t m_iStackPointer = 0;
-		int64_t m_iCallStackPointer = 0;
 		int64_t m_iBasePointer = 0;
-		std::unordered_map<std::string, BatNativeCallback> m_Natives;
+		NativeTable m_Natives;
+		// Bindings of the running code's natives, indexed like BatCode::natives
+		std::vector<const NativeBinding*> m_ResolvedNatives;
+		// Whether any parameter of a native is an array, indexed like BatCode::natives
+		std::vector<bool> m_NativeTakesArrays;
+		AwaitableTable m_Awaitables;
+		// Awaitables of the running code's natives, indexed like BatCode::natives
+		std::vector<const AwaitableCallback*> m_ResolvedAwaitables;
+		Scheduler m_Scheduler;
+		// Start of the running task's part of the stack, right above the globals
+		int64_t m_iTaskStackBase = 0;
+		StringTable m_Strings;
+		std::vector<int64_t> m_Heap;
+		// Handles of the arrays on the heap except the empty one, sorted by each collection
+		std::vector<int64_t> m_Arrays;
+		// Unused runs of slots on the heap, size to start, rebuilt and merged by each collection
+		std::multimap<int64_t, int64_t> m_FreeSlots;
+		static constexpr int64_t HANDLE_TAG = int64_t( 1 ) << 48;
+		static constexpr int64_t HANDLE_MASK = HANDLE_TAG - 1;
+		// Slots of the heap that arrays use, counting the ones that may be unreachable since the last collection
+		size_t m_iSlotsInUse = 1;
+		// The heap is collected when there is no free run for an array and it would bring the slots in use past this,
+		// which is twice what was live after the last collection but at least MIN_COLLECT_AT
+		static constexpr size_t MIN_COLLECT_AT = 64 * 1024;
+		size_t m_iCollectAt = MIN_COLLECT_AT;
+		// Scratch space for CollectArrays, indexed like m_Arrays
+		std::vector<bool> m_ArrayMarks;
+		std::vector<int64_t> m_MarkStack;
+		std::ostream* m_pOut = &std::cout;
+		std::unique_ptr<OpStats> m_pOpStats;
+		Profiler* m_pProfiler = nullptr;
+		// Scratch space for Sample
+		std::vector<int64_t> m_SamplePcs;
 	};
 }
\ No newline at end of file